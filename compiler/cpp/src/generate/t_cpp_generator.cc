@@ -18,6 +18,7 @@
  */
 
 #include <cassert>
+#include <cstdlib>
 
 #include <fstream>
 #include <iostream>
@@ -31,6 +32,9 @@
 #include "t_oop_generator.h"
 using namespace std;
 
+// Field id of the deadline in call arguments; must match
+// apache::thrift::processor::TDeadline::DEADLINE_FIELD_ID.
+static const int32_t DEADLINE_FIELD_ID = 32767;
 
 /**
  * C++ code generator. This is legitimacy incarnate.
@@ -52,6 +56,18 @@ class t_cpp_generator : public t_oop_generator {
     iter = parsed_options.find("include_prefix");
     use_include_prefix_ = (iter != parsed_options.end());
 
+    iter = parsed_options.find("pool_args");
+    gen_pool_args_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("async");
+    gen_async_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("deadlines");
+    gen_deadlines_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("oneway_mtype");
+    gen_oneway_mtype_ = (iter != parsed_options.end());
+
     out_dir_base_ = "gen-cpp";
   }
 
@@ -70,6 +86,7 @@ class t_cpp_generator : public t_oop_generator {
 
   void generate_typedef(t_typedef* ttypedef);
   void generate_enum(t_enum* tenum);
+  void generate_enum_names(t_enum* tenum);
   void generate_struct(t_struct* tstruct) {
     generate_cpp_struct(tstruct, false);
   }
@@ -83,11 +100,14 @@ class t_cpp_generator : public t_oop_generator {
   void print_const_value(std::ofstream& out, std::string name, t_type* type, t_const_value* value);
   std::string render_const_value(std::ofstream& out, std::string name, t_type* type, t_const_value* value);
 
-  void generate_struct_definition    (std::ofstream& out, t_struct* tstruct, bool is_exception=false, bool pointers=false, bool read=true, bool write=true);
+  void generate_struct_definition    (std::ofstream& out, t_struct* tstruct, bool is_exception=false, bool pointers=false, bool read=true, bool write=true, bool masked=false);
   void generate_struct_fingerprint   (std::ofstream& out, t_struct* tstruct, bool is_definition);
-  void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
+  void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false, bool masked=false);
   void generate_struct_writer        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
   void generate_struct_result_writer (std::ofstream& out, t_struct* tstruct, bool pointers=false);
+  void generate_struct_lazy_accessors(std::ofstream& out, t_struct* tstruct);
+  void generate_struct_swap          (std::ofstream& out, t_struct* tstruct);
+  void generate_struct_clear         (std::ofstream& out, t_struct* tstruct, bool reuse_elements=false);
 
   /**
    * Service-level generation functions
@@ -97,7 +117,7 @@ class t_cpp_generator : public t_oop_generator {
   void generate_service_null      (t_service* tservice);
   void generate_service_multiface (t_service* tservice);
   void generate_service_helpers   (t_service* tservice);
-  void generate_service_client    (t_service* tservice);
+  void generate_service_client    (t_service* tservice, std::string style="");
   void generate_service_processor (t_service* tservice);
   void generate_service_skeleton  (t_service* tservice);
   void generate_process_function  (t_service* tservice, t_function* tfunction);
@@ -170,6 +190,7 @@ class t_cpp_generator : public t_oop_generator {
   std::string base_type_name(t_base_type::t_base tbase);
   std::string declare_field(t_field* tfield, bool init=false, bool pointer=false, bool constant=false, bool reference=false);
   std::string function_signature(t_function* tfunction, std::string prefix="", bool name_params=true);
+  std::string async_function_signature(t_function* tfunction, std::string prefix="");
   std::string argument_list(t_struct* tstruct, bool name_params=true);
   std::string type_to_enum(t_type* ttype);
   std::string local_reflection_name(const char*, t_type* ttype, bool external=false);
@@ -178,6 +199,21 @@ class t_cpp_generator : public t_oop_generator {
   void generate_local_reflection(std::ofstream& out, t_type* ttype, bool is_definition);
   void generate_local_reflection_pointer(std::ofstream& out, t_type* ttype);
 
+  bool is_lazy_field(t_struct* tstruct, t_field* tfield);
+  bool is_struct_list(t_type* ttype);
+
+  long cache_ttl_ms(t_function* tfunction);
+  bool uses_response_cache(t_service* tservice);
+
+  bool is_integral_const(t_type* ttype) {
+    ttype = get_true_type(ttype);
+
+    return
+      ttype->is_enum() ||
+      (ttype->is_base_type() && !is_complex_type(ttype) &&
+       ((t_base_type*)ttype)->get_base() != t_base_type::TYPE_DOUBLE);
+  }
+
   bool is_complex_type(t_type* ttype) {
     ttype = get_true_type(ttype);
 
@@ -210,6 +246,28 @@ class t_cpp_generator : public t_oop_generator {
    */
   bool use_include_prefix_;
 
+  /**
+   * True iff processors should recycle per-thread args/result objects
+   * instead of constructing new ones for every call.
+   */
+  bool gen_pool_args_;
+
+  /**
+   * True iff clients should send oneway calls as T_ONEWAY rather than T_CALL.
+   */
+  bool gen_oneway_mtype_;
+
+  /**
+   * True iff we should generate callback-based <Service>AsyncClient classes.
+   */
+  bool gen_async_;
+
+  /**
+   * True iff clients should send per-call deadlines and processors should
+   * drop calls whose deadline has passed.
+   */
+  bool gen_deadlines_;
+
   /**
    * Strings for namespace, computed once up front then used directly
    */
@@ -267,8 +325,23 @@ void t_cpp_generator::init_generator() {
   f_types_ <<
     "#include <Thrift.h>" << endl <<
     "#include <protocol/TProtocol.h>" << endl <<
-    "#include <transport/TTransport.h>" << endl <<
-    endl;
+    "#include <protocol/TFieldMask.h>" << endl <<
+    "#include <transport/TTransport.h>" << endl;
+
+  // Lazily deserialized fields keep their raw bytes in a TLazyField.
+  bool has_lazy_fields = false;
+  const vector<t_struct*>& objects = program_->get_objects();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    const vector<t_field*>& members = objects[i]->get_members();
+    for (size_t j = 0; j < members.size(); ++j) {
+      has_lazy_fields = has_lazy_fields || is_lazy_field(objects[i], members[j]);
+    }
+  }
+  if (has_lazy_fields) {
+    f_types_ <<
+      "#include <protocol/TLazyField.h>" << endl;
+  }
+  f_types_ << endl;
 
   // Include other Thrift includes
   const vector<t_program*>& includes = program_->get_includes();
@@ -297,6 +370,8 @@ void t_cpp_generator::init_generator() {
   f_types_impl_ <<
     "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
     "_types.h\"" << endl <<
+    endl <<
+    "#include <algorithm>" << endl <<
     endl;
 
   // If we are generating local reflection metadata, we need to include
@@ -386,10 +461,80 @@ void t_cpp_generator::generate_enum(t_enum* tenum) {
     "};" << endl <<
     endl;
 
+  generate_enum_names(tenum);
+
   generate_local_reflection(f_types_, tenum, false);
   generate_local_reflection(f_types_impl_, tenum, true);
 }
 
+/**
+ * Generates <Enum>_name(), which maps a value to its name (or NULL if the
+ * value is not part of the enum).  Dense enums index a static array of
+ * string literals and sparse ones use a switch, so neither needs any
+ * static initialization or heap allocation.
+ *
+ * @param tenum The enumeration
+ */
+void t_cpp_generator::generate_enum_names(t_enum* tenum) {
+  string fn_name = tenum->get_name() + "_name";
+
+  // Resolve implicit values the same way the C++ enum does.
+  vector<t_enum_value*> constants = tenum->get_constants();
+  vector<t_enum_value*>::iterator c_iter;
+  map<int, string> names;
+  int value = -1;
+  for (c_iter = constants.begin(); c_iter != constants.end(); ++c_iter) {
+    value = (*c_iter)->has_value() ? (*c_iter)->get_value() : value + 1;
+    // Aliases map to the first name given.
+    names.insert(make_pair(value, (*c_iter)->get_name()));
+  }
+
+  f_types_ <<
+    indent() << "const char* " << fn_name << "(int value);" << endl <<
+    endl;
+
+  indent(f_types_impl_) <<
+    "const char* " << fn_name << "(int value) {" << endl;
+  indent_up();
+
+  map<int, string>::iterator n_iter;
+  if (names.empty()) {
+    indent(f_types_impl_) << "(void) value;" << endl;
+  } else if ((int64_t)names.rbegin()->first - names.begin()->first < 2 * (int64_t)names.size() + 8) {
+    int lo = names.begin()->first;
+    int hi = names.rbegin()->first;
+    indent(f_types_impl_) << "static const char* const names[] = {" << endl;
+    indent_up();
+    n_iter = names.begin();
+    for (int64_t v = lo; v <= hi; ++v) {
+      if (n_iter != names.end() && n_iter->first == v) {
+        indent(f_types_impl_) << "\"" << n_iter->second << "\"," << endl;
+        ++n_iter;
+      } else {
+        indent(f_types_impl_) << "NULL," << endl;
+      }
+    }
+    indent_down();
+    f_types_impl_ <<
+      indent() << "};" << endl <<
+      indent() << "if (value >= " << lo << " && value <= " << hi << ") {" << endl <<
+      indent() << "  return names[value - (" << lo << ")];" << endl <<
+      indent() << "}" << endl;
+  } else {
+    indent(f_types_impl_) << "switch (value) {" << endl;
+    for (n_iter = names.begin(); n_iter != names.end(); ++n_iter) {
+      indent(f_types_impl_) <<
+        "case " << n_iter->first << ": return \"" << n_iter->second << "\";" << endl;
+    }
+    indent(f_types_impl_) << "}" << endl;
+  }
+  indent(f_types_impl_) << "return NULL;" << endl;
+
+  indent_down();
+  indent(f_types_impl_) <<
+    "}" << endl << endl;
+}
+
 /**
  * Generates a class that holds all the constants.
  */
@@ -426,29 +571,61 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
     ns_open_ << endl <<
     endl;
 
+  // Scalars are static const members with constant initializers, so they
+  // cost nothing at startup.  Strings, containers and structs are built by
+  // the constructor, which only runs the first time instance() is called.
+  string cname = program_name_ + "Constants";
   f_consts <<
-    "class " << program_name_ << "Constants {" << endl <<
+    "class " << cname << " {" << endl <<
     " public:" << endl <<
-    "  " << program_name_ << "Constants();" << endl <<
+    "  " << cname << "();" << endl <<
+    endl <<
+    "  static const " << cname << "& instance();" << endl <<
     endl;
   indent_up();
   vector<t_const*>::iterator c_iter;
   for (c_iter = consts.begin(); c_iter != consts.end(); ++c_iter) {
     string name = (*c_iter)->get_name();
     t_type* type = (*c_iter)->get_type();
-    f_consts <<
-      indent() << type_name(type) << " " << name << ";" << endl;
+    if (is_complex_type(type)) {
+      f_consts <<
+        indent() << type_name(type) << " " << name << ";" << endl;
+    } else if (is_integral_const(type)) {
+      f_consts <<
+        indent() << "static const " << type_name(type) << " " << name << " = " <<
+        render_const_value(f_consts, name, get_true_type(type), (*c_iter)->get_value()) << ";" << endl;
+    } else {
+      f_consts <<
+        indent() << "static const " << type_name(type) << " " << name << ";" << endl;
+    }
   }
   indent_down();
   f_consts <<
     "};" << endl;
 
+  for (c_iter = consts.begin(); c_iter != consts.end(); ++c_iter) {
+    string name = (*c_iter)->get_name();
+    t_type* type = (*c_iter)->get_type();
+    if (is_complex_type(type)) {
+      continue;
+    } else if (is_integral_const(type)) {
+      f_consts_impl <<
+        "const " << type_name(type) << " " << cname << "::" << name << ";" << endl;
+    } else {
+      f_consts_impl <<
+        "const " << type_name(type) << " " << cname << "::" << name << " = " <<
+        render_const_value(f_consts_impl, name, get_true_type(type), (*c_iter)->get_value()) << ";" << endl;
+    }
+  }
+
   f_consts_impl <<
-    "const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
     endl <<
-    program_name_ << "Constants::" << program_name_ << "Constants() {" << endl;
+    cname << "::" << cname << "() {" << endl;
   indent_up();
   for (c_iter = consts.begin(); c_iter != consts.end(); ++c_iter) {
+    if (!is_complex_type((*c_iter)->get_type())) {
+      continue;
+    }
     print_const_value(f_consts_impl,
                       (*c_iter)->get_name(),
                       (*c_iter)->get_type(),
@@ -456,11 +633,22 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
   }
   indent_down();
   indent(f_consts_impl) <<
+    "}" << endl <<
+    endl;
+
+  f_consts_impl <<
+    "const " << cname << "& " << cname << "::instance() {" << endl <<
+    "  static const " << cname << " constants;" << endl <<
+    "  return constants;" << endl <<
     "}" << endl;
 
+  // Shorthand for instance().  A function rather than a namespace-scope
+  // reference, so that including the header runs no static initializer.
   f_consts <<
     endl <<
-    "extern const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
+    "inline const " << cname << "& g_" << program_name_ << "_constants() {" << endl <<
+    "  return " << cname << "::instance();" << endl <<
+    "}" << endl <<
     endl <<
     ns_close_ << endl <<
     endl <<
@@ -594,13 +782,20 @@ string t_cpp_generator::render_const_value(ofstream& out, string name, t_type* t
  * @param tstruct The struct definition
  */
 void t_cpp_generator::generate_cpp_struct(t_struct* tstruct, bool is_exception) {
-  generate_struct_definition(f_types_, tstruct, is_exception);
+  generate_struct_definition(f_types_, tstruct, is_exception, false, true, true, true);
+  f_types_ <<
+    indent() << "void swap(" << tstruct->get_name() << " &a, " << tstruct->get_name() << " &b);" << endl <<
+    endl;
   generate_struct_fingerprint(f_types_impl_, tstruct, true);
   generate_local_reflection(f_types_, tstruct, false);
   generate_local_reflection(f_types_impl_, tstruct, true);
   generate_local_reflection_pointer(f_types_impl_, tstruct);
   generate_struct_reader(f_types_impl_, tstruct);
+  generate_struct_reader(f_types_impl_, tstruct, false, true);
   generate_struct_writer(f_types_impl_, tstruct);
+  generate_struct_lazy_accessors(f_types_impl_, tstruct);
+  generate_struct_swap(f_types_impl_, tstruct);
+  generate_struct_clear(f_types_impl_, tstruct);
 }
 
 /**
@@ -614,7 +809,8 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
                                                  bool is_exception,
                                                  bool pointers,
                                                  bool read,
-                                                 bool write) {
+                                                 bool write,
+                                                 bool masked) {
   string extends = "";
   if (is_exception) {
     extends = " : public apache::thrift::TException";
@@ -692,8 +888,11 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       endl << endl;
   }
 
-  // Declare all fields
+  // Declare all fields.  Lazy fields are private, see below.
   for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    if (is_lazy_field(tstruct, *m_iter)) {
+      continue;
+    }
     indent(out) <<
       declare_field(*m_iter, false, pointers && !(*m_iter)->get_type()->is_xception(), !read) << endl;
   }
@@ -741,6 +940,29 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       "} __isset;" << endl;
   }
 
+  // Raw bytes and accessors for lazily deserialized fields.
+  bool has_lazy_fields = false;
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    if (is_lazy_field(tstruct, *m_iter)) {
+      if (!has_lazy_fields) {
+        has_lazy_fields = true;
+        out << endl;
+      }
+      indent(out) <<
+        "apache::thrift::protocol::TLazyField __lazy_" << (*m_iter)->get_name() << ";" << endl;
+    }
+  }
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    if (is_lazy_field(tstruct, *m_iter)) {
+      out <<
+        endl <<
+        indent() << "const " << type_name((*m_iter)->get_type()) << "& get_" <<
+          (*m_iter)->get_name() << "() const;" << endl <<
+        indent() << type_name((*m_iter)->get_type()) << "& mutable_" <<
+          (*m_iter)->get_name() << "();" << endl;
+    }
+  }
+
   out << endl;
 
   if (!pointers) {
@@ -753,10 +975,15 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
       // Most existing Thrift code does not use isset or optional/required,
       // so we treat "default" fields as required.
+      // Lazy fields have to be decoded before they can be compared.
+      string value = (*m_iter)->get_name();
+      if (is_lazy_field(tstruct, *m_iter)) {
+        value = "get_" + value + "()";
+      }
       if ((*m_iter)->get_req() != t_field::T_OPTIONAL) {
         out <<
-          indent() << "if (!(" << (*m_iter)->get_name()
-                   << " == rhs." << (*m_iter)->get_name() << "))" << endl <<
+          indent() << "if (!(" << value
+                   << " == rhs." << value << "))" << endl <<
           indent() << "  return false;" << endl;
       } else {
         out <<
@@ -764,7 +991,7 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
                    << " != rhs.__isset." << (*m_iter)->get_name() << ")" << endl <<
           indent() << "  return false;" << endl <<
           indent() << "else if (__isset." << (*m_iter)->get_name() << " && !("
-                   << (*m_iter)->get_name() << " == rhs." << (*m_iter)->get_name()
+                   << value << " == rhs." << value
                    << "))" << endl <<
           indent() << "  return false;" << endl;
       }
@@ -787,12 +1014,40 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     out <<
       indent() << "uint32_t read(apache::thrift::protocol::TProtocol* iprot);" << endl;
   }
+  if (read && masked) {
+    out <<
+      indent() << "uint32_t readFields(apache::thrift::protocol::TProtocol* iprot, const apache::thrift::protocol::TFieldMask& mask);" << endl;
+  }
+  if (!pointers) {
+    out <<
+      indent() << "void __clear();" << endl;
+  }
   if (write) {
     out <<
       indent() << "uint32_t write(apache::thrift::protocol::TProtocol* oprot) const;" << endl;
   }
   out << endl;
 
+  // A lazy field is empty until its bytes are decoded, so it can only be
+  // reached through the accessors.  It is mutable so that the const getter
+  // can decode into it.
+  if (has_lazy_fields) {
+    indent_down();
+    indent(out) << " private:" << endl;
+    indent_up();
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      if (is_lazy_field(tstruct, *m_iter)) {
+        indent(out) <<
+          "mutable " << declare_field(*m_iter, false, false, !read) << endl;
+      }
+    }
+    out <<
+      endl <<
+      indent() << "friend void swap(" << tstruct->get_name() << " &a, " <<
+        tstruct->get_name() << " &b);" << endl <<
+      endl;
+  }
+
   indent_down();
   indent(out) <<
     "};" << endl <<
@@ -972,12 +1227,20 @@ void t_cpp_generator::generate_local_reflection_pointer(std::ofstream& out,
  *
  * @param out Stream to write to
  * @param tstruct The struct
+ * @param masked Generate readFields(), which only deserializes the fields
+ *               selected by a TFieldMask and skips the rest
  */
 void t_cpp_generator::generate_struct_reader(ofstream& out,
                                              t_struct* tstruct,
-                                             bool pointers) {
-  indent(out) <<
-    "uint32_t " << tstruct->get_name() << "::read(apache::thrift::protocol::TProtocol* iprot) {" << endl;
+                                             bool pointers,
+                                             bool masked) {
+  if (masked) {
+    indent(out) <<
+      "uint32_t " << tstruct->get_name() << "::readFields(apache::thrift::protocol::TProtocol* iprot, const apache::thrift::protocol::TFieldMask& mask) {" << endl;
+  } else {
+    indent(out) <<
+      "uint32_t " << tstruct->get_name() << "::read(apache::thrift::protocol::TProtocol* iprot) {" << endl;
+  }
   indent_up();
 
   const vector<t_field*>& fields = tstruct->get_members();
@@ -996,6 +1259,19 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
     indent() << "using apache::thrift::protocol::TProtocolException;" << endl <<
     endl;
 
+  // A lazy field missing from this message must not keep the last one's.
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if (!is_lazy_field(tstruct, *f_iter)) {
+      continue;
+    }
+    out <<
+      indent() << "this->__lazy_" << (*f_iter)->get_name() << ".clear();" << endl <<
+      indent() << "this->" << (*f_iter)->get_name() << ".__clear();" << endl;
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      indent(out) << "this->__isset." << (*f_iter)->get_name() << " = false;" << endl;
+    }
+  }
+
   // Required variables aren't in __isset, so we need tmp vars to check them.
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if ((*f_iter)->get_req() == t_field::T_REQUIRED)
@@ -1030,8 +1306,14 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
         indent(out) <<
           "case " << (*f_iter)->get_key() << ":" << endl;
         indent_up();
-        indent(out) <<
-          "if (ftype == " << type_to_enum((*f_iter)->get_type()) << ") {" << endl;
+        if (masked) {
+          indent(out) <<
+            "if (ftype == " << type_to_enum((*f_iter)->get_type()) <<
+            " && mask.contains(" << (*f_iter)->get_key() << ")) {" << endl;
+        } else {
+          indent(out) <<
+            "if (ftype == " << type_to_enum((*f_iter)->get_type()) << ") {" << endl;
+        }
         indent_up();
 
         const char *isset_prefix =
@@ -1047,11 +1329,38 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
           indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
 #endif
 
+        t_type* field_type = get_true_type((*f_iter)->get_type());
+        bool nestable = masked && (field_type->is_struct() || field_type->is_xception());
+        if (nestable) {
+          // A nested mask projects the substruct too.
+          out <<
+            indent() << "const apache::thrift::protocol::TFieldMask* sub = mask.nested(" <<
+              (*f_iter)->get_key() << ");" << endl <<
+            indent() << "if (sub != NULL) {" << endl <<
+            indent() << "  xfer += this->" << (*f_iter)->get_name() << ".readFields(iprot, *sub);" << endl <<
+            indent() << "} else {" << endl;
+          indent_up();
+        }
+
         if (pointers && !(*f_iter)->get_type()->is_xception()) {
           generate_deserialize_field(out, *f_iter, "(*(this->", "))");
+        } else if (is_lazy_field(tstruct, *f_iter)) {
+          // Keep the raw bytes if we can, otherwise fall back to a full read.
+          out <<
+            indent() << "if (!this->__lazy_" << (*f_iter)->get_name() <<
+              ".capture(iprot, ftype, xfer)) {" << endl;
+          indent_up();
+          generate_deserialize_field(out, *f_iter, "this->");
+          indent_down();
+          indent(out) << "}" << endl;
         } else {
           generate_deserialize_field(out, *f_iter, "this->");
         }
+
+        if (nestable) {
+          indent_down();
+          indent(out) << "}" << endl;
+        }
         out <<
           indent() << isset_prefix << (*f_iter)->get_name() << " = true;" << endl;
         indent_down();
@@ -1089,10 +1398,15 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   // there might possibly be a chance of continuing.
   out << endl;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-    if ((*f_iter)->get_req() == t_field::T_REQUIRED)
-      out <<
-        indent() << "if (!isset_" << (*f_iter)->get_name() << ')' << endl <<
-        indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED)
+      continue;
+    // Fields left out of the mask are skipped, so they can't be missing.
+    indent(out) << "if (";
+    if (masked) {
+      out << "mask.contains(" << (*f_iter)->get_key() << ") && ";
+    }
+    out << "!isset_" << (*f_iter)->get_name() << ')' << endl <<
+      indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
   }
 
   indent(out) << "return xfer;" << endl;
@@ -1126,7 +1440,12 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
     "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
-      indent(out) << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      if (pointers) {
+        // Argument pointers have no __isset; a NULL one is left out.
+        indent(out) << "if (this->" << (*f_iter)->get_name() << " != NULL) {" << endl;
+      } else {
+        indent(out) << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      }
       indent_up();
     }
     // Write field header
@@ -1138,6 +1457,14 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
     // Write field contents
     if (pointers) {
       generate_serialize_field(out, *f_iter, "(*(this->", "))");
+    } else if (is_lazy_field(tstruct, *f_iter)) {
+      // Untouched lazy fields are copied out without being re-encoded.
+      out <<
+        indent() << "if (this->__lazy_" << (*f_iter)->get_name() << ".canWrite(oprot)) {" << endl <<
+        indent() << "  xfer += this->__lazy_" << (*f_iter)->get_name() << ".write(oprot);" << endl <<
+        indent() << "} else {" << endl <<
+        indent() << "  xfer += this->get_" << (*f_iter)->get_name() << "().write(oprot);" << endl <<
+        indent() << "}" << endl;
     } else {
       generate_serialize_field(out, *f_iter, "this->");
     }
@@ -1162,6 +1489,162 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
     endl;
 }
 
+/**
+ * Generates the accessors for fields annotated with cpp.lazy. The getter
+ * decodes the captured bytes into the field once, under the TLazyField's
+ * lock, so concurrent readers are safe. The mutable accessor also drops the
+ * bytes, since the field may no longer match what was read.
+ *
+ * @param out Stream to write to
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_lazy_accessors(ofstream& out,
+                                                     t_struct* tstruct) {
+  string name = tstruct->get_name();
+  const vector<t_field*>& fields = tstruct->get_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if (!is_lazy_field(tstruct, *f_iter)) {
+      continue;
+    }
+    string fname = (*f_iter)->get_name();
+    string ftype = type_name((*f_iter)->get_type());
+
+    indent(out) <<
+      "const " << ftype << "& " << name << "::get_" << fname << "() const {" << endl;
+    indent_up();
+    out <<
+      indent() << "this->__lazy_" << fname << ".decode(this->" << fname << ");" << endl <<
+      indent() << "return this->" << fname << ";" << endl;
+    indent_down();
+    indent(out) <<
+      "}" << endl << endl;
+
+    indent(out) <<
+      ftype << "& " << name << "::mutable_" << fname << "() {" << endl;
+    indent_up();
+    out <<
+      indent() << "get_" << fname << "();" << endl <<
+      indent() << "this->__lazy_" << fname << ".clear();" << endl <<
+      indent() << "return this->" << fname << ";" << endl;
+    indent_down();
+    indent(out) <<
+      "}" << endl << endl;
+  }
+}
+
+/**
+ * Generates a non-member swap() for a struct.  Containers and strings are
+ * swapped in O(1), so handing a large struct from one object to another
+ * never copies its contents.  (For exceptions the TException base message
+ * is left alone; generated exceptions don't use it.)
+ *
+ * @param out Output stream
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_swap(ofstream& out, t_struct* tstruct) {
+  string name = tstruct->get_name();
+  const vector<t_field*>& fields = tstruct->get_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  indent(out) <<
+    "void swap(" << name << " &a, " << name << " &b) {" << endl;
+  indent_up();
+
+  indent(out) << "using ::std::swap;" << endl;
+  bool has_nonrequired_fields = false;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    string fname = (*f_iter)->get_name();
+    indent(out) << "swap(a." << fname << ", b." << fname << ");" << endl;
+    if (is_lazy_field(tstruct, *f_iter)) {
+      indent(out) << "a.__lazy_" << fname << ".swap(b.__lazy_" << fname << ");" << endl;
+    }
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      has_nonrequired_fields = true;
+    }
+  }
+  if (has_nonrequired_fields) {
+    indent(out) << "swap(a.__isset, b.__isset);" << endl;
+  }
+  if (fields.empty()) {
+    out <<
+      indent() << "(void) a;" << endl <<
+      indent() << "(void) b;" << endl;
+  }
+
+  indent_down();
+  indent(out) <<
+    "}" << endl << endl;
+}
+
+/**
+ * Generates __clear(), which puts a struct back into its default-constructed
+ * state without giving up memory it already owns: strings and vectors keep
+ * their capacity and nested structs are cleared recursively.  Used to
+ * recycle objects between requests.
+ *
+ * With reuse_elements, lists of structs are left alone instead, so that the
+ * elements and all they own are reused by the next read(), which clears
+ * the ones it refills.  The pooled processor empties such a list itself if
+ * the call does not carry it.
+ *
+ * @param out Output stream
+ * @param tstruct The struct
+ * @param reuse_elements Whether to keep the elements of lists of structs
+ */
+void t_cpp_generator::generate_struct_clear(ofstream& out,
+                                            t_struct* tstruct,
+                                            bool reuse_elements) {
+  const vector<t_field*>& fields = tstruct->get_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  indent(out) <<
+    "void " << tstruct->get_name() << "::__clear() {" << endl;
+  indent_up();
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    string fname = "this->" + (*f_iter)->get_name();
+    t_type* t = get_true_type((*f_iter)->get_type());
+    t_const_value* cv = (*f_iter)->get_value();
+    if ((t->is_base_type() && !t->is_string()) || t->is_enum()) {
+      string dval = "0";
+      if (t->is_enum()) {
+        dval = "(" + type_name(t) + ")0";
+      }
+      if (cv != NULL) {
+        dval = render_const_value(out, (*f_iter)->get_name(), t, cv);
+      }
+      indent(out) << fname << " = " << dval << ";" << endl;
+      continue;
+    }
+
+    if (t->is_struct() || t->is_xception()) {
+      indent(out) << fname << ".__clear();" << endl;
+    } else if (reuse_elements && cv == NULL && is_struct_list(t)) {
+      indent(out) << "// " << fname << " is reused by read()" << endl;
+    } else {
+      indent(out) << fname << ".clear();" << endl;
+    }
+    if (is_lazy_field(tstruct, *f_iter)) {
+      indent(out) << "this->__lazy_" << (*f_iter)->get_name() << ".clear();" << endl;
+    }
+    if (cv != NULL) {
+      print_const_value(out, fname, t, cv);
+    }
+  }
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      indent(out) << "this->__isset." << (*f_iter)->get_name() << " = false;" << endl;
+    }
+  }
+
+  indent_down();
+  indent(out) <<
+    "}" << endl << endl;
+}
+
 /**
  * Struct writer for result of a function, which can have only one of its
  * fields set and does a conditional if else look up into the __isset field
@@ -1259,7 +1742,26 @@ void t_cpp_generator::generate_service(t_service* tservice) {
     "#ifndef " << svcname << "_H" << endl <<
     "#define " << svcname << "_H" << endl <<
     endl <<
-    "#include <TProcessor.h>" << endl <<
+    "#include <TProcessor.h>" << endl;
+  if (gen_pool_args_) {
+    f_header_ <<
+      "#include <memory>" << endl <<
+      "#include <concurrency/ThreadLocal.h>" << endl;
+  }
+  if (gen_async_) {
+    f_header_ <<
+      "#include <async/TAsyncChannel.h>" << endl <<
+      "#include <transport/TBufferTransports.h>" << endl;
+  }
+  if (gen_deadlines_) {
+    f_header_ <<
+      "#include <processor/TDeadline.h>" << endl;
+  }
+  if (uses_response_cache(tservice)) {
+    f_header_ <<
+      "#include <processor/TResponseCache.h>" << endl;
+  }
+  f_header_ <<
     "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
     "_types.h\"" << endl;
 
@@ -1292,6 +1794,9 @@ void t_cpp_generator::generate_service(t_service* tservice) {
   generate_service_null(tservice);
   generate_service_helpers(tservice);
   generate_service_client(tservice);
+  if (gen_async_) {
+    generate_service_client(tservice, "Async");
+  }
   generate_service_processor(tservice);
   generate_service_multiface(tservice);
   generate_service_skeleton(tservice);
@@ -1324,10 +1829,21 @@ void t_cpp_generator::generate_service_helpers(t_service* tservice) {
     t_struct* ts = (*f_iter)->get_arglist();
     string name_orig = ts->get_name();
 
+    // The wire arguments carry the caller's deadline as an extra optional
+    // field, which the handler never sees.
+    t_struct args_with_deadline(*ts);
+    t_field deadline(g_type_i32, "__deadline_ms", DEADLINE_FIELD_ID);
+    if (gen_deadlines_) {
+      deadline.set_req(t_field::T_OPTIONAL);
+      args_with_deadline.append(&deadline);
+      ts = &args_with_deadline;
+    }
+
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_args");
     generate_struct_definition(f_header_, ts, false);
     generate_struct_reader(f_service_, ts);
     generate_struct_writer(f_service_, ts);
+    generate_struct_clear(f_service_, ts, gen_pool_args_);
     ts->set_name(tservice->get_name() + "_" + (*f_iter)->get_name() + "_pargs");
     generate_struct_definition(f_header_, ts, false, true, false, true);
     generate_struct_writer(f_service_, ts, true);
@@ -1540,48 +2056,95 @@ void t_cpp_generator::generate_service_multiface(t_service* tservice) {
  *
  * @param tservice The service to generate a server for.
  */
-void t_cpp_generator::generate_service_client(t_service* tservice) {
+void t_cpp_generator::generate_service_client(t_service* tservice, string style) {
+  bool async = (style == "Async");
+  string client = style + "Client";
   string extends = "";
   string extends_client = "";
   if (tservice->get_extends() != NULL) {
     extends = type_name(tservice->get_extends());
-    extends_client = ", public " + extends + "Client";
+    extends_client = ", public " + extends + client;
   }
 
-  // Generate the header portion
-  f_header_ <<
-    "class " << service_name_ << "Client : " <<
-    "virtual public " << service_name_ << "If" <<
-    extends_client << " {" << endl <<
-    " public:" << endl;
+  // The response cache lives in the first client class of the hierarchy
+  // with a function that uses it.
+  bool owns_cache = !async && uses_response_cache(tservice) &&
+    (tservice->get_extends() == NULL || !uses_response_cache(tservice->get_extends()));
 
-  indent_up();
-  f_header_ <<
-    indent() << service_name_ << "Client(boost::shared_ptr<apache::thrift::protocol::TProtocol> prot) :" << endl;
-  if (extends.empty()) {
+  // Generate the header portion
+  if (async) {
+    // Async clients don't implement the (blocking) service interface.
     f_header_ <<
-      indent() << "  piprot_(prot)," << endl <<
-      indent() << "  poprot_(prot) {" << endl <<
-      indent() << "  iprot_ = prot.get();" << endl <<
-      indent() << "  oprot_ = prot.get();" << endl <<
-      indent() << "}" << endl;
+      "class " << service_name_ << client <<
+      (extends.empty() ? "" : " : public " + extends + client) << " {" << endl <<
+      " public:" << endl;
   } else {
     f_header_ <<
-      indent() << "  " << extends << "Client(prot, prot) {}" << endl;
+      "class " << service_name_ << client << " : " <<
+      "virtual public " << service_name_ << "If" <<
+      extends_client << " {" << endl <<
+      " public:" << endl;
   }
 
-  f_header_ <<
-    indent() << service_name_ << "Client(boost::shared_ptr<apache::thrift::protocol::TProtocol> iprot, boost::shared_ptr<apache::thrift::protocol::TProtocol> oprot) :" << endl;
-  if (extends.empty()) {
+  indent_up();
+  if (async) {
+    f_header_ <<
+      indent() << service_name_ << client << "(boost::shared_ptr<apache::thrift::async::TAsyncChannel> channel, apache::thrift::protocol::TProtocolFactory* protocolFactory) :" << endl;
+    if (extends.empty()) {
+      f_header_ <<
+        indent() << "  channel_(channel)," << endl <<
+        indent() << "  itrans_(new apache::thrift::transport::TMemoryBuffer())," << endl <<
+        indent() << "  otrans_(new apache::thrift::transport::TMemoryBuffer())," << endl <<
+        indent() << "  piprot_(protocolFactory->getProtocol(itrans_))," << endl <<
+        indent() << "  poprot_(protocolFactory->getProtocol(otrans_))," << endl <<
+        indent() << "  seqid_(0)" << (gen_deadlines_ ? ",\n" + indent() + "  callTimeoutMs_(0)" : "") << " {" << endl <<
+        indent() << "  iprot_ = piprot_.get();" << endl <<
+        indent() << "  oprot_ = poprot_.get();" << endl <<
+        indent() << "}" << endl;
+    } else {
+      f_header_ <<
+        indent() << "  " << extends << client << "(channel, protocolFactory) {}" << endl;
+    }
     f_header_ <<
-      indent() << "  piprot_(iprot)," << endl <<
-      indent() << "  poprot_(oprot) {" << endl <<
-      indent() << "  iprot_ = iprot.get();" << endl <<
-      indent() << "  oprot_ = oprot.get();" << endl <<
+      indent() << "boost::shared_ptr<apache::thrift::async::TAsyncChannel> getChannel() {" << endl <<
+      indent() << "  return channel_;" << endl <<
       indent() << "}" << endl;
   } else {
+    string cache_init = owns_cache ?
+      ",\n" + indent() + "  responseCache_(apache::thrift::processor::TResponseCache::getDefault())" : "";
+    f_header_ <<
+      indent() << service_name_ << client << "(boost::shared_ptr<apache::thrift::protocol::TProtocol> prot) :" << endl;
+    if (extends.empty()) {
+      f_header_ <<
+        indent() << "  piprot_(prot)," << endl <<
+        indent() << "  poprot_(prot)," << endl <<
+        indent() << "  seqid_(0)" <<
+        (gen_deadlines_ ? ",\n" + indent() + "  callTimeoutMs_(0)" : "") <<
+        cache_init << " {" << endl <<
+        indent() << "  iprot_ = prot.get();" << endl <<
+        indent() << "  oprot_ = prot.get();" << endl <<
+        indent() << "}" << endl;
+    } else {
+      f_header_ <<
+        indent() << "  " << extends << client << "(prot, prot)" << cache_init << " {}" << endl;
+    }
+
     f_header_ <<
-      indent() << "  " << extends << "Client(iprot, oprot) {}" << endl;
+      indent() << service_name_ << client << "(boost::shared_ptr<apache::thrift::protocol::TProtocol> iprot, boost::shared_ptr<apache::thrift::protocol::TProtocol> oprot) :" << endl;
+    if (extends.empty()) {
+      f_header_ <<
+        indent() << "  piprot_(iprot)," << endl <<
+        indent() << "  poprot_(oprot)," << endl <<
+        indent() << "  seqid_(0)" <<
+        (gen_deadlines_ ? ",\n" + indent() + "  callTimeoutMs_(0)" : "") <<
+        cache_init << " {" << endl <<
+        indent() << "  iprot_ = iprot.get();" << endl <<
+        indent() << "  oprot_ = oprot.get();" << endl <<
+        indent() << "}" << endl;
+    } else {
+      f_header_ <<
+        indent() << "  " << extends << client << "(iprot, oprot)" << cache_init << " {}" << endl;
+    }
   }
 
   // Generate getters for the protocols.
@@ -1595,13 +2158,46 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
     indent() << "  return poprot_;" << endl <<
     indent() << "}" << endl;
 
+  if (!async) {
+    f_header_ <<
+      indent() << "static bool isIdempotent(const std::string& fname);" << endl;
+  }
+
+  if (gen_deadlines_ && extends.empty()) {
+    f_header_ <<
+      indent() << "// Time each call may take, in ms, sent along so the server can drop" << endl <<
+      indent() << "// calls this client has given up on.  0 means none, but a call made" << endl <<
+      indent() << "// from a handler still passes on what is left of the handler's own" << endl <<
+      indent() << "// deadline.  Waiting for the reply is still bounded only by the" << endl <<
+      indent() << "// transport's timeouts." << endl <<
+      indent() << "void setCallTimeout(int32_t ms) {" << endl <<
+      indent() << "  callTimeoutMs_ = ms;" << endl <<
+      indent() << "}" << endl;
+  }
+
+  if (owns_cache) {
+    f_header_ <<
+      indent() << "// Where the replies of functions annotated cpp.cache_ttl_ms are" << endl <<
+      indent() << "// cached, by default the process-wide cache.  NULL turns caching off." << endl <<
+      indent() << "void setResponseCache(boost::shared_ptr<apache::thrift::processor::TResponseCache> cache) {" << endl <<
+      indent() << "  responseCache_ = cache;" << endl <<
+      indent() << "}" << endl <<
+      indent() << "boost::shared_ptr<apache::thrift::processor::TResponseCache> getResponseCache() {" << endl <<
+      indent() << "  return responseCache_;" << endl <<
+      indent() << "}" << endl;
+  }
+
   vector<t_function*> functions = tservice->get_functions();
   vector<t_function*>::const_iterator f_iter;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     t_function send_function(g_type_void,
                              string("send_") + (*f_iter)->get_name(),
                              (*f_iter)->get_arglist());
-    indent(f_header_) << function_signature(*f_iter) << ";" << endl;
+    if (async) {
+      indent(f_header_) << async_function_signature(*f_iter) << ";" << endl;
+    } else {
+      indent(f_header_) << function_signature(*f_iter) << ";" << endl;
+    }
     indent(f_header_) << function_signature(&send_function) << ";" << endl;
     if (!(*f_iter)->is_oneway()) {
       t_struct noargs(program_);
@@ -1617,11 +2213,32 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
     f_header_ <<
       " protected:" << endl;
     indent_up();
+    if (async) {
+      f_header_ <<
+        indent() << "boost::shared_ptr<apache::thrift::async::TAsyncChannel> channel_;"  << endl <<
+        indent() << "boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> itrans_;"  << endl <<
+        indent() << "boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> otrans_;"  << endl;
+    }
     f_header_ <<
       indent() << "boost::shared_ptr<apache::thrift::protocol::TProtocol> piprot_;"  << endl <<
       indent() << "boost::shared_ptr<apache::thrift::protocol::TProtocol> poprot_;"  << endl <<
       indent() << "apache::thrift::protocol::TProtocol* iprot_;"  << endl <<
-      indent() << "apache::thrift::protocol::TProtocol* oprot_;"  << endl;
+      indent() << "apache::thrift::protocol::TProtocol* oprot_;"  << endl <<
+      indent() << "int32_t seqid_;" << endl;
+    if (gen_deadlines_) {
+      f_header_ <<
+        indent() << "int32_t callTimeoutMs_;" << endl;
+    }
+    if (owns_cache) {
+      f_header_ <<
+        indent() << "boost::shared_ptr<apache::thrift::processor::TResponseCache> responseCache_;" << endl;
+    }
+    f_header_ <<
+      endl <<
+      indent() << "int32_t nextSeqId() {" << endl <<
+      indent() << "  seqid_ = (seqid_ < 0x7fffffff) ? seqid_ + 1 : 1;" << endl <<
+      indent() << "  return seqid_;" << endl <<
+      indent() << "}" << endl;
     indent_down();
   }
 
@@ -1629,25 +2246,108 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
     "};" << endl <<
     endl;
 
-  string scope = service_name_ + "Client::";
+  string scope = service_name_ + client + "::";
+
+  // Methods annotated (idempotent = "true") are safe to send twice, e.g.
+  // by a hedging transport.
+  if (!async) {
+    f_service_ <<
+      indent() << "bool " << scope << "isIdempotent(const std::string& fname) {" << endl;
+    indent_up();
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      map<string, string>::const_iterator a_iter =
+        (*f_iter)->annotations_.find("idempotent");
+      if (a_iter != (*f_iter)->annotations_.end() && a_iter->second == "true") {
+        f_service_ <<
+          indent() << "if (fname == \"" << (*f_iter)->get_name() << "\") {" << endl <<
+          indent() << "  return true;" << endl <<
+          indent() << "}" << endl;
+      }
+    }
+    if (extends.empty()) {
+      f_service_ <<
+        indent() << "return false;" << endl;
+    } else {
+      f_service_ <<
+        indent() << "return " << extends << client << "::isIdempotent(fname);" << endl;
+    }
+    indent_down();
+    f_service_ <<
+      indent() << "}" << endl <<
+      endl;
+  }
 
   // Generate client method implementations
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     string funname = (*f_iter)->get_name();
 
     // Open function
-    indent(f_service_) <<
-      function_signature(*f_iter, scope) << endl;
+    if (async) {
+      indent(f_service_) <<
+        async_function_signature(*f_iter, scope) << endl;
+    } else {
+      indent(f_service_) <<
+        function_signature(*f_iter, scope) << endl;
+    }
     scope_up(f_service_);
-    indent(f_service_) <<
-      "send_" << funname << "(";
 
     // Get the struct of function call params
     t_struct* arg_struct = (*f_iter)->get_arglist();
-
-    // Declare the function arguments
     const vector<t_field*>& fields = arg_struct->get_members();
     vector<t_field*>::const_iterator fld_iter;
+
+    // Functions annotated cpp.cache_ttl_ms look in the response cache
+    // first, keyed by their serialized arguments.
+    long cache_ttl = cache_ttl_ms(*f_iter);
+    if (async && cache_ttl > 0) {
+      pwarning(1, "Ignoring cpp.cache_ttl_ms on %s: async clients do not cache replies\n",
+               funname.c_str());
+      cache_ttl = 0;
+    } else if (!async && cache_ttl == 0 &&
+               (*f_iter)->annotations_.count("cpp.cache_ttl_ms") != 0) {
+      pwarning(1, "Ignoring cpp.cache_ttl_ms on %s: it needs a positive value and a function with a result\n",
+               funname.c_str());
+    }
+    bool complex_return = is_complex_type((*f_iter)->get_returntype());
+    string cache_scope = tservice->get_name() + "_" + funname;
+    if (cache_ttl > 0) {
+      f_service_ <<
+        indent() << "std::string ckey;" << endl <<
+        indent() << "if (responseCache_ != NULL) {" << endl;
+      indent_up();
+      f_service_ <<
+        indent() << cache_scope << "_pargs cargs;" << endl;
+      for (fld_iter = fields.begin(); fld_iter != fields.end(); ++fld_iter) {
+        f_service_ <<
+          indent() << "cargs." << (*fld_iter)->get_name() << " = &" << (*fld_iter)->get_name() << ";" << endl;
+      }
+      if (gen_deadlines_) {
+        f_service_ <<
+          indent() << "cargs.__deadline_ms = NULL;" << endl;
+      }
+      f_service_ <<
+        indent() << "ckey = apache::thrift::processor::TResponseCache::makeKey(\"" <<
+        tservice->get_name() << "." << funname << "\", cargs);" << endl;
+      if (!complex_return) {
+        t_field returnfield((*f_iter)->get_returntype(), "_return");
+        f_service_ <<
+          indent() << declare_field(&returnfield) << endl;
+      }
+      f_service_ <<
+        indent() << cache_scope << "_presult cresult;" << endl <<
+        indent() << "cresult.success = &_return;" << endl <<
+        indent() << "if (responseCache_->getResult(ckey, cresult)) {" << endl <<
+        indent() << "  return" << (complex_return ? "" : " _return") << ";" << endl <<
+        indent() << "}" << endl;
+      indent_down();
+      f_service_ <<
+        indent() << "}" << endl;
+    }
+
+    indent(f_service_) <<
+      "send_" << funname << "(";
+
+    // Declare the function arguments
     bool first = true;
     for (fld_iter = fields.begin(); fld_iter != fields.end(); ++fld_iter) {
       if (first) {
@@ -1659,7 +2359,32 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
     }
     f_service_ << ");" << endl;
 
-    if (!(*f_iter)->is_oneway()) {
+    if (async && (*f_iter)->is_oneway()) {
+      indent(f_service_) <<
+        "channel_->sendMessage(std::tr1::bind(cob, this), otrans_.get());" << endl;
+    } else if (async) {
+      indent(f_service_) <<
+        "channel_->sendAndRecvMessage(std::tr1::bind(cob, this), otrans_.get(), itrans_.get());" << endl;
+    } else if (cache_ttl > 0) {
+      if (complex_return) {
+        f_service_ <<
+          indent() << "recv_" << funname << "(_return);" << endl;
+      } else {
+        f_service_ <<
+          indent() << type_name((*f_iter)->get_returntype()) << " _return = recv_" << funname << "();" << endl;
+      }
+      f_service_ <<
+        indent() << "if (responseCache_ != NULL) {" << endl <<
+        indent() << "  " << cache_scope << "_result cresult;" << endl <<
+        indent() << "  cresult.success = _return;" << endl <<
+        indent() << "  cresult.__isset.success = true;" << endl <<
+        indent() << "  responseCache_->putResult(ckey, cresult, " << cache_ttl << ");" << endl <<
+        indent() << "}" << endl;
+      if (!complex_return) {
+        f_service_ <<
+          indent() << "return _return;" << endl;
+      }
+    } else if (!(*f_iter)->is_oneway()) {
       f_service_ << indent();
       if (!(*f_iter)->get_returntype()->is_void()) {
         if (is_complex_type((*f_iter)->get_returntype())) {
@@ -1691,8 +2416,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
 
     // Serialize the request
     f_service_ <<
-      indent() << "int32_t cseqid = 0;" << endl <<
-      indent() << "oprot_->writeMessageBegin(\"" << (*f_iter)->get_name() << "\", apache::thrift::protocol::T_CALL, cseqid);" << endl <<
+      indent() << "int32_t cseqid = nextSeqId();" << endl <<
+      indent() << "oprot_->writeMessageBegin(\"" << (*f_iter)->get_name() << "\", apache::thrift::protocol::" << ((*f_iter)->is_oneway() && gen_oneway_mtype_ ? "T_ONEWAY" : "T_CALL") << ", cseqid);" << endl <<
       endl <<
       indent() << argsname << " args;" << endl;
 
@@ -1700,6 +2425,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
       f_service_ <<
         indent() << "args." << (*fld_iter)->get_name() << " = &" << (*fld_iter)->get_name() << ";" << endl;
     }
+    if (gen_deadlines_) {
+      f_service_ <<
+        indent() << "int32_t cbudget = apache::thrift::processor::TDeadline::budgetFor(callTimeoutMs_);" << endl <<
+        indent() << "args.__deadline_ms = (cbudget > 0) ? &cbudget : NULL;" << endl;
+    }
 
     f_service_ <<
       indent() << "args.write(oprot_);" << endl <<
@@ -1728,7 +2458,19 @@ void t_cpp_generator::generate_service_client(t_service* tservice) {
         indent() << "std::string fname;" << endl <<
         indent() << "apache::thrift::protocol::TMessageType mtype;" << endl <<
         endl <<
-        indent() << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl <<
+        indent() << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl;
+      if (!async) {
+        // Only one call is outstanding on a blocking client, so anything
+        // other than the reply to the last request is a stray.
+        f_service_ <<
+          indent() << "if (rseqid != seqid_) {" << endl <<
+          indent() << "  iprot_->skip(apache::thrift::protocol::T_STRUCT);" << endl <<
+          indent() << "  iprot_->readMessageEnd();" << endl <<
+          indent() << "  iprot_->getTransport()->readEnd();" << endl <<
+          indent() << "  throw apache::thrift::TApplicationException(apache::thrift::TApplicationException::BAD_SEQUENCE_ID);" << endl <<
+          indent() << "}" << endl;
+      }
+      f_service_ <<
         indent() << "if (mtype == apache::thrift::protocol::T_EXCEPTION) {" << endl <<
         indent() << "  apache::thrift::TApplicationException x;" << endl <<
         indent() << "  x.read(iprot_);" << endl <<
@@ -1855,6 +2597,41 @@ void t_cpp_generator::generate_service_processor(t_service* tservice) {
     indent(f_header_) <<
       "void process_" << (*f_iter)->get_name() << "(int32_t seqid, apache::thrift::protocol::TProtocol* iprot, apache::thrift::protocol::TProtocol* oprot);" << endl;
   }
+  if (gen_pool_args_) {
+    // Each thread keeps its own args/result objects and clears them between
+    // calls, so their strings and vectors keep the capacity they grew to.
+    // A call that re-enters the same method on the same thread (a handler
+    // calling back into the processor) finds the entry busy and uses
+    // objects of its own.
+    f_header_ <<
+      indent() << "struct Pool {" << endl;
+    indent_up();
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      string prefix = tservice->get_name() + "_" + (*f_iter)->get_name();
+      string entry = (*f_iter)->get_name() + "_entry";
+      f_header_ <<
+        indent() << "struct " << entry << " {" << endl <<
+        indent() << "  " << entry << "() : busy(false) {}" << endl <<
+        indent() << "  " << prefix << "_args args;" << endl;
+      if (!(*f_iter)->is_oneway()) {
+        f_header_ <<
+          indent() << "  " << prefix << "_result result;" << endl;
+      }
+      f_header_ <<
+        indent() << "  bool busy;" << endl <<
+        indent() << "} " << (*f_iter)->get_name() << ";" << endl;
+    }
+    indent_down();
+    f_header_ <<
+      indent() << "};" << endl <<
+      indent() << "// Marks a pool entry busy for as long as it is in scope" << endl <<
+      indent() << "struct PoolUse {" << endl <<
+      indent() << "  PoolUse(bool* busy) : busy_(busy) { *busy_ = true; }" << endl <<
+      indent() << "  ~PoolUse() { *busy_ = false; }" << endl <<
+      indent() << "  bool* busy_;" << endl <<
+      indent() << "};" << endl <<
+      indent() << "apache::thrift::concurrency::ThreadLocal<Pool> pool_;" << endl;
+  }
   indent_down();
 
   indent_up();
@@ -1998,6 +2775,7 @@ void t_cpp_generator::generate_function_helpers(t_service* tservice,
   generate_struct_definition(f_header_, &result, false);
   generate_struct_reader(f_service_, &result);
   generate_struct_result_writer(f_service_, &result);
+  generate_struct_clear(f_service_, &result);
 
   result.set_name(tservice->get_name() + "_" + tfunction->get_name() + "_presult");
   generate_struct_definition(f_header_, &result, false, true, true, false);
@@ -2022,19 +2800,79 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
   string argsname = tservice->get_name() + "_" + tfunction->get_name() + "_args";
   string resultname = tservice->get_name() + "_" + tfunction->get_name() + "_result";
 
+  if (gen_pool_args_) {
+    string entry = "Pool::" + tfunction->get_name() + "_entry";
+    f_service_ <<
+      indent() << entry << "* entry = &pool_.get()->" << tfunction->get_name() << ";" << endl <<
+      indent() << "std::auto_ptr<" << entry << "> reentered;" << endl <<
+      indent() << "if (entry->busy) {" << endl <<
+      indent() << "  reentered.reset(new " << entry << "());" << endl <<
+      indent() << "  entry = reentered.get();" << endl <<
+      indent() << "}" << endl <<
+      indent() << "PoolUse use(&entry->busy);" << endl <<
+      indent() << argsname << "& args = entry->args;" << endl <<
+      indent() << "args.__clear();" << endl;
+  } else {
+    f_service_ <<
+      indent() << argsname << " args;" << endl;
+  }
+  f_service_ <<
+    indent() << "args.read(iprot);" << endl;
+  if (gen_pool_args_) {
+    // __clear() left these for read() to reuse; one not sent must be empty
+    const vector<t_field*>& fields = tfunction->get_arglist()->get_members();
+    vector<t_field*>::const_iterator f_iter;
+    for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+      if (is_struct_list((*f_iter)->get_type()) &&
+          (*f_iter)->get_value() == NULL &&
+          (*f_iter)->get_req() != t_field::T_REQUIRED) {
+        indent(f_service_) <<
+          "if (!args.__isset." << (*f_iter)->get_name() << ") {" << endl <<
+          indent() << "  args." << (*f_iter)->get_name() << ".clear();" << endl <<
+          indent() << "}" << endl;
+      }
+    }
+  }
   f_service_ <<
-    indent() << argsname << " args;" << endl <<
-    indent() << "args.read(iprot);" << endl <<
     indent() << "iprot->readMessageEnd();" << endl <<
     indent() << "iprot->getTransport()->readEnd();" << endl <<
     endl;
 
+  // Don't run calls the client has already given up on
+  if (gen_deadlines_) {
+    f_service_ <<
+      indent() << "apache::thrift::processor::TDeadlineScope deadline(args.__isset.__deadline_ms ? args.__deadline_ms : 0);" << endl <<
+      indent() << "if (deadline.expired()) {" << endl;
+    indent_up();
+    f_service_ <<
+      indent() << "apache::thrift::processor::TDeadline::expired();" << endl;
+    if (!tfunction->is_oneway()) {
+      f_service_ <<
+        indent() << "apache::thrift::TApplicationException x(apache::thrift::TApplicationException::TIMED_OUT);" << endl <<
+        indent() << "oprot->writeMessageBegin(\"" << tfunction->get_name() << "\", apache::thrift::protocol::T_EXCEPTION, seqid);" << endl <<
+        indent() << "x.write(oprot);" << endl <<
+        indent() << "oprot->writeMessageEnd();" << endl <<
+        indent() << "oprot->getTransport()->flush();" << endl <<
+        indent() << "oprot->getTransport()->writeEnd();" << endl;
+    }
+    f_service_ <<
+      indent() << "return;" << endl;
+    indent_down();
+    f_service_ <<
+      indent() << "}" << endl <<
+      endl;
+  }
+
   t_struct* xs = tfunction->get_xceptions();
   const std::vector<t_field*>& xceptions = xs->get_members();
   vector<t_field*>::const_iterator x_iter;
 
   // Declare result
-  if (!tfunction->is_oneway()) {
+  if (!tfunction->is_oneway() && gen_pool_args_) {
+    f_service_ <<
+      indent() << resultname << "& result = entry->result;" << endl <<
+      indent() << "result.__clear();" << endl;
+  } else if (!tfunction->is_oneway()) {
     f_service_ <<
       indent() << resultname << " result;" << endl;
   }
@@ -2087,7 +2925,7 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
       if (!tfunction->is_oneway()) {
         indent_up();
         f_service_ <<
-          indent() << "result." << (*x_iter)->get_name() << " = " << (*x_iter)->get_name() << ";" << endl <<
+          indent() << "swap(result." << (*x_iter)->get_name() << ", " << (*x_iter)->get_name() << ");" << endl <<
           indent() << "result.__isset." << (*x_iter)->get_name() << " = true;" << endl;
         indent_down();
         f_service_ << indent() << "}";
@@ -2321,10 +3159,13 @@ void t_cpp_generator::generate_deserialize_container(ofstream& out,
 
   t_container* tcontainer = (t_container*)ttype;
   bool use_push = tcontainer->has_cpp_name();
+  // Structs already in a list are cleared and read into, not reallocated
+  bool reuse = is_struct_list(ttype);
 
-  indent(out) <<
-    prefix << ".clear();" << endl <<
-    indent() << "uint32_t " << size << ";" << endl;
+  if (!reuse) {
+    indent(out) << prefix << ".clear();" << endl;
+  }
+  indent(out) << "uint32_t " << size << ";" << endl;
 
   // Declare variables, read header
   if (ttype->is_map()) {
@@ -2343,7 +3184,19 @@ void t_cpp_generator::generate_deserialize_container(ofstream& out,
       indent() << "apache::thrift::protocol::TType " << etype << ";" << endl <<
       indent() << "iprot->readListBegin(" <<
       etype << ", " << size << ");" << endl;
-    if (!use_push) {
+    if (reuse) {
+      string keep = tmp("_keep");
+      string j = tmp("_j");
+      out <<
+        indent() << "uint32_t " << keep << " = " << prefix << ".size();" << endl <<
+        indent() << "if (" << keep << " > " << size << ") {" << endl <<
+        indent() << "  " << keep << " = " << size << ";" << endl <<
+        indent() << "}" << endl <<
+        indent() << prefix << ".resize(" << size << ");" << endl <<
+        indent() << "for (uint32_t " << j << " = 0; " << j << " < " << keep << "; ++" << j << ") {" << endl <<
+        indent() << "  " << prefix << "[" << j << "].__clear();" << endl <<
+        indent() << "}" << endl;
+    } else if (!use_push) {
       indent(out) << prefix << ".resize(" << size << ");" << endl;
     }
   }
@@ -2612,6 +3465,84 @@ void t_cpp_generator::generate_serialize_list_element(ofstream& out,
   generate_serialize_field(out, &efield, "");
 }
 
+/**
+ * Checks whether a field should be deserialized lazily. Only fields of
+ * user-declared structs honor the cpp.lazy annotation; the argument and
+ * result helpers of services are always read eagerly, since the generated
+ * processor hands their members straight to the handler.
+ *
+ * @param tstruct The struct containing the field
+ * @param tfield The field
+ * @return True iff the field is annotated with cpp.lazy
+ */
+bool t_cpp_generator::is_lazy_field(t_struct* tstruct, t_field* tfield) {
+  if (tfield->annotations_.find("cpp.lazy") == tfield->annotations_.end()) {
+    return false;
+  }
+  const vector<t_struct*>& objects = program_->get_objects();
+  if (std::find(objects.begin(), objects.end(), tstruct) == objects.end()) {
+    return false;
+  }
+  t_type* type = get_true_type(tfield->get_type());
+  if (!type->is_struct() && !type->is_xception()) {
+    throw "compiler error: cpp.lazy is only supported on struct fields: " +
+      tstruct->get_name() + "." + tfield->get_name();
+  }
+  return true;
+}
+
+/**
+ * Checks whether a type is a list of structs that is read into by index,
+ * so that its elements can be reused rather than reallocated.
+ *
+ * @param ttype The type
+ * @return True iff ttype is such a list
+ */
+bool t_cpp_generator::is_struct_list(t_type* ttype) {
+  ttype = get_true_type(ttype);
+  if (!ttype->is_list() || ((t_container*)ttype)->has_cpp_name()) {
+    return false;
+  }
+  t_type* elem = get_true_type(((t_list*)ttype)->get_elem_type());
+  return elem->is_struct() || elem->is_xception();
+}
+
+/**
+ * Reads the cpp.cache_ttl_ms annotation of a function.
+ *
+ * @param tfunction The function
+ * @return The TTL in ms, or 0 if the function has none or cannot be cached
+ */
+long t_cpp_generator::cache_ttl_ms(t_function* tfunction) {
+  map<string, string>::const_iterator c_iter =
+    tfunction->annotations_.find("cpp.cache_ttl_ms");
+  if (c_iter == tfunction->annotations_.end() || tfunction->is_oneway() ||
+      tfunction->get_returntype()->is_void()) {
+    return 0;
+  }
+  long ttl = atol(c_iter->second.c_str());
+  return ttl > 0 ? ttl : 0;
+}
+
+/**
+ * Checks whether the sync client of a service caches any replies.
+ *
+ * @param tservice The service
+ * @return True iff the service or one it extends has a cached function
+ */
+bool t_cpp_generator::uses_response_cache(t_service* tservice) {
+  for (; tservice != NULL; tservice = tservice->get_extends()) {
+    const vector<t_function*>& functions = tservice->get_functions();
+    vector<t_function*>::const_iterator f_iter;
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      if (cache_ttl_ms(*f_iter) > 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 /**
  * Makes a :: prefix for a namespace
  *
@@ -2867,6 +3798,24 @@ string t_cpp_generator::function_signature(t_function* tfunction,
   }
 }
 
+/**
+ * Renders the signature of an AsyncClient method, which takes a completion
+ * callback ahead of the usual arguments and never returns a value.
+ *
+ * @param tfunction Function definition
+ * @param prefix Class scope to qualify the name with
+ * @return String of rendered function definition
+ */
+string t_cpp_generator::async_function_signature(t_function* tfunction,
+                                                 string prefix) {
+  t_struct* arglist = tfunction->get_arglist();
+  bool empty = arglist->get_members().size() == 0;
+  return
+    "void " + prefix + tfunction->get_name() +
+    "(std::tr1::function<void(" + service_name_ + "AsyncClient* client)> cob" +
+    (empty ? "" : (", " + argument_list(arglist))) + ")";
+}
+
 /**
  * Renders a field list
  *
@@ -3000,4 +3949,8 @@ string t_cpp_generator::get_include_prefix(const t_program& program) const {
 THRIFT_REGISTER_GENERATOR(cpp, "C++",
 "    dense:           Generate type specifications for the dense protocol.\n"
 "    include_prefix:  Use full include paths in generated files.\n"
+"    pool_args:       Reuse per-thread args/result objects in processors.\n"
+"    async:           Generate callback-based async clients (see TAsyncChannel).\n"
+"    deadlines:       Send per-call deadlines and drop expired calls (see TDeadline).\n"
+"    oneway_mtype:    Send oneway calls as T_ONEWAY; servers older than this release reject them.\n"
 );
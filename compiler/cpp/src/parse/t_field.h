@@ -20,6 +20,7 @@
 #ifndef T_FIELD_H
 #define T_FIELD_H
 
+#include <map>
 #include <string>
 #include <boost/lexical_cast.hpp>
 
@@ -133,6 +134,8 @@ class t_field : public t_doc {
     }
   };
 
+  std::map<std::string, std::string> annotations_;
+
 
  private:
   t_type* type_;
@@ -20,6 +20,7 @@
 #ifndef T_FUNCTION_H
 #define T_FUNCTION_H
 
+#include <map>
 #include <string>
 #include "t_type.h"
 #include "t_struct.h"
@@ -82,6 +83,8 @@ class t_function : public t_doc {
     return oneway_;
   }
 
+  std::map<std::string, std::string> annotations_;
+
  private:
   t_type* returntype_;
   std::string name_;
@@ -121,6 +121,7 @@ class TApplicationException : public TException {
   , WRONG_METHOD_NAME = 3
   , BAD_SEQUENCE_ID = 4
   , MISSING_RESULT = 5
+  , TIMED_OUT = 6
   };
 
   TApplicationException() :
@@ -161,6 +162,7 @@ class TApplicationException : public TException {
         case WRONG_METHOD_NAME    : return "TApplicationException: Wrong method name";
         case BAD_SEQUENCE_ID      : return "TApplicationException: Bad sequence identifier";
         case MISSING_RESULT       : return "TApplicationException: Missing result";
+        case TIMED_OUT            : return "TApplicationException: Deadline passed before the call ran";
         default                   : return "TApplicationException: (Invalid exception type)";
       };
     } else {
@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_ASYNC_TASYNCCHANNEL_H_
+#define _THRIFT_ASYNC_TASYNCCHANNEL_H_ 1
+
+#include <tr1/functional>
+#include <Thrift.h>
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+}}}
+
+namespace apache { namespace thrift { namespace async {
+
+using apache::thrift::transport::TMemoryBuffer;
+
+/**
+ * A message-oriented, non-blocking connection used by generated
+ * <Service>AsyncClient classes.  Callers hand over a fully serialized
+ * message and are called back once it has been answered; nothing here
+ * blocks the calling thread.
+ *
+ */
+class TAsyncChannel {
+ public:
+  typedef std::tr1::function<void()> VoidCallback;
+
+  virtual ~TAsyncChannel() {}
+
+  /**
+   * True iff the channel can accept new messages.
+   */
+  virtual bool good() const = 0;
+
+  /**
+   * True iff the channel has failed.  Outstanding and subsequent calls
+   * complete with an empty response.
+   */
+  virtual bool error() const = 0;
+
+  /**
+   * Takes the contents of sendBuf (leaving it empty) and sends them as one
+   * message.  cob runs once the message has been written.
+   */
+  virtual void sendMessage(const VoidCallback& cob,
+                           TMemoryBuffer* sendBuf) = 0;
+
+  /**
+   * Like sendMessage(), but cob runs once the response has arrived, at
+   * which point recvBuf holds it.  recvBuf is only valid inside cob, so the
+   * response must be read (e.g. by calling recv_<method>()) from there.
+   */
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  TMemoryBuffer* sendBuf,
+                                  TMemoryBuffer* recvBuf) = 0;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_ASYNC_TASYNCCHANNEL_H_
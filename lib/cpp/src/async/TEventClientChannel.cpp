@@ -0,0 +1,395 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "TEventClientChannel.h"
+#include <transport/TBufferTransports.h>
+#include <transport/TTransportException.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+namespace apache { namespace thrift { namespace async {
+
+using namespace std;
+using apache::thrift::transport::TTransportException;
+
+TEventClientChannel::TEventClientChannel(const string& host,
+                                         int port,
+                                         event_base* base) :
+  host_(host),
+  port_(port),
+  eventBase_(base),
+  socket_(-1),
+  eventFlags_(0),
+  connecting_(false),
+  error_(false),
+  maxFrameSize_(0x7fffffff),
+  writePos_(0),
+  bytesQueued_(0),
+  bytesWritten_(0) {
+}
+
+TEventClientChannel::~TEventClientChannel() {
+  setFlags(0);
+  if (socket_ >= 0) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+void TEventClientChannel::open() {
+  if (socket_ >= 0) {
+    throw TTransportException(TTransportException::ALREADY_OPEN);
+  }
+  if (port_ < 0 || port_ > 65535) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Specified port is invalid");
+  }
+
+  struct addrinfo hints, *res, *res0;
+  char port[sizeof("65536")];
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  sprintf(port, "%d", port_);
+
+  int error = getaddrinfo(host_.c_str(), port, &hints, &res0);
+  if (error) {
+    GlobalOutput(("TEventClientChannel::open() getaddrinfo() " + host_ + ": " +
+                  gai_strerror(error)).c_str());
+    throw TTransportException(TTransportException::NOT_OPEN, "Could not resolve host for client socket.");
+  }
+
+  // Take the first address we can start a connection to.
+  int errno_copy = 0;
+  for (res = res0; res != NULL; res = res->ai_next) {
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd == -1) {
+      errno_copy = errno;
+      continue;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    int one = 1;
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+      errno_copy = errno;
+      ::close(fd);
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+      socket_ = fd;
+      connecting_ = false;
+      break;
+    } else if (errno == EINPROGRESS) {
+      socket_ = fd;
+      connecting_ = true;
+      break;
+    }
+    errno_copy = errno;
+    ::close(fd);
+  }
+  freeaddrinfo(res0);
+
+  if (socket_ < 0) {
+    GlobalOutput.perror("TEventClientChannel::open() connect() " + host_ + " ", errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, "connect() failed", errno_copy);
+  }
+
+  error_ = false;
+  updateEvents();
+}
+
+void TEventClientChannel::close() {
+  fail("");
+}
+
+void TEventClientChannel::sendMessage(const VoidCallback& cob,
+                                      TMemoryBuffer* sendBuf) {
+  if (error_) {
+    sendBuf->resetBuffer();
+    cob();
+    return;
+  }
+  if (socket_ < 0) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Channel is not open");
+  }
+  enqueue(sendBuf);
+  PendingWrite pw;
+  pw.end = bytesQueued_;
+  pw.cob = cob;
+  writeQueue_.push_back(pw);
+  updateEvents();
+}
+
+void TEventClientChannel::sendAndRecvMessage(const VoidCallback& cob,
+                                             TMemoryBuffer* sendBuf,
+                                             TMemoryBuffer* recvBuf) {
+  if (error_) {
+    sendBuf->resetBuffer();
+    recvBuf->resetBuffer();
+    cob();
+    return;
+  }
+  if (socket_ < 0) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Channel is not open");
+  }
+  enqueue(sendBuf);
+  PendingRecv pr;
+  pr.cob = cob;
+  pr.recvBuf = recvBuf;
+  recvQueue_.push_back(pr);
+  updateEvents();
+}
+
+void TEventClientChannel::enqueue(TMemoryBuffer* sendBuf) {
+  uint8_t* buf;
+  uint32_t sz;
+  sendBuf->getBuffer(&buf, &sz);
+
+  int32_t frameSize = (int32_t)htonl((uint32_t)sz);
+  writeBuffer_.append((const char*)&frameSize, sizeof(frameSize));
+  writeBuffer_.append((const char*)buf, sz);
+  bytesQueued_ += sizeof(frameSize) + sz;
+  sendBuf->resetBuffer();
+}
+
+void TEventClientChannel::workSocket(short which) {
+  if (connecting_) {
+    if (!(which & EV_WRITE)) {
+      return;
+    }
+    finishConnect();
+  }
+  if (socket_ >= 0 && (which & EV_WRITE)) {
+    doWrite();
+  }
+  if (socket_ >= 0 && (which & EV_READ)) {
+    doRead();
+  }
+  updateEvents();
+}
+
+void TEventClientChannel::finishConnect() {
+  int val;
+  socklen_t lon = sizeof(val);
+  if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, (void*)&val, &lon) == -1) {
+    val = errno;
+  }
+  if (val != 0) {
+    GlobalOutput.perror("TEventClientChannel connect() " + host_ + " ", val);
+    fail("connect() failed");
+    return;
+  }
+  connecting_ = false;
+}
+
+void TEventClientChannel::doWrite() {
+  while (writePos_ < writeBuffer_.size()) {
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+    ssize_t sent = send(socket_,
+                        writeBuffer_.data() + writePos_,
+                        writeBuffer_.size() - writePos_,
+                        flags);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      int errno_copy = errno;
+      GlobalOutput.perror("TEventClientChannel::doWrite() send() " + host_ + " ", errno_copy);
+      fail("send() failed");
+      return;
+    }
+    writePos_ += sent;
+    bytesWritten_ += sent;
+  }
+
+  // Reclaim the written prefix, keeping the buffer's capacity.
+  if (writePos_ == writeBuffer_.size()) {
+    writeBuffer_.clear();
+    writePos_ = 0;
+  } else if (writePos_ > writeBuffer_.size() / 2) {
+    writeBuffer_.erase(0, writePos_);
+    writePos_ = 0;
+  }
+
+  while (!writeQueue_.empty() && writeQueue_.front().end <= bytesWritten_) {
+    VoidCallback cob = writeQueue_.front().cob;
+    writeQueue_.pop_front();
+    runCallback(cob);
+  }
+}
+
+void TEventClientChannel::doRead() {
+  uint8_t buf[16384];
+  while (true) {
+    ssize_t got = recv(socket_, buf, sizeof(buf), 0);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      int errno_copy = errno;
+      GlobalOutput.perror("TEventClientChannel::doRead() recv() " + host_ + " ", errno_copy);
+      fail("recv() failed");
+      return;
+    }
+    if (got == 0) {
+      fail("Connection closed by server");
+      return;
+    }
+    readBuffer_.append((const char*)buf, got);
+    if ((size_t)got < sizeof(buf)) {
+      break;
+    }
+  }
+  deliverFrames();
+}
+
+void TEventClientChannel::deliverFrames() {
+  uint32_t pos = 0;
+  while (socket_ >= 0 && readBuffer_.size() - pos >= sizeof(int32_t)) {
+    int32_t frameSize;
+    std::memcpy(&frameSize, readBuffer_.data() + pos, sizeof(frameSize));
+    uint32_t sz = ntohl((uint32_t)frameSize);
+    if (sz > maxFrameSize_) {
+      fail("Response frame too large");
+      return;
+    }
+    if (readBuffer_.size() - pos - sizeof(frameSize) < sz) {
+      break;
+    }
+    if (recvQueue_.empty()) {
+      fail("Unexpected response");
+      return;
+    }
+
+    PendingRecv pr = recvQueue_.front();
+    recvQueue_.pop_front();
+    pos += sizeof(frameSize);
+    pr.recvBuf->resetBuffer((uint8_t*)&readBuffer_[pos], sz);
+    pos += sz;
+    runCallback(pr.cob);
+  }
+
+  if (socket_ >= 0) {
+    readBuffer_.erase(0, std::min((size_t)pos, readBuffer_.size()));
+  }
+}
+
+void TEventClientChannel::fail(const string& why) {
+  if (socket_ < 0 && recvQueue_.empty() && writeQueue_.empty()) {
+    return;
+  }
+  if (!why.empty() && socket_ >= 0) {
+    GlobalOutput(("TEventClientChannel " + host_ + ": " + why).c_str());
+  }
+
+  setFlags(0);
+  if (socket_ >= 0) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+  connecting_ = false;
+  error_ = true;
+  writeBuffer_.clear();
+  writePos_ = 0;
+  readBuffer_.clear();
+
+  // Callbacks may issue new calls, which now complete immediately.
+  std::deque<PendingRecv> recvs;
+  recvs.swap(recvQueue_);
+  std::deque<PendingWrite> writes;
+  writes.swap(writeQueue_);
+
+  while (!writes.empty()) {
+    runCallback(writes.front().cob);
+    writes.pop_front();
+  }
+  while (!recvs.empty()) {
+    recvs.front().recvBuf->resetBuffer();
+    runCallback(recvs.front().cob);
+    recvs.pop_front();
+  }
+}
+
+void TEventClientChannel::runCallback(const VoidCallback& cob) {
+  try {
+    cob();
+  } catch (TException& x) {
+    GlobalOutput.printf("TEventClientChannel callback threw: %s", x.what());
+  } catch (std::exception& x) {
+    GlobalOutput.printf("TEventClientChannel callback threw: %s", x.what());
+  } catch (...) {
+    GlobalOutput("TEventClientChannel callback threw an unknown exception");
+  }
+}
+
+void TEventClientChannel::updateEvents() {
+  if (socket_ < 0) {
+    setFlags(0);
+  } else if (connecting_) {
+    setFlags(EV_WRITE | EV_PERSIST);
+  } else if (writePos_ < writeBuffer_.size()) {
+    setFlags(EV_READ | EV_WRITE | EV_PERSIST);
+  } else {
+    setFlags(EV_READ | EV_PERSIST);
+  }
+}
+
+void TEventClientChannel::setFlags(short eventFlags) {
+  if (eventFlags_ == eventFlags) {
+    return;
+  }
+  if (eventFlags_ != 0) {
+    if (event_del(&event_) == -1) {
+      GlobalOutput("TEventClientChannel::setFlags() event_del");
+    }
+  }
+  eventFlags_ = eventFlags;
+  if (eventFlags_ == 0) {
+    return;
+  }
+  event_set(&event_, socket_, eventFlags_, TEventClientChannel::eventHandler, this);
+  event_base_set(eventBase_, &event_);
+  if (event_add(&event_, 0) == -1) {
+    GlobalOutput("TEventClientChannel::setFlags() event_add");
+  }
+}
+
+}}} // apache::thrift::async
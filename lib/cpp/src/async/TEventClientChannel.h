@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_ASYNC_TEVENTCLIENTCHANNEL_H_
+#define _THRIFT_ASYNC_TEVENTCLIENTCHANNEL_H_ 1
+
+#include "TAsyncChannel.h"
+
+#include <deque>
+#include <string>
+#include <event.h>
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * A TAsyncChannel that talks framed Thrift (as understood by
+ * TNonblockingServer and TFramedTransport) over a non-blocking TCP
+ * connection driven by a libevent event_base.
+ *
+ * Any number of calls may be outstanding on one channel; requests are
+ * pipelined and responses are matched to them in the order they were sent.
+ * Any number of channels may share one event_base, so a single thread
+ * running event_base_loop() can fan out to many servers at once.
+ *
+ * All methods must be called from the thread running the event loop.
+ * Callbacks run on that thread too, and must not destroy the channel.
+ *
+ */
+class TEventClientChannel : public TAsyncChannel {
+ public:
+  TEventClientChannel(const std::string& host, int port, event_base* base);
+
+  /**
+   * Closes the connection.  Outstanding callbacks are dropped, not run.
+   */
+  virtual ~TEventClientChannel();
+
+  /**
+   * Resolves the host and starts connecting.  Messages may be sent as soon
+   * as this returns; they are written once the connection is up.
+   */
+  void open();
+
+  /**
+   * Closes the connection, completing all outstanding calls with an error.
+   */
+  void close();
+
+  bool isOpen() const {
+    return socket_ >= 0;
+  }
+
+  bool good() const {
+    return socket_ >= 0 && !error_;
+  }
+
+  bool error() const {
+    return error_;
+  }
+
+  /**
+   * Number of calls still waiting for a response.
+   */
+  uint32_t getNumPending() const {
+    return recvQueue_.size();
+  }
+
+  /**
+   * Responses with a larger frame are treated as a protocol error.
+   */
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize;
+  }
+
+  void sendMessage(const VoidCallback& cob, TMemoryBuffer* sendBuf);
+
+  void sendAndRecvMessage(const VoidCallback& cob,
+                          TMemoryBuffer* sendBuf,
+                          TMemoryBuffer* recvBuf);
+
+ private:
+  struct PendingRecv {
+    VoidCallback cob;
+    TMemoryBuffer* recvBuf;
+  };
+
+  struct PendingWrite {
+    uint64_t end;
+    VoidCallback cob;
+  };
+
+  // Libevent handler
+  static void eventHandler(int fd, short which, void* v) {
+    ((TEventClientChannel*)v)->workSocket(which);
+  }
+
+  void workSocket(short which);
+  void finishConnect();
+  void doWrite();
+  void doRead();
+  void deliverFrames();
+
+  // Appends sendBuf to the write buffer as one frame
+  void enqueue(TMemoryBuffer* sendBuf);
+
+  // Recomputes which events we need and registers them
+  void updateEvents();
+  void setFlags(short eventFlags);
+
+  // Closes the socket and completes everything outstanding
+  void fail(const std::string& why);
+
+  // Runs a user callback, keeping exceptions out of libevent
+  static void runCallback(const VoidCallback& cob);
+
+  std::string host_;
+  int port_;
+  event_base* eventBase_;
+  int socket_;
+
+  // Libevent object and the flags it is currently registered with
+  struct event event_;
+  short eventFlags_;
+
+  bool connecting_;
+  bool error_;
+  uint32_t maxFrameSize_;
+
+  // Framed requests not yet written, and how far we are through them
+  std::string writeBuffer_;
+  uint32_t writePos_;
+  uint64_t bytesQueued_;
+  uint64_t bytesWritten_;
+  std::deque<PendingWrite> writeQueue_;
+
+  // Bytes read but not yet delivered, and the calls waiting for them
+  std::string readBuffer_;
+  std::deque<PendingRecv> recvQueue_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_ASYNC_TEVENTCLIENTCHANNEL_H_
@@ -0,0 +1,344 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "TMultiplexedChannel.h"
+#include <concurrency/PosixThreadFactory.h>
+#include <transport/TTransportException.h>
+
+#include <arpa/inet.h>
+
+namespace apache { namespace thrift { namespace async {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::T_ONEWAY;
+using apache::thrift::transport::TTransportException;
+
+class TMultiplexedChannel::Reader : public Runnable {
+ public:
+  Reader(TMultiplexedChannel* channel) : channel_(channel) {}
+
+  void run() {
+    channel_->readLoop();
+  }
+
+ private:
+  TMultiplexedChannel* channel_;
+};
+
+TMultiplexedChannel::TMultiplexedChannel(shared_ptr<TTransport> transport,
+                                         shared_ptr<TProtocolFactory> protocolFactory) :
+  transport_(transport),
+  maxFrameSize_(0x7fffffff),
+  nextSeqId_(0),
+  open_(false),
+  error_(false),
+  wInBuf_(new TMemoryBuffer()),
+  wOutBuf_(new TMemoryBuffer()),
+  rInBuf_(new TMemoryBuffer()),
+  rOutBuf_(new TMemoryBuffer()) {
+  wInProt_ = protocolFactory->getProtocol(wInBuf_);
+  wOutProt_ = protocolFactory->getProtocol(wOutBuf_);
+  rInProt_ = protocolFactory->getProtocol(rInBuf_);
+  rOutProt_ = protocolFactory->getProtocol(rOutBuf_);
+}
+
+TMultiplexedChannel::~TMultiplexedChannel() {
+  try {
+    close();
+  } catch (TException& x) {
+    GlobalOutput.printf("TMultiplexedChannel::~TMultiplexedChannel() %s", x.what());
+  }
+}
+
+void TMultiplexedChannel::open() {
+  if (readerThread_ != NULL) {
+    throw TTransportException(TTransportException::ALREADY_OPEN);
+  }
+  if (!transport_->isOpen()) {
+    transport_->open();
+  }
+  {
+    Synchronized s(monitor_);
+    open_ = true;
+    error_ = false;
+  }
+
+  // Not detached, so that close() can wait for it
+  PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                   PosixThreadFactory::NORMAL,
+                                   1,
+                                   false);
+  readerThread_ = threadFactory.newThread(shared_ptr<Runnable>(new Reader(this)));
+  readerThread_->start();
+}
+
+void TMultiplexedChannel::close() {
+  fail();
+  {
+    Synchronized s(monitor_);
+    open_ = false;
+  }
+  if (readerThread_ != NULL) {
+    readerThread_->join();
+    readerThread_.reset();
+  }
+}
+
+bool TMultiplexedChannel::good() const {
+  Synchronized s(monitor_);
+  return open_ && !error_;
+}
+
+bool TMultiplexedChannel::error() const {
+  Synchronized s(monitor_);
+  return error_;
+}
+
+uint32_t TMultiplexedChannel::getNumPending() const {
+  Synchronized s(monitor_);
+  return pending_.size();
+}
+
+void TMultiplexedChannel::sendMessage(const VoidCallback& cob,
+                                      TMemoryBuffer* sendBuf) {
+  write(cob, sendBuf, NULL);
+  cob();
+}
+
+void TMultiplexedChannel::sendAndRecvMessage(const VoidCallback& cob,
+                                             TMemoryBuffer* sendBuf,
+                                             TMemoryBuffer* recvBuf) {
+  if (!write(cob, sendBuf, recvBuf)) {
+    // Oneway, or the channel has failed: there is nothing to wait for.
+    recvBuf->resetBuffer();
+    cob();
+  }
+}
+
+namespace {
+
+struct SyncCall {
+  Monitor monitor;
+  bool done;
+  TMemoryBuffer response;
+  TMemoryBuffer* recvBuf;
+
+  SyncCall(TMemoryBuffer* buf) : done(false), recvBuf(buf) {}
+
+  // Runs on the reader thread while response is still valid
+  void complete() {
+    uint8_t* buf;
+    uint32_t sz;
+    response.getBuffer(&buf, &sz);
+    recvBuf->resetBuffer();
+    recvBuf->write(buf, sz);
+
+    Synchronized s(monitor);
+    done = true;
+    monitor.notify();
+  }
+};
+
+}
+
+void TMultiplexedChannel::call(TMemoryBuffer* sendBuf,
+                               TMemoryBuffer* recvBuf) {
+  SyncCall sc(recvBuf);
+  if (!write(std::tr1::bind(&SyncCall::complete, &sc), sendBuf, &sc.response)) {
+    recvBuf->resetBuffer();
+    if (!good()) {
+      throw TTransportException(TTransportException::NOT_OPEN, "TMultiplexedChannel has failed");
+    }
+    return;
+  }
+
+  {
+    Synchronized s(sc.monitor);
+    while (!sc.done) {
+      sc.monitor.wait();
+    }
+  }
+  // A real response is never empty.
+  if (recvBuf->available_read() == 0) {
+    throw TTransportException(TTransportException::END_OF_FILE, "TMultiplexedChannel has failed");
+  }
+}
+
+bool TMultiplexedChannel::write(const VoidCallback& cob,
+                                TMemoryBuffer* sendBuf,
+                                TMemoryBuffer* recvBuf) {
+  bool registered = false;
+  int32_t wireSeqId = 0;
+  bool failed = false;
+  {
+    Guard g(writeMutex_);
+
+    uint8_t* buf;
+    uint32_t sz;
+    sendBuf->getBuffer(&buf, &sz);
+
+    string name;
+    TMessageType type;
+    int32_t seqid;
+    wInBuf_->resetBuffer(buf, sz);
+    wInProt_->readMessageBegin(name, type, seqid);
+    uint32_t headerSize = sz - wInBuf_->available_read();
+
+    {
+      Synchronized s(monitor_);
+      if (!open_ || error_) {
+        sendBuf->resetBuffer();
+        return false;
+      }
+      nextSeqId_ = (nextSeqId_ < 0x7fffffff) ? nextSeqId_ + 1 : 1;
+      wireSeqId = nextSeqId_;
+      // Register before writing: the response may beat us back.
+      if (recvBuf != NULL && type != T_ONEWAY) {
+        PendingCall& pc = pending_[wireSeqId];
+        pc.cob = cob;
+        pc.recvBuf = recvBuf;
+        pc.seqid = seqid;
+        registered = true;
+      }
+    }
+
+    // Frame size placeholder, then the renumbered header and the body
+    int32_t frameSize = 0;
+    wOutBuf_->resetBuffer();
+    wOutBuf_->write((const uint8_t*)&frameSize, sizeof(frameSize));
+    wOutProt_->writeMessageBegin(name, type, wireSeqId);
+    wOutBuf_->write(buf + headerSize, sz - headerSize);
+    sendBuf->resetBuffer();
+
+    uint8_t* frame;
+    uint32_t frameLen;
+    wOutBuf_->getBuffer(&frame, &frameLen);
+    frameSize = (int32_t)htonl(frameLen - sizeof(frameSize));
+    memcpy(frame, &frameSize, sizeof(frameSize));
+
+    try {
+      transport_->write(frame, frameLen);
+      transport_->flush();
+    } catch (TTransportException& ttx) {
+      GlobalOutput.printf("TMultiplexedChannel write failed: %s", ttx.what());
+      failed = true;
+    }
+  }
+
+  if (failed) {
+    // Completes our own call too, if we registered one.
+    fail();
+  }
+  return registered;
+}
+
+void TMultiplexedChannel::readLoop() {
+  try {
+    for (;;) {
+      int32_t sz;
+      transport_->readAll((uint8_t*)&sz, sizeof(sz));
+      sz = ntohl(sz);
+      if (sz <= 0 || (uint32_t)sz > maxFrameSize_) {
+        GlobalOutput.printf("TMultiplexedChannel: bad frame size %d", sz);
+        break;
+      }
+      if (rFrame_.size() < (uint32_t)sz) {
+        rFrame_.resize(sz);
+      }
+      transport_->readAll(&rFrame_[0], sz);
+
+      string name;
+      TMessageType type;
+      int32_t seqid;
+      rInBuf_->resetBuffer(&rFrame_[0], sz);
+      rInProt_->readMessageBegin(name, type, seqid);
+      uint32_t headerSize = sz - rInBuf_->available_read();
+
+      PendingCall pc;
+      {
+        Synchronized s(monitor_);
+        PendingMap::iterator it = pending_.find(seqid);
+        if (it == pending_.end()) {
+          GlobalOutput.printf("TMultiplexedChannel: dropping response to unknown seqid %d", seqid);
+          continue;
+        }
+        pc = it->second;
+        pending_.erase(it);
+      }
+
+      // Give the caller back the sequence id it sent
+      rOutBuf_->resetBuffer();
+      rOutProt_->writeMessageBegin(name, type, pc.seqid);
+      rOutBuf_->write(&rFrame_[headerSize], sz - headerSize);
+
+      uint8_t* buf;
+      uint32_t len;
+      rOutBuf_->getBuffer(&buf, &len);
+      pc.recvBuf->resetBuffer(buf, len);
+      runCallback(pc.cob);
+    }
+  } catch (TException& x) {
+    if (!error()) {
+      GlobalOutput.printf("TMultiplexedChannel read failed: %s", x.what());
+    }
+  }
+  fail();
+}
+
+void TMultiplexedChannel::fail() {
+  PendingMap pending;
+  {
+    Synchronized s(monitor_);
+    error_ = true;
+    pending.swap(pending_);
+  }
+
+  {
+    Guard g(writeMutex_);
+    if (transport_->isOpen()) {
+      transport_->close();
+    }
+  }
+
+  for (PendingMap::iterator it = pending.begin(); it != pending.end(); ++it) {
+    it->second.recvBuf->resetBuffer();
+    runCallback(it->second.cob);
+  }
+}
+
+void TMultiplexedChannel::runCallback(const VoidCallback& cob) {
+  try {
+    cob();
+  } catch (TException& x) {
+    GlobalOutput.printf("TMultiplexedChannel callback threw: %s", x.what());
+  } catch (std::exception& x) {
+    GlobalOutput.printf("TMultiplexedChannel callback threw: %s", x.what());
+  } catch (...) {
+    GlobalOutput("TMultiplexedChannel callback threw an unknown exception");
+  }
+}
+
+}}} // apache::thrift::async
@@ -0,0 +1,219 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_ASYNC_TMULTIPLEXEDCHANNEL_H_
+#define _THRIFT_ASYNC_TMULTIPLEXEDCHANNEL_H_ 1
+
+#include "TAsyncChannel.h"
+
+#include <map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Monitor.h>
+#include <concurrency/Mutex.h>
+#include <concurrency/Thread.h>
+#include <protocol/TProtocol.h>
+#include <transport/TTransport.h>
+#include <transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace async {
+
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::transport::TTransport;
+
+/**
+ * A thread-safe TAsyncChannel that lets any number of clients, on any
+ * number of threads, share one framed connection.
+ *
+ * Each request is renumbered with a sequence id that is unique on the
+ * connection, and a reader thread hands each response to the call it
+ * answers, in whatever order the server completes them.  The caller's own
+ * sequence id is put back into the response, so clients need not
+ * coordinate their ids.  Message headers are rewritten with the supplied
+ * protocol factory; the protocol must not read ahead of the header (the
+ * binary and compact protocols qualify, TJSONProtocol does not).
+ *
+ * Callbacks for sendAndRecvMessage() run on the reader thread, those for
+ * sendMessage() on the sending thread.  Neither may make blocking calls on
+ * the channel.
+ *
+ */
+class TMultiplexedChannel : public TAsyncChannel {
+ public:
+  /**
+   * transport is the raw connection (e.g. a TSocket); the channel does its
+   * own framing.  It should have no receive timeout, since the reader waits
+   * on it for as long as the channel is open.
+   */
+  TMultiplexedChannel(boost::shared_ptr<TTransport> transport,
+                      boost::shared_ptr<TProtocolFactory> protocolFactory);
+
+  virtual ~TMultiplexedChannel();
+
+  /**
+   * Opens the transport if necessary and starts the reader thread.
+   */
+  void open();
+
+  /**
+   * Closes the transport and waits for the reader thread, completing all
+   * outstanding calls with an error.
+   */
+  void close();
+
+  bool good() const;
+
+  bool error() const;
+
+  /**
+   * Number of calls still waiting for a response.
+   */
+  uint32_t getNumPending() const;
+
+  /**
+   * Responses with a larger frame are treated as a protocol error.
+   */
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize;
+  }
+
+  void sendMessage(const VoidCallback& cob, TMemoryBuffer* sendBuf);
+
+  void sendAndRecvMessage(const VoidCallback& cob,
+                          TMemoryBuffer* sendBuf,
+                          TMemoryBuffer* recvBuf);
+
+  /**
+   * Blocking form of sendAndRecvMessage(): returns once the response has
+   * been copied into recvBuf, or for a oneway message once it has been
+   * written.  Throws TTransportException if the channel fails first.
+   */
+  void call(TMemoryBuffer* sendBuf, TMemoryBuffer* recvBuf);
+
+ private:
+  class Reader;
+  friend class Reader;
+
+  struct PendingCall {
+    VoidCallback cob;
+    TMemoryBuffer* recvBuf;
+    int32_t seqid;
+  };
+
+  typedef std::map<int32_t, PendingCall> PendingMap;
+
+  // Renumbers, frames and writes sendBuf.  Registers cob under the new
+  // sequence id unless recvBuf is NULL or the message is oneway; returns
+  // true iff it did.
+  bool write(const VoidCallback& cob,
+             TMemoryBuffer* sendBuf,
+             TMemoryBuffer* recvBuf);
+
+  // Reader thread body
+  void readLoop();
+
+  // Marks the channel failed and completes everything outstanding
+  void fail();
+
+  // Runs a user callback, keeping exceptions away from our threads
+  static void runCallback(const VoidCallback& cob);
+
+  boost::shared_ptr<TTransport> transport_;
+  uint32_t maxFrameSize_;
+
+  // Guards pending_, nextSeqId_, open_ and error_
+  apache::thrift::concurrency::Monitor monitor_;
+  PendingMap pending_;
+  int32_t nextSeqId_;
+  bool open_;
+  bool error_;
+
+  // Serializes writers; guards everything on the write side
+  apache::thrift::concurrency::Mutex writeMutex_;
+  boost::shared_ptr<TMemoryBuffer> wInBuf_;
+  boost::shared_ptr<TMemoryBuffer> wOutBuf_;
+  boost::shared_ptr<TProtocol> wInProt_;
+  boost::shared_ptr<TProtocol> wOutProt_;
+
+  // Owned by the reader thread
+  boost::shared_ptr<apache::thrift::concurrency::Thread> readerThread_;
+  std::vector<uint8_t> rFrame_;
+  boost::shared_ptr<TMemoryBuffer> rInBuf_;
+  boost::shared_ptr<TMemoryBuffer> rOutBuf_;
+  boost::shared_ptr<TProtocol> rInProt_;
+  boost::shared_ptr<TProtocol> rOutProt_;
+};
+
+/**
+ * Lets an ordinary blocking client use a TMultiplexedChannel.  Writes are
+ * buffered until flush(), which performs the call and leaves the response
+ * to be read.  Give each thread its own client and TMultiplexedTransport;
+ * all of them may share one channel.
+ *
+ */
+class TMultiplexedTransport : public TTransport {
+ public:
+  TMultiplexedTransport(boost::shared_ptr<TMultiplexedChannel> channel) :
+    channel_(channel) {}
+
+  bool isOpen() {
+    return channel_->good();
+  }
+
+  bool peek() {
+    return recvBuf_.peek();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    return recvBuf_.read(buf, len);
+  }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    sendBuf_.write(buf, len);
+  }
+
+  void flush() {
+    if (sendBuf_.available_read() > 0) {
+      channel_->call(&sendBuf_, &recvBuf_);
+    }
+  }
+
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len) {
+    return recvBuf_.borrow(buf, len);
+  }
+
+  void consume(uint32_t len) {
+    recvBuf_.consume(len);
+  }
+
+  boost::shared_ptr<TMultiplexedChannel> getChannel() {
+    return channel_;
+  }
+
+ private:
+  boost::shared_ptr<TMultiplexedChannel> channel_;
+  TMemoryBuffer sendBuf_;
+  TMemoryBuffer recvBuf_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_ASYNC_TMULTIPLEXEDCHANNEL_H_
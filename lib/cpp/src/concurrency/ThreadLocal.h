@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_CONCURRENCY_THREADLOCAL_H_
+#define _THRIFT_CONCURRENCY_THREADLOCAL_H_ 1
+
+#include "Exception.h"
+#include "Mutex.h"
+
+#include <boost/shared_ptr.hpp>
+#include <pthread.h>
+#include <map>
+#include <set>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Holds one default-constructed T per thread, created the first time that
+ * thread calls get().  A thread's object is destroyed when the thread exits;
+ * whatever is left over is destroyed along with the ThreadLocal itself, so
+ * it must outlive any calls to get().  Threads may exit while it is being
+ * destroyed.
+ *
+ * All ThreadLocal<T> for the same T share one pthread key, under which each
+ * thread keeps a map of its objects, so any number of them may exist at
+ * once.  A thread frees what it kept for destroyed ones the next time it
+ * calls get() on a new one, or when it exits.
+ *
+ * @version $Id:$
+ */
+template <class T>
+class ThreadLocal {
+ public:
+  ThreadLocal() :
+    state_(new State()) {
+    pthread_once(&keyOnce_, &ThreadLocal::createKey);
+    if (!keyCreated_) {
+      throw SystemResourceException("pthread_key_create() failed");
+    }
+  }
+
+  ~ThreadLocal() {
+    Guard g(state_->mutex);
+    state_->dead = true;
+    typename std::set<Slot*>::iterator it;
+    for (it = state_->slots.begin(); it != state_->slots.end(); ++it) {
+      delete (*it)->value;
+      (*it)->value = NULL;
+    }
+    state_->slots.clear();
+  }
+
+  T* get() {
+    Slots* slots = static_cast<Slots*>(pthread_getspecific(key_));
+    if (slots == NULL) {
+      slots = new Slots();
+      pthread_setspecific(key_, slots);
+    }
+    typename Slots::iterator found = slots->find(state_.get());
+    if (found != slots->end()) {
+      return found->second->value;
+    }
+
+    purge(slots);
+    Slot* slot = new Slot(state_);
+    {
+      Guard g(state_->mutex);
+      state_->slots.insert(slot);
+    }
+    (*slots)[state_.get()] = slot;
+    return slot->value;
+  }
+
+ private:
+  struct Slot;
+
+  // Shared with the slots, so that a thread exiting during ~ThreadLocal()
+  // still has a mutex to take, and a state is not reused while a thread
+  // still has it in its map.  Whoever removes a slot from the set destroys
+  // its value.
+  struct State {
+    State() : dead(false) {}
+    Mutex mutex;
+    std::set<Slot*> slots;
+    bool dead;
+  };
+
+  // Owned by its thread
+  struct Slot {
+    explicit Slot(const boost::shared_ptr<State>& state) :
+      state(state),
+      value(new T()) {}
+    boost::shared_ptr<State> state;
+    T* value;
+  };
+
+  // A thread's slots, by the ThreadLocal they belong to
+  typedef std::map<const State*, Slot*> Slots;
+
+  static void createKey() {
+    keyCreated_ = (pthread_key_create(&key_, &ThreadLocal::threadExit) == 0);
+  }
+
+  // Frees the slots of ThreadLocals that have been destroyed
+  static void purge(Slots* slots) {
+    typename Slots::iterator it = slots->begin();
+    while (it != slots->end()) {
+      Slot* slot = it->second;
+      bool dead;
+      {
+        Guard g(slot->state->mutex);
+        dead = slot->state->dead;
+      }
+      if (dead) {
+        delete slot;
+        slots->erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  static void threadExit(void* arg) {
+    Slots* slots = static_cast<Slots*>(arg);
+    typename Slots::iterator it;
+    for (it = slots->begin(); it != slots->end(); ++it) {
+      Slot* slot = it->second;
+      {
+        Guard g(slot->state->mutex);
+        if (slot->state->slots.erase(slot) != 0) {
+          delete slot->value;
+        }
+      }
+      delete slot;
+    }
+    delete slots;
+  }
+
+  // Not copyable.
+  ThreadLocal(const ThreadLocal&);
+  ThreadLocal& operator=(const ThreadLocal&);
+
+  static pthread_once_t keyOnce_;
+  static pthread_key_t key_;
+  static bool keyCreated_;
+
+  boost::shared_ptr<State> state_;
+};
+
+template <class T>
+pthread_once_t ThreadLocal<T>::keyOnce_ = PTHREAD_ONCE_INIT;
+
+template <class T>
+pthread_key_t ThreadLocal<T>::key_;
+
+template <class T>
+bool ThreadLocal<T>::keyCreated_ = false;
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_THREADLOCAL_H_
@@ -0,0 +1,158 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "TCaptureProcessor.h"
+
+namespace apache { namespace thrift { namespace processor {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+
+TCaptureProcessor::TCaptureProcessor(shared_ptr<TProcessor> processor,
+                                     shared_ptr<TTransport> capture,
+                                     uint32_t sampleRate,
+                                     shared_ptr<TProtocolFactory> protocolFactory) :
+  processor_(processor),
+  capture_(capture),
+  sampleRate_(sampleRate),
+  protocolFactory_(protocolFactory),
+  numRequests_(0),
+  numCaptured_(0),
+  numSkipped_(0),
+  numFailed_(0) {
+  if (protocolFactory_ == NULL) {
+    protocolFactory_.reset(new TBinaryProtocolFactory());
+  }
+}
+
+void TCaptureProcessor::captureMethod(const string& name) {
+  methods_.insert(name);
+}
+
+bool TCaptureProcessor::process(shared_ptr<TProtocol> in,
+                                shared_ptr<TProtocol> out) {
+  bool sampled = false;
+  {
+    Guard g(mutex_);
+    numRequests_++;
+    if (sampleRate_ > 0 && numRequests_ % sampleRate_ == 0) {
+      sampled = true;
+    }
+  }
+
+  if (sampled || !methods_.empty()) {
+    capture(in->getTransport().get(), sampled);
+  }
+  return processor_->process(in, out);
+}
+
+const uint8_t* TCaptureProcessor::borrowRequest(TTransport* trans, uint32_t* len) {
+  const uint8_t* buf = NULL;
+  *len = 0;
+  if (TFramedTransport* framed = dynamic_cast<TFramedTransport*>(trans)) {
+    buf = framed->borrowFrame(len);
+  } else if (TMemoryBuffer* memory = dynamic_cast<TMemoryBuffer*>(trans)) {
+    uint8_t* data;
+    memory->getBuffer(&data, len);
+    buf = data;
+  }
+  return *len > 0 ? buf : NULL;
+}
+
+bool TCaptureProcessor::isCapturedMethod(const uint8_t* buf, uint32_t len) {
+  shared_ptr<TMemoryBuffer> request(new TMemoryBuffer((uint8_t*)buf, len));
+  shared_ptr<TProtocol> prot = protocolFactory_->getProtocol(request);
+  string name;
+  TMessageType type;
+  int32_t seqid;
+  try {
+    prot->readMessageBegin(name, type, seqid);
+  } catch (TException&) {
+    // Let the processor deal with it
+    return false;
+  }
+  return methods_.find(name) != methods_.end();
+}
+
+void TCaptureProcessor::capture(TTransport* trans, bool sampled) {
+  uint32_t len;
+  const uint8_t* buf = borrowRequest(trans, &len);
+  if (buf == NULL) {
+    Guard g(mutex_);
+    numSkipped_++;
+    return;
+  }
+
+  if (!sampled && !isCapturedMethod(buf, len)) {
+    return;
+  }
+
+  try {
+    capture_->write(buf, len);
+  } catch (TTransportException& ttx) {
+    GlobalOutput.printf("TCaptureProcessor: capture failed: %s", ttx.what());
+    Guard g(mutex_);
+    numFailed_++;
+    return;
+  }
+  Guard g(mutex_);
+  numCaptured_++;
+}
+
+uint64_t TCaptureProcessor::getNumRequests() {
+  Guard g(mutex_);
+  return numRequests_;
+}
+
+uint64_t TCaptureProcessor::getNumCaptured() {
+  Guard g(mutex_);
+  return numCaptured_;
+}
+
+uint64_t TCaptureProcessor::getNumSkipped() {
+  Guard g(mutex_);
+  return numSkipped_;
+}
+
+uint64_t TCaptureProcessor::getNumFailed() {
+  Guard g(mutex_);
+  return numFailed_;
+}
+
+void TCaptureProcessor::getCounters(map<string, int64_t>& counters,
+                                    const string& prefix) {
+  counters[prefix + ".requests"] = getNumRequests();
+  counters[prefix + ".captured"] = getNumCaptured();
+  counters[prefix + ".skipped"] = getNumSkipped();
+  counters[prefix + ".failed"] = getNumFailed();
+}
+
+}}} // apache::thrift::processor
@@ -0,0 +1,125 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_
+#define _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_ 1
+
+#include <map>
+#include <set>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <TProcessor.h>
+#include <concurrency/Mutex.h>
+#include <protocol/TProtocol.h>
+#include <transport/TTransport.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * Captures a sample of the requests a server handles, for replaying with
+ * TFileProcessor as load:
+ *
+ *   shared_ptr<TFileTransport> capture(new TFileTransport("requests.log"));
+ *   shared_ptr<TCaptureProcessor> processor(
+ *     new TCaptureProcessor(actualProcessor, capture, 1000));
+ *   processor->captureMethod("getUser");
+ *
+ * A request is captured if it is the sampleRate'th since the last one
+ * sampled (0 turns that off), or if it calls one of the methods given to
+ * captureMethod().
+ *
+ * The request's bytes are taken where the server already holds them: the
+ * frame read by a TFramedTransport, or the TMemoryBuffer over the
+ * nonblocking server's read buffer.  They are borrowed before the
+ * processor reads them, so nothing is copied for requests that are not
+ * captured, and a captured one is copied once, by the capture transport.
+ * Requests on other transports (unframed ones, or framed ones wrapped in
+ * something else) cannot be told apart and are counted as skipped.
+ *
+ * Each captured request is one write() to the capture transport, which is
+ * never flushed from here.  With a TFileTransport that makes every request
+ * an event, and the writes are safe from any number of server threads.  A
+ * failed capture is counted and logged; the request is processed anyway.
+ *
+ * Only the method name is parsed, and only when methods are given, with
+ * the protocol factory (TBinaryProtocol by default).
+ *
+ */
+class TCaptureProcessor : public apache::thrift::TProcessor {
+ public:
+  TCaptureProcessor(boost::shared_ptr<apache::thrift::TProcessor> processor,
+                    boost::shared_ptr<apache::thrift::transport::TTransport> capture,
+                    uint32_t sampleRate = 0,
+                    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory =
+                      boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>());
+
+  /**
+   * Captures every call of the method name.  Not safe while serving.
+   */
+  void captureMethod(const std::string& name);
+
+  bool process(boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+               boost::shared_ptr<apache::thrift::protocol::TProtocol> out);
+
+  /**
+   * Number of requests seen, captured, skipped because their transport does
+   * not hold whole requests, and lost to errors from the capture transport.
+   */
+  uint64_t getNumRequests();
+
+  uint64_t getNumCaptured();
+
+  uint64_t getNumSkipped();
+
+  uint64_t getNumFailed();
+
+  /**
+   * Adds the above to counters as "<prefix>.<counter>", for fb303's
+   * getCounters().
+   */
+  void getCounters(std::map<std::string, int64_t>& counters,
+                   const std::string& prefix = "capture");
+
+ private:
+  // The rest of the current request, if its transport holds all of it
+  static const uint8_t* borrowRequest(apache::thrift::transport::TTransport* trans,
+                                      uint32_t* len);
+
+  bool isCapturedMethod(const uint8_t* buf, uint32_t len);
+
+  void capture(apache::thrift::transport::TTransport* trans, bool sampled);
+
+  boost::shared_ptr<apache::thrift::TProcessor> processor_;
+  boost::shared_ptr<apache::thrift::transport::TTransport> capture_;
+  uint32_t sampleRate_;
+  boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory_;
+  std::set<std::string> methods_;
+
+  apache::thrift::concurrency::Mutex mutex_;
+  uint64_t numRequests_;
+  uint64_t numCaptured_;
+  uint64_t numSkipped_;
+  uint64_t numFailed_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_
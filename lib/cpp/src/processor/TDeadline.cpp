@@ -0,0 +1,105 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <concurrency/Mutex.h>
+#include <concurrency/ThreadLocal.h>
+#include <concurrency/Util.h>
+#include "TDeadline.h"
+
+namespace apache { namespace thrift { namespace processor {
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::ThreadLocal;
+using apache::thrift::concurrency::Util;
+
+namespace {
+
+struct DeadlineState {
+  DeadlineState() : received(0), current(0) {}
+
+  // When the pending request arrived, until a processor picks it up
+  int64_t received;
+  // Deadline of the call being handled
+  int64_t current;
+};
+
+ThreadLocal<DeadlineState> state;
+
+Mutex expiredMutex;
+uint64_t numExpired = 0;
+
+}
+
+const int16_t TDeadline::DEADLINE_FIELD_ID;
+
+void TDeadline::setReceived(int64_t ms) {
+  state.get()->received = ms;
+}
+
+int64_t TDeadline::getCurrent() {
+  return state.get()->current;
+}
+
+int32_t TDeadline::budgetFor(int32_t timeoutMs) {
+  int64_t budget = timeoutMs > 0 ? timeoutMs : 0;
+  int64_t current = getCurrent();
+  if (current > 0) {
+    int64_t left = current - Util::currentTime();
+    if (left < 1) {
+      left = 1;
+    }
+    if (budget == 0 || left < budget) {
+      budget = left;
+    }
+  }
+  return (int32_t)budget;
+}
+
+uint64_t TDeadline::getNumExpired() {
+  Guard g(expiredMutex);
+  return numExpired;
+}
+
+void TDeadline::expired() {
+  Guard g(expiredMutex);
+  numExpired++;
+}
+
+TDeadlineScope::TDeadlineScope(int32_t budgetMs) :
+  deadline_(0) {
+  DeadlineState* s = state.get();
+  if (budgetMs > 0) {
+    int64_t start = s->received > 0 ? s->received : Util::currentTime();
+    deadline_ = start + budgetMs;
+  }
+  s->received = 0;
+  previous_ = s->current;
+  s->current = deadline_;
+}
+
+TDeadlineScope::~TDeadlineScope() {
+  state.get()->current = previous_;
+}
+
+bool TDeadlineScope::expired() const {
+  return deadline_ > 0 && Util::currentTime() >= deadline_;
+}
+
+}}} // apache::thrift::processor
@@ -0,0 +1,106 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TDEADLINE_H_
+#define _THRIFT_PROCESSOR_TDEADLINE_H_ 1
+
+#include <Thrift.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * Per-call deadlines, for code generated with the cpp "deadlines" option.
+ *
+ * A client given a call timeout sends the time it has left in milliseconds
+ * as an extra field of the call's arguments, with id DEADLINE_FIELD_ID.
+ * Servers generated without the option skip it like any unknown field.
+ * Sending time left rather than a wall clock time keeps clock skew out of
+ * it.
+ *
+ * The processor starts the clock when the server reports the request
+ * arrived (see setReceived()), so time spent queued for a worker counts.
+ * If the budget is gone by the time the handler would run, it answers with
+ * a TApplicationException of type TIMED_OUT instead of running it.
+ * Otherwise the deadline stays in force on that thread while the handler
+ * runs, and calls it makes through clients with the option pass on
+ * whatever is left of it.
+ *
+ */
+class TDeadline {
+ public:
+  /**
+   * Field id of the time left in a call's arguments.
+   */
+  static const int16_t DEADLINE_FIELD_ID = 32767;
+
+  /**
+   * Records when the request about to be processed on this thread arrived,
+   * in ms (see concurrency::Util::currentTime()).  Servers call this before
+   * handing a request to the processor; without it the clock starts when
+   * the processor has read the arguments.
+   */
+  static void setReceived(int64_t ms);
+
+  /**
+   * Absolute deadline of the call being handled on this thread, in ms, or
+   * 0 if there is none.
+   */
+  static int64_t getCurrent();
+
+  /**
+   * Time left to send with an outgoing call: the smaller of timeoutMs (if
+   * positive) and what is left of the current deadline, at least 1.
+   * Returns 0 if there is neither.
+   */
+  static int32_t budgetFor(int32_t timeoutMs);
+
+  /**
+   * Number of calls dropped because their deadline had passed.
+   */
+  static uint64_t getNumExpired();
+
+  /**
+   * Counts a dropped call.
+   */
+  static void expired();
+};
+
+/**
+ * Makes budgetMs (0 for none) the current deadline for the scope of a
+ * call's handler, restoring the previous one on exit.
+ */
+class TDeadlineScope {
+ public:
+  explicit TDeadlineScope(int32_t budgetMs);
+
+  ~TDeadlineScope();
+
+  /**
+   * Whether the deadline has already passed.
+   */
+  bool expired() const;
+
+ private:
+  int64_t deadline_;
+  int64_t previous_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TDEADLINE_H_
@@ -0,0 +1,226 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <concurrency/Util.h>
+#include "TResponseCache.h"
+
+namespace apache { namespace thrift { namespace processor {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::Util;
+
+namespace {
+
+// Charged per entry on top of its key and value, for the list node, the
+// index node and the strings' own bookkeeping
+const size_t kEntryOverhead = 128;
+
+Mutex defaultMutex;
+
+}
+
+const size_t TResponseCache::DEFAULT_MAX_BYTES;
+const int TResponseCache::DEFAULT_NUM_SHARDS;
+
+TResponseCache::TResponseCache(size_t maxBytes, int numShards) {
+  if (numShards < 1) {
+    numShards = 1;
+  }
+  maxShardBytes_ = maxBytes / numShards;
+  for (int i = 0; i < numShards; ++i) {
+    shards_.push_back(shared_ptr<Shard>(new Shard()));
+  }
+}
+
+shared_ptr<TResponseCache> TResponseCache::getDefault() {
+  static shared_ptr<TResponseCache> cache;
+  Guard g(defaultMutex);
+  if (cache == NULL) {
+    cache.reset(new TResponseCache());
+  }
+  return cache;
+}
+
+TResponseCache::Shard& TResponseCache::shardFor(const string& key) {
+  // FNV-1a
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < key.size(); ++i) {
+    hash ^= (uint8_t)key[i];
+    hash *= 16777619U;
+  }
+  return *shards_[hash % shards_.size()];
+}
+
+size_t TResponseCache::cost(const string& key, const string& value) {
+  return key.size() + value.size() + kEntryOverhead;
+}
+
+void TResponseCache::erase(Shard& shard, EntryMap::iterator it) {
+  shard.size -= cost(it->second->key, it->second->value);
+  shard.entries.erase(it->second);
+  shard.index.erase(it);
+}
+
+bool TResponseCache::get(const string& key, string& value) {
+  Shard& shard = shardFor(key);
+  Guard g(shard.mutex);
+  EntryMap::iterator it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    ++shard.numMisses;
+    return false;
+  }
+  if (it->second->expiresAt <= Util::currentTime()) {
+    erase(shard, it);
+    ++shard.numExpirations;
+    ++shard.numMisses;
+    return false;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+  value = it->second->value;
+  ++shard.numHits;
+  return true;
+}
+
+void TResponseCache::put(const string& key, const string& value, int64_t ttlMs) {
+  size_t size = cost(key, value);
+  if (ttlMs <= 0 || size > maxShardBytes_) {
+    return;
+  }
+
+  Shard& shard = shardFor(key);
+  Guard g(shard.mutex);
+  EntryMap::iterator it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    erase(shard, it);
+  }
+  while (shard.size + size > maxShardBytes_) {
+    EntryMap::iterator lru = shard.index.find(shard.entries.back().key);
+    erase(shard, lru);
+    ++shard.numEvictions;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.value = value;
+  entry.expiresAt = Util::currentTime() + ttlMs;
+  shard.entries.push_front(entry);
+  shard.index[key] = shard.entries.begin();
+  shard.size += size;
+}
+
+void TResponseCache::invalidate(const string& key) {
+  Shard& shard = shardFor(key);
+  Guard g(shard.mutex);
+  EntryMap::iterator it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    erase(shard, it);
+  }
+}
+
+void TResponseCache::invalidateFunction(const string& name) {
+  string prefix = name + '\0';
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Shard& shard = *shards_[i];
+    Guard g(shard.mutex);
+    EntryMap::iterator it = shard.index.lower_bound(prefix);
+    while (it != shard.index.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+      erase(shard, it++);
+    }
+  }
+}
+
+void TResponseCache::clear() {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Shard& shard = *shards_[i];
+    Guard g(shard.mutex);
+    shard.entries.clear();
+    shard.index.clear();
+    shard.size = 0;
+  }
+}
+
+uint64_t TResponseCache::getNumHits() {
+  uint64_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->numHits;
+  }
+  return total;
+}
+
+uint64_t TResponseCache::getNumMisses() {
+  uint64_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->numMisses;
+  }
+  return total;
+}
+
+uint64_t TResponseCache::getNumEvictions() {
+  uint64_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->numEvictions;
+  }
+  return total;
+}
+
+uint64_t TResponseCache::getNumExpirations() {
+  uint64_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->numExpirations;
+  }
+  return total;
+}
+
+size_t TResponseCache::getSize() {
+  size_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->size;
+  }
+  return total;
+}
+
+size_t TResponseCache::getNumEntries() {
+  size_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Guard g(shards_[i]->mutex);
+    total += shards_[i]->entries.size();
+  }
+  return total;
+}
+
+void TResponseCache::getCounters(map<string, int64_t>& counters,
+                                 const string& prefix) {
+  counters[prefix + ".hits"] = getNumHits();
+  counters[prefix + ".misses"] = getNumMisses();
+  counters[prefix + ".evictions"] = getNumEvictions();
+  counters[prefix + ".expirations"] = getNumExpirations();
+  counters[prefix + ".bytes"] = getSize();
+  counters[prefix + ".entries"] = getNumEntries();
+}
+
+}}} // apache::thrift::processor
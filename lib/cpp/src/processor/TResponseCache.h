@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TRESPONSECACHE_H_
+#define _THRIFT_PROCESSOR_TRESPONSECACHE_H_ 1
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <Thrift.h>
+#include <concurrency/Mutex.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * In-process cache of replies, for functions annotated with
+ * cpp.cache_ttl_ms:
+ *
+ *   Config getConfig(1: string name) (cpp.cache_ttl_ms = "5000")
+ *
+ * Before sending such a call the generated client looks up the service and
+ * function name with the serialized arguments, and on a hit returns the
+ * cached result without touching the network.  Only successful replies are
+ * cached, for the annotated number of milliseconds.
+ *
+ * Entries are split over shards by key hash, each with its own lock and
+ * least recently used list, and each shard holds at most its share of the
+ * cache's size.  An entry is charged for its key, its value and a fixed
+ * overhead.
+ *
+ * Clients use the process-wide getDefault() cache unless given another
+ * with setResponseCache(), or none with NULL.
+ *
+ */
+class TResponseCache {
+ public:
+  static const size_t DEFAULT_MAX_BYTES = 32 * 1024 * 1024;
+  static const int DEFAULT_NUM_SHARDS = 16;
+
+  TResponseCache(size_t maxBytes = DEFAULT_MAX_BYTES,
+                 int numShards = DEFAULT_NUM_SHARDS);
+
+  static boost::shared_ptr<TResponseCache> getDefault();
+
+  /**
+   * Looks up key, counting a hit or a miss.
+   */
+  bool get(const std::string& key, std::string& value);
+
+  /**
+   * Caches value for ttlMs, evicting the least recently used entries of
+   * its shard as needed.  Values too big for a shard are not cached.
+   */
+  void put(const std::string& key, const std::string& value, int64_t ttlMs);
+
+  /**
+   * Drops one entry (see makeKey()), every entry of one function, given as
+   * "Service.function", or everything.
+   */
+  void invalidate(const std::string& key);
+
+  void invalidateFunction(const std::string& name);
+
+  void clear();
+
+  /**
+   * Key of a call: the function's name, then its arguments (the generated
+   * pargs or args struct) in TBinaryProtocol.
+   */
+  template <class Args>
+  static std::string makeKey(const std::string& name, const Args& args) {
+    boost::shared_ptr<transport::TMemoryBuffer> buf(new transport::TMemoryBuffer());
+    protocol::TBinaryProtocol prot(buf);
+    args.write(&prot);
+    return name + '\0' + buf->getBufferAsString();
+  }
+
+  /**
+   * Fills the generated result (or presult) struct from the cache.
+   */
+  template <class Result>
+  bool getResult(const std::string& key, Result& result) {
+    std::string value;
+    if (!get(key, value)) {
+      return false;
+    }
+    boost::shared_ptr<transport::TMemoryBuffer> buf(
+        new transport::TMemoryBuffer((uint8_t*)value.data(), value.size()));
+    protocol::TBinaryProtocol prot(buf);
+    result.read(&prot);
+    return result.__isset.success;
+  }
+
+  template <class Result>
+  void putResult(const std::string& key, const Result& result, int64_t ttlMs) {
+    boost::shared_ptr<transport::TMemoryBuffer> buf(new transport::TMemoryBuffer());
+    protocol::TBinaryProtocol prot(buf);
+    result.write(&prot);
+    put(key, buf->getBufferAsString(), ttlMs);
+  }
+
+  uint64_t getNumHits();
+
+  uint64_t getNumMisses();
+
+  /**
+   * Entries dropped to make room, and because they had expired.
+   */
+  uint64_t getNumEvictions();
+
+  uint64_t getNumExpirations();
+
+  /**
+   * Bytes charged for, and number of, the entries held.
+   */
+  size_t getSize();
+
+  size_t getNumEntries();
+
+  /**
+   * Adds the above to counters as "<prefix>.<counter>", for fb303's
+   * getCounters().
+   */
+  void getCounters(std::map<std::string, int64_t>& counters,
+                   const std::string& prefix = "response_cache");
+
+ private:
+  struct Entry {
+    std::string key;
+    std::string value;
+    int64_t expiresAt;
+  };
+
+  typedef std::list<Entry> EntryList;
+  typedef std::map<std::string, EntryList::iterator> EntryMap;
+
+  struct Shard {
+    Shard() :
+      size(0),
+      numHits(0),
+      numMisses(0),
+      numEvictions(0),
+      numExpirations(0) {}
+
+    apache::thrift::concurrency::Mutex mutex;
+    // Most recently used first
+    EntryList entries;
+    EntryMap index;
+    size_t size;
+    uint64_t numHits;
+    uint64_t numMisses;
+    uint64_t numEvictions;
+    uint64_t numExpirations;
+  };
+
+  Shard& shardFor(const std::string& key);
+
+  // Called with the shard's mutex held
+  static void erase(Shard& shard, EntryMap::iterator it);
+
+  static size_t cost(const std::string& key, const std::string& value);
+
+  size_t maxShardBytes_;
+  std::vector<boost::shared_ptr<Shard> > shards_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TRESPONSECACHE_H_
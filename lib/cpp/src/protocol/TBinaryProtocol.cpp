@@ -20,6 +20,7 @@
 #include "TBinaryProtocol.h"
 
 #include <limits>
+#include <algorithm>
 
 using std::string;
 
@@ -360,6 +361,13 @@ uint32_t TBinaryProtocol::readBinary(string& str) {
   return TBinaryProtocol::readString(str);
 }
 
+uint32_t TBinaryProtocol::skipBinary() {
+  uint32_t result;
+  int32_t size;
+  result = readI32(size);
+  return result + skipStringBody(size);
+}
+
 uint32_t TBinaryProtocol::readStringBody(string& str, int32_t size) {
   uint32_t result = 0;
 
@@ -387,8 +395,22 @@ uint32_t TBinaryProtocol::readStringBody(string& str, int32_t size) {
     string_buf_size_ = size;
   }
   trans_->readAll(string_buf_, size);
-  str = string((char*)string_buf_, size);
+  str.assign((char*)string_buf_, size);
   return (uint32_t)size;
 }
 
+/**
+ * Discards a string body without building a std::string, draining it
+ * through the same scratch buffer readStringBody uses.
+ */
+uint32_t TBinaryProtocol::skipStringBody(int32_t size) {
+  if (size < 0) {
+    throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+  }
+  if (string_limit_ > 0 && size > string_limit_) {
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  }
+  return skipBytes(size, string_buf_, string_buf_size_);
+}
+
 }}} // apache::thrift::protocol
@@ -188,9 +188,13 @@ class TBinaryProtocol : public TProtocol {
 
   uint32_t readBinary(std::string& str);
 
+  uint32_t skipBinary();
+
  protected:
   uint32_t readStringBody(std::string& str, int32_t sz);
 
+  uint32_t skipStringBody(int32_t sz);
+
   int32_t string_limit_;
   int32_t container_limit_;
 
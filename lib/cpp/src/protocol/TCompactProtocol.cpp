@@ -21,6 +21,7 @@
 
 #include <config.h>
 #include <limits>
+#include <algorithm>
 
 /*
  * TCompactProtocol::i*ToZigzag depend on the fact that the right shift
@@ -625,6 +626,23 @@ uint32_t TCompactProtocol::readBinary(std::string& str) {
   return rsize + (uint32_t)size;
 }
 
+/**
+ * Skip a byte[] on the wire without copying it into a std::string.
+ */
+uint32_t TCompactProtocol::skipBinary() {
+  uint32_t rsize = 0;
+  int32_t size;
+
+  rsize += readVarint32(size);
+  if (size < 0) {
+    throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+  }
+  if (string_limit_ > 0 && size > string_limit_) {
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  }
+  return rsize + skipBytes(size, string_buf_, string_buf_size_);
+}
+
 /**
  * Read an i32 from the wire as a varint. The MSB of each byte is set
  * if there is another byte to follow. This can read up to 5 bytes.
@@ -216,6 +216,8 @@ class TCompactProtocol : public TProtocol {
 
   uint32_t readBinary(std::string& str);
 
+  uint32_t skipBinary();
+
   /*
    *These methods are here for the struct to call, but don't have any wire
    * encoding.
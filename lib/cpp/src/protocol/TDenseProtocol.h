@@ -205,6 +205,11 @@ class TDenseProtocol : public TBinaryProtocol {
 
   uint32_t readBinary(std::string& str);
 
+  // Dense strings are not length-prefixed like TBinaryProtocol's.
+  uint32_t skipBinary() {
+    return TProtocol::skipBinary();
+  }
+
   /*
    * Helper reading functions (don't do state transitions).
    */
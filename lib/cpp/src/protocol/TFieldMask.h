@@ -0,0 +1,93 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_PROTOCOL_TFIELDMASK_H_
+#define _THRIFT_PROTOCOL_TFIELDMASK_H_ 1
+
+#include <Thrift.h>
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Selects a subset of a struct's fields for a generated readFields() call.
+ *
+ * Fields whose ids are not in the mask are skipped on the wire and left
+ * untouched in the target object.  A struct-typed field may carry a nested
+ * mask, in which case only the selected fields of the substruct are read.
+ *
+ *   TFieldMask inner;
+ *   inner.add(1);
+ *   TFieldMask mask;
+ *   mask.add(2).add(4, inner);
+ *   obj.readFields(iprot, mask);
+ *
+ */
+class TFieldMask {
+ public:
+  TFieldMask() {}
+
+  /**
+   * Selects field fid in its entirety.
+   */
+  TFieldMask& add(int16_t fid) {
+    fields_[fid].reset();
+    return *this;
+  }
+
+  /**
+   * Selects the struct-typed field fid, reading only the fields of it
+   * that are selected by nested.
+   */
+  TFieldMask& add(int16_t fid, const TFieldMask& nested) {
+    fields_[fid].reset(new TFieldMask(nested));
+    return *this;
+  }
+
+  bool contains(int16_t fid) const {
+    return fields_.find(fid) != fields_.end();
+  }
+
+  /**
+   * Returns the projection for field fid, or NULL if it is to be read whole
+   * (or not at all).
+   */
+  const TFieldMask* nested(int16_t fid) const {
+    std::map<int16_t, boost::shared_ptr<TFieldMask> >::const_iterator it =
+      fields_.find(fid);
+    if (it == fields_.end()) {
+      return NULL;
+    }
+    return it->second.get();
+  }
+
+  bool empty() const {
+    return fields_.empty();
+  }
+
+ private:
+  std::map<int16_t, boost::shared_ptr<TFieldMask> > fields_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TFIELDMASK_H_
@@ -0,0 +1,98 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "TLazyField.h"
+#include "TBinaryProtocol.h"
+#include "TCompactProtocol.h"
+#include "TDenseProtocol.h"
+#include <transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TFramedTransport;
+
+TLazyField::Kind TLazyField::getKind(TProtocol* prot) {
+  // TDenseProtocol extends TBinaryProtocol, but its encoding of a struct
+  // depends on reflection state, so its bytes can't be moved around.
+  if (dynamic_cast<TDenseProtocol*>(prot) != NULL) {
+    return KIND_NONE;
+  }
+  if (dynamic_cast<TBinaryProtocol*>(prot) != NULL) {
+    return KIND_BINARY;
+  }
+  if (dynamic_cast<TCompactProtocol*>(prot) != NULL) {
+    return KIND_COMPACT;
+  }
+  return KIND_NONE;
+}
+
+bool TLazyField::capture(TProtocol* iprot, TType ftype, uint32_t& xfer) {
+  clear();
+
+  Kind kind = getKind(iprot);
+  if (kind == KIND_NONE) {
+    return false;
+  }
+
+  // Only transports that hold the rest of the message in a single buffer
+  // let us take a pointer before the skip that is still valid after it.
+  TTransport* trans = iprot->getTransport().get();
+  if (dynamic_cast<TMemoryBuffer*>(trans) == NULL &&
+      dynamic_cast<TFramedTransport*>(trans) == NULL) {
+    return false;
+  }
+
+  uint32_t len = 0;
+  const uint8_t* start = trans->borrow(NULL, &len);
+  if (start == NULL) {
+    return false;
+  }
+
+  xfer += iprot->skip(ftype);
+
+  len = 0;
+  const uint8_t* end = trans->borrow(NULL, &len);
+  if (end == NULL || end < start) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Transport buffer moved while capturing lazy field");
+  }
+
+  bytes_.assign((const char*)start, end - start);
+  kind_ = kind;
+  return true;
+}
+
+uint32_t TLazyField::write(TProtocol* oprot) const {
+  oprot->getTransport()->write((const uint8_t*)bytes_.data(), bytes_.size());
+  return bytes_.size();
+}
+
+boost::shared_ptr<TProtocol> TLazyField::getProtocol() const {
+  boost::shared_ptr<TTransport> trans(
+    new TMemoryBuffer((uint8_t*)bytes_.data(), bytes_.size()));
+  if (kind_ == KIND_COMPACT) {
+    return boost::shared_ptr<TProtocol>(new TCompactProtocol(trans));
+  }
+  return boost::shared_ptr<TProtocol>(new TBinaryProtocol(trans));
+}
+
+}}} // apache::thrift::protocol
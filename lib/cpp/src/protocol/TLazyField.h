@@ -0,0 +1,151 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_PROTOCOL_TLAZYFIELD_H_
+#define _THRIFT_PROTOCOL_TLAZYFIELD_H_ 1
+
+#include <protocol/TProtocol.h>
+#include <concurrency/Mutex.h>
+
+#include <string>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Holds the still-encoded bytes of a struct field annotated with cpp.lazy.
+ *
+ * Generated read() methods call capture() instead of deserializing the
+ * field.  When the input protocol is a TBinaryProtocol or TCompactProtocol
+ * reading from a TMemoryBuffer or TFramedTransport, the field is skipped and
+ * its raw bytes are kept here until the generated accessor asks for them to
+ * be decoded.  The generated struct keeps the field itself private, since it
+ * is empty until then.  Generated write() methods re-emit the raw bytes verbatim
+ * (provided the output protocol matches and the field has not been handed
+ * out for modification), so services that only forward a payload never pay
+ * to decode or re-encode it.
+ *
+ */
+class TLazyField {
+ public:
+  TLazyField() :
+    kind_(KIND_NONE),
+    decoded_(false) {}
+
+  // Copies get a lock of their own.
+  TLazyField(const TLazyField& other) {
+    apache::thrift::concurrency::Guard g(other.mutex_);
+    bytes_ = other.bytes_;
+    kind_ = other.kind_;
+    decoded_ = other.decoded_;
+  }
+
+  TLazyField& operator=(const TLazyField& other) {
+    if (this != &other) {
+      TLazyField copy(other);
+      swap(copy);
+    }
+    return *this;
+  }
+
+  /**
+   * Skips over a field of type ftype, keeping its encoded bytes.
+   * Returns false without consuming anything if iprot cannot be captured
+   * from, in which case the caller must deserialize the field normally.
+   */
+  bool capture(TProtocol* iprot, TType ftype, uint32_t& xfer);
+
+  /**
+   * True iff there are captured bytes that have not been decoded yet.
+   */
+  bool pending() const {
+    apache::thrift::concurrency::Guard g(mutex_);
+    return kind_ != KIND_NONE && !decoded_;
+  }
+
+  /**
+   * Decodes the captured bytes into value if that has not been done yet.
+   * Const accessors call this, so it is serialized by a lock of its own.
+   * The bytes are retained so that an unmodified field can still be written
+   * out without re-encoding.
+   */
+  template <class T>
+  void decode(T& value) const {
+    apache::thrift::concurrency::Guard g(mutex_);
+    if (kind_ == KIND_NONE || decoded_) {
+      return;
+    }
+    boost::shared_ptr<TProtocol> iprot = getProtocol();
+    value.read(iprot.get());
+    decoded_ = true;
+  }
+
+  /**
+   * True iff the captured bytes can be written to oprot as-is.
+   */
+  bool canWrite(TProtocol* oprot) const {
+    return kind_ != KIND_NONE && kind_ == getKind(oprot);
+  }
+
+  /**
+   * Writes the captured bytes to the transport underneath oprot.
+   */
+  uint32_t write(TProtocol* oprot) const;
+
+  /**
+   * Drops the captured bytes.  Called once the field may have been modified.
+   */
+  void clear() {
+    bytes_.clear();
+    kind_ = KIND_NONE;
+    decoded_ = false;
+  }
+
+  uint32_t size() const {
+    return bytes_.size();
+  }
+
+  void swap(TLazyField& other) {
+    bytes_.swap(other.bytes_);
+    std::swap(kind_, other.kind_);
+    std::swap(decoded_, other.decoded_);
+  }
+
+ private:
+  enum Kind {
+    KIND_NONE = 0,
+    KIND_BINARY = 1,
+    KIND_COMPACT = 2
+  };
+
+  static Kind getKind(TProtocol* prot);
+
+  boost::shared_ptr<TProtocol> getProtocol() const;
+
+  apache::thrift::concurrency::Mutex mutex_;
+  std::string bytes_;
+  Kind kind_;
+  mutable bool decoded_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TLAZYFIELD_H_
@@ -28,6 +28,8 @@
 
 #include <netinet/in.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <map>
 
@@ -297,6 +299,16 @@ class TProtocol {
     return rv;
   }
 
+  /**
+   * Skips over a string or binary value.  The default implementation reads
+   * the value into a temporary; protocols that can discard the bytes
+   * without materializing them should override this.
+   */
+  virtual uint32_t skipBinary() {
+    std::string str;
+    return readBinary(str);
+  }
+
   /**
    * Method to arbitrarily skip over data.
    */
@@ -334,8 +346,7 @@ class TProtocol {
       }
     case T_STRING:
       {
-        std::string str;
-        return readBinary(str);
+        return skipBinary();
       }
     case T_STRUCT:
       {
@@ -417,6 +428,44 @@ class TProtocol {
     trans_ = ptrans.get();
   }
 
+  // Largest scratch read used when skipping a string we cannot borrow.
+  static const int32_t SKIP_CHUNK_SIZE = 4096;
+
+  /**
+   * Discards the next size bytes for skipBinary(), which has already read
+   * and checked the length.  If the transport holds them all they are
+   * consumed in place; otherwise they are read in chunks into buf, the
+   * protocol's string scratch buffer, growing it to SKIP_CHUNK_SIZE at most.
+   */
+  uint32_t skipBytes(int32_t size, uint8_t*& buf, int32_t& bufSize) {
+    if (size == 0) {
+      return 0;
+    }
+
+    uint32_t have = (uint32_t)size;
+    if (trans_->borrow(NULL, &have) != NULL) {
+      trans_->consume((uint32_t)size);
+      return (uint32_t)size;
+    }
+
+    int32_t chunk = std::min(size, (int32_t)SKIP_CHUNK_SIZE);
+    if (chunk > bufSize || buf == NULL) {
+      void* newBuf = std::realloc(buf, (uint32_t)chunk);
+      if (newBuf == NULL) {
+        throw TProtocolException(TProtocolException::UNKNOWN, "Out of memory in TProtocol::skipBytes");
+      }
+      buf = (uint8_t*)newBuf;
+      bufSize = chunk;
+    }
+    int32_t left = size;
+    while (left > 0) {
+      int32_t n = std::min(left, bufSize);
+      trans_->readAll(buf, n);
+      left -= n;
+    }
+    return (uint32_t)size;
+  }
+
   boost::shared_ptr<TTransport> ptrans_;
   TTransport* trans_;
 
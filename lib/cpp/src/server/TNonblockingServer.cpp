@@ -19,7 +19,10 @@
 
 #include "TNonblockingServer.h"
 #include <concurrency/Exception.h>
+#include <concurrency/Util.h>
+#include <processor/TDeadline.h>
 
+#include <cstring>
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -38,6 +41,7 @@ namespace apache { namespace thrift { namespace server {
 using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
 using namespace apache::thrift::concurrency;
+using apache::thrift::processor::TDeadline;
 using namespace std;
 
 class TConnection::Task: public Runnable {
@@ -45,14 +49,18 @@ class TConnection::Task: public Runnable {
   Task(boost::shared_ptr<TProcessor> processor,
        boost::shared_ptr<TProtocol> input,
        boost::shared_ptr<TProtocol> output,
-       int taskHandle) :
+       int taskHandle,
+       int64_t received) :
     processor_(processor),
     input_(input),
     output_(output),
-    taskHandle_(taskHandle) {}
+    taskHandle_(taskHandle),
+    received_(received) {}
 
   void run() {
     try {
+      // Time spent queued for this thread counts against any deadline
+      TDeadline::setReceived(received_);
       while (processor_->process(input_, output_)) {
         if (!input_->getTransport()->peek()) {
           break;
@@ -81,6 +89,7 @@ class TConnection::Task: public Runnable {
   boost::shared_ptr<TProtocol> input_;
   boost::shared_ptr<TProtocol> output_;
   int taskHandle_;
+  int64_t received_;
 };
 
 void TConnection::init(int socket, short eventFlags, TNonblockingServer* s) {
@@ -90,6 +99,7 @@ void TConnection::init(int socket, short eventFlags, TNonblockingServer* s) {
   eventFlags_ = 0;
 
   readBufferPos_ = 0;
+  readStart_ = 0;
   readWant_ = 0;
 
   writeBuffer_ = NULL;
@@ -120,7 +130,14 @@ void TConnection::workSocket() {
   switch (socketState_) {
   case SOCKET_RECV:
     // It is an error to be in this state if we already have all the data
-    assert(readBufferPos_ < readWant_);
+    assert(readBufferPos_ - readStart_ < readWant_);
+
+    // Move what we have to the front if the rest would not fit after it
+    if (readStart_ > 0 && readStart_ + readWant_ > readBufferSize_) {
+      readBufferPos_ -= readStart_;
+      std::memmove(readBuffer_, readBuffer_ + readStart_, readBufferPos_);
+      readStart_ = 0;
+    }
 
     // Double the buffer size until it is big enough
     if (readWant_ > readBufferSize_) {
@@ -135,19 +152,18 @@ void TConnection::workSocket() {
       }
     }
 
-    // Read from the socket
-    fetch = readWant_ - readBufferPos_;
+    // Read from the socket, as much as fits: a client that batches its
+    // calls (see TBatchingTransport) sends many frames at once, and they
+    // can then be processed without going back to the socket
+    fetch = readBufferSize_ - readBufferPos_;
     got = recv(socket_, readBuffer_ + readBufferPos_, fetch, 0);
 
     if (got > 0) {
       // Move along in the buffer
       readBufferPos_ += got;
 
-      // Check that we did not overdo it
-      assert(readBufferPos_ <= readWant_);
-
       // We are done reading, move onto the next state
-      if (readBufferPos_ == readWant_) {
+      if (readBufferPos_ - readStart_ >= readWant_) {
         transition();
       }
       return;
@@ -226,16 +242,19 @@ void TConnection::workSocket() {
 void TConnection::transition() {
 
   int sz = 0;
+  int64_t received;
 
   // Switch upon the state that we are currently in and move to a new state
   switch (appState_) {
 
+  LABEL_APP_READ_REQUEST:
   case APP_READ_REQUEST:
     // We are done reading the request, package the read buffer into transport
     // and get back some data from the dispatch function
     // If we've used these transport buffers enough times, reset them to avoid bloating
 
-    inputTransport_->resetBuffer(readBuffer_, readBufferPos_);
+    received = Util::currentTime();
+    inputTransport_->resetBuffer(readBuffer_ + readStart_, readWant_);
     ++numReadsSinceReset_;
     if (numWritesSinceReset_ < 512) {
       outputTransport_->resetBuffer();
@@ -268,7 +287,8 @@ void TConnection::transition() {
           boost::shared_ptr<Runnable>(new Task(server_->getProcessor(),
                                                inputProtocol_,
                                                outputProtocol_,
-                                               sv[1]));
+                                               sv[1],
+                                               received));
         // The application is now waiting on the task to finish
         appState_ = APP_WAIT_TASK;
 
@@ -304,6 +324,7 @@ void TConnection::transition() {
     } else {
       try {
         // Invoke the processor
+        TDeadline::setReceived(received);
         server_->getProcessor()->process(inputProtocol_, outputProtocol_);
       } catch (TTransportException &ttx) {
         GlobalOutput.printf("TTransportException: Server::process() %s", ttx.what());
@@ -367,9 +388,19 @@ void TConnection::transition() {
   LABEL_APP_INIT:
   case APP_INIT:
 
+    // Skip past the request just processed
+    readStart_ += readWant_;
+    if (readStart_ >= readBufferPos_) {
+      readStart_ = 0;
+      readBufferPos_ = 0;
+    }
+
     // reset the input buffer if we used it enough times that it might be bloated
-    if (numReadsSinceReset_ > 512)
+    if (numReadsSinceReset_ > 512 && readBufferPos_ - readStart_ <= 1024)
     {
+      readBufferPos_ -= readStart_;
+      std::memmove(readBuffer_, readBuffer_ + readStart_, readBufferPos_);
+      readStart_ = 0;
       void * new_buffer = std::realloc(readBuffer_, 1024);
       if (new_buffer == NULL) {
         GlobalOutput("TConnection::transition() realloc");
@@ -387,7 +418,6 @@ void TConnection::transition() {
     writeBufferSize_ = 0;
 
     // Set up read buffer for getting 4 bytes
-    readBufferPos_ = 0;
     readWant_ = 4;
 
     // Into read4 state we go
@@ -397,14 +427,20 @@ void TConnection::transition() {
     // Register read event
     setRead();
 
+    // Go on with the next call if it was read along with this one
+    if (readBufferPos_ - readStart_ >= readWant_) {
+      goto LABEL_APP_READ_FRAME_SIZE;
+    }
+
     // Try to work the socket right away
     // workSocket();
 
     return;
 
+  LABEL_APP_READ_FRAME_SIZE:
   case APP_READ_FRAME_SIZE:
     // We just read the request length, deserialize it
-    sz = *(int32_t*)readBuffer_;
+    memcpy(&sz, readBuffer_ + readStart_, 4);
     sz = (int32_t)ntohl(sz);
 
     if (sz <= 0) {
@@ -413,13 +449,18 @@ void TConnection::transition() {
       return;
     }
 
-    // Reset the read buffer
+    // The request follows the frame size
     readWant_ = (uint32_t)sz;
-    readBufferPos_= 0;
+    readStart_ += 4;
 
     // Move into read request state
     appState_ = APP_READ_REQUEST;
 
+    // It may have been read already
+    if (readBufferPos_ - readStart_ >= readWant_) {
+      goto LABEL_APP_READ_REQUEST;
+    }
+
     // Work the socket right away
     // workSocket();
 
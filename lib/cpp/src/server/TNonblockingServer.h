@@ -306,6 +306,10 @@ class TConnection {
   // Where in the read buffer are we
   uint32_t readBufferPos_;
 
+  // Where in the read buffer the frame size or request being read starts;
+  // anything past it was read ahead with an earlier one
+  uint32_t readStart_;
+
   // Read buffer
   uint8_t* readBuffer_;
 
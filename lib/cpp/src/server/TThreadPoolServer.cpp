@@ -21,6 +21,8 @@
 #include "transport/TTransportException.h"
 #include "concurrency/Thread.h"
 #include "concurrency/ThreadManager.h"
+#include "concurrency/Util.h"
+#include "processor/TDeadline.h"
 #include <string>
 #include <iostream>
 
@@ -32,6 +34,7 @@ using namespace apache::thrift;
 using namespace apache::thrift::concurrency;
 using namespace apache::thrift::protocol;;
 using namespace apache::thrift::transport;
+using apache::thrift::processor::TDeadline;
 
 class TThreadPoolServer::Task : public Runnable {
 
@@ -56,10 +59,14 @@ public:
       eventHandler->clientBegin(input_, output_);
     }
     try {
+      // Any deadline a request carries runs from when the peek after the
+      // previous one saw it arrive, not from when the connection went idle.
+      TDeadline::setReceived(Util::currentTime());
       while (processor_->process(input_, output_)) {
         if (!input_->getTransport()->peek()) {
           break;
         }
+        TDeadline::setReceived(Util::currentTime());
       }
     } catch (TTransportException& ttx) {
       // This is reasonably expected, client didn't send a full request so just
@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "TBatchingTransport.h"
+#include "TTransportException.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::TimerManager;
+
+const uint32_t TBatchingTransport::DEFAULT_MAX_BYTES;
+const uint32_t TBatchingTransport::DEFAULT_MAX_CALLS;
+
+class TBatchingTransport::FlushTask : public Runnable {
+ public:
+  FlushTask(shared_ptr<Owner> owner) :
+    owner_(owner) {}
+
+  void run() {
+    Guard g(owner_->mutex);
+    if (owner_->transport != NULL) {
+      owner_->transport->timedFlush();
+    }
+  }
+
+ private:
+  shared_ptr<Owner> owner_;
+};
+
+TBatchingTransport::TBatchingTransport(shared_ptr<TTransport> transport,
+                                       uint32_t maxBytes,
+                                       uint32_t maxCalls) :
+  transport_(transport),
+  maxBytes_(maxBytes),
+  maxCalls_(maxCalls > 0 ? maxCalls : 1),
+  wBuf_(maxBytes),
+  pendingCalls_(0),
+  flushInterval_(0),
+  timerArmed_(false),
+  owner_(new Owner()),
+  numCalls_(0),
+  numBatches_(0),
+  numDropped_(0) {
+  owner_->transport = this;
+}
+
+TBatchingTransport::~TBatchingTransport() {
+  {
+    Guard g(owner_->mutex);
+    owner_->transport = NULL;
+  }
+  try {
+    flushBatch();
+  } catch (TTransportException& ttx) {
+    GlobalOutput.printf("TBatchingTransport::~TBatchingTransport() %s", ttx.what());
+  }
+}
+
+void TBatchingTransport::close() {
+  flushBatch();
+  transport_->close();
+}
+
+uint32_t TBatchingTransport::read(uint8_t* buf, uint32_t len) {
+  flushBatch();
+  return transport_->read(buf, len);
+}
+
+void TBatchingTransport::write(const uint8_t* buf, uint32_t len) {
+  Guard g(mutex_);
+  wBuf_.write(buf, len);
+}
+
+void TBatchingTransport::flush() {
+  Guard g(mutex_);
+  uint8_t* buf;
+  uint32_t len;
+  wBuf_.getBuffer(&buf, &len);
+  ++numCalls_;
+  ++pendingCalls_;
+  if (pendingCalls_ >= maxCalls_ || len >= maxBytes_) {
+    writeBatch();
+  } else if (timerManager_ != NULL && !timerArmed_) {
+    timerArmed_ = true;
+    timerManager_->add(shared_ptr<Runnable>(new FlushTask(owner_)), flushInterval_);
+  }
+}
+
+void TBatchingTransport::flushBatch() {
+  Guard g(mutex_);
+  writeBatch();
+}
+
+void TBatchingTransport::writeBatch() {
+  uint8_t* buf;
+  uint32_t len;
+  wBuf_.getBuffer(&buf, &len);
+  if (len == 0) {
+    pendingCalls_ = 0;
+    return;
+  }
+
+  // Forget the batch before writing it, so it is not resent if that fails
+  wBuf_.resetBuffer();
+  pendingCalls_ = 0;
+  transport_->write(buf, len);
+  transport_->flush();
+  ++numBatches_;
+}
+
+void TBatchingTransport::timedFlush() {
+  Guard g(mutex_);
+  timerArmed_ = false;
+  uint32_t calls = pendingCalls_;
+  try {
+    writeBatch();
+  } catch (TTransportException& ttx) {
+    numDropped_ += calls;
+    GlobalOutput.printf("TBatchingTransport: timed flush failed: %s", ttx.what());
+  }
+}
+
+void TBatchingTransport::setFlushInterval(shared_ptr<TimerManager> timerManager,
+                                          int64_t ms) {
+  Guard g(mutex_);
+  timerManager_ = timerManager;
+  flushInterval_ = ms;
+}
+
+uint64_t TBatchingTransport::getNumCalls() {
+  Guard g(mutex_);
+  return numCalls_;
+}
+
+uint64_t TBatchingTransport::getNumBatches() {
+  Guard g(mutex_);
+  return numBatches_;
+}
+
+uint64_t TBatchingTransport::getNumDropped() {
+  Guard g(mutex_);
+  return numDropped_;
+}
+
+}}} // apache::thrift::transport
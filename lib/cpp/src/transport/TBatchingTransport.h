@@ -0,0 +1,158 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_ 1
+
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Mutex.h>
+#include <concurrency/TimerManager.h>
+#include "TBufferTransports.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Coalesces the flushes of a client, for streams of oneway calls.
+ *
+ * Generated clients flush once per call.  This transport counts a flush as
+ * the end of a call and holds the bytes back, writing everything buffered
+ * to the underlying transport in one go once maxCalls calls or maxBytes
+ * bytes are pending, when the flush interval runs out, or before anything
+ * is read.  Calls that wait for a reply therefore still go out at once
+ * (with whatever oneway calls are queued ahead of them), so one client can
+ * mix both kinds.
+ *
+ * It goes under the framing, so each call is still a frame of its own:
+ *
+ *   shared_ptr<TBatchingTransport> batching(new TBatchingTransport(socket));
+ *   batching->setFlushInterval(timerManager, 10);
+ *   shared_ptr<TTransport> transport(new TFramedTransport(batching));
+ *
+ * The timer flushes from the TimerManager's thread, so the buffer is
+ * guarded by a mutex; otherwise, like the other transports, it is meant to
+ * be used from one thread.  A failed timed flush is logged and its calls
+ * are counted as dropped, as befits oneway calls.
+ *
+ */
+class TBatchingTransport : public TTransport {
+ public:
+  static const uint32_t DEFAULT_MAX_BYTES = 16384;
+  static const uint32_t DEFAULT_MAX_CALLS = 100;
+
+  TBatchingTransport(boost::shared_ptr<TTransport> transport,
+                     uint32_t maxBytes = DEFAULT_MAX_BYTES,
+                     uint32_t maxCalls = DEFAULT_MAX_CALLS);
+
+  /**
+   * Writes out what is pending, without throwing.
+   */
+  ~TBatchingTransport();
+
+  bool isOpen() {
+    return transport_->isOpen();
+  }
+
+  bool peek() {
+    return transport_->peek();
+  }
+
+  void open() {
+    transport_->open();
+  }
+
+  /**
+   * Writes out what is pending first.
+   */
+  void close();
+
+  /**
+   * Writes out what is pending first.
+   */
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  /**
+   * Ends a call, writing out the batch if it is full.
+   */
+  void flush();
+
+  /**
+   * Writes out whatever is pending now.
+   */
+  void flushBatch();
+
+  /**
+   * Makes timerManager write out a batch at most ms after its first call
+   * was buffered.  Without one, partial batches wait for the next read,
+   * close() or flushBatch().
+   */
+  void setFlushInterval(boost::shared_ptr<apache::thrift::concurrency::TimerManager> timerManager,
+                        int64_t ms);
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return transport_;
+  }
+
+  /**
+   * Number of calls buffered, batches written, and calls lost to failed
+   * timed flushes.
+   */
+  uint64_t getNumCalls();
+
+  uint64_t getNumBatches();
+
+  uint64_t getNumDropped();
+
+ private:
+  class FlushTask;
+
+  // What a timer holds on to, since timers cannot be cancelled
+  struct Owner {
+    apache::thrift::concurrency::Mutex mutex;
+    TBatchingTransport* transport;
+  };
+
+  // Called with mutex_ held
+  void writeBatch();
+
+  void timedFlush();
+
+  boost::shared_ptr<TTransport> transport_;
+  uint32_t maxBytes_;
+  uint32_t maxCalls_;
+
+  apache::thrift::concurrency::Mutex mutex_;
+  TMemoryBuffer wBuf_;
+  uint32_t pendingCalls_;
+
+  boost::shared_ptr<apache::thrift::concurrency::TimerManager> timerManager_;
+  int64_t flushInterval_;
+  bool timerArmed_;
+  boost::shared_ptr<Owner> owner_;
+
+  uint64_t numCalls_;
+  uint64_t numBatches_;
+  uint64_t numDropped_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_
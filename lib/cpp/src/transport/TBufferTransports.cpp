@@ -268,6 +268,14 @@ const uint8_t* TFramedTransport::borrowSlow(uint8_t* buf, uint32_t* len) {
   return NULL;
 }
 
+const uint8_t* TFramedTransport::borrowFrame(uint32_t* len) {
+  if (rBase_ == rBound_) {
+    readFrame();
+  }
+  *len = rBound_ - rBase_;
+  return rBase_;
+}
+
 
 void TMemoryBuffer::computeRead(uint32_t len, uint8_t** out_start, uint32_t* out_give) {
   // Correct rBound_ so we can use the fast path in the future.
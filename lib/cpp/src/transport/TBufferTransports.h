@@ -343,6 +343,13 @@ class TFramedTransport : public TUnderlyingTransport {
 
   const uint8_t* borrowSlow(uint8_t* buf, uint32_t* len);
 
+  /**
+   * Returns what is left of the frame being read, without consuming it,
+   * first reading in the next frame if this one is used up.  *len is set
+   * to its size.  The bytes stay put until the frame is read past.
+   */
+  const uint8_t* borrowFrame(uint32_t* len);
+
  protected:
   /**
    * Reads a frame of input from the underlying stream.
@@ -0,0 +1,326 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <sstream>
+#include <vector>
+#include <boost/enable_shared_from_this.hpp>
+
+#include <concurrency/Mutex.h>
+#include <concurrency/Util.h>
+#include "TConnectionPool.h"
+#include "TTransportException.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::ReadWriteMutex;
+using apache::thrift::concurrency::RWGuard;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::TimedOutException;
+using apache::thrift::concurrency::TimerManager;
+using apache::thrift::concurrency::Util;
+
+/**
+ * Periodic evictIdle() task.  It reschedules itself after each run until
+ * the pool detaches it on destruction.
+ */
+class TConnectionPool::Evictor :
+    public Runnable,
+    public boost::enable_shared_from_this<TConnectionPool::Evictor> {
+ public:
+  Evictor(TConnectionPool* pool, TimerManager* timerManager, int64_t intervalMs) :
+    pool_(pool),
+    timerManager_(timerManager),
+    intervalMs_(intervalMs) {}
+
+  void run() {
+    Guard g(mutex_);
+    if (pool_ == NULL) {
+      return;
+    }
+    pool_->evictIdle();
+    try {
+      timerManager_->add(shared_from_this(), intervalMs_);
+    } catch (TException& x) {
+      GlobalOutput.printf("TConnectionPool eviction stopped: %s", x.what());
+    }
+  }
+
+  void detach() {
+    Guard g(mutex_);
+    pool_ = NULL;
+  }
+
+ private:
+  Mutex mutex_;
+  TConnectionPool* pool_;
+  // The timer manager owns us while we are scheduled, so it outlives us.
+  TimerManager* timerManager_;
+  int64_t intervalMs_;
+};
+
+/**
+ * Lets a TConnectionLease reach its pool for as long as the pool exists.
+ * Releases hold the lock shared, so they only exclude the pool's destructor.
+ */
+class TConnectionPool::Handle {
+ public:
+  explicit Handle(TConnectionPool* pool) :
+    pool_(pool) {}
+
+  void release(shared_ptr<TSocket> socket, bool reusable) {
+    RWGuard g(mutex_);
+    if (pool_ == NULL) {
+      socket->close();
+      return;
+    }
+    pool_->release(socket, reusable);
+  }
+
+  void detach() {
+    RWGuard g(mutex_, true);
+    pool_ = NULL;
+  }
+
+ private:
+  ReadWriteMutex mutex_;
+  TConnectionPool* pool_;
+};
+
+TConnectionPool::TConnectionPool() :
+  maxIdlePerHost_(8),
+  maxTotalPerHost_(0),
+  leaseTimeout_(0),
+  idleTimeout_(60000),
+  connTimeout_(0),
+  recvTimeout_(0),
+  sendTimeout_(0),
+  numReused_(0),
+  numOpened_(0),
+  numDiscarded_(0),
+  handle_(new Handle(this)) {
+}
+
+TConnectionPool::~TConnectionPool() {
+  // Waits out any lease that is returning its connection right now.
+  handle_->detach();
+  if (evictor_ != NULL) {
+    evictor_->detach();
+  }
+
+  Synchronized s(monitor_);
+  map<string, HostPool>::iterator it;
+  for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+    deque<IdleConnection>& idle = it->second.idle;
+    for (size_t i = 0; i < idle.size(); ++i) {
+      idle[i].socket->close();
+    }
+  }
+}
+
+string TConnectionPool::key(const string& host, int port) {
+  ostringstream oss;
+  oss << host << ":" << port;
+  return oss.str();
+}
+
+shared_ptr<TSocket> TConnectionPool::lease(const string& host, int port) {
+  string k = key(host, port);
+  int64_t deadline = Util::currentTime() + leaseTimeout_;
+
+  for (;;) {
+    IdleConnection conn;
+    {
+      Synchronized s(monitor_);
+      HostPool& hp = hosts_[k];
+      if (hp.idle.empty()) {
+        if (maxTotalPerHost_ == 0 || hp.total < maxTotalPerHost_) {
+          // Reserve a slot, then connect without holding the lock.
+          hp.total++;
+          break;
+        }
+        int64_t remaining = deadline - Util::currentTime();
+        if (remaining <= 0) {
+          throw TTransportException(TTransportException::TIMED_OUT,
+                                    "No connection available to " + k);
+        }
+        try {
+          monitor_.wait(remaining);
+        } catch (TimedOutException&) {
+          throw TTransportException(TTransportException::TIMED_OUT,
+                                    "Timed out waiting for a connection to " + k);
+        }
+        continue;
+      }
+      conn = hp.idle.back();
+      hp.idle.pop_back();
+    }
+
+    // Check outside the lock; this is a non-blocking peek.
+    if (Util::currentTime() - conn.since < idleTimeout_ &&
+        conn.socket->isIdleUsable()) {
+      Synchronized s(monitor_);
+      numReused_++;
+      return conn.socket;
+    }
+
+    conn.socket->close();
+    Synchronized s(monitor_);
+    hosts_[k].total--;
+    numDiscarded_++;
+    monitor_.notifyAll();
+  }
+
+  shared_ptr<TSocket> socket(new TSocket(host, port));
+  socket->setConnTimeout(connTimeout_);
+  socket->setRecvTimeout(recvTimeout_);
+  socket->setSendTimeout(sendTimeout_);
+  try {
+    socket->open();
+  } catch (...) {
+    Synchronized s(monitor_);
+    hosts_[k].total--;
+    monitor_.notifyAll();
+    throw;
+  }
+
+  Synchronized s(monitor_);
+  numOpened_++;
+  return socket;
+}
+
+void TConnectionPool::release(shared_ptr<TSocket> socket, bool reusable) {
+  string k = key(socket->getHost(), socket->getPort());
+  reusable = reusable && socket->isOpen();
+
+  {
+    Synchronized s(monitor_);
+    map<string, HostPool>::iterator it = hosts_.find(k);
+    if (it != hosts_.end()) {
+      HostPool& hp = it->second;
+      if (reusable && hp.idle.size() < maxIdlePerHost_) {
+        IdleConnection conn;
+        conn.socket = socket;
+        conn.since = Util::currentTime();
+        hp.idle.push_back(conn);
+        monitor_.notifyAll();
+        return;
+      }
+      hp.total--;
+      monitor_.notifyAll();
+    }
+  }
+  socket->close();
+}
+
+void TConnectionPool::evictIdle() {
+  vector<shared_ptr<TSocket> > expired;
+  {
+    Synchronized s(monitor_);
+    int64_t cutoff = Util::currentTime() - idleTimeout_;
+    map<string, HostPool>::iterator it;
+    for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+      HostPool& hp = it->second;
+      // Oldest at the front
+      while (!hp.idle.empty() && hp.idle.front().since <= cutoff) {
+        expired.push_back(hp.idle.front().socket);
+        hp.idle.pop_front();
+        hp.total--;
+      }
+    }
+    numDiscarded_ += expired.size();
+    if (!expired.empty()) {
+      monitor_.notifyAll();
+    }
+  }
+
+  for (size_t i = 0; i < expired.size(); ++i) {
+    expired[i]->close();
+  }
+}
+
+void TConnectionPool::startEviction(shared_ptr<TimerManager> timerManager,
+                                    int64_t intervalMs) {
+  if (evictor_ != NULL) {
+    evictor_->detach();
+  }
+  evictor_.reset(new Evictor(this, timerManager.get(), intervalMs));
+  timerManager->add(evictor_, intervalMs);
+}
+
+uint32_t TConnectionPool::getNumIdle() const {
+  Synchronized s(monitor_);
+  uint32_t n = 0;
+  map<string, HostPool>::const_iterator it;
+  for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+    n += it->second.idle.size();
+  }
+  return n;
+}
+
+uint32_t TConnectionPool::getNumLeased() const {
+  Synchronized s(monitor_);
+  uint32_t n = 0;
+  map<string, HostPool>::const_iterator it;
+  for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+    n += it->second.total - it->second.idle.size();
+  }
+  return n;
+}
+
+uint64_t TConnectionPool::getNumReused() const {
+  Synchronized s(monitor_);
+  return numReused_;
+}
+
+uint64_t TConnectionPool::getNumOpened() const {
+  Synchronized s(monitor_);
+  return numOpened_;
+}
+
+uint64_t TConnectionPool::getNumDiscarded() const {
+  Synchronized s(monitor_);
+  return numDiscarded_;
+}
+
+TConnectionLease::TConnectionLease(TConnectionPool& pool,
+                                   const string& host,
+                                   int port) :
+  pool_(pool.handle_),
+  socket_(pool.lease(host, port)) {
+}
+
+TConnectionLease::~TConnectionLease() {
+  if (socket_ != NULL) {
+    pool_->release(socket_, false);
+  }
+}
+
+void TConnectionLease::release() {
+  if (socket_ != NULL) {
+    pool_->release(socket_, true);
+    socket_.reset();
+  }
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,215 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCONNECTIONPOOL_H_
+#define _THRIFT_TRANSPORT_TCONNECTIONPOOL_H_ 1
+
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Monitor.h>
+#include <concurrency/TimerManager.h>
+#include "TSocket.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * A thread-safe pool of open client connections, keyed by host and port.
+ *
+ * lease() hands out an idle connection to the server if there is a usable
+ * one, and opens a new one otherwise, so the cost of resolving and
+ * connecting is only paid when the pool has to grow.  Idle connections are
+ * checked before reuse, and those left idle too long are closed by
+ * evictIdle(), which can be run periodically on a TimerManager.
+ *
+ */
+class TConnectionPool {
+ public:
+  TConnectionPool();
+
+  /**
+   * Closes all idle connections.  Connections still held by a
+   * TConnectionLease are closed when the lease ends; sockets taken directly
+   * from lease() must be given back with release() before the pool goes.
+   */
+  virtual ~TConnectionPool();
+
+  /**
+   * Most idle connections kept per server; extras are closed on return.
+   */
+  void setMaxIdlePerHost(uint32_t maxIdle) {
+    maxIdlePerHost_ = maxIdle;
+  }
+
+  /**
+   * Most connections (leased plus idle) per server, or 0 for no limit.
+   */
+  void setMaxTotalPerHost(uint32_t maxTotal) {
+    maxTotalPerHost_ = maxTotal;
+  }
+
+  /**
+   * How long lease() waits for a connection once a server is at its
+   * maximum, in ms.  0 means fail at once.
+   */
+  void setLeaseTimeout(int ms) {
+    leaseTimeout_ = ms;
+  }
+
+  /**
+   * Idle connections older than this are not reused, in ms.
+   */
+  void setIdleTimeout(int ms) {
+    idleTimeout_ = ms;
+  }
+
+  /**
+   * Timeouts applied to newly opened sockets; see TSocket.
+   */
+  void setConnTimeout(int ms) {
+    connTimeout_ = ms;
+  }
+
+  void setRecvTimeout(int ms) {
+    recvTimeout_ = ms;
+  }
+
+  void setSendTimeout(int ms) {
+    sendTimeout_ = ms;
+  }
+
+  /**
+   * Returns an open connection to host:port.
+   *
+   * @throws TTransportException if no connection could be opened, or the
+   *         server is at its maximum and none came back in time
+   */
+  boost::shared_ptr<TSocket> lease(const std::string& host, int port);
+
+  /**
+   * Gives back a connection obtained from lease().  Pass reusable=false if
+   * the last call on it failed, so that it is closed instead of pooled.
+   */
+  void release(boost::shared_ptr<TSocket> socket, bool reusable=true);
+
+  /**
+   * Closes idle connections older than the idle timeout.
+   */
+  void evictIdle();
+
+  /**
+   * Runs evictIdle() on timerManager every intervalMs until the pool is
+   * destroyed.  The timer manager must already be started.
+   */
+  void startEviction(boost::shared_ptr<apache::thrift::concurrency::TimerManager> timerManager,
+                     int64_t intervalMs);
+
+  uint32_t getNumIdle() const;
+
+  uint32_t getNumLeased() const;
+
+  /**
+   * Number of leases served from the pool and by opening new connections.
+   */
+  uint64_t getNumReused() const;
+
+  uint64_t getNumOpened() const;
+
+  /**
+   * Number of idle connections closed as expired or broken.
+   */
+  uint64_t getNumDiscarded() const;
+
+ private:
+  class Evictor;
+  class Handle;
+  friend class TConnectionLease;
+
+  struct IdleConnection {
+    boost::shared_ptr<TSocket> socket;
+    int64_t since;
+  };
+
+  struct HostPool {
+    HostPool() : total(0) {}
+
+    // Most recently returned at the back
+    std::deque<IdleConnection> idle;
+    uint32_t total;
+  };
+
+  static std::string key(const std::string& host, int port);
+
+  uint32_t maxIdlePerHost_;
+  uint32_t maxTotalPerHost_;
+  int leaseTimeout_;
+  int idleTimeout_;
+  int connTimeout_;
+  int recvTimeout_;
+  int sendTimeout_;
+
+  apache::thrift::concurrency::Monitor monitor_;
+  std::map<std::string, HostPool> hosts_;
+  uint64_t numReused_;
+  uint64_t numOpened_;
+  uint64_t numDiscarded_;
+
+  boost::shared_ptr<Evictor> evictor_;
+  // Shared with leases, so that they can outlive the pool.
+  boost::shared_ptr<Handle> handle_;
+};
+
+/**
+ * Holds a connection leased from a TConnectionPool for the length of a
+ * scope, e.g. while making calls through a generated client:
+ *
+ *   TConnectionLease lease(pool, host, port);
+ *   shared_ptr<TTransport> trans(new TFramedTransport(lease.socket()));
+ *   MyServiceClient client(shared_ptr<TProtocol>(new TBinaryProtocol(trans)));
+ *   client.foo();
+ *   lease.release();
+ *
+ * release() returns the connection for reuse; if the scope is left without
+ * it (e.g. by an exception) the connection is closed instead, since it may
+ * hold half a message.  A lease may outlive its pool, in which case the
+ * connection is simply closed when the lease ends.
+ *
+ */
+class TConnectionLease {
+ public:
+  TConnectionLease(TConnectionPool& pool, const std::string& host, int port);
+
+  ~TConnectionLease();
+
+  boost::shared_ptr<TSocket> socket() {
+    return socket_;
+  }
+
+  void release();
+
+ private:
+  boost::shared_ptr<TConnectionPool::Handle> pool_;
+  boost::shared_ptr<TSocket> socket_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TCONNECTIONPOOL_H_
@@ -0,0 +1,109 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "TCrc32c.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <cpuid.h>
+#define T_CRC32C_SSE42 1
+#endif
+
+namespace apache { namespace thrift { namespace transport {
+
+namespace {
+
+// reversed Castagnoli polynomial
+const uint32_t kPolynomial = 0x82f63b78;
+
+struct Table {
+  Table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+
+  uint32_t entries[256];
+};
+
+uint32_t extendTable(uint32_t crc, const uint8_t* buf, size_t len) {
+  static const Table table;
+  while (len-- > 0) {
+    crc = table.entries[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef T_CRC32C_SSE42
+bool haveSse42() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ecx & (1 << 20)) != 0;
+}
+
+// The instruction is used through asm so that the rest of the library
+// need not be built for SSE4.2
+uint32_t extendSse42(uint32_t crc, const uint8_t* buf, size_t len) {
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, buf, sizeof(word));
+    __asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (word));
+    buf += 8;
+    len -= 8;
+  }
+  uint32_t crc32 = (uint32_t)crc64;
+  while (len-- > 0) {
+    __asm__("crc32b %1, %0" : "+r" (crc32) : "rm" (*buf));
+    ++buf;
+  }
+  return crc32;
+}
+#endif
+
+}
+
+bool TCrc32c::isAccelerated() {
+#ifdef T_CRC32C_SSE42
+  static const bool accelerated = haveSse42();
+  return accelerated;
+#else
+  return false;
+#endif
+}
+
+uint32_t TCrc32c::extend(uint32_t crc, const uint8_t* buf, size_t len) {
+  crc = ~crc;
+#ifdef T_CRC32C_SSE42
+  if (isAccelerated()) {
+    return ~extendSse42(crc, buf, len);
+  }
+#endif
+  return ~extendTable(crc, buf, len);
+}
+
+}}} // apache::thrift::transport
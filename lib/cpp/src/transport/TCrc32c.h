@@ -0,0 +1,54 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_TRANSPORT_TCRC32C_H_
+#define _THRIFT_TRANSPORT_TCRC32C_H_ 1
+
+#include <Thrift.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * CRC32C (Castagnoli), the checksum of iSCSI and SCTP.  It is computed with
+ * the crc32 instruction on x86-64 processors with SSE4.2, and with a table
+ * elsewhere.
+ *
+ */
+class TCrc32c {
+ public:
+  /**
+   * Extends crc, the checksum of what came before (0 for nothing), with
+   * the len bytes at buf.
+   */
+  static uint32_t extend(uint32_t crc, const uint8_t* buf, size_t len);
+
+  static uint32_t value(const uint8_t* buf, size_t len) {
+    return extend(0, buf, len);
+  }
+
+  /**
+   * Whether extend() uses the crc32 instruction.
+   */
+  static bool isAccelerated();
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TCRC32C_H_
@@ -0,0 +1,181 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "TFileChunkIndex.h"
+#include "TTransportException.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+
+TFileChunkIndex::TFileChunkIndex(const string& path) :
+  path_(path),
+  fd_(-1),
+  numWritten_(0),
+  loaded_(0) {}
+
+TFileChunkIndex::~TFileChunkIndex() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void TFileChunkIndex::open() {
+  if (fd_ >= 0) {
+    return;
+  }
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND,
+               S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ == -1) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TFileChunkIndex: open() " + path_, errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, path_, errno_copy);
+  }
+
+  // drop anything after the whole entries loaded, such as a record torn by
+  // a writer that crashed, so that appended entries stay aligned
+  if (-1 == ftruncate(fd_, loaded_)) {
+    int errno_copy = errno;
+    ::close(fd_);
+    fd_ = -1;
+    GlobalOutput.perror("TFileChunkIndex: open() ftruncate ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, path_, errno_copy);
+  }
+}
+
+void TFileChunkIndex::load() {
+  int fd = ::open(path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+
+  Entry entry;
+  off_t offset = loaded_;
+  while (pread(fd, &entry, sizeof(entry), offset) == (ssize_t)sizeof(entry)) {
+    entries_.push_back(entry);
+    offset += sizeof(entry);
+  }
+  ::close(fd);
+
+  loaded_ = offset;
+  numWritten_ = entries_.size();
+}
+
+void TFileChunkIndex::clear() {
+  open();
+  if (-1 == ftruncate(fd_, 0)) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TFileChunkIndex: clear() ftruncate ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, path_, errno_copy);
+  }
+  entries_.clear();
+  numWritten_ = 0;
+  loaded_ = 0;
+}
+
+void TFileChunkIndex::append(const Entry& entry) {
+  entries_.push_back(entry);
+}
+
+void TFileChunkIndex::write() {
+  if (numWritten_ == entries_.size()) {
+    return;
+  }
+  open();
+
+  const uint8_t* buf = (const uint8_t*)&entries_[numWritten_];
+  size_t len = (entries_.size() - numWritten_) * sizeof(Entry);
+  while (len > 0) {
+    ssize_t written = ::write(fd_, buf, len);
+    if (written == -1) {
+      int errno_copy = errno;
+      if (errno_copy == EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("TFileChunkIndex: write() ", errno_copy);
+      throw TTransportException(TTransportException::UNKNOWN, path_, errno_copy);
+    }
+    buf += written;
+    len -= written;
+  }
+  loaded_ += (entries_.size() - numWritten_) * sizeof(Entry);
+  numWritten_ = entries_.size();
+}
+
+uint64_t TFileChunkIndex::getNumEvents() const {
+  if (entries_.empty()) {
+    return 0;
+  }
+  return entries_.back().firstEvent + entries_.back().numEvents;
+}
+
+uint32_t TFileChunkIndex::getNextChunk() const {
+  if (entries_.empty()) {
+    return 0;
+  }
+  return entries_.back().chunk + 1;
+}
+
+const TFileChunkIndex::Entry* TFileChunkIndex::findTime(int64_t ms) const {
+  // start of the latest run of entries with unknown times
+  const Entry* unknown = NULL;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& entry = entries_[i];
+    if (entry.maxTime == 0) {
+      if (unknown == NULL) {
+        unknown = &entry;
+      }
+      continue;
+    }
+    if (entry.maxTime >= ms) {
+      return unknown != NULL ? unknown : &entry;
+    }
+    unknown = NULL;
+  }
+  return unknown;
+}
+
+const TFileChunkIndex::Entry* TFileChunkIndex::findEvent(uint64_t n) const {
+  // the last entry starting at or before n
+  size_t lo = 0;
+  size_t hi = entries_.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (entries_[mid].firstEvent <= n) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return NULL;
+  }
+  const Entry& entry = entries_[lo - 1];
+  if (n >= entry.firstEvent + entry.numEvents) {
+    return NULL;
+  }
+  return &entry;
+}
+
+}}} // apache::thrift::transport
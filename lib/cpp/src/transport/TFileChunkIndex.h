@@ -0,0 +1,140 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TFILECHUNKINDEX_H_
+#define _THRIFT_TRANSPORT_TFILECHUNKINDEX_H_ 1
+
+#include <Thrift.h>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Sidecar index of the chunks of a TFileTransport log, kept next to it in
+ * <log>.idx (see TFileTransport::setChunkIndex()).
+ *
+ * The file is a sequence of fixed size Entry records in host byte order,
+ * one for each chunk the writer has moved past, in chunk order.  The
+ * chunk still being written has no entry yet, so readers treat whatever
+ * follows the last entry as newer than anything indexed.  A torn record at
+ * the end, left by a writer that crashed, is ignored by readers and cut off
+ * by the next writer.
+ *
+ * Events carry no timestamps in the log itself, so the times are when the
+ * writer wrote them out, in ms (see concurrency::Util::currentTime()).
+ * For events written before the index was kept, or rebuilt from the log
+ * alone, only an upper bound is known: minTime is 0, and maxTime the log's
+ * modification time when they were indexed.
+ */
+class TFileChunkIndex {
+ public:
+  struct Entry {
+    Entry() :
+      chunk(0), firstEventOffset(0), numEvents(0), reserved(0),
+      firstEvent(0), minTime(0), maxTime(0) {}
+
+    uint32_t chunk;
+    // where the chunk's first event starts, from the start of the chunk
+    uint32_t firstEventOffset;
+    uint32_t numEvents;
+    uint32_t reserved;
+    // number of the chunk's first event, counting from the start of the log
+    uint64_t firstEvent;
+    int64_t minTime;
+    int64_t maxTime;
+  };
+
+  explicit TFileChunkIndex(const std::string& path);
+
+  ~TFileChunkIndex();
+
+  static std::string pathFor(const std::string& logPath) {
+    return logPath + ".idx";
+  }
+
+  const std::string& getPath() const {
+    return path_;
+  }
+
+  /**
+   * Reads whatever entries have been added to the file since the last
+   * load.  A missing file is an empty index.
+   */
+  void load();
+
+  /**
+   * Forgets all entries, and empties the file.
+   */
+  void clear();
+
+  /**
+   * Adds an entry after the last one.  It goes to the file on write().
+   */
+  void append(const Entry& entry);
+
+  /**
+   * Writes out the entries appended since the last write.  The first write
+   * cuts the file back to the entries loaded, so load() before appending
+   * to an index that is already there.
+   */
+  void write();
+
+  const std::vector<Entry>& getEntries() const {
+    return entries_;
+  }
+
+  /**
+   * Number of events in the indexed chunks, which is also the number of
+   * the first event after them.
+   */
+  uint64_t getNumEvents() const;
+
+  /**
+   * Chunk that follows the indexed ones.
+   */
+  uint32_t getNextChunk() const;
+
+  /**
+   * The first entry that may hold events written at or after ms, or NULL if
+   * no indexed chunk does.  Entries with unknown times right before the
+   * first one known to qualify are assumed to qualify too.
+   */
+  const Entry* findTime(int64_t ms) const;
+
+  /**
+   * The entry of the chunk holding event number n, or NULL if it is not in
+   * an indexed chunk.
+   */
+  const Entry* findEvent(uint64_t n) const;
+
+ private:
+  void open();
+
+  std::string path_;
+  int fd_;
+  std::vector<Entry> entries_;
+  // how many of entries_ are in the file, and how many bytes of it are
+  size_t numWritten_;
+  off_t loaded_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TFILECHUNKINDEX_H_
@@ -23,6 +23,12 @@
 
 #include "TFileTransport.h"
 #include "TTransportUtils.h"
+#include "TCrc32c.h"
+#include <concurrency/Monitor.h>
+#include <concurrency/Mutex.h>
+#include <concurrency/ThreadLocal.h>
+#include <concurrency/ThreadManager.h>
+#include <concurrency/Util.h>
 
 #include <pthread.h>
 #ifdef HAVE_SYS_TIME_H
@@ -38,14 +44,77 @@
 #endif
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
+#include <sstream>
+#include <limits.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 namespace apache { namespace thrift { namespace transport {
 
 using boost::shared_ptr;
 using namespace std;
 using namespace apache::thrift::protocol;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::ThreadLocal;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::concurrency::Util;
+
+namespace {
+
+// Writing threads are numbered in the order they first write to any
+// TFileTransport, and use the shard their number picks in each of them.
+Mutex producerMutex;
+uint32_t numProducers = 0;
+
+struct ProducerId {
+  ProducerId() {
+    Guard g(producerMutex);
+    id = numProducers++;
+  }
+  uint32_t id;
+};
+
+ThreadLocal<ProducerId> producerId;
+
+// what checkRecord() makes of the bytes where a record should be
+enum RecordCheck {
+  RECORD_OK,
+  // cut short by the end of the file, or not all written yet
+  RECORD_END,
+  RECORD_BAD
+};
+
+// Reads up to len bytes at offset at, stopping short only at end of file
+ssize_t preadAll(int fd, uint8_t* buf, size_t len, off_t at) {
+  size_t have = 0;
+  while (have < len) {
+    ssize_t got = ::pread(fd, buf + have, len - have, at + have);
+    if (got == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    have += got;
+  }
+  return have;
+}
+
+}
 
 #ifndef HAVE_CLOCK_GETTIME
 
@@ -71,11 +140,17 @@ static int clock_gettime(int clk_id /*ignored*/, struct timespec *tp) {
 TFileTransport::TFileTransport(string path, bool readOnly)
   : readState_()
   , readBuff_(NULL)
+  , readWindow_(NULL)
+  , mapReads_(false)
+  , mapBase_(NULL)
+  , mapLen_(0)
   , currentEvent_(NULL)
+  , recycledEvent_(NULL)
   , readBuffSize_(DEFAULT_READ_BUFF_SIZE)
   , readTimeout_(NO_TAIL_READ_TIMEOUT)
   , chunkSize_(DEFAULT_CHUNK_SIZE)
   , eventBufferSize_(DEFAULT_EVENT_BUFFER_SIZE)
+  , enqueueShards_(DEFAULT_ENQUEUE_SHARDS)
   , flushMaxUs_(DEFAULT_FLUSH_MAX_US)
   , flushMaxBytes_(DEFAULT_FLUSH_MAX_BYTES)
   , maxEventSize_(DEFAULT_MAX_EVENT_SIZE)
@@ -83,21 +158,31 @@ TFileTransport::TFileTransport(string path, bool readOnly)
   , eofSleepTime_(DEFAULT_EOF_SLEEP_TIME_US)
   , corruptedEventSleepTime_(DEFAULT_CORRUPTED_SLEEP_TIME_US)
   , writerThreadId_(0)
-  , dequeueBuffer_(NULL)
-  , enqueueBuffer_(NULL)
+  , shards_(NULL)
+  , pending_(false)
   , closing_(false)
-  , forceFlush_(false)
+  , flushRequested_(0)
+  , flushCompleted_(0)
   , filename_(path)
   , fd_(0)
   , bufferAndThreadInitialized_(false)
   , offset_(0)
+  , preallocateChunks_(false)
+  , preallocatedChunk_(-1)
+  , chunkIndex_(false)
+  , writeIndex_(NULL)
+  , eventChecksums_(false)
+  , resyncSkipped_(0)
+  , stagedOffset_(0)
+  , recordOffset_(0)
+  , scannedTo_(0)
+  , scannedLength_(0)
   , lastBadChunk_(0)
   , numCorruptedEventsInChunk_(0)
   , readOnly_(readOnly)
 {
   // initialize all the condition vars/mutexes
   pthread_mutex_init(&mutex_, NULL);
-  pthread_cond_init(&notFull_, NULL);
   pthread_cond_init(&notEmpty_, NULL);
   pthread_cond_init(&flushed_, NULL);
 
@@ -126,6 +211,13 @@ void TFileTransport::resetOutputFile(int fd, string filename, int64_t offset) {
     // open file if the input fd is 0
     openLogFile();
   }
+
+  // the records of a compressed log are looked for afresh
+  chunkRecords_.clear();
+  scannedTo_ = 0;
+  scannedLength_ = 0;
+  recordOffset_ = 0;
+  stagedOffset_ = offset_;
 }
 
 
@@ -138,8 +230,11 @@ TFileTransport::~TFileTransport() {
     // flush output buffer
     flush();
 
-    // set state to closing
+    // set state to closing, and wake the writer to notice
+    pthread_mutex_lock(&mutex_);
     closing_ = true;
+    pthread_cond_signal(&notEmpty_);
+    pthread_mutex_unlock(&mutex_);
 
     // TODO: make sure event queue is empty
     // currently only the write buffer is flushed
@@ -150,14 +245,12 @@ TFileTransport::~TFileTransport() {
     writerThreadId_ = 0;
   }
 
-  if (dequeueBuffer_) {
-    delete dequeueBuffer_;
-    dequeueBuffer_ = NULL;
-  }
-
-  if (enqueueBuffer_) {
-    delete enqueueBuffer_;
-    enqueueBuffer_ = NULL;
+  if (shards_) {
+    for (uint32_t i = 0; i < enqueueShards_; ++i) {
+      delete shards_[i];
+    }
+    delete[] shards_;
+    shards_ = NULL;
   }
 
   if (readBuff_) {
@@ -165,11 +258,23 @@ TFileTransport::~TFileTransport() {
     readBuff_ = NULL;
   }
 
+  unmapWindow();
+
+  if (writeIndex_) {
+    delete writeIndex_;
+    writeIndex_ = NULL;
+  }
+
   if (currentEvent_) {
     delete currentEvent_;
     currentEvent_ = NULL;
   }
 
+  if (recycledEvent_) {
+    delete recycledEvent_;
+    recycledEvent_ = NULL;
+  }
+
   // close logfile
   if (fd_ > 0) {
     if(-1 == ::close(fd_)) {
@@ -184,6 +289,13 @@ bool TFileTransport::initBufferAndWriteThread() {
     return false;
   }
 
+  if (shards_ == NULL) {
+    shards_ = new EnqueueShard*[enqueueShards_];
+    for (uint32_t i = 0; i < enqueueShards_; ++i) {
+      shards_[i] = new EnqueueShard(eventBufferSize_, eventChecksums_);
+    }
+  }
+
   if (writerThreadId_ == 0) {
     if (pthread_create(&writerThreadId_, NULL, startWriterThread, (void *)this) != 0) {
       T_ERROR("Could not create writer thread");
@@ -191,13 +303,29 @@ bool TFileTransport::initBufferAndWriteThread() {
     }
   }
 
-  dequeueBuffer_ = new TFileTransportBuffer(eventBufferSize_);
-  enqueueBuffer_ = new TFileTransportBuffer(eventBufferSize_);
+  // Writing threads check the flag without the mutex, so the shards must
+  // be visible before it is
+  __sync_synchronize();
   bufferAndThreadInitialized_ = true;
 
   return true;
 }
 
+TFileTransport::EnqueueShard::EnqueueShard(uint32_t bufferSize, bool checksums)
+  : buffer(new TFileTransportBuffer(bufferSize, checksums))
+  , spare(new TFileTransportBuffer(bufferSize, checksums))
+{
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&notFull, NULL);
+}
+
+TFileTransport::EnqueueShard::~EnqueueShard() {
+  delete buffer;
+  delete spare;
+  pthread_cond_destroy(&notFull);
+  pthread_mutex_destroy(&mutex);
+}
+
 void TFileTransport::write(const uint8_t* buf, uint32_t len) {
   if (readOnly_) {
     throw TTransportException("TFileTransport: attempting to write to file opened readonly");
@@ -223,99 +351,144 @@ void TFileTransport::enqueueEvent(const uint8_t* buf, uint32_t eventLen, bool bl
     return;
   }
 
-  eventInfo* toEnqueue = new eventInfo();
-  toEnqueue->eventBuff_ = (uint8_t *)std::malloc((sizeof(uint8_t) * eventLen) + 4);
-  // first 4 bytes is the event length
-  memcpy(toEnqueue->eventBuff_, (void*)(&eventLen), 4);
-  // actual event contents
-  memcpy(toEnqueue->eventBuff_ + 4, buf, eventLen);
-  toEnqueue->eventSize_ = eventLen + 4;
-
-  // lock mutex
-  pthread_mutex_lock(&mutex_);
-
-  // make sure that enqueue buffer is initialized and writer thread is running
+  // make sure that the buffers are initialized and writer thread is running
   if (!bufferAndThreadInitialized_) {
-    if (!initBufferAndWriteThread()) {
-      delete toEnqueue;
-      pthread_mutex_unlock(&mutex_);
+    pthread_mutex_lock(&mutex_);
+    bool initialized = bufferAndThreadInitialized_ || initBufferAndWriteThread();
+    pthread_mutex_unlock(&mutex_);
+    if (!initialized) {
       return;
     }
   }
 
+  // worked out before taking the shard's lock
+  uint32_t checksum = eventChecksums_ ? TFileTransportBuffer::eventChecksum(buf, eventLen) : 0;
+
+  EnqueueShard* shard = shards_[producerId.get()->id % enqueueShards_];
+  pthread_mutex_lock(&shard->mutex);
+
   // Can't enqueue while buffer is full
-  while (enqueueBuffer_->isFull()) {
-    pthread_cond_wait(&notFull_, &mutex_);
+  while (shard->buffer->isFull()) {
+    pthread_cond_wait(&shard->notFull, &shard->mutex);
   }
 
-  // add to the buffer
-  if (!enqueueBuffer_->addEvent(toEnqueue)) {
-    delete toEnqueue;
-    pthread_mutex_unlock(&mutex_);
+  // copy the event, behind its length, into the buffer
+  bool wasEmpty = shard->buffer->isEmpty();
+  bool added = shard->buffer->addEvent(buf, eventLen, checksum);
+  pthread_mutex_unlock(&shard->mutex);
+  if (!added) {
     return;
   }
 
-  // signal anybody who's waiting for the buffer to be non-empty
-  pthread_cond_signal(&notEmpty_);
+  // The writer collects every shard once woken, so only the first event
+  // in a shard since the last collection needs to wake it
+  if (wasEmpty) {
+    pthread_mutex_lock(&mutex_);
+    pending_ = true;
+    pthread_cond_signal(&notEmpty_);
+    pthread_mutex_unlock(&mutex_);
+  }
 
   if (blockUntilFlush) {
-    pthread_cond_wait(&flushed_, &mutex_);
+    flush();
   }
-
-  // this really should be a loop where it makes sure it got flushed
-  // because condition variables can get triggered by the os for no reason
-  // it is probably a non-factor for the time being
-  pthread_mutex_unlock(&mutex_);
 }
 
-bool TFileTransport::swapEventBuffers(struct timespec* deadline) {
+uint64_t TFileTransport::waitForEvents(struct timespec* deadline) {
   pthread_mutex_lock(&mutex_);
-  if (deadline != NULL) {
-    // if we were handed a deadline time struct, do a timed wait
+  if (!pending_ && !closing_ && flushRequested_ == flushCompleted_) {
     pthread_cond_timedwait(&notEmpty_, &mutex_, deadline);
-  } else {
-    // just wait until the buffer gets an item
-    pthread_cond_wait(&notEmpty_, &mutex_);
-  }
-
-  bool swapped = false;
-
-  // could be empty if we timed out
-  if (!enqueueBuffer_->isEmpty()) {
-    TFileTransportBuffer *temp = enqueueBuffer_;
-    enqueueBuffer_ = dequeueBuffer_;
-    dequeueBuffer_ = temp;
-
-    swapped = true;
   }
-
-  // unlock the mutex and signal if required
+  // whatever was signalled so far is picked up by the collection that
+  // follows
+  pending_ = false;
+  uint64_t flushRequested = flushRequested_;
   pthread_mutex_unlock(&mutex_);
+  return flushRequested;
+}
 
-  if (swapped) {
-    pthread_cond_signal(&notFull_);
+bool TFileTransport::writeShards(uint32_t* unflushed) {
+  bool wrote = false;
+  for (uint32_t i = 0; i < enqueueShards_; ++i) {
+    EnqueueShard* shard = shards_[i];
+    pthread_mutex_lock(&shard->mutex);
+    if (shard->buffer->isEmpty()) {
+      pthread_mutex_unlock(&shard->mutex);
+      continue;
+    }
+    // the spare was emptied the last time round
+    TFileTransportBuffer* full = shard->buffer;
+    shard->buffer = shard->spare;
+    shard->spare = full;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_cond_broadcast(&shard->notFull);
+
+    writeEvents(full, unflushed);
+    wrote = true;
   }
-
-  return swapped;
+  // the events must be written before the buffers free them
+  writeQueued();
+  // and before the index says their chunks are done
+  if (writeIndex_) {
+    writeIndex_->write();
+  }
+  for (uint32_t i = 0; i < enqueueShards_; ++i) {
+    if (!shards_[i]->spare->isEmpty()) {
+      shards_[i]->spare->reset();
+    }
+  }
+  return wrote;
 }
 
-
 void TFileTransport::writerThread() {
   // open file if it is not open
   if(!fd_) {
     openLogFile();
   }
 
-  // set the offset to the correct value (EOF)
-  try {
-    seekToEnd();
-  } catch (TException &te) {
+  // Keep the index if all it lacks is the chunk being written, which is
+  // quick to catch up.  One further behind is left to the next seek, so
+  // that writes never wait on a scan of the whole log.
+  if (chunkIndex_) {
+    writeIndex_ = new TFileChunkIndex(TFileChunkIndex::pathFor(filename_));
+    try {
+      writeIndex_->load();
+      if (writeIndex_->getNextChunk() + 1 < getNumChunks()) {
+        throw TTransportException("chunk index is behind the log until a reader catches it up");
+      }
+      writeIndexEntry_ = TFileChunkIndex::Entry();
+      writeIndexEntry_.firstEvent = writeIndex_->getNumEvents();
+      indexChunks(writeIndex_, &writeIndexEntry_, writeIndex_->getNextChunk());
+      writeIndex_->write();
+    } catch (TException &te) {
+      GlobalOutput.printf("TFileTransport: not keeping a chunk index: %s", te.what());
+      delete writeIndex_;
+      writeIndex_ = NULL;
+    }
   }
 
-  // throw away any partial events
-  offset_ += readState_.lastDispatchPtr_;
-  ftruncate(fd_, offset_);
-  readState_.resetAllValues();
+  if (codec_) {
+    // carry on after the last whole record, throwing away one cut short
+    try {
+      scanRecords();
+    } catch (TException &te) {
+    }
+    ftruncate(fd_, scannedTo_);
+    offset_ = scannedLength_;
+    stagedOffset_ = offset_;
+    staged_.reserve(chunkSize_);
+  } else {
+    // set the offset to the correct value (EOF)
+    try {
+      seekToEnd();
+    } catch (TException &te) {
+    }
+
+    // throw away any partial events
+    offset_ += readState_.lastDispatchPtr_;
+    ftruncate(fd_, offset_);
+    readState_.resetAllValues();
+  }
 
   // Figure out the next time by which a flush must take place
 
@@ -324,81 +497,25 @@ void TFileTransport::writerThread() {
   uint32_t unflushed = 0;
 
   while(1) {
-    // this will only be true when the destructor is being invoked
-    if(closing_) {
-      // empty out both the buffers
-      if (enqueueBuffer_->isEmpty() && dequeueBuffer_->isEmpty()) {
-        if (-1 == ::close(fd_)) {
-          int errno_copy = errno;
-          GlobalOutput.perror("TFileTransport: writerThread() ::close() ", errno_copy);
-          throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error in file close", errno_copy);
-        }
-        // just be safe and sync to disk
-        fsync(fd_);
-        fd_ = 0;
-        pthread_exit(NULL);
-        return;
+    uint64_t flushRequested = waitForEvents(&ts_next_flush);
+    bool wrote = writeShards(&unflushed);
+
+    // this will only be true when the destructor is being invoked, and
+    // once the shards have been emptied out
+    if (closing_ && !wrote) {
+      // just be safe and sync to disk
+      if (codec_) {
+        writeRecord();
       }
-    }
-
-    if (swapEventBuffers(&ts_next_flush)) {
-      eventInfo* outEvent;
-      while (NULL != (outEvent = dequeueBuffer_->getNext())) {
-        if (!outEvent) {
-          T_DEBUG_L(1, "Got an empty event");
-          return;
-        }
-
-        // sanity check on event
-        if ((maxEventSize_ > 0) && (outEvent->eventSize_ > maxEventSize_)) {
-          T_ERROR("msg size is greater than max event size: %u > %u\n", outEvent->eventSize_, maxEventSize_);
-          continue;
-        }
-
-        // If chunking is required, then make sure that msg does not cross chunk boundary
-        if ((outEvent->eventSize_ > 0) && (chunkSize_ != 0)) {
-
-          // event size must be less than chunk size
-          if(outEvent->eventSize_ > chunkSize_) {
-            T_ERROR("TFileTransport: event size(%u) is greater than chunk size(%u): skipping event",
-                  outEvent->eventSize_, chunkSize_);
-            continue;
-          }
-
-          int64_t chunk1 = offset_/chunkSize_;
-          int64_t chunk2 = (offset_ + outEvent->eventSize_ - 1)/chunkSize_;
-
-          // if adding this event will cross a chunk boundary, pad the chunk with zeros
-          if (chunk1 != chunk2) {
-            // refetch the offset to keep in sync
-            offset_ = lseek(fd_, 0, SEEK_CUR);
-            int32_t padding = (int32_t)((offset_/chunkSize_ + 1)*chunkSize_ - offset_);
-
-            uint8_t zeros[padding];
-            bzero(zeros, padding);
-            if (-1 == ::write(fd_, zeros, padding)) {
-              int errno_copy = errno;
-              GlobalOutput.perror("TFileTransport: writerThread() error while padding zeros ", errno_copy);
-              throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error while padding zeros", errno_copy);
-            }
-            unflushed += padding;
-            offset_ += padding;
-          }
-        }
-
-        // write the dequeued event to the file
-        if (outEvent->eventSize_ > 0) {
-          if (-1 == ::write(fd_, outEvent->eventBuff_, outEvent->eventSize_)) {
-            int errno_copy = errno;
-            GlobalOutput.perror("TFileTransport: error while writing event ", errno_copy);
-            throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error while writing event", errno_copy);
-          }
-
-          unflushed += outEvent->eventSize_;
-          offset_ += outEvent->eventSize_;
-        }
+      fsync(fd_);
+      if (-1 == ::close(fd_)) {
+        int errno_copy = errno;
+        GlobalOutput.perror("TFileTransport: writerThread() ::close() ", errno_copy);
+        throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error in file close", errno_copy);
       }
-      dequeueBuffer_->reset();
+      fd_ = 0;
+      pthread_exit(NULL);
+      return;
     }
 
     bool flushTimeElapsed = false;
@@ -414,17 +531,313 @@ void TFileTransport::writerThread() {
     // couple of cases from which a flush could be triggered
     if ((flushTimeElapsed && unflushed > 0) ||
        unflushed > flushMaxBytes_ ||
-       forceFlush_) {
+       flushRequested != flushCompleted_) {
 
-      // sync (force flush) file to disk
+      // sync (force flush) file to disk, with what there is of the chunk
+      // being compressed
+      if (codec_) {
+        writeRecord();
+      }
       fsync(fd_);
       unflushed = 0;
 
       // notify anybody waiting for flush completion
-      forceFlush_ = false;
+      pthread_mutex_lock(&mutex_);
+      flushCompleted_ = flushRequested;
       pthread_cond_broadcast(&flushed_);
+      pthread_mutex_unlock(&mutex_);
+    }
+  }
+}
+
+void TFileTransport::writeEvents(TFileTransportBuffer* buffer, uint32_t* unflushed) {
+  int64_t now = writeIndex_ ? Util::currentTime() : 0;
+  const uint8_t* outEvent;
+  uint32_t outEventSize;
+  while (buffer->getNext(&outEvent, &outEventSize)) {
+    // sanity check on event
+    if ((maxEventSize_ > 0) && (outEventSize > maxEventSize_)) {
+      T_ERROR("msg size is greater than max event size: %u > %u\n", outEventSize, maxEventSize_);
+      continue;
+    }
+
+    // If chunking is required, then make sure that msg does not cross chunk boundary
+    if ((outEventSize > 0) && (chunkSize_ != 0)) {
+
+      // event size must be less than chunk size
+      if(outEventSize > chunkSize_) {
+        T_ERROR("TFileTransport: event size(%u) is greater than chunk size(%u): skipping event",
+              outEventSize, chunkSize_);
+        continue;
+      }
+
+      int64_t chunk1 = offset_/chunkSize_;
+      int64_t chunk2 = (offset_ + outEventSize - 1)/chunkSize_;
+
+      // if adding this event will cross a chunk boundary, pad the chunk with zeros.
+      // Every write appends, so offset_ is the file size and the padding
+      // follows from it.
+      if (chunk1 != chunk2) {
+        uint32_t padding = (uint32_t)((chunk1 + 1)*chunkSize_ - offset_);
+        queuePadding(padding);
+        *unflushed += padding;
+        offset_ += padding;
+      }
+
+      // a compressed log does not fill chunkSize_ bytes per chunk
+      if (preallocateChunks_ && !codec_ && offset_/chunkSize_ != preallocatedChunk_) {
+        preallocateChunk(offset_/chunkSize_);
+      }
     }
+
+    // write the dequeued event to the file
+    if (outEventSize > 0) {
+      if (writeIndex_) {
+        indexEvent(writeIndex_, &writeIndexEntry_, offset_, now, now);
+      }
+      queueWrite(outEvent, outEventSize);
+      *unflushed += outEventSize;
+      offset_ += outEventSize;
+    }
+  }
+}
+
+void TFileTransport::queueWrite(const uint8_t* buf, uint32_t len) {
+  // events next to each other in the arena go out as one piece
+  if (!iov_.empty() &&
+      (const uint8_t*)iov_.back().iov_base + iov_.back().iov_len == buf) {
+    iov_.back().iov_len += len;
+    return;
+  }
+  if (iov_.size() == IOV_MAX) {
+    writeQueued();
   }
+  struct iovec v;
+  v.iov_base = (void*)buf;
+  v.iov_len = len;
+  iov_.push_back(v);
+}
+
+void TFileTransport::queuePadding(uint32_t len) {
+  static const uint8_t zeros[64 * 1024] = { 0 };
+  while (len > 0) {
+    uint32_t part = min(len, (uint32_t)sizeof(zeros));
+    queueWrite(zeros, part);
+    len -= part;
+  }
+}
+
+void TFileTransport::writeQueued() {
+  if (codec_) {
+    // the writes make up chunks to compress
+    try {
+      for (size_t i = 0; i < iov_.size(); ++i) {
+        stageChunk((const uint8_t*)iov_[i].iov_base, iov_[i].iov_len);
+      }
+    } catch (...) {
+      iov_.clear();
+      throw;
+    }
+    iov_.clear();
+    return;
+  }
+
+  struct iovec* v = iov_.empty() ? NULL : &iov_[0];
+  size_t count = iov_.size();
+  while (count > 0) {
+    ssize_t written = ::writev(fd_, v, (int)min(count, (size_t)IOV_MAX));
+    if (written == -1) {
+      int errno_copy = errno;
+      if (errno_copy == EINTR) {
+        continue;
+      }
+      iov_.clear();
+      GlobalOutput.perror("TFileTransport: error while writing event ", errno_copy);
+      throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error while writing event", errno_copy);
+    }
+
+    // skip what went out, resuming a partial write where it stopped
+    while (count > 0 && (size_t)written >= v->iov_len) {
+      written -= v->iov_len;
+      ++v;
+      --count;
+    }
+    if (count > 0) {
+      v->iov_base = (uint8_t*)v->iov_base + written;
+      v->iov_len -= written;
+    }
+  }
+  iov_.clear();
+}
+
+void TFileTransport::stageChunk(const uint8_t* buf, uint32_t len) {
+  while (len > 0) {
+    uint32_t room = chunkSize_ - (uint32_t)((stagedOffset_ + staged_.size()) % chunkSize_);
+    uint32_t part = min(len, room);
+    staged_.insert(staged_.end(), buf, buf + part);
+    buf += part;
+    len -= part;
+
+    // the chunk is done
+    if (part == room) {
+      writeRecord();
+    }
+  }
+}
+
+void TFileTransport::writeRecord() {
+  if (staged_.empty()) {
+    return;
+  }
+
+  uint32_t length = staged_.size();
+  record_.resize(sizeof(RecordHeader) + codec_->compressBound(length));
+  RecordHeader header;
+  header.magic = RECORD_MAGIC;
+  header.codec = codec_->getId();
+  header.offset = stagedOffset_;
+  header.length = length;
+  header.compressedLength = codec_->compress(&staged_[0], length, &record_[sizeof(header)]);
+  memcpy(&record_[0], &header, sizeof(header));
+
+  // a reader that finds the record cut short waits for the rest
+  const uint8_t* buf = &record_[0];
+  size_t left = sizeof(header) + header.compressedLength;
+  while (left > 0) {
+    ssize_t written = ::write(fd_, buf, left);
+    if (written == -1) {
+      int errno_copy = errno;
+      if (errno_copy == EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("TFileTransport: error while writing chunk ", errno_copy);
+      throw TTransportException(TTransportException::UNKNOWN, "TFileTransport: error while writing chunk", errno_copy);
+    }
+    buf += written;
+    left -= written;
+  }
+
+  stagedOffset_ += length;
+  staged_.clear();
+}
+
+int TFileTransport::checkRecord(off_t at, off_t size, RecordHeader* header) {
+  if (at + (off_t)sizeof(*header) > size) {
+    return RECORD_END;
+  }
+  if (preadAll(fd_, (uint8_t*)header, sizeof(*header), at) != (ssize_t)sizeof(*header)) {
+    return RECORD_END;
+  }
+  if (header->magic != RECORD_MAGIC) {
+    return RECORD_BAD;
+  }
+  if (header->codec != codec_->getId()) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TFileTransport: log was compressed with another codec");
+  }
+  // a record holds part of one chunk
+  if (header->length == 0 || header->compressedLength == 0 ||
+      header->offset % chunkSize_ + header->length > chunkSize_ ||
+      header->compressedLength > codec_->compressBound(chunkSize_)) {
+    return RECORD_BAD;
+  }
+  if (at + (off_t)sizeof(*header) + header->compressedLength > size) {
+    return RECORD_END;
+  }
+  return RECORD_OK;
+}
+
+off_t TFileTransport::findRecord(off_t at, RecordHeader* header) {
+  struct stat f_info;
+  if (fstat(fd_, &f_info) == -1) {
+    int errno_copy = errno;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TFileTransport::findRecord() (fstat)",
+                              errno_copy);
+  }
+
+  int check = checkRecord(at, f_info.st_size, header);
+  if (check != RECORD_BAD) {
+    return check == RECORD_OK ? at : -1;
+  }
+
+  // look for the next record past the damage
+  GlobalOutput.printf("TFileTransport: corrupted record at offset %ld", (long)at);
+  uint8_t buf[64 * 1024];
+  uint32_t magic = RECORD_MAGIC;
+  for (off_t from = at + 1; from < f_info.st_size; from += sizeof(buf) - 3) {
+    ssize_t got = preadAll(fd_, buf, sizeof(buf), from);
+    if (got < (ssize_t)sizeof(magic)) {
+      break;
+    }
+    for (ssize_t i = 0; i + (ssize_t)sizeof(magic) <= got; ++i) {
+      if (memcmp(buf + i, &magic, sizeof(magic)) == 0 &&
+          checkRecord(from + i, f_info.st_size, header) == RECORD_OK) {
+        return from + i;
+      }
+    }
+  }
+  return -1;
+}
+
+void TFileTransport::scanRecords() {
+  RecordHeader header;
+  off_t at;
+  while ((at = findRecord(scannedTo_, &header)) != -1) {
+    // chunks lost to damage start with the next record found
+    uint32_t chunk = header.offset / chunkSize_;
+    while (chunkRecords_.size() <= chunk) {
+      chunkRecords_.push_back(at);
+    }
+    scannedTo_ = at + sizeof(header) + header.compressedLength;
+    scannedLength_ = header.offset + header.length;
+  }
+}
+
+int32_t TFileTransport::readRecord() {
+  readWindow_ = NULL;
+  RecordHeader header;
+  off_t at;
+  while ((at = findRecord(recordOffset_, &header)) != -1) {
+    recordOffset_ = at + sizeof(header) + header.compressedLength;
+    if (readRecord_.size() < header.compressedLength) {
+      readRecord_.resize(header.compressedLength);
+    }
+    if (readChunk_.size() < header.length) {
+      readChunk_.resize(header.length);
+    }
+    ssize_t got = preadAll(fd_, &readRecord_[0], header.compressedLength,
+                           at + sizeof(header));
+    if (got != (ssize_t)header.compressedLength) {
+      return -1;
+    }
+    try {
+      codec_->uncompress(&readRecord_[0], header.compressedLength,
+                         &readChunk_[0], header.length);
+    } catch (TTransportException &te) {
+      GlobalOutput.printf("TFileTransport: skipping record at offset %ld: %s",
+                          (long)at, te.what());
+      continue;
+    }
+    offset_ = header.offset;
+    readWindow_ = &readChunk_[0];
+    return header.length;
+  }
+  return 0;
+}
+
+void TFileTransport::preallocateChunk(int64_t chunk) {
+  preallocatedChunk_ = chunk;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  // failure only costs contiguity, so it is not worth more than a note
+  if (-1 == fallocate(fd_, FALLOC_FL_KEEP_SIZE, off_t(chunk) * chunkSize_, chunkSize_)) {
+    int errno_copy = errno;
+    if (errno_copy == EOPNOTSUPP) {
+      preallocateChunks_ = false;
+    }
+    GlobalOutput.perror("TFileTransport: fallocate() ", errno_copy);
+  }
+#endif
 }
 
 void TFileTransport::flush() {
@@ -432,12 +845,13 @@ void TFileTransport::flush() {
   if (writerThreadId_ <= 0) {
     return;
   }
-  // wait for flush to take place
+  // wait for everything enqueued so far to be written and synced
   pthread_mutex_lock(&mutex_);
 
-  forceFlush_ = true;
+  uint64_t ticket = ++flushRequested_;
+  pthread_cond_signal(&notEmpty_);
 
-  while (forceFlush_) {
+  while (flushCompleted_ < ticket) {
     pthread_cond_wait(&flushed_, &mutex_);
   }
 
@@ -478,24 +892,66 @@ uint32_t TFileTransport::read(uint8_t* buf, uint32_t len) {
     // copy over anything thats remaining
     if (remaining > 0) {
       memcpy(buf,
-             currentEvent_->eventBuff_ + currentEvent_->eventBuffPos_,
+             currentEvent_->data() + currentEvent_->eventBuffPos_,
              remaining);
     }
-    delete(currentEvent_);
+    recycleEvent(currentEvent_);
     currentEvent_ = NULL;
     return remaining;
   }
 
   // read as much as possible
-  memcpy(buf, currentEvent_->eventBuff_ + currentEvent_->eventBuffPos_, len);
+  memcpy(buf, currentEvent_->data() + currentEvent_->eventBuffPos_, len);
   currentEvent_->eventBuffPos_ += len;
   return len;
 }
 
+const uint8_t* TFileTransport::borrow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  if (!currentEvent_) {
+    currentEvent_ = readEvent();
+  }
+  if (!currentEvent_) {
+    return NULL;
+  }
+
+  // only what is left of the current event can be lent out
+  uint32_t remaining = currentEvent_->eventSize_ - currentEvent_->eventBuffPos_;
+  if (remaining < *len) {
+    return NULL;
+  }
+  *len = remaining;
+  return currentEvent_->data() + currentEvent_->eventBuffPos_;
+}
+
+void TFileTransport::consume(uint32_t len) {
+  currentEvent_->eventBuffPos_ += len;
+  if (currentEvent_->eventBuffPos_ == currentEvent_->eventSize_) {
+    recycleEvent(currentEvent_);
+    currentEvent_ = NULL;
+  }
+}
+
+bool TFileTransport::readEvent(TMemoryBuffer* view) {
+  if (!currentEvent_) {
+    currentEvent_ = readEvent();
+  }
+  if (!currentEvent_) {
+    return false;
+  }
+
+  // the event's buffer stays as it is until the next event is read
+  view->resetBuffer(const_cast<uint8_t*>(currentEvent_->data()) + currentEvent_->eventBuffPos_,
+                    currentEvent_->eventSize_ - currentEvent_->eventBuffPos_);
+  recycleEvent(currentEvent_);
+  currentEvent_ = NULL;
+  return true;
+}
+
 eventInfo* TFileTransport::readEvent() {
   int readTries = 0;
 
-  if (!readBuff_) {
+  if (!readBuff_ && !mapReads_ && !codec_) {
     readBuff_ = new uint8_t[readBuffSize_];
   }
 
@@ -504,7 +960,14 @@ eventInfo* TFileTransport::readEvent() {
     if (readState_.bufferPtr_ == readState_.bufferLen_) {
       // advance the offset pointer
       offset_ += readState_.bufferLen_;
-      readState_.bufferLen_ = ::read(fd_, readBuff_, readBuffSize_);
+      if (codec_) {
+        readState_.bufferLen_ = readRecord();
+      } else if (mapReads_) {
+        readState_.bufferLen_ = mapNextWindow();
+      } else {
+        readState_.bufferLen_ = ::read(fd_, readBuff_, readBuffSize_);
+        readWindow_ = readBuff_;
+      }
       //       if (readState_.bufferLen_) {
       //         T_DEBUG_L(1, "Amount read: %u (offset: %lu)", readState_.bufferLen_, offset_);
       //       }
@@ -544,9 +1007,10 @@ eventInfo* TFileTransport::readEvent() {
     // attempt to read an event from the buffer
     while(readState_.bufferPtr_ < readState_.bufferLen_) {
       if (readState_.readingSize_) {
+        uint32_t headerSize = getEventHeaderSize();
         if(readState_.eventSizeBuffPos_ == 0) {
           if ( (offset_ + readState_.bufferPtr_)/chunkSize_ !=
-               ((offset_ + readState_.bufferPtr_ + 3)/chunkSize_)) {
+               ((offset_ + readState_.bufferPtr_ + headerSize - 1)/chunkSize_)) {
             // skip one byte towards chunk boundary
             //            T_DEBUG_L(1, "Skipping a byte");
             readState_.bufferPtr_++;
@@ -555,7 +1019,7 @@ eventInfo* TFileTransport::readEvent() {
         }
 
         readState_.eventSizeBuff_[readState_.eventSizeBuffPos_++] =
-          readBuff_[readState_.bufferPtr_++];
+          readWindow_[readState_.bufferPtr_++];
         if (readState_.eventSizeBuffPos_ == 4) {
           // 0 length event indicates padding
           if (*((uint32_t *)(readState_.eventSizeBuff_)) == 0) {
@@ -563,33 +1027,60 @@ eventInfo* TFileTransport::readEvent() {
             readState_.resetState(readState_.lastDispatchPtr_);
             continue;
           }
+          // a checksummed event starts with a marker
+          if (eventChecksums_ && !findSyncMarker()) {
+            continue;
+          }
+        }
+        if (readState_.eventSizeBuffPos_ == headerSize) {
           // got a valid event
           readState_.readingSize_ = false;
-          if (readState_.event_) {
-            delete(readState_.event_);
+          if (!readState_.event_) {
+            readState_.event_ = new eventInfo();
           }
-          readState_.event_ = new eventInfo();
-          readState_.event_->eventSize_ = *((uint32_t *)(readState_.eventSizeBuff_));
+          readState_.event_->eventSize_ =
+            *((uint32_t *)(readState_.eventSizeBuff_ + headerSize - (eventChecksums_ ? 8 : 4)));
+          readState_.event_->eventBuffPos_ = 0;
+          readState_.event_->eventMapped_ = NULL;
 
           // check if the event is corrupted and perform recovery if required
           if (isEventCorrupted()) {
+            if (eventChecksums_) {
+              // the marker was not one, so look past it
+              readState_.readingSize_ = true;
+              readState_.eventSizeBuffPos_--;
+              memmove(readState_.eventSizeBuff_, readState_.eventSizeBuff_ + 1,
+                      readState_.eventSizeBuffPos_);
+              resyncSkipped_++;
+              findSyncMarker();
+              continue;
+            }
             performRecovery();
             // start from the top
             break;
           }
+
+          // an event that is all there in the mapping, or in the chunk just
+          // uncompressed, is used in place
+          if ((mapReads_ || codec_) &&
+              readState_.bufferLen_ - readState_.bufferPtr_ >= (int32_t)readState_.event_->eventSize_) {
+            readState_.event_->eventMapped_ = readWindow_ + readState_.bufferPtr_;
+            readState_.bufferPtr_ += readState_.event_->eventSize_;
+            if (eventChecksums_ && !isChecksumValid()) {
+              continue;
+            }
+            return completeEvent();
+          }
+          readState_.event_->reserve();
         }
       } else {
-        if (!readState_.event_->eventBuff_) {
-          readState_.event_->eventBuff_ = new uint8_t[readState_.event_->eventSize_];
-          readState_.event_->eventBuffPos_ = 0;
-        }
         // take either the entire event or the remaining bytes in the buffer
         int reclaimBuffer = min((uint32_t)(readState_.bufferLen_ - readState_.bufferPtr_),
                                 readState_.event_->eventSize_ - readState_.event_->eventBuffPos_);
 
         // copy data from read buffer into event buffer
         memcpy(readState_.event_->eventBuff_ + readState_.event_->eventBuffPos_,
-               readBuff_ + readState_.bufferPtr_,
+               readWindow_ + readState_.bufferPtr_,
                reclaimBuffer);
 
         // increment position ptrs
@@ -598,15 +1089,11 @@ eventInfo* TFileTransport::readEvent() {
 
         // check if the event has been read in full
         if (readState_.event_->eventBuffPos_ == readState_.event_->eventSize_) {
-          // set the completed event to the current event
-          eventInfo* completeEvent = readState_.event_;
-          completeEvent->eventBuffPos_ = 0;
-
-          readState_.event_ = NULL;
-          readState_.resetState(readState_.bufferPtr_);
-
+          if (eventChecksums_ && !isChecksumValid()) {
+            continue;
+          }
           // exit criteria
-          return completeEvent;
+          return completeEvent();
         }
       }
     }
@@ -614,6 +1101,80 @@ eventInfo* TFileTransport::readEvent() {
   }
 }
 
+eventInfo* TFileTransport::completeEvent() {
+  // set the completed event to the current event
+  eventInfo* completeEvent = readState_.event_;
+  completeEvent->eventBuffPos_ = 0;
+
+  // assemble the next one in the last event handed out, if any
+  readState_.event_ = recycledEvent_;
+  recycledEvent_ = NULL;
+  readState_.resetState(readState_.bufferPtr_);
+  return completeEvent;
+}
+
+int32_t TFileTransport::mapNextWindow() {
+  unmapWindow();
+  readWindow_ = NULL;
+
+  struct stat f_info;
+  if (fstat(fd_, &f_info) == -1) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TFileTransport: mapNextWindow() fstat ", errno_copy);
+    return -1;
+  }
+  if (offset_ >= f_info.st_size) {
+    return 0;
+  }
+
+  // Map up to the end of the chunk.  No valid event crosses it, so only
+  // the last events of a file still being written get split between
+  // windows; those are copied out.
+  off_t end = (offset_/chunkSize_ + 1) * off_t(chunkSize_);
+  end = min(end, (off_t)f_info.st_size);
+  end = min(end, offset_ + (off_t)INT_MAX / 2);
+
+  static const off_t pageSize = sysconf(_SC_PAGESIZE);
+  off_t start = offset_ - offset_ % pageSize;
+  void* base = mmap(NULL, end - start, PROT_READ, MAP_SHARED, fd_, start);
+  if (base == MAP_FAILED) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TFileTransport: mapNextWindow() mmap ", errno_copy);
+    return -1;
+  }
+  mapBase_ = base;
+  mapLen_ = end - start;
+
+#ifdef MADV_SEQUENTIAL
+  madvise(mapBase_, mapLen_, MADV_SEQUENTIAL);
+#endif
+#ifdef POSIX_FADV_WILLNEED
+  // start reading the next chunk in while this one is processed
+  posix_fadvise(fd_, end, chunkSize_, POSIX_FADV_WILLNEED);
+#endif
+
+  readWindow_ = (const uint8_t*)mapBase_ + (offset_ - start);
+  return (int32_t)(end - offset_);
+}
+
+void TFileTransport::unmapWindow() {
+  if (mapBase_ != NULL) {
+    munmap(mapBase_, mapLen_);
+    mapBase_ = NULL;
+    mapLen_ = 0;
+  }
+}
+
+void TFileTransport::recycleEvent(eventInfo* event) {
+  if (event == NULL) {
+    return;
+  }
+  if (recycledEvent_) {
+    delete recycledEvent_;
+  }
+  recycledEvent_ = event;
+}
+
 bool TFileTransport::isEventCorrupted() {
   // an error is triggered if:
   if ( (maxEventSize_ > 0) &&  (readState_.event_->eventSize_ > maxEventSize_)) {
@@ -626,7 +1187,12 @@ bool TFileTransport::isEventCorrupted() {
     T_ERROR("Read corrupt event. Event size(%u) greater than chunk size (%u)",
                readState_.event_->eventSize_, chunkSize_);
     return true;
-  } else if( ((offset_ + readState_.bufferPtr_ - 4)/chunkSize_) !=
+  } else if (readState_.event_->eventSize_ == 0) {
+    // 4. only a checksummed event has a length to be 0 at all
+    T_ERROR("Read corrupt event. Event size is 0 at offset %ld",
+            offset_ + readState_.bufferPtr_);
+    return true;
+  } else if( ((offset_ + readState_.bufferPtr_ - getEventHeaderSize())/chunkSize_) !=
              ((offset_ + readState_.bufferPtr_ + readState_.event_->eventSize_ - 1)/chunkSize_) ) {
     // 3. size indicates that event crosses chunk boundary
     T_ERROR("Read corrupt event. Event crosses chunk boundary. Event size:%u  Offset:%ld",
@@ -637,6 +1203,62 @@ bool TFileTransport::isEventCorrupted() {
   return false;
 }
 
+bool TFileTransport::findSyncMarker() {
+  // move along the header read so far a byte at a time, until it starts
+  // with a marker or there is too little of it to tell
+  uint8_t* header = readState_.eventSizeBuff_;
+  while (readState_.eventSizeBuffPos_ >= 4 &&
+         *((uint32_t *)header) != TFileTransportBuffer::SYNC_MARKER) {
+    readState_.eventSizeBuffPos_--;
+    memmove(header, header + 1, readState_.eventSizeBuffPos_);
+    resyncSkipped_++;
+  }
+  return readState_.eventSizeBuffPos_ >= 4;
+}
+
+bool TFileTransport::isChecksumValid() {
+  eventInfo* event = readState_.event_;
+  uint32_t checksum = TFileTransportBuffer::eventChecksum(event->data(), event->eventSize_);
+  off_t eventOffset = offset_ + readState_.bufferPtr_ - event->eventSize_ - getEventHeaderSize();
+  if (checksum == *((uint32_t *)(readState_.eventSizeBuff_ + 8))) {
+    if (resyncSkipped_ > 0) {
+      GlobalOutput.printf("TFileTransport: skipped %lu damaged bytes before offset %ld",
+                          (unsigned long)resyncSkipped_, (long)eventOffset);
+      resyncSkipped_ = 0;
+    }
+    return true;
+  }
+
+  T_ERROR("Read corrupt event. Checksum mismatch. Event size:%u  Offset:%ld",
+          event->eventSize_, (long)eventOffset);
+  resync(eventOffset);
+  return false;
+}
+
+void TFileTransport::resync(off_t eventOffset) {
+  // the length may be what was damaged, so the next event can start
+  // anywhere after the marker
+  off_t from = eventOffset + 1;
+  resyncSkipped_++;
+  readState_.resetState(readState_.lastDispatchPtr_);
+  readState_.event_->eventBuffPos_ = 0;
+  readState_.event_->eventMapped_ = NULL;
+  if (from >= offset_) {
+    readState_.bufferPtr_ = from - offset_;
+    return;
+  }
+
+  // it started in an earlier read, so read from there again
+  offset_ = from;
+  readState_.resetState(0);
+  readState_.bufferPtr_ = 0;
+  readState_.bufferLen_ = 0;
+  if (!mapReads_ && lseek(fd_, from, SEEK_SET) == -1) {
+    GlobalOutput("TFileTransport: lseek error in resync");
+    throw TTransportException("TFileTransport: lseek error in resync");
+  }
+}
+
 void TFileTransport::performRecovery() {
   // perform some kickass recovery
   uint32_t curChunk = getCurChunk();
@@ -667,6 +1289,7 @@ void TFileTransport::performRecovery() {
       // pretty hosed at this stage, rewind the file back to the last successful
       // point and punt on the error
       readState_.resetState(readState_.lastDispatchPtr_);
+      recycleEvent(currentEvent_);
       currentEvent_ = NULL;
       char errorMsg[1024];
       sprintf(errorMsg, "TFileTransport: log file corrupted at offset: %lu",
@@ -709,12 +1332,20 @@ void TFileTransport::seekToChunk(int32_t chunk) {
     seekToEnd = true;
     chunk = numChunks - 1;
     // this is the min offset to process events till
-    minEndOffset = lseek(fd_, 0, SEEK_END);
+    minEndOffset = codec_ ? scannedLength_ : lseek(fd_, 0, SEEK_END);
   }
 
   off_t newOffset = off_t(chunk) * chunkSize_;
-  offset_ = lseek(fd_, newOffset, SEEK_SET);
+  if (codec_) {
+    // getNumChunks() has found the chunk's first record, unless the log
+    // ends where the chunk starts
+    recordOffset_ = (uint32_t)chunk < chunkRecords_.size() ? chunkRecords_[chunk] : scannedTo_;
+    offset_ = newOffset;
+  } else {
+    offset_ = lseek(fd_, newOffset, SEEK_SET);
+  }
   readState_.resetAllValues();
+  recycleEvent(currentEvent_);
   currentEvent_ = NULL;
   if (offset_ == -1) {
     GlobalOutput("TFileTransport: lseek error in seekToChunk");
@@ -726,7 +1357,13 @@ void TFileTransport::seekToChunk(int32_t chunk) {
     uint32_t oldReadTimeout = getReadTimeout();
     setReadTimeout(NO_TAIL_READ_TIMEOUT);
     // keep on reading unti the last event at point of seekChunk call
-    while (readEvent() && ((offset_ + readState_.bufferPtr_) < minEndOffset)) {};
+    eventInfo* event;
+    while ((event = readEvent()) != NULL) {
+      recycleEvent(event);
+      if ((offset_ + readState_.bufferPtr_) >= minEndOffset) {
+        break;
+      }
+    }
     setReadTimeout(oldReadTimeout);
   }
 
@@ -736,11 +1373,166 @@ void TFileTransport::seekToEnd() {
   seekToChunk(getNumChunks());
 }
 
+void TFileTransport::seekToTime(int64_t ms) {
+  TFileChunkIndex index(TFileChunkIndex::pathFor(filename_));
+  index.load();
+  catchUpChunkIndex(&index);
+  const TFileChunkIndex::Entry* entry = index.findTime(ms);
+  seekToChunk(entry ? entry->chunk : index.getNextChunk());
+}
+
+void TFileTransport::seekToEvent(uint64_t n) {
+  TFileChunkIndex index(TFileChunkIndex::pathFor(filename_));
+  index.load();
+  catchUpChunkIndex(&index);
+
+  // start from the chunk holding it, or else from the first one that is
+  // not indexed
+  uint32_t chunk = index.getNextChunk();
+  uint64_t first = index.getNumEvents();
+  const TFileChunkIndex::Entry* entry = index.findEvent(n);
+  if (entry != NULL) {
+    chunk = entry->chunk;
+    first = entry->firstEvent;
+  } else if (n < first) {
+    // the index does not cover it, so count from the start
+    chunk = 0;
+    first = 0;
+  }
+
+  if (chunk >= getNumChunks()) {
+    seekToEnd();
+    return;
+  }
+  seekToChunk(chunk);
+  skipEvents(n - first);
+}
+
+void TFileTransport::skipEvents(uint64_t count) {
+  int32_t oldReadTimeout = readTimeout_;
+  readTimeout_ = NO_TAIL_READ_TIMEOUT;
+  for (uint64_t i = 0; i < count; ++i) {
+    eventInfo* event = readEvent();
+    if (event == NULL) {
+      break;
+    }
+    recycleEvent(event);
+  }
+  readTimeout_ = oldReadTimeout;
+}
+
+void TFileTransport::catchUpChunkIndex(TFileChunkIndex* index) {
+  // the last chunk may still be being written, and is never indexed
+  if (index->getNextChunk() + 1 >= getNumChunks()) {
+    return;
+  }
+  TFileChunkIndex::Entry current;
+  current.firstEvent = index->getNumEvents();
+  indexChunks(index, &current, index->getNextChunk());
+  try {
+    index->write();
+  } catch (TException &te) {
+    // still good for this seek
+    GlobalOutput.printf("TFileTransport: could not save chunk index: %s", te.what());
+  }
+}
+
+void TFileTransport::rebuildChunkIndex() {
+  TFileChunkIndex old(TFileChunkIndex::pathFor(filename_));
+  old.load();
+
+  TFileChunkIndex index(TFileChunkIndex::pathFor(filename_));
+  TFileChunkIndex::Entry current;
+  indexChunks(&index, &current, 0);
+  vector<TFileChunkIndex::Entry> entries = index.getEntries();
+
+  // keep the times of chunks that hold the same events as before
+  const vector<TFileChunkIndex::Entry>& before = old.getEntries();
+  size_t i = 0;
+  for (size_t j = 0; j < entries.size(); ++j) {
+    while (i < before.size() && before[i].chunk < entries[j].chunk) {
+      ++i;
+    }
+    if (i < before.size() && before[i].chunk == entries[j].chunk &&
+        before[i].firstEvent == entries[j].firstEvent &&
+        before[i].numEvents == entries[j].numEvents) {
+      entries[j].minTime = before[i].minTime;
+      entries[j].maxTime = before[i].maxTime;
+    }
+  }
+
+  index.clear();
+  for (size_t j = 0; j < entries.size(); ++j) {
+    index.append(entries[j]);
+  }
+  index.write();
+  seekToChunk(0);
+}
+
+void TFileTransport::indexEvent(TFileChunkIndex* index, TFileChunkIndex::Entry* current,
+                                off_t offset, int64_t minTime, int64_t maxTime) {
+  uint32_t chunk = offset / chunkSize_;
+  if (current->numEvents > 0 && chunk != current->chunk) {
+    // done with the chunk
+    index->append(*current);
+    uint64_t next = current->firstEvent + current->numEvents;
+    *current = TFileChunkIndex::Entry();
+    current->firstEvent = next;
+  }
+  if (current->numEvents == 0) {
+    current->chunk = chunk;
+    current->firstEventOffset = offset % chunkSize_;
+  }
+  current->numEvents++;
+  if (minTime != 0 && (current->minTime == 0 || minTime < current->minTime)) {
+    current->minTime = minTime;
+  }
+  current->maxTime = max(current->maxTime, maxTime);
+}
+
+void TFileTransport::indexChunks(TFileChunkIndex* index, TFileChunkIndex::Entry* current,
+                                 uint32_t fromChunk) {
+  if (fromChunk >= getNumChunks()) {
+    return;
+  }
+
+  // All that is known of when these were written is that it was no later
+  // than the log was last modified
+  struct stat f_info;
+  int64_t maxTime = 0;
+  if (fstat(fd_, &f_info) == 0) {
+    maxTime = (int64_t)f_info.st_mtime * 1000 + 999;
+  }
+
+  int32_t oldReadTimeout = readTimeout_;
+  readTimeout_ = NO_TAIL_READ_TIMEOUT;
+  try {
+    seekToChunk(fromChunk);
+    eventInfo* event;
+    while ((event = readEvent()) != NULL) {
+      // the event ends where the reader is now
+      off_t offset = offset_ + readState_.bufferPtr_ - event->eventSize_ - getEventHeaderSize();
+      recycleEvent(event);
+      indexEvent(index, current, offset, 0, maxTime);
+    }
+  } catch (TTransportException &te) {
+    // a corrupted end of the log ends the index too
+    GlobalOutput.printf("TFileTransport: indexing stopped: %s", te.what());
+  }
+  readTimeout_ = oldReadTimeout;
+}
+
 uint32_t TFileTransport::getNumChunks() {
   if (fd_ <= 0) {
     return 0;
   }
 
+  // chunks are counted as if the log were not compressed
+  if (codec_) {
+    scanRecords();
+    return scannedLength_ > 0 ? scannedLength_/chunkSize_ + 1 : 0;
+  }
+
   struct stat f_info;
   int rv = fstat(fd_, &f_info);
 
@@ -789,69 +1581,458 @@ void TFileTransport::getNextFlushTime(struct timespec* ts_next_flush) {
   ts_next_flush->tv_sec += flushMaxUs_ / 1000000;
 }
 
-TFileTransportBuffer::TFileTransportBuffer(uint32_t size)
+const uint32_t TFileTransportBuffer::SYNC_MARKER;
+const uint32_t TFileTransportBuffer::CHECKSUMMED_HEADER_SIZE;
+
+// Arena size to start with, and the most kept across resets
+static const size_t kMinArenaSize = 64 * 1024;
+static const size_t kMaxRetainedArenaSize = 64 * 1024 * 1024;
+
+TFileTransportBuffer::TFileTransportBuffer(uint32_t size, bool checksums)
   : bufferMode_(WRITE)
-  , writePoint_(0)
-  , readPoint_(0)
+  , numEvents_(0)
   , size_(size)
+  , checksums_(checksums)
+  , arena_(NULL)
+  , arenaSize_(0)
+  , writePos_(0)
+  , readPos_(0)
 {
-  buffer_ = new eventInfo*[size];
 }
 
 TFileTransportBuffer::~TFileTransportBuffer() {
-  if (buffer_) {
-    for (uint32_t i = 0; i < writePoint_; i++) {
-      delete buffer_[i];
-    }
-    delete[] buffer_;
-    buffer_ = NULL;
-  }
+  std::free(arena_);
+  arena_ = NULL;
+}
+
+uint32_t TFileTransportBuffer::eventChecksum(const uint8_t* buf, uint32_t eventLen) {
+  uint32_t crc = TCrc32c::value((const uint8_t*)&eventLen, sizeof(eventLen));
+  return TCrc32c::extend(crc, buf, eventLen);
 }
 
-bool TFileTransportBuffer::addEvent(eventInfo *event) {
+bool TFileTransportBuffer::addEvent(const uint8_t* buf, uint32_t eventLen, uint32_t checksum) {
   if (bufferMode_ == READ) {
     GlobalOutput("Trying to write to a buffer in read mode");
   }
-  if (writePoint_ < size_) {
-    buffer_[writePoint_++] = event;
-    return true;
-  } else {
+  if (numEvents_ >= size_) {
     // buffer is full
     return false;
   }
+
+  uint32_t headerSize = checksums_ ? CHECKSUMMED_HEADER_SIZE : 4;
+  size_t needed = writePos_ + headerSize + eventLen;
+  if (needed > arenaSize_) {
+    size_t newSize = max(arenaSize_, kMinArenaSize);
+    while (newSize < needed) {
+      newSize *= 2;
+    }
+    uint8_t* newArena = (uint8_t*)std::realloc(arena_, newSize);
+    if (newArena == NULL) {
+      GlobalOutput("TFileTransportBuffer::addEvent() realloc");
+      return false;
+    }
+    arena_ = newArena;
+    arenaSize_ = newSize;
+  }
+
+  uint8_t* header = arena_ + writePos_;
+  if (checksums_) {
+    memcpy(header, &SYNC_MARKER, 4);
+    memcpy(header + 4, &eventLen, 4);
+    memcpy(header + 8, &checksum, 4);
+  } else {
+    // first 4 bytes is the event length
+    memcpy(header, &eventLen, 4);
+  }
+  // actual event contents
+  memcpy(header + headerSize, buf, eventLen);
+  writePos_ = needed;
+  numEvents_++;
+  return true;
 }
 
-eventInfo* TFileTransportBuffer::getNext() {
+bool TFileTransportBuffer::getNext(const uint8_t** event, uint32_t* eventSize) {
   if (bufferMode_ == WRITE) {
     bufferMode_ = READ;
   }
-  if (readPoint_ < writePoint_) {
-    return buffer_[readPoint_++];
-  } else {
+  if (readPos_ >= writePos_) {
     // no more entries
-    return NULL;
+    return false;
   }
+  uint32_t headerSize = checksums_ ? CHECKSUMMED_HEADER_SIZE : 4;
+  uint32_t eventLen;
+  memcpy(&eventLen, arena_ + readPos_ + headerSize - (checksums_ ? 8 : 4), 4);
+  *event = arena_ + readPos_;
+  *eventSize = headerSize + eventLen;
+  readPos_ += headerSize + eventLen;
+  return true;
 }
 
 void TFileTransportBuffer::reset() {
-  if (bufferMode_ == WRITE || writePoint_ > readPoint_) {
+  if (bufferMode_ == WRITE || writePos_ > readPos_) {
     T_DEBUG("Resetting a buffer with unread entries");
   }
-  // Clean up the old entries
-  for (uint32_t i = 0; i < writePoint_; i++) {
-    delete buffer_[i];
+  // Don't hang on to the arena after a burst of huge events
+  if (arenaSize_ > kMaxRetainedArenaSize) {
+    std::free(arena_);
+    arena_ = NULL;
+    arenaSize_ = 0;
   }
   bufferMode_ = WRITE;
-  writePoint_ = 0;
-  readPoint_ = 0;
+  numEvents_ = 0;
+  writePos_ = 0;
+  readPos_ = 0;
 }
 
 bool TFileTransportBuffer::isFull() {
-  return writePoint_ == size_;
+  return numEvents_ == size_;
 }
 
 bool TFileTransportBuffer::isEmpty() {
-  return writePoint_ == 0;
+  return numEvents_ == 0;
+}
+
+/**
+ * Where a parallel replay is at, shared by a TFileProcessor and its workers.
+ */
+class TFileReplayProgress {
+ public:
+  struct Worker {
+    Worker() : events(0), failed(0), busyMs(0) {}
+
+    int64_t events;
+    int64_t failed;
+    int64_t busyMs;
+  };
+
+  TFileReplayProgress() :
+    numChunks_(0),
+    nextChunk_(0),
+    chunksDone_(0),
+    running_(0) {}
+
+  void reset(uint32_t numChunks, size_t numWorkers) {
+    Synchronized s(monitor_);
+    numChunks_ = numChunks;
+    nextChunk_ = 0;
+    chunksDone_ = 0;
+    workers_.assign(numWorkers, Worker());
+    failure_.clear();
+  }
+
+  // Hands out the next range of up to size chunks, if there is one left
+  bool nextRange(uint32_t size, uint32_t* begin, uint32_t* end) {
+    Synchronized s(monitor_);
+    if (nextChunk_ >= numChunks_ || !failure_.empty()) {
+      return false;
+    }
+    *begin = nextChunk_;
+    nextChunk_ = numChunks_ - nextChunk_ > size ? nextChunk_ + size : numChunks_;
+    *end = nextChunk_;
+    return true;
+  }
+
+  void chunksDone(uint32_t chunks) {
+    Synchronized s(monitor_);
+    chunksDone_ += chunks;
+  }
+
+  void setChunksDone(uint32_t chunks) {
+    Synchronized s(monitor_);
+    chunksDone_ = chunks;
+  }
+
+  // Adds what a worker did since it last reported
+  void report(size_t worker, const Worker& done) {
+    Synchronized s(monitor_);
+    workers_[worker].events += done.events;
+    workers_[worker].failed += done.failed;
+    workers_[worker].busyMs += done.busyMs;
+  }
+
+  void started() {
+    Synchronized s(monitor_);
+    running_++;
+  }
+
+  // Records that a worker gave up, which ends the replay
+  void failed(size_t worker, const string& what) {
+    Synchronized s(monitor_);
+    if (failure_.empty()) {
+      ostringstream failure;
+      failure << "TFileProcessor: replay worker " << worker << " failed: " << what;
+      failure_ = failure.str();
+    }
+  }
+
+  // What the first worker to give up failed with, if one did
+  bool getFailure(string* what) {
+    Synchronized s(monitor_);
+    *what = failure_;
+    return !failure_.empty();
+  }
+
+  void stopped() {
+    Synchronized s(monitor_);
+    if (--running_ == 0) {
+      monitor_.notifyAll();
+    }
+  }
+
+  void waitForWorkers() {
+    Synchronized s(monitor_);
+    while (running_ > 0) {
+      monitor_.wait();
+    }
+  }
+
+  void getCounters(map<string, int64_t>& counters, const string& prefix) {
+    Synchronized s(monitor_);
+    int64_t events = 0;
+    int64_t failed = 0;
+    for (size_t i = 0; i < workers_.size(); i++) {
+      const Worker& worker = workers_[i];
+      ostringstream name;
+      name << prefix << ".worker" << i << ".";
+      counters[name.str() + "events"] = worker.events;
+      counters[name.str() + "failed"] = worker.failed;
+      counters[name.str() + "events_per_sec"] =
+        worker.busyMs > 0 ? worker.events * 1000 / worker.busyMs : 0;
+      events += worker.events;
+      failed += worker.failed;
+    }
+    counters[prefix + ".chunks"] = numChunks_;
+    counters[prefix + ".chunks_done"] = chunksDone_;
+    counters[prefix + ".events"] = events;
+    counters[prefix + ".failed"] = failed;
+  }
+
+ private:
+  Monitor monitor_;
+  uint32_t numChunks_;
+  uint32_t nextChunk_;
+  uint32_t chunksDone_;
+  uint32_t running_;
+  vector<Worker> workers_;
+  string failure_;
+};
+
+namespace {
+
+// how many events a worker processes between reports
+const int64_t REPORT_EVENTS = 256;
+
+/**
+ * One of the workers of a parallel replay.  It processes events in place,
+ * with a processor and protocols of its own.
+ */
+class ReplayWorker : public Runnable {
+ public:
+  ReplayWorker(shared_ptr<TFileReplayProgress> progress,
+               size_t id,
+               shared_ptr<TProcessor> processor,
+               shared_ptr<TProtocolFactory> inputProtocolFactory,
+               shared_ptr<TProtocolFactory> outputProtocolFactory) :
+    progress_(progress),
+    id_(id),
+    processor_(processor),
+    event_(new TMemoryBuffer()),
+    started_(0) {
+    inputProtocol_ = inputProtocolFactory->getProtocol(event_);
+    outputProtocol_ =
+      outputProtocolFactory->getProtocol(shared_ptr<TTransport>(new TNullTransport()));
+  }
+
+  void run() {
+    try {
+      replay();
+    } catch (TException& te) {
+      GlobalOutput.printf("TFileProcessor: replay worker %u failed: %s",
+                          (unsigned)id_, te.what());
+      progress_->failed(id_, te.what());
+    } catch (std::exception& e) {
+      GlobalOutput.printf("TFileProcessor: replay worker %u failed: %s",
+                          (unsigned)id_, e.what());
+      progress_->failed(id_, e.what());
+    } catch (...) {
+      GlobalOutput.printf("TFileProcessor: replay worker %u failed",
+                          (unsigned)id_);
+      progress_->failed(id_, "unknown exception");
+    }
+    // Always reached, or the dispatcher would wait on this worker forever
+    stopping();
+    progress_->stopped();
+  }
+
+ protected:
+  virtual void replay() = 0;
+
+  // Called as the worker stops, whether or not it failed
+  virtual void stopping() {}
+
+  // Processes the event event_ points at
+  void process() {
+    try {
+      if (processor_->process(inputProtocol_, outputProtocol_)) {
+        done_.events++;
+        return;
+      }
+    } catch (TException& te) {
+      T_DEBUG("TFileProcessor: replayed event failed: %s", te.what());
+    }
+    done_.failed++;
+  }
+
+  void startClock() {
+    started_ = Util::currentTime();
+  }
+
+  // Tells progress what this worker did since it last did, and how long it
+  // has been at it since startClock() or the last report
+  void report() {
+    int64_t now = Util::currentTime();
+    done_.busyMs = now - started_;
+    started_ = now;
+    progress_->report(id_, done_);
+    done_ = TFileReplayProgress::Worker();
+  }
+
+  bool shouldReport() {
+    return (done_.events + done_.failed) % REPORT_EVENTS == 0;
+  }
+
+  shared_ptr<TFileReplayProgress> progress_;
+  size_t id_;
+  shared_ptr<TProcessor> processor_;
+  shared_ptr<TMemoryBuffer> event_;
+  shared_ptr<TProtocol> inputProtocol_;
+  shared_ptr<TProtocol> outputProtocol_;
+  TFileReplayProgress::Worker done_;
+  int64_t started_;
+};
+
+/**
+ * Replays whichever ranges of chunks are left, with its own reader.
+ */
+class ChunkReplayWorker : public ReplayWorker {
+ public:
+  ChunkReplayWorker(shared_ptr<TFileReplayProgress> progress,
+                    size_t id,
+                    shared_ptr<TProcessor> processor,
+                    shared_ptr<TProtocolFactory> inputProtocolFactory,
+                    shared_ptr<TProtocolFactory> outputProtocolFactory,
+                    shared_ptr<TFileTransport> reader,
+                    uint32_t rangeChunks) :
+    ReplayWorker(progress, id, processor, inputProtocolFactory, outputProtocolFactory),
+    reader_(reader),
+    rangeChunks_(rangeChunks) {}
+
+ protected:
+  void replay() {
+    startClock();
+    uint32_t begin;
+    uint32_t end;
+    while (progress_->nextRange(rangeChunks_, &begin, &end)) {
+      reader_->seekToChunk(begin);
+      // reads are mapped a chunk at a time, so the reader knows which chunk
+      // each event is in
+      while (reader_->readEvent(event_.get()) && reader_->getCurChunk() < end) {
+        process();
+        if (shouldReport()) {
+          report();
+        }
+      }
+      report();
+      progress_->chunksDone(end - begin);
+    }
+  }
+
+ private:
+  shared_ptr<TFileTransport> reader_;
+  uint32_t rangeChunks_;
+};
+
+/**
+ * Replays the events queued for it, in the order they were queued.
+ */
+class KeyedReplayWorker : public ReplayWorker {
+ public:
+  KeyedReplayWorker(shared_ptr<TFileReplayProgress> progress,
+                    size_t id,
+                    shared_ptr<TProcessor> processor,
+                    shared_ptr<TProtocolFactory> inputProtocolFactory,
+                    shared_ptr<TProtocolFactory> outputProtocolFactory,
+                    uint32_t maxQueued) :
+    ReplayWorker(progress, id, processor, inputProtocolFactory, outputProtocolFactory),
+    maxQueued_(maxQueued),
+    finished_(false),
+    stopped_(false) {}
+
+  // Queues a copy of an event, waiting while the queue is full.  Returns
+  // false if the worker has stopped.
+  bool add(const uint8_t* buf, uint32_t len) {
+    Synchronized s(monitor_);
+    while (queue_.size() >= maxQueued_ && !stopped_) {
+      monitor_.wait();
+    }
+    if (stopped_) {
+      return false;
+    }
+    queue_.push_back(string((const char*)buf, len));
+    if (queue_.size() == 1) {
+      monitor_.notifyAll();
+    }
+    return true;
+  }
+
+  // Lets the worker stop once its queue is empty
+  void finish() {
+    Synchronized s(monitor_);
+    finished_ = true;
+    monitor_.notifyAll();
+  }
+
+ protected:
+  void replay() {
+    deque<string> batch;
+    while (true) {
+      {
+        Synchronized s(monitor_);
+        while (queue_.empty() && !finished_) {
+          monitor_.wait();
+        }
+        if (queue_.empty()) {
+          return;
+        }
+        batch.swap(queue_);
+        monitor_.notifyAll();
+      }
+
+      // waiting for events is not counted against throughput
+      startClock();
+      for (deque<string>::iterator it = batch.begin(); it != batch.end(); ++it) {
+        event_->resetBuffer((uint8_t*)it->data(), it->size());
+        process();
+      }
+      batch.clear();
+      report();
+    }
+  }
+
+  void stopping() {
+    Synchronized s(monitor_);
+    stopped_ = true;
+    monitor_.notifyAll();
+  }
+
+ private:
+  Monitor monitor_;
+  deque<string> queue_;
+  uint32_t maxQueued_;
+  bool finished_;
+  bool stopped_;
+};
+
 }
 
 TFileProcessor::TFileProcessor(shared_ptr<TProcessor> processor,
@@ -860,7 +2041,10 @@ TFileProcessor::TFileProcessor(shared_ptr<TProcessor> processor,
   processor_(processor),
   inputProtocolFactory_(protocolFactory),
   outputProtocolFactory_(protocolFactory),
-  inputTransport_(inputTransport) {
+  inputTransport_(inputTransport),
+  inPlace_(false),
+  parallelChunks_(DEFAULT_PARALLEL_CHUNKS),
+  progress_(new TFileReplayProgress()) {
 
   // default the output transport to a null transport (common case)
   outputTransport_ = shared_ptr<TNullTransport>(new TNullTransport());
@@ -873,7 +2057,10 @@ TFileProcessor::TFileProcessor(shared_ptr<TProcessor> processor,
   processor_(processor),
   inputProtocolFactory_(inputProtocolFactory),
   outputProtocolFactory_(outputProtocolFactory),
-  inputTransport_(inputTransport) {
+  inputTransport_(inputTransport),
+  inPlace_(false),
+  parallelChunks_(DEFAULT_PARALLEL_CHUNKS),
+  progress_(new TFileReplayProgress()) {
 
   // default the output transport to a null transport (common case)
   outputTransport_ = shared_ptr<TNullTransport>(new TNullTransport());
@@ -887,10 +2074,14 @@ TFileProcessor::TFileProcessor(shared_ptr<TProcessor> processor,
   inputProtocolFactory_(protocolFactory),
   outputProtocolFactory_(protocolFactory),
   inputTransport_(inputTransport),
-  outputTransport_(outputTransport) {};
+  outputTransport_(outputTransport),
+  inPlace_(false),
+  parallelChunks_(DEFAULT_PARALLEL_CHUNKS),
+  progress_(new TFileReplayProgress()) {};
 
 void TFileProcessor::process(uint32_t numEvents, bool tail) {
-  shared_ptr<TProtocol> inputProtocol = inputProtocolFactory_->getProtocol(inputTransport_);
+  shared_ptr<TMemoryBuffer> event;
+  shared_ptr<TProtocol> inputProtocol = getInputProtocol(&event);
   shared_ptr<TProtocol> outputProtocol = outputProtocolFactory_->getProtocol(outputTransport_);
 
   // set the read timeout to 0 if tailing is required
@@ -905,6 +2096,7 @@ void TFileProcessor::process(uint32_t numEvents, bool tail) {
     // bad form to use exceptions for flow control but there is really
     // no other way around it
     try {
+      nextEvent(event.get());
       processor_->process(inputProtocol, outputProtocol);
       numProcessed++;
       if ( (numEvents > 0) && (numProcessed == numEvents)) {
@@ -928,7 +2120,8 @@ void TFileProcessor::process(uint32_t numEvents, bool tail) {
 }
 
 void TFileProcessor::processChunk() {
-  shared_ptr<TProtocol> inputProtocol = inputProtocolFactory_->getProtocol(inputTransport_);
+  shared_ptr<TMemoryBuffer> event;
+  shared_ptr<TProtocol> inputProtocol = getInputProtocol(&event);
   shared_ptr<TProtocol> outputProtocol = outputProtocolFactory_->getProtocol(outputTransport_);
 
   uint32_t curChunk = inputTransport_->getCurChunk();
@@ -937,6 +2130,7 @@ void TFileProcessor::processChunk() {
     // bad form to use exceptions for flow control but there is really
     // no other way around it
     try {
+      nextEvent(event.get());
       processor_->process(inputProtocol, outputProtocol);
       if (curChunk != inputTransport_->getCurChunk()) {
         break;
@@ -950,4 +2144,127 @@ void TFileProcessor::processChunk() {
   }
 }
 
+shared_ptr<TProtocol> TFileProcessor::getInputProtocol(shared_ptr<TMemoryBuffer>* event) {
+  if (inPlace_) {
+    if (dynamic_cast<TFileTransport*>(inputTransport_.get()) != NULL) {
+      event->reset(new TMemoryBuffer());
+      return inputProtocolFactory_->getProtocol(*event);
+    }
+    GlobalOutput("TFileProcessor: only a TFileTransport can be processed in place");
+  }
+  return inputProtocolFactory_->getProtocol(inputTransport_);
+}
+
+void TFileProcessor::nextEvent(TMemoryBuffer* event) {
+  // without a view the processor reads straight from the input
+  if (event == NULL) {
+    return;
+  }
+  TFileTransport* input = static_cast<TFileTransport*>(inputTransport_.get());
+  if (!input->readEvent(event)) {
+    throw TEOFException();
+  }
+}
+
+void TFileProcessor::processParallel(shared_ptr<ThreadManager> threadManager,
+                                     shared_ptr<TFileProcessorFactory> processorFactory,
+                                     shared_ptr<TFileEventKey> key) {
+  TFileTransport* input = dynamic_cast<TFileTransport*>(inputTransport_.get());
+  if (input == NULL) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TFileProcessor: only a TFileTransport can be replayed in parallel");
+  }
+  size_t numWorkers = threadManager->workerCount();
+  if (numWorkers == 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TFileProcessor: no threads to replay on");
+  }
+
+  shared_ptr<TFileTransport> reader = openReader(input);
+  uint32_t numChunks = reader->getNumChunks();
+  progress_->reset(numChunks, numWorkers);
+
+  // everything that can fail is done before any worker starts
+  vector<shared_ptr<ReplayWorker> > workers;
+  vector<shared_ptr<KeyedReplayWorker> > keyed;
+  for (size_t i = 0; i < numWorkers; i++) {
+    if (key) {
+      keyed.push_back(shared_ptr<KeyedReplayWorker>(
+        new KeyedReplayWorker(progress_, i, processorFactory->getProcessor(),
+                              inputProtocolFactory_, outputProtocolFactory_,
+                              MAX_QUEUED_EVENTS)));
+      workers.push_back(keyed.back());
+    } else {
+      shared_ptr<TFileTransport> workerReader =
+        i == 0 ? reader : openReader(input);
+      workers.push_back(shared_ptr<ReplayWorker>(
+        new ChunkReplayWorker(progress_, i, processorFactory->getProcessor(),
+                              inputProtocolFactory_, outputProtocolFactory_,
+                              workerReader, parallelChunks_)));
+    }
+  }
+
+  try {
+    for (size_t i = 0; i < workers.size(); i++) {
+      progress_->started();
+      try {
+        threadManager->add(workers[i]);
+      } catch (...) {
+        progress_->stopped();
+        throw;
+      }
+    }
+
+    if (key) {
+      TMemoryBuffer event;
+      uint8_t* buf;
+      uint32_t len;
+      uint32_t curChunk = 0;
+      while (reader->readEvent(&event)) {
+        event.getBuffer(&buf, &len);
+        if (!keyed[key->getKey(buf, len) % numWorkers]->add(buf, len)) {
+          // that worker failed, which ends the replay
+          break;
+        }
+        if (curChunk != reader->getCurChunk()) {
+          curChunk = reader->getCurChunk();
+          progress_->setChunksDone(curChunk);
+        }
+      }
+      progress_->setChunksDone(numChunks);
+    }
+  } catch (...) {
+    for (size_t i = 0; i < keyed.size(); i++) {
+      keyed[i]->finish();
+    }
+    progress_->waitForWorkers();
+    throw;
+  }
+
+  for (size_t i = 0; i < keyed.size(); i++) {
+    keyed[i]->finish();
+  }
+  progress_->waitForWorkers();
+
+  string failure;
+  if (progress_->getFailure(&failure)) {
+    throw TTransportException(failure);
+  }
+}
+
+void TFileProcessor::getCounters(map<string, int64_t>& counters, const string& prefix) {
+  progress_->getCounters(counters, prefix);
+}
+
+shared_ptr<TFileTransport> TFileProcessor::openReader(TFileTransport* input) {
+  shared_ptr<TFileTransport> reader(new TFileTransport(input->getFilename(), true));
+  reader->setChunkSize(input->getChunkSize());
+  reader->setMaxEventSize(input->getMaxEventSize());
+  reader->setChunkCodec(input->getChunkCodec());
+  reader->setEventChecksums(input->getEventChecksums());
+  reader->setMapReads(true);
+  reader->setReadTimeout(TFileTransport::NO_TAIL_READ_TIMEOUT);
+  return reader;
+}
+
 }}} // apache::thrift::transport
@@ -23,39 +23,98 @@
 #include "TTransport.h"
 #include "Thrift.h"
 #include "TProcessor.h"
+#include "TFileChunkIndex.h"
 
 #include <string>
+#include <vector>
 #include <stdio.h>
 
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include <boost/shared_ptr.hpp>
 
+namespace apache { namespace thrift { namespace concurrency {
+class ThreadManager;
+}}}
+
 namespace apache { namespace thrift { namespace transport {
 
 using apache::thrift::TProcessor;
 using apache::thrift::protocol::TProtocolFactory;
 
+class TMemoryBuffer;
+
+/**
+ * Compresses the chunks of a TFileTransport log (see
+ * TFileTransport::setChunkCodec()).  Errors are thrown as
+ * TTransportException.
+ */
+class TFileChunkCodec {
+ public:
+  virtual ~TFileChunkCodec() {}
+
+  /**
+   * Stored with each chunk, so that a log is not read with the wrong codec.
+   */
+  virtual uint32_t getId() = 0;
+
+  /**
+   * Most bytes compress() can turn len bytes into.
+   */
+  virtual uint32_t compressBound(uint32_t len) = 0;
+
+  /**
+   * Compresses len bytes at in into out, which has room for
+   * compressBound(len) bytes, and returns how many it took.
+   */
+  virtual uint32_t compress(const uint8_t* in, uint32_t len, uint8_t* out) = 0;
+
+  /**
+   * Uncompresses len bytes at in into out, which must come to exactly
+   * outLen bytes.
+   */
+  virtual void uncompress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t outLen) = 0;
+};
+
 // Data pertaining to a single event
 typedef struct eventInfo {
   uint8_t* eventBuff_;
   uint32_t eventSize_;
   uint32_t eventBuffPos_;
+  // bytes allocated at eventBuff_, which may be more than the event needs
+  // when the eventInfo is reused
+  uint32_t eventBuffCapacity_;
+  // the event in place in the mapped file, if it was not copied out
+  const uint8_t* eventMapped_;
 
-  eventInfo():eventBuff_(NULL), eventSize_(0), eventBuffPos_(0){};
+  eventInfo():eventBuff_(NULL), eventSize_(0), eventBuffPos_(0), eventBuffCapacity_(0), eventMapped_(NULL){};
   ~eventInfo() {
     if (eventBuff_) {
       delete[] eventBuff_;
     }
   }
+
+  const uint8_t* data() const {
+    return eventMapped_ ? eventMapped_ : eventBuff_;
+  }
+
+  // make room for an event of eventSize_ bytes
+  void reserve() {
+    if (eventBuffCapacity_ < eventSize_) {
+      delete[] eventBuff_;
+      eventBuff_ = new uint8_t[eventSize_];
+      eventBuffCapacity_ = eventSize_;
+    }
+  }
 } eventInfo;
 
 // information about current read state
 typedef struct readState {
   eventInfo* event_;
 
-  // keep track of event size
-  uint8_t   eventSizeBuff_[4];
+  // keep track of event size, or of the whole header of a checksummed event
+  uint8_t   eventSizeBuff_[12];
   uint8_t   eventSizeBuffPos_;
   bool      readingSize_;
 
@@ -97,7 +156,12 @@ typedef struct readState {
 
 /**
  * TFileTransportBuffer - buffer class used by TFileTransport for queueing up events
- * to be written to disk.  Should be used in the following way:
+ * to be written to disk.  Events are copied into one contiguous arena, each
+ * behind its 4 byte length (and, for checksummed events, a sync marker before
+ * that and the checksum after), exactly as they go to disk, so the writer
+ * can hand runs of them to writev() in place.  The arena is kept across resets,
+ * so once it has grown to fit a buffer's worth of events nothing is
+ * allocated per event.  Should be used in the following way:
  *  1) Buffer created
  *  2) Buffer written to (addEvent)
  *  3) Buffer read from (getNext)
@@ -111,11 +175,24 @@ typedef struct readState {
  */
 class TFileTransportBuffer {
   public:
-    TFileTransportBuffer(uint32_t size);
+    TFileTransportBuffer(uint32_t size, bool checksums = false);
     ~TFileTransportBuffer();
 
-    bool addEvent(eventInfo *event);
-    eventInfo* getNext();
+    // A checksummed event is framed by SYNC_MARKER, its length, and the
+    // CRC32C of the two of them (see eventChecksum())
+    static const uint32_t SYNC_MARKER = 0xa1c3f0e7;
+    static const uint32_t CHECKSUMMED_HEADER_SIZE = 12;
+
+    static uint32_t eventChecksum(const uint8_t* buf, uint32_t eventLen);
+
+    // Appends an event behind its length, or returns false if full.  The
+    // checksum is only stored if the buffer is for checksummed events.
+    bool addEvent(const uint8_t* buf, uint32_t eventLen, uint32_t checksum = 0);
+
+    // Points event at the next event, header included, or returns false
+    // if there are no more
+    bool getNext(const uint8_t** event, uint32_t* eventSize);
+
     void reset();
     bool isFull();
     bool isEmpty();
@@ -129,10 +206,15 @@ class TFileTransportBuffer {
     };
     mode bufferMode_;
 
-    uint32_t writePoint_;
-    uint32_t readPoint_;
+    // number of events held, and the most that fit
+    uint32_t numEvents_;
     uint32_t size_;
-    eventInfo** buffer_;
+
+    bool checksums_;
+    uint8_t* arena_;
+    size_t arenaSize_;
+    size_t writePos_;
+    size_t readPos_;
 };
 
 /**
@@ -181,15 +263,53 @@ class TFileTransport : public TFileReaderTransport,
   uint32_t readAll(uint8_t* buf, uint32_t len);
   uint32_t read(uint8_t* buf, uint32_t len);
 
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+  void consume(uint32_t len);
+
+  /**
+   * Points view at what is left of the current event, or at the next one,
+   * and moves past it.  When reads are mapped (see setMapReads()) the event
+   * is usually not copied at all.  The view is good until the next read
+   * from this transport.  Returns false where read() would return 0.
+   */
+  bool readEvent(TMemoryBuffer* view);
+
   // log-file specific functions
   void seekToChunk(int32_t chunk);
   void seekToEnd();
   uint32_t getNumChunks();
   uint32_t getCurChunk();
 
+  /**
+   * Seeks to the start of the first chunk that may hold events written at
+   * or after ms (see concurrency::Util::currentTime()), going by the chunk
+   * index (see setChunkIndex()).  If no indexed chunk does, that is the
+   * first chunk after the indexed ones, or the end of the log.
+   */
+  void seekToTime(int64_t ms);
+
+  /**
+   * Seeks to event number n, counting from the start of the log, using the
+   * chunk index to skip whole chunks.  Seeks to the end of the log if it
+   * has no more than n events.
+   */
+  void seekToEvent(uint64_t n);
+
+  /**
+   * Rebuilds the chunk index from the log, e.g. one written without it or
+   * after a crash.  Write times cannot be recovered from the log, so they
+   * are kept for chunks the old index had.  For the others the log's
+   * modification time is all there is to go by.
+   */
+  void rebuildChunkIndex();
+
   // for changing the output file
   void resetOutputFile(int fd, std::string filename, int64_t offset);
 
+  std::string getFilename() {
+    return filename_;
+  }
+
   // Setter/Getter functions for user-controllable options
   void setReadBuffSize(uint32_t readBuffSize) {
     if (readBuffSize) {
@@ -200,6 +320,19 @@ class TFileTransport : public TFileReaderTransport,
     return readBuffSize_;
   }
 
+  /**
+   * Whether to read by mmap()ing the file a chunk at a time, instead of
+   * ::read()ing it into a buffer of getReadBuffSize() bytes.  Events that
+   * lie whole in the mapping are then used where they are rather than
+   * copied out.  Meant for scanning large logs; set it before reading.
+   */
+  void setMapReads(bool mapReads) {
+    mapReads_ = mapReads;
+  }
+  bool getMapReads() {
+    return mapReads_;
+  }
+
   static const int32_t TAIL_READ_TIMEOUT = -1;
   static const int32_t NO_TAIL_READ_TIMEOUT = 0;
   void setReadTimeout(int32_t readTimeout) {
@@ -230,6 +363,28 @@ class TFileTransport : public TFileReaderTransport,
     return eventBufferSize_;
   }
 
+  /**
+   * Number of staging buffers that writing threads are spread over.  Each
+   * thread always enqueues into the same one, so its events keep their
+   * order, and threads on different buffers don't contend for a lock.
+   * Each buffer holds up to getEventBufferSize() events, so this also
+   * multiplies how much can be queued before writers block.  Defaults to
+   * 1, a single buffer.
+   */
+  void setEnqueueShards(uint32_t enqueueShards) {
+    if (bufferAndThreadInitialized_) {
+      GlobalOutput("Cannot change the number of enqueue shards after writer thread started");
+      return;
+    }
+    if (enqueueShards) {
+      enqueueShards_ = enqueueShards;
+    }
+  }
+
+  uint32_t getEnqueueShards() {
+    return enqueueShards_;
+  }
+
   void setFlushMaxUs(uint32_t flushMaxUs) {
     if (flushMaxUs) {
       flushMaxUs_ = flushMaxUs;
@@ -271,12 +426,104 @@ class TFileTransport : public TFileReaderTransport,
     return eofSleepTime_;
   }
 
+  /**
+   * Whether the writer reserves disk space a chunk at a time (with
+   * fallocate(), where available), to keep chunks contiguous on disk.
+   * The file's size still grows only as events are written.
+   */
+  void setPreallocateChunks(bool preallocateChunks) {
+    preallocateChunks_ = preallocateChunks;
+  }
+  bool getPreallocateChunks() {
+    return preallocateChunks_;
+  }
+
+  /**
+   * Whether the writer keeps an index of the chunks it fills in a sidecar
+   * file (see TFileChunkIndex), for seekToTime() and seekToEvent().  Set it
+   * before the first write.  The writer only picks up an index that lacks
+   * no more than the chunk being written.  One further behind, e.g. for a
+   * log written without it, is caught up by the next seekToTime() or
+   * seekToEvent() instead, so that the writer never waits on a scan.
+   */
+  void setChunkIndex(bool chunkIndex) {
+    chunkIndex_ = chunkIndex;
+  }
+  bool getChunkIndex() {
+    return chunkIndex_;
+  }
+
+  /**
+   * Frames each event with a sync marker and a CRC32C of it, so that the
+   * reader catches any damage to it, and picks up again at the next whole
+   * event rather than giving up on the rest of the chunk.  It costs 8
+   * bytes an event.  A log must be read as it was written; set it before
+   * the first read or write.
+   */
+  void setEventChecksums(bool eventChecksums) {
+    if (bufferAndThreadInitialized_) {
+      GlobalOutput("Cannot change event checksums after writer thread started");
+      return;
+    }
+    eventChecksums_ = eventChecksums;
+  }
+  bool getEventChecksums() {
+    return eventChecksums_;
+  }
+
+  /**
+   * Compresses the log with codec.  Each chunk is compressed as a unit when
+   * the writer is done with it, and stored as a record with a small header
+   * giving its place in the log.  Chunk and event offsets are as they would
+   * be in a log that was not compressed, so seekToChunk() and the chunk
+   * index work as usual; the reader finds a chunk's record by walking the
+   * headers, and remembers where it found them.
+   *
+   * A flush writes out what the chunk holds so far as a record of its own,
+   * so frequent flushes cost compression.  A log must be read with the
+   * codec it was written with, and reads are never mapped.  Set it before
+   * the first read or write.
+   */
+  void setChunkCodec(boost::shared_ptr<TFileChunkCodec> codec) {
+    codec_ = codec;
+  }
+  boost::shared_ptr<TFileChunkCodec> getChunkCodec() {
+    return codec_;
+  }
+
  private:
   // helper functions for writing to a file
   void enqueueEvent(const uint8_t* buf, uint32_t eventLen, bool blockUntilFlush);
-  bool swapEventBuffers(struct timespec* deadline);
   bool initBufferAndWriteThread();
 
+  // A staging buffer, with its own lock, for the threads assigned to it.
+  // The writer thread swaps the buffer for the spare when collecting.
+  struct EnqueueShard {
+    EnqueueShard(uint32_t bufferSize, bool checksums);
+    ~EnqueueShard();
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notFull;
+    TFileTransportBuffer* buffer;
+    TFileTransportBuffer* spare;
+  };
+
+  // writer thread helpers: wait until there is something to do, then
+  // write out whatever the shards hold
+  uint64_t waitForEvents(struct timespec* deadline);
+  bool writeShards(uint32_t* unflushed);
+  void writeEvents(TFileTransportBuffer* buffer, uint32_t* unflushed);
+
+  // chunk index helpers: account for an event starting at offset, and
+  // account for all events from the start of a chunk to the end of the log
+  void indexEvent(TFileChunkIndex* index, TFileChunkIndex::Entry* current,
+                  off_t offset, int64_t minTime, int64_t maxTime);
+  void indexChunks(TFileChunkIndex* index, TFileChunkIndex::Entry* current,
+                   uint32_t fromChunk);
+  // indexes and saves the whole chunks that index lacks
+  void catchUpChunkIndex(TFileChunkIndex* index);
+  void skipEvents(uint64_t count);
+
   // control for writer thread
   static void* startWriterThread(void* ptr) {
     (((TFileTransport*)ptr)->writerThread());
@@ -284,13 +531,53 @@ class TFileTransport : public TFileReaderTransport,
   }
   void writerThread();
 
+  // writer thread helpers: events are gathered into iov_ and written with
+  // as few writev() calls as possible
+  void queueWrite(const uint8_t* buf, uint32_t len);
+  void queuePadding(uint32_t len);
+  void writeQueued();
+  void preallocateChunk(int64_t chunk);
+
+  // compressed logs: the header of each record, what the writer has of
+  // the chunk it is on, and what the reader has found of the records
+  struct RecordHeader {
+    uint32_t magic;
+    uint32_t codec;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t compressedLength;
+  };
+  static const uint32_t RECORD_MAGIC = 0x5446435a;
+
+  void stageChunk(const uint8_t* buf, uint32_t len);
+  void writeRecord();
+  off_t findRecord(off_t at, RecordHeader* header);
+  int checkRecord(off_t at, off_t size, RecordHeader* header);
+  void scanRecords();
+  int32_t readRecord();
+
   // helper functions for reading from a file
   eventInfo* readEvent();
+  eventInfo* completeEvent();
+  void recycleEvent(eventInfo* event);
+  int32_t mapNextWindow();
+  void unmapWindow();
 
   // event corruption-related functions
   bool isEventCorrupted();
   void performRecovery();
 
+  // checksummed events: the size of an event's header, whether the
+  // header being read starts with a sync marker (moving on to the next
+  // one that might if not), whether the event just read is intact, and
+  // where to look for the next event when it is not
+  uint32_t getEventHeaderSize() {
+    return eventChecksums_ ? TFileTransportBuffer::CHECKSUMMED_HEADER_SIZE : 4;
+  }
+  bool findSyncMarker();
+  bool isChecksumValid();
+  void resync(off_t eventOffset);
+
   // Utility functions
   void openLogFile();
   void getNextFlushTime(struct timespec* ts_next_flush);
@@ -298,7 +585,18 @@ class TFileTransport : public TFileReaderTransport,
   // Class variables
   readState readState_;
   uint8_t* readBuff_;
+  // where readState_'s buffer positions point into: readBuff_, or the
+  // mapped part of the file
+  const uint8_t* readWindow_;
+
+  // the current mapping of the file when reads are mapped, which starts a
+  // little before readWindow_ to be page aligned
+  bool mapReads_;
+  void* mapBase_;
+  size_t mapLen_;
   eventInfo* currentEvent_;
+  // an event already read, kept for its buffer
+  eventInfo* recycledEvent_;
 
   uint32_t readBuffSize_;
   static const uint32_t DEFAULT_READ_BUFF_SIZE = 1 * 1024 * 1024;
@@ -314,6 +612,10 @@ class TFileTransport : public TFileReaderTransport,
   uint32_t eventBufferSize_;
   static const uint32_t DEFAULT_EVENT_BUFFER_SIZE = 10000;
 
+  // number of staging buffers
+  uint32_t enqueueShards_;
+  static const uint32_t DEFAULT_ENQUEUE_SHARDS = 1;
+
   // max number of microseconds that can pass without flushing
   uint32_t flushMaxUs_;
   static const uint32_t DEFAULT_FLUSH_MAX_US = 3000000;
@@ -341,32 +643,65 @@ class TFileTransport : public TFileReaderTransport,
   // writer thread id
   pthread_t writerThreadId_;
 
-  // buffers to hold data before it is flushed. Each element of the buffer stores a msg that
-  // needs to be written to the file.  The buffers are swapped by the writer thread.
-  TFileTransportBuffer *dequeueBuffer_;
-  TFileTransportBuffer *enqueueBuffer_;
+  // buffers to hold data before it is written, enqueueShards_ of them
+  EnqueueShard** shards_;
+
+  // Mutex that guards waking the writer thread and flush requests; writing
+  // threads only take it when a shard goes from empty to non-empty
+  pthread_mutex_t mutex_;
 
-  // conditions used to block when the buffer is full or empty
-  pthread_cond_t notFull_, notEmpty_;
+  // signalled when there is work for the writer thread
+  pthread_cond_t notEmpty_;
+  bool pending_;
   volatile bool closing_;
 
-  // To keep track of whether the buffer has been flushed
+  // flush() takes a ticket, and waits on flushed_ until the writer has
+  // written and synced everything enqueued before the ticket was taken
   pthread_cond_t flushed_;
-  volatile bool forceFlush_;
-
-  // Mutex that is grabbed when enqueueing and swapping the read/write buffers
-  pthread_mutex_t mutex_;
+  uint64_t flushRequested_;
+  uint64_t flushCompleted_;
 
   // File information
   std::string filename_;
   int fd_;
 
   // Whether the writer thread and buffers have been initialized
-  bool bufferAndThreadInitialized_;
+  volatile bool bufferAndThreadInitialized_;
 
   // Offset within the file
   off_t offset_;
 
+  // Writes gathered by the writer thread, and the last chunk it reserved
+  std::vector<struct iovec> iov_;
+  bool preallocateChunks_;
+  int64_t preallocatedChunk_;
+
+  // the writer's chunk index, and the entry for the chunk being written
+  bool chunkIndex_;
+  TFileChunkIndex* writeIndex_;
+  TFileChunkIndex::Entry writeIndexEntry_;
+
+  // checksummed events, and bytes skipped looking for the next one
+  bool eventChecksums_;
+  uint64_t resyncSkipped_;
+
+  boost::shared_ptr<TFileChunkCodec> codec_;
+  // the writer's part of the current chunk not yet written, which starts at
+  // offset stagedOffset_ in the log, and the record made of it
+  std::vector<uint8_t> staged_;
+  off_t stagedOffset_;
+  std::vector<uint8_t> record_;
+  // the record reads continue from, and what they are read and uncompressed
+  // into
+  off_t recordOffset_;
+  std::vector<uint8_t> readRecord_;
+  std::vector<uint8_t> readChunk_;
+  // where each chunk's first record is, as far as the records have been
+  // scanned, and where the scan goes on from
+  std::vector<off_t> chunkRecords_;
+  off_t scannedTo_;
+  off_t scannedLength_;
+
   // event corruption information
   uint32_t lastBadChunk_;
   uint32_t numCorruptedEventsInChunk_;
@@ -382,6 +717,30 @@ class TEOFException : public TTransportException {
 };
 
 
+/**
+ * Makes the processor for each worker of a parallel replay (see
+ * TFileProcessor::processParallel()).
+ */
+class TFileProcessorFactory {
+ public:
+  virtual ~TFileProcessorFactory() {}
+
+  virtual boost::shared_ptr<TProcessor> getProcessor() = 0;
+};
+
+/**
+ * Key of an event in a parallel replay: events with the same key are
+ * processed one after another, in the order they are in the log.
+ */
+class TFileEventKey {
+ public:
+  virtual ~TFileEventKey() {}
+
+  virtual uint64_t getKey(const uint8_t* event, uint32_t len) = 0;
+};
+
+class TFileReplayProgress;
+
 // wrapper class to process events from a file containing thrift events
 class TFileProcessor {
  public:
@@ -428,12 +787,76 @@ class TFileProcessor {
    */
   void processChunk();
 
+  /**
+   * Whether to hand each event to the processor through a TMemoryBuffer
+   * over the event itself, rather than read it through the file transport.
+   * Combined with TFileTransport::setMapReads() this avoids copying events
+   * altogether.  Only for a TFileTransport input whose events each hold
+   * whole messages.
+   */
+  void setProcessInPlace(bool inPlace) {
+    inPlace_ = inPlace;
+  }
+
+  /**
+   * Replays the whole log on the threads of threadManager, and returns when
+   * it is done.  Each worker has a reader of its own and a processor from
+   * processorFactory, and processes each event in place, so the input must
+   * be a TFileTransport whose events each hold whole messages.  Replies go
+   * nowhere, whatever the output transport.
+   *
+   * Without a key, workers take turns at ranges of getParallelChunks()
+   * chunks, so events are processed in no particular order.  With one,
+   * this thread reads the log and hands each event to the worker its key
+   * picks, which keeps events with the same key in order.  Either way an
+   * event that fails is counted and skipped.  threadManager must be
+   * started, and not busy with anything else.
+   *
+   * A worker that fails outright, say on a log it cannot read, ends the
+   * replay: once the other workers are done this throws a
+   * TTransportException with its error.
+   */
+  void processParallel(boost::shared_ptr<concurrency::ThreadManager> threadManager,
+                       boost::shared_ptr<TFileProcessorFactory> processorFactory,
+                       boost::shared_ptr<TFileEventKey> key = boost::shared_ptr<TFileEventKey>());
+
+  void setParallelChunks(uint32_t parallelChunks) {
+    if (parallelChunks) {
+      parallelChunks_ = parallelChunks;
+    }
+  }
+  uint32_t getParallelChunks() {
+    return parallelChunks_;
+  }
+
+  /**
+   * Adds the progress of the running, or last, parallel replay to counters
+   * as "<prefix>.<counter>", for fb303's getCounters(): chunks, chunks_done,
+   * events and failed, and for each worker events, failed and events_per_sec
+   * (over the time it spent processing) as "<prefix>.worker<n>.<counter>".
+   */
+  void getCounters(std::map<std::string, int64_t>& counters,
+                   const std::string& prefix = "file_replay");
+
  private:
+  boost::shared_ptr<protocol::TProtocol> getInputProtocol(boost::shared_ptr<TMemoryBuffer>* event);
+  void nextEvent(TMemoryBuffer* event);
+  // Another reader of input's file, set up to read it the same way
+  boost::shared_ptr<TFileTransport> openReader(TFileTransport* input);
+
+  // chunks per range handed to a worker when events need no ordering
+  static const uint32_t DEFAULT_PARALLEL_CHUNKS = 4;
+  // events queued for each worker when they do
+  static const uint32_t MAX_QUEUED_EVENTS = 1024;
+
   boost::shared_ptr<TProcessor> processor_;
   boost::shared_ptr<TProtocolFactory> inputProtocolFactory_;
   boost::shared_ptr<TProtocolFactory> outputProtocolFactory_;
   boost::shared_ptr<TFileReaderTransport> inputTransport_;
   boost::shared_ptr<TTransport> outputTransport_;
+  bool inPlace_;
+  uint32_t parallelChunks_;
+  boost::shared_ptr<TFileReplayProgress> progress_;
 };
 
 
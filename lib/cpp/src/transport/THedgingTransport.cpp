@@ -0,0 +1,316 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <concurrency/Util.h>
+#include "THedgingTransport.h"
+#include "TTransportException.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::protocol::T_ONEWAY;
+using apache::thrift::concurrency::Util;
+
+// Unspent hedges carried over, so a quiet spell cannot save up a burst
+static const double kMaxHedgeTokens = 10.0;
+
+THedgingTransport::THedgingTransport(const vector< shared_ptr<TSocketPoolServer> >& servers,
+                                     shared_ptr<TProtocolFactory> protocolFactory) :
+  protocolFactory_(protocolFactory),
+  primary_(new TSocketPool(servers)),
+  backup_(new TSocketPool()),
+  servers_(servers),
+  filter_(NULL),
+  hedgeDelay_(50),
+  budgetPercent_(5),
+  hedgeTokens_(0),
+  numHedgeable_(0),
+  numHedgesSent_(0),
+  numHedgesWon_(0) {
+  for (size_t i = 0; i < servers.size(); ++i) {
+    backupServers_.push_back(shared_ptr<TSocketPoolServer>(
+        new TSocketPoolServer(servers[i]->host_, servers[i]->port_)));
+  }
+}
+
+THedgingTransport::~THedgingTransport() {
+  close();
+}
+
+bool THedgingTransport::isOpen() {
+  return primary_->isOpen();
+}
+
+bool THedgingTransport::peek() {
+  return recvBuf_.available_read() > 0 || primary_->peek();
+}
+
+void THedgingTransport::open() {
+  primary_->open();
+}
+
+void THedgingTransport::close() {
+  primary_->close();
+  backup_->close();
+}
+
+uint32_t THedgingTransport::read(uint8_t* buf, uint32_t len) {
+  return recvBuf_.read(buf, len);
+}
+
+void THedgingTransport::write(const uint8_t* buf, uint32_t len) {
+  sendBuf_.write(buf, len);
+}
+
+const uint8_t* THedgingTransport::borrow(uint8_t* buf, uint32_t* len) {
+  return recvBuf_.borrow(buf, len);
+}
+
+void THedgingTransport::consume(uint32_t len) {
+  recvBuf_.consume(len);
+}
+
+void THedgingTransport::earnHedgeToken() {
+  hedgeTokens_ += budgetPercent_ / 100.0;
+  if (hedgeTokens_ > kMaxHedgeTokens) {
+    hedgeTokens_ = kMaxHedgeTokens;
+  }
+}
+
+int64_t THedgingTransport::recvDeadline(TSocketPool* pool, int64_t sentAt) {
+  if (pool == NULL || pool->getRecvTimeout() <= 0) {
+    return 0;
+  }
+  return sentAt + pool->getRecvTimeout();
+}
+
+bool THedgingTransport::openBackup() {
+  shared_ptr<TSocketPoolServer> current = primary_->getCurrentServer();
+  if (backup_->isOpen()) {
+    shared_ptr<TSocketPoolServer> other = backup_->getCurrentServer();
+    if (other->host_ != current->host_ || other->port_ != current->port_) {
+      return true;
+    }
+    backup_->close();
+  }
+
+  vector< shared_ptr<TSocketPoolServer> > others;
+  for (size_t i = 0; i < servers_.size(); ++i) {
+    if (servers_[i] != current) {
+      others.push_back(backupServers_[i]);
+    }
+  }
+  if (others.empty()) {
+    return false;
+  }
+  backup_->setServers(others);
+  try {
+    backup_->open();
+  } catch (TTransportException& ttx) {
+    GlobalOutput.printf("THedgingTransport: no server to hedge to: %s", ttx.what());
+    return false;
+  }
+  return true;
+}
+
+void THedgingTransport::sendFrame(TSocketPool* pool) {
+  uint8_t* data;
+  uint32_t sz;
+  sendBuf_.getBuffer(&data, &sz);
+  int32_t frameSize = htonl((int32_t)sz);
+  pool->write((uint8_t*)&frameSize, sizeof(frameSize));
+  pool->write(data, sz);
+  pool->flush();
+}
+
+void THedgingTransport::readFrame(TSocketPool* pool) {
+  int32_t frameSize;
+  pool->readAll((uint8_t*)&frameSize, sizeof(frameSize));
+  frameSize = ntohl(frameSize);
+  if (frameSize < 0) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "THedgingTransport: negative frame size");
+  }
+  recvBuf_.resetBuffer();
+  uint8_t* dst = recvBuf_.getWritePtr(frameSize);
+  pool->readAll(dst, frameSize);
+  recvBuf_.wroteBytes(frameSize);
+}
+
+TSocketPool* THedgingTransport::waitReadable(TSocketPool* a, TSocketPool* b, int timeout) {
+  struct pollfd fds[2];
+  int nfds = 0;
+  fds[nfds].fd = a->getSocketFD();
+  fds[nfds].events = POLLIN;
+  nfds++;
+  if (b != NULL) {
+    fds[nfds].fd = b->getSocketFD();
+    fds[nfds].events = POLLIN;
+    nfds++;
+  }
+
+  int ret;
+  do {
+    ret = poll(fds, nfds, timeout);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    int errno_copy = errno;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "THedgingTransport: poll() failed", errno_copy);
+  }
+  for (int i = 0; i < nfds; ++i) {
+    if (fds[i].revents != 0) {
+      return i == 0 ? a : b;
+    }
+  }
+  return NULL;
+}
+
+void THedgingTransport::flush() {
+  // Find out what we are sending
+  string fname;
+  TMessageType mtype;
+  int32_t seqid;
+  {
+    uint8_t* data;
+    uint32_t sz;
+    sendBuf_.getBuffer(&data, &sz);
+    shared_ptr<TMemoryBuffer> header(new TMemoryBuffer(data, sz));
+    shared_ptr<TProtocol> prot = protocolFactory_->getProtocol(header);
+    prot->readMessageBegin(fname, mtype, seqid);
+  }
+
+  if (!primary_->isOpen()) {
+    primary_->open();
+  }
+  int64_t sentAt = Util::currentTime();
+  try {
+    sendFrame(primary_.get());
+  } catch (...) {
+    sendBuf_.resetBuffer();
+    primary_->close();
+    throw;
+  }
+
+  if (mtype == T_ONEWAY) {
+    sendBuf_.resetBuffer();
+    return;
+  }
+
+  TSocketPool* waiting = primary_.get();
+  TSocketPool* hedge = NULL;
+  int64_t hedgeSentAt = 0;
+  if (filter_ != NULL && filter_(fname)) {
+    numHedgeable_++;
+    earnHedgeToken();
+    if (hedgeTokens_ >= 1.0 &&
+        waitReadable(waiting, NULL, hedgeDelay_) == NULL &&
+        openBackup()) {
+      try {
+        hedgeSentAt = Util::currentTime();
+        sendFrame(backup_.get());
+        hedge = backup_.get();
+        hedgeTokens_ -= 1.0;
+        numHedgesSent_++;
+      } catch (TTransportException& ttx) {
+        GlobalOutput.printf("THedgingTransport: hedge failed: %s", ttx.what());
+        backup_->close();
+      }
+    }
+  }
+  sendBuf_.resetBuffer();
+
+  if (hedge == NULL) {
+    try {
+      readFrame(waiting);
+    } catch (...) {
+      waiting->close();
+      throw;
+    }
+    return;
+  }
+
+  // Take whichever reply comes first.  If that connection fails or runs out
+  // of time, fall back to the other one.
+  int64_t waitingDeadline = recvDeadline(waiting, sentAt);
+  int64_t hedgeDeadline = recvDeadline(hedge, hedgeSentAt);
+  for (;;) {
+    int64_t now = Util::currentTime();
+    if (hedge != NULL && hedgeDeadline > 0 && now >= hedgeDeadline) {
+      hedge->close();
+      hedge = NULL;
+    }
+    if (waitingDeadline > 0 && now >= waitingDeadline) {
+      waiting->close();
+      waiting = hedge;
+      waitingDeadline = hedgeDeadline;
+      hedge = NULL;
+    }
+    if (waiting == NULL) {
+      throw TTransportException(TTransportException::TIMED_OUT,
+                                "THedgingTransport: no reply in time");
+    }
+
+    int64_t deadline = waitingDeadline;
+    if (hedge != NULL && hedgeDeadline > 0 &&
+        (deadline == 0 || hedgeDeadline < deadline)) {
+      deadline = hedgeDeadline;
+    }
+    TSocketPool* ready = waitReadable(waiting, hedge,
+                                      deadline > 0 ? (int)(deadline - now) : -1);
+    if (ready == NULL) {
+      continue;
+    }
+    TSocketPool* loser = (ready == waiting) ? hedge : waiting;
+    int64_t loserDeadline = (ready == waiting) ? hedgeDeadline : waitingDeadline;
+    try {
+      readFrame(ready);
+    } catch (TTransportException& ttx) {
+      ready->close();
+      if (loser == NULL) {
+        throw;
+      }
+      GlobalOutput.printf("THedgingTransport: reply failed, waiting for the other: %s",
+                          ttx.what());
+      waiting = loser;
+      waitingDeadline = loserDeadline;
+      hedge = NULL;
+      continue;
+    }
+    if (ready == backup_.get()) {
+      numHedgesWon_++;
+    }
+    if (loser != NULL) {
+      // Its reply would arrive ahead of the next one
+      loser->close();
+    }
+    return;
+  }
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,209 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_THEDGINGTRANSPORT_H_
+#define _THRIFT_TRANSPORT_THEDGINGTRANSPORT_H_ 1
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <protocol/TProtocol.h>
+#include "TBufferTransports.h"
+#include "TSocketPool.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Framed client transport that hedges idempotent calls across a pool of
+ * equivalent servers.
+ *
+ * Each call goes to a primary server picked by a TSocketPool.  If the call
+ * is hedgeable and no reply has arrived after the hedge delay, the same
+ * frame is sent to a second server and whichever reply arrives first is
+ * returned; the connection with the other reply still pending is closed.
+ * Closing counts the loser's elapsed time against its latency average, so
+ * with a latency-aware policy on the primary (see TSocketPoolPolicy) a
+ * server that keeps losing soon stops being picked.
+ *
+ * Only calls whose name passes the hedge filter are hedged.  Generated
+ * clients have a static isIdempotent() listing the functions annotated
+ * (idempotent = "true"), which is meant to be used here:
+ *
+ *   shared_ptr<THedgingTransport> trans(new THedgingTransport(servers, pf));
+ *   trans->setHedgeFilter(&MyServiceClient::isIdempotent);
+ *   MyServiceClient client(pf->getProtocol(trans));
+ *
+ * Hedges are limited by a budget: each hedgeable call earns budget/100 of a
+ * hedge, whether or not it turns out slow, and each hedge sent spends a
+ * whole one, so a budget of 5 allows hedging at most about 5% of them.
+ *
+ * Once a call is hedged each request waits at most its pool's receive
+ * timeout, counted from when it was sent; if neither reply arrives in time
+ * the call fails with TIMED_OUT.
+ *
+ * A oneway call is recognised by its T_ONEWAY message type, so a client
+ * that makes oneway calls through this transport must be generated with
+ * the cpp:oneway_mtype option; otherwise flush() waits for a reply that
+ * never comes.
+ *
+ * Replaces TFramedTransport; the servers must use framing.  Like the other
+ * transports it is not thread safe.
+ *
+ */
+class THedgingTransport : public TTransport {
+ public:
+  typedef bool (*HedgeFilter)(const std::string& fname);
+
+  /**
+   * @param servers   the interchangeable servers; at least two are needed
+   *                  for hedging to happen
+   * @param protocolFactory protocol the client uses, to read call names
+   */
+  THedgingTransport(const std::vector< boost::shared_ptr<TSocketPoolServer> >& servers,
+                    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory);
+
+  ~THedgingTransport();
+
+  bool isOpen();
+
+  bool peek();
+
+  /**
+   * Opens the primary pool.  The backup is opened on the first hedge.
+   */
+  void open();
+
+  void close();
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  /**
+   * Sends the buffered call and, unless it is oneway, waits for its reply.
+   */
+  void flush();
+
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+
+  void consume(uint32_t len);
+
+  /**
+   * Calls for which filter returns true are hedged.  NULL, the default,
+   * hedges nothing.
+   */
+  void setHedgeFilter(HedgeFilter filter) {
+    filter_ = filter;
+  }
+
+  /**
+   * How long to wait for the primary before hedging, in ms.  Around the
+   * servers' 95th percentile latency is a good start.
+   */
+  void setHedgeDelay(int ms) {
+    hedgeDelay_ = ms;
+  }
+
+  /**
+   * Most hedges to send, as a percentage of hedgeable calls.
+   */
+  void setHedgeBudget(double percent) {
+    budgetPercent_ = percent;
+  }
+
+  /**
+   * The pools the primary and hedged requests go through, e.g. to set
+   * timeouts or a policy.
+   */
+  boost::shared_ptr<TSocketPool> getPrimary() {
+    return primary_;
+  }
+
+  boost::shared_ptr<TSocketPool> getBackup() {
+    return backup_;
+  }
+
+  /**
+   * Number of calls that passed the filter, hedges sent, and hedges whose
+   * reply came first.
+   */
+  uint64_t getNumHedgeable() const {
+    return numHedgeable_;
+  }
+
+  uint64_t getNumHedgesSent() const {
+    return numHedgesSent_;
+  }
+
+  uint64_t getNumHedgesWon() const {
+    return numHedgesWon_;
+  }
+
+ private:
+  /**
+   * Makes sure the backup is connected to some server other than the
+   * primary's.  Returns false if that is not possible.
+   */
+  bool openBackup();
+
+  void earnHedgeToken();
+
+  /**
+   * When the reply to a request sent at sentAt (ms) is due, or 0 if the
+   * pool has no receive timeout.
+   */
+  static int64_t recvDeadline(TSocketPool* pool, int64_t sentAt);
+
+  void sendFrame(TSocketPool* pool);
+
+  void readFrame(TSocketPool* pool);
+
+  /**
+   * Waits up to timeout ms (-1 for ever) for either socket to become
+   * readable, returning the ready one or NULL.
+   */
+  TSocketPool* waitReadable(TSocketPool* a, TSocketPool* b, int timeout);
+
+  boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory_;
+
+  boost::shared_ptr<TSocketPool> primary_;
+  boost::shared_ptr<TSocketPool> backup_;
+
+  // The backup's own copies of the servers, in the same order, so that it
+  // keeps its own connections
+  std::vector< boost::shared_ptr<TSocketPoolServer> > servers_;
+  std::vector< boost::shared_ptr<TSocketPoolServer> > backupServers_;
+
+  TMemoryBuffer sendBuf_;
+  TMemoryBuffer recvBuf_;
+
+  HedgeFilter filter_;
+  int hedgeDelay_;
+  double budgetPercent_;
+  double hedgeTokens_;
+
+  uint64_t numHedgeable_;
+  uint64_t numHedgesSent_;
+  uint64_t numHedgesWon_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_THEDGINGTRANSPORT_H_
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 
 #include "concurrency/Monitor.h"
+#include "concurrency/Util.h"
 #include "TSocket.h"
 #include "TTransportException.h"
 
@@ -52,6 +53,7 @@ TSocket::TSocket(string host, int port) :
   port_(port),
   socket_(-1),
   connTimeout_(0),
+  connectStagger_(0),
   sendTimeout_(0),
   recvTimeout_(0),
   lingerOn_(1),
@@ -67,6 +69,7 @@ TSocket::TSocket() :
   port_(0),
   socket_(-1),
   connTimeout_(0),
+  connectStagger_(0),
   sendTimeout_(0),
   recvTimeout_(0),
   lingerOn_(1),
@@ -82,6 +85,7 @@ TSocket::TSocket(int socket) :
   port_(0),
   socket_(socket),
   connTimeout_(0),
+  connectStagger_(0),
   sendTimeout_(0),
   recvTimeout_(0),
   lingerOn_(1),
@@ -125,6 +129,19 @@ bool TSocket::peek() {
   return (r > 0);
 }
 
+bool TSocket::isIdleUsable() {
+  if (!isOpen()) {
+    return false;
+  }
+  uint8_t buf;
+  int r = recv(socket_, &buf, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (r == -1) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+  }
+  // 0 is an orderly shutdown; anything else is a stray response.
+  return false;
+}
+
 void TSocket::openConnection(struct addrinfo *res) {
   if (isOpen()) {
     throw TTransportException(TTransportException::ALREADY_OPEN);
@@ -234,6 +251,15 @@ void TSocket::open() {
     throw TTransportException(TTransportException::NOT_OPEN, "Specified port is invalid");
   }
 
+  if (connectStagger_ > 0) {
+    vector<ConnectCandidate> candidates;
+    vector<bool> failed;
+    vector<bool> started;
+    resolve(host_, port_, 0, candidates);
+    raceConnect(candidates, failed, started);
+    return;
+  }
+
   struct addrinfo hints, *res, *res0;
   res = NULL;
   res0 = NULL;
@@ -275,6 +301,215 @@ void TSocket::open() {
   freeaddrinfo(res0);
 }
 
+void TSocket::resolve(const string& host, int port, int tag,
+                      vector<ConnectCandidate>& candidates) {
+  struct addrinfo hints, *res, *res0;
+  char portStr[sizeof("65536")];
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  sprintf(portStr, "%d", port);
+
+  int error = getaddrinfo(host.c_str(), portStr, &hints, &res0);
+  if (error) {
+    string errStr = "TSocket::resolve() getaddrinfo() " + host + ": " + string(gai_strerror(error));
+    GlobalOutput(errStr.c_str());
+    throw TTransportException(TTransportException::NOT_OPEN, "Could not resolve host for client socket.");
+  }
+
+  // Split by family, then interleave starting with the resolver's
+  // favourite.
+  vector<ConnectCandidate> first;
+  vector<ConnectCandidate> other;
+  for (res = res0; res; res = res->ai_next) {
+    if (res->ai_addrlen > sizeof(struct sockaddr_storage)) {
+      continue;
+    }
+    ConnectCandidate c;
+    std::memcpy(&c.addr, res->ai_addr, res->ai_addrlen);
+    c.addrLen = res->ai_addrlen;
+    c.family = res->ai_family;
+    c.socktype = res->ai_socktype;
+    c.protocol = res->ai_protocol;
+    c.tag = tag;
+    if (first.empty() || c.family == first[0].family) {
+      first.push_back(c);
+    } else {
+      other.push_back(c);
+    }
+  }
+  freeaddrinfo(res0);
+
+  for (size_t i = 0; i < first.size() || i < other.size(); ++i) {
+    if (i < first.size()) {
+      candidates.push_back(first[i]);
+    }
+    if (i < other.size()) {
+      candidates.push_back(other[i]);
+    }
+  }
+}
+
+size_t TSocket::raceConnect(vector<ConnectCandidate>& candidates,
+                            vector<bool>& failed,
+                            vector<bool>& started) {
+  if (isOpen()) {
+    throw TTransportException(TTransportException::ALREADY_OPEN);
+  }
+
+  failed.assign(candidates.size(), false);
+  started.assign(candidates.size(), false);
+  vector<int> fds(candidates.size(), -1);
+  vector<struct pollfd> pfds;
+  vector<size_t> pidx;
+
+  int64_t now = concurrency::Util::currentTime();
+  int64_t deadline = (connTimeout_ > 0) ? now + connTimeout_ : 0;
+  int64_t nextStart = now;
+  size_t next = 0;
+  bool exhausted = false;
+  int inFlight = 0;
+  int lastErrno = 0;
+  bool won = false;
+  size_t winner = 0;
+
+  while (!won) {
+    now = concurrency::Util::currentTime();
+
+    // Start the next connect when it is due, or when nothing is left
+    // running.  Further candidates are only asked for at that point.
+    if (!exhausted && (now >= nextStart || inFlight == 0)) {
+      if (next == candidates.size()) {
+        if (!moreCandidates(candidates)) {
+          exhausted = true;
+        }
+        failed.resize(candidates.size(), false);
+        started.resize(candidates.size(), false);
+        fds.resize(candidates.size(), -1);
+        continue;
+      }
+      if (next > 0 && !mayStartConnect()) {
+        exhausted = true;
+        continue;
+      }
+      const ConnectCandidate& c = candidates[next];
+      started[next] = true;
+      int fd = socket(c.family, c.socktype, c.protocol);
+      if (fd == -1) {
+        lastErrno = errno;
+        failed[next++] = true;
+        continue;
+      }
+      int flags = fcntl(fd, F_GETFL, 0);
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      int ret = connect(fd, (struct sockaddr*)&c.addr, c.addrLen);
+      if (ret == 0) {
+        fds[next] = fd;
+        winner = next++;
+        won = true;
+        break;
+      }
+      if (errno != EINPROGRESS) {
+        lastErrno = errno;
+        ::close(fd);
+        failed[next++] = true;
+        continue;
+      }
+      fds[next++] = fd;
+      inFlight++;
+      nextStart = now + connectStagger_;
+      continue;
+    }
+
+    if (inFlight == 0) {
+      break;
+    }
+    if (deadline > 0 && now >= deadline) {
+      break;
+    }
+
+    int timeout = -1;
+    if (!exhausted) {
+      timeout = (int)(nextStart - now);
+    }
+    if (deadline > 0 && (timeout < 0 || deadline - now < timeout)) {
+      timeout = (int)(deadline - now);
+    }
+
+    pfds.clear();
+    pidx.clear();
+    for (size_t i = 0; i < next; ++i) {
+      if (fds[i] >= 0) {
+        struct pollfd p;
+        p.fd = fds[i];
+        p.events = POLLOUT;
+        p.revents = 0;
+        pfds.push_back(p);
+        pidx.push_back(i);
+      }
+    }
+    int ret = poll(&pfds[0], pfds.size(), timeout);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      lastErrno = errno;
+      break;
+    }
+
+    for (size_t j = 0; j < pfds.size() && !won; ++j) {
+      if (pfds[j].revents == 0) {
+        continue;
+      }
+      size_t i = pidx[j];
+      int val = 0;
+      socklen_t lon = sizeof(int);
+      if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, (void *)&val, &lon) == -1) {
+        val = errno;
+      }
+      if (val == 0) {
+        winner = i;
+        won = true;
+      } else {
+        lastErrno = val;
+        ::close(fds[i]);
+        fds[i] = -1;
+        failed[i] = true;
+        inFlight--;
+        // Don't wait out the stagger behind a refused connect
+        nextStart = now;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if ((!won || i != winner) && fds[i] >= 0) {
+      ::close(fds[i]);
+    }
+  }
+
+  if (!won) {
+    string errStr = "TSocket::raceConnect() no address connected " + getSocketInfo();
+    GlobalOutput.perror(errStr.c_str(), lastErrno);
+    throw TTransportException(TTransportException::NOT_OPEN, "open() failed", lastErrno);
+  }
+
+  // Back to blocking, then the usual options
+  socket_ = fds[winner];
+  int flags = fcntl(socket_, F_GETFL, 0);
+  fcntl(socket_, F_SETFL, flags & ~O_NONBLOCK);
+  if (sendTimeout_ > 0) {
+    setSendTimeout(sendTimeout_);
+  }
+  if (recvTimeout_ > 0) {
+    setRecvTimeout(recvTimeout_);
+  }
+  setLinger(lingerOn_, lingerVal_);
+  setNoDelay(noDelay_);
+  return winner;
+}
+
 void TSocket::close() {
   if (socket_ >= 0) {
     shutdown(socket_, SHUT_RDWR);
@@ -470,6 +705,10 @@ void TSocket::setConnTimeout(int ms) {
   connTimeout_ = ms;
 }
 
+void TSocket::setConnectStagger(int ms) {
+  connectStagger_ = ms;
+}
+
 void TSocket::setRecvTimeout(int ms) {
   if (ms < 0) {
     char errBuf[512];
@@ -21,6 +21,8 @@
 #define _THRIFT_TRANSPORT_TSOCKET_H_ 1
 
 #include <string>
+#include <vector>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 #include "TTransport.h"
@@ -75,6 +77,13 @@ class TSocket : public TTransport {
    */
   bool peek();
 
+  /**
+   * Checks, without blocking, whether an idle connection can still carry a
+   * request: false if the peer has closed or reset it, or has sent data
+   * nobody asked for.
+   */
+  bool isIdleUsable();
+
   /**
    * Creates and opens the UNIX socket.
    *
@@ -146,11 +155,28 @@ class TSocket : public TTransport {
    */
   void setConnTimeout(int ms);
 
+  /**
+   * Races connects instead of trying addresses one at a time ("happy
+   * eyeballs").  With a stagger of ms > 0, open() starts connecting to the
+   * next address whenever those already started have gone ms without
+   * connecting, or as soon as they have all failed.  It keeps the first
+   * socket to connect and closes the rest, and the connect timeout bounds
+   * the whole race.  0, the default, tries each address in turn.
+   */
+  void setConnectStagger(int ms);
+
   /**
    * Set the receive timeout
    */
   void setRecvTimeout(int ms);
 
+  /**
+   * The receive timeout in ms, 0 for none
+   */
+  int getRecvTimeout() {
+    return recvTimeout_;
+  }
+
   /**
    * Set the send timeout
    */
@@ -162,6 +188,14 @@ class TSocket : public TTransport {
    */
   void setMaxRecvRetries(int maxRecvRetries);
 
+  /**
+   * The underlying UNIX socket handle, or -1 if not open.  Lets callers
+   * poll() several sockets at once.
+   */
+  int getSocketFD() {
+    return socket_;
+  }
+
   /**
    * Get socket information formated as a string <Host: x Port: x>
    */
@@ -193,6 +227,52 @@ class TSocket : public TTransport {
   /** connect, called by open */
   void openConnection(struct addrinfo *res);
 
+  /** An address to connect to; tag tells the caller whose it is */
+  struct ConnectCandidate {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    int family;
+    int socktype;
+    int protocol;
+    int tag;
+  };
+
+  /**
+   * Appends the addresses of host:port to candidates, alternating address
+   * families so that a broken family costs one stagger, not all of them.
+   */
+  static void resolve(const std::string& host, int port, int tag,
+                      std::vector<ConnectCandidate>& candidates);
+
+  /**
+   * Races connects to candidates as described for setConnectStagger(), in
+   * order, and makes the winner this socket.  When the list runs out,
+   * moreCandidates() is asked to extend it.  Returns the winner's index;
+   * started says which candidates a connect was begun for, and failed
+   * which of those were refused or errored, as opposed to abandoned.
+   *
+   * @throws TTransportException if none connected in time
+   */
+  size_t raceConnect(std::vector<ConnectCandidate>& candidates,
+                     std::vector<bool>& failed,
+                     std::vector<bool>& started);
+
+  /**
+   * Asked by raceConnect() when the next connect is due and no candidate
+   * is left.  Appends any more it has and returns true, or returns false
+   * once there are none.
+   */
+  virtual bool moreCandidates(std::vector<ConnectCandidate>& /* candidates */) {
+    return false;
+  }
+
+  /**
+   * Asked before each connect the race starts after the first.
+   */
+  virtual bool mayStartConnect() {
+    return true;
+  }
+
   /** Host to connect to */
   std::string host_;
 
@@ -214,6 +294,9 @@ class TSocket : public TTransport {
   /** Connect timeout in ms */
   int connTimeout_;
 
+  /** Delay between racing connects in ms, 0 to connect in turn */
+  int connectStagger_;
+
   /** Send timeout in ms */
   int sendTimeout_;
 
@@ -19,6 +19,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <sys/time.h>
 
 #include "TSocketPool.h"
 
@@ -27,6 +29,13 @@ namespace apache { namespace thrift { namespace transport {
 using namespace std;
 
 using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+
+static int64_t nowUsec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
 /**
  * TSocketPoolServer implementation
@@ -37,7 +46,16 @@ TSocketPoolServer::TSocketPoolServer()
     port_(0),
     socket_(-1),
     lastFailTime_(0),
-    consecutiveFailures_(0) {}
+    consecutiveFailures_(0),
+    latencyEwma_(0),
+    outstanding_(0),
+    breakerState_(BREAKER_CLOSED),
+    windowErrors_(0),
+    windowTimeouts_(0),
+    openedAtMs_(0),
+    trialInFlight_(false),
+    numTrips_(0),
+    numRejected_(0) {}
 
 /**
  * Constructor for TSocketPool server
@@ -47,7 +65,268 @@ TSocketPoolServer::TSocketPoolServer(const string &host, int port)
     port_(port),
     socket_(-1),
     lastFailTime_(0),
-    consecutiveFailures_(0) {}
+    consecutiveFailures_(0),
+    latencyEwma_(0),
+    outstanding_(0),
+    breakerState_(BREAKER_CLOSED),
+    windowErrors_(0),
+    windowTimeouts_(0),
+    openedAtMs_(0),
+    trialInFlight_(false),
+    numTrips_(0),
+    numRejected_(0) {}
+
+void TSocketPoolServer::callStarted() {
+  Guard g(statsMutex_);
+  ++outstanding_;
+}
+
+void TSocketPoolServer::callFinished(int64_t latencyUs, double alpha) {
+  Guard g(statsMutex_);
+  if (outstanding_ > 0) {
+    --outstanding_;
+  }
+  if (latencyUs < 0) {
+    return;
+  }
+  if (latencyEwma_ == 0) {
+    latencyEwma_ = (double)latencyUs;
+  } else {
+    latencyEwma_ += alpha * ((double)latencyUs - latencyEwma_);
+  }
+}
+
+double TSocketPoolServer::getLatencyEwma() const {
+  Guard g(statsMutex_);
+  return latencyEwma_;
+}
+
+int TSocketPoolServer::getOutstanding() const {
+  Guard g(statsMutex_);
+  return outstanding_;
+}
+
+bool TSocketPoolServer::isAvailable(const TCircuitBreakerConfig& config, int64_t nowMs) {
+  Guard g(statsMutex_);
+  switch (breakerState_) {
+  case BREAKER_OPEN:
+    return nowMs - openedAtMs_ >= config.openTimeMs;
+  case BREAKER_HALF_OPEN:
+    return !trialInFlight_;
+  default:
+    return true;
+  }
+}
+
+bool TSocketPoolServer::tryAcquire(const TCircuitBreakerConfig& config, int64_t nowMs) {
+  Guard g(statsMutex_);
+  if (breakerState_ == BREAKER_OPEN && nowMs - openedAtMs_ >= config.openTimeMs) {
+    breakerState_ = BREAKER_HALF_OPEN;
+    trialInFlight_ = false;
+  }
+  if (breakerState_ == BREAKER_CLOSED) {
+    return true;
+  }
+  if (breakerState_ == BREAKER_HALF_OPEN && !trialInFlight_) {
+    trialInFlight_ = true;
+    return true;
+  }
+  ++numRejected_;
+  return false;
+}
+
+void TSocketPoolServer::trip(int64_t nowMs) {
+  if (breakerState_ != BREAKER_OPEN) {
+    ++numTrips_;
+  }
+  breakerState_ = BREAKER_OPEN;
+  openedAtMs_ = nowMs;
+  trialInFlight_ = false;
+  window_.clear();
+  windowErrors_ = 0;
+  windowTimeouts_ = 0;
+}
+
+void TSocketPoolServer::recordOutcome(CallOutcome outcome,
+                                      const TCircuitBreakerConfig& config,
+                                      int64_t nowMs) {
+  Guard g(statsMutex_);
+  if (outcome == CALL_ABANDONED) {
+    if (breakerState_ == BREAKER_HALF_OPEN) {
+      // Let another call try
+      trialInFlight_ = false;
+    }
+    return;
+  }
+
+  switch (breakerState_) {
+  case BREAKER_OPEN:
+    // Stragglers from before it opened.  Failures keep it open longer.
+    if (outcome != CALL_OK) {
+      openedAtMs_ = nowMs;
+    }
+    return;
+  case BREAKER_HALF_OPEN:
+    if (outcome == CALL_OK) {
+      breakerState_ = BREAKER_CLOSED;
+      trialInFlight_ = false;
+    } else {
+      trip(nowMs);
+    }
+    return;
+  default:
+    break;
+  }
+
+  window_.push_back(outcome);
+  if (outcome == CALL_ERROR) {
+    ++windowErrors_;
+  } else if (outcome == CALL_TIMEOUT) {
+    ++windowTimeouts_;
+  }
+  while ((int)window_.size() > config.windowSize) {
+    if (window_.front() == CALL_ERROR) {
+      --windowErrors_;
+    } else if (window_.front() == CALL_TIMEOUT) {
+      --windowTimeouts_;
+    }
+    window_.pop_front();
+  }
+
+  double n = (double)window_.size();
+  if ((int)window_.size() >= config.minCalls &&
+      (windowErrors_ / n >= config.maxErrorRate ||
+       windowTimeouts_ / n >= config.maxTimeoutRate)) {
+    trip(nowMs);
+  }
+}
+
+TSocketPoolServer::BreakerState TSocketPoolServer::getBreakerState() const {
+  Guard g(statsMutex_);
+  return breakerState_;
+}
+
+uint64_t TSocketPoolServer::getNumTrips() const {
+  Guard g(statsMutex_);
+  return numTrips_;
+}
+
+uint64_t TSocketPoolServer::getNumRejected() const {
+  Guard g(statsMutex_);
+  return numRejected_;
+}
+
+/**
+ * TRetryBudget implementation
+ *
+ */
+TRetryBudget::TRetryBudget(double ratio, double reserve) :
+  ratio_(ratio),
+  reserve_(reserve),
+  balance_(reserve),
+  numRequests_(0),
+  numRetries_(0),
+  numRetriesDenied_(0) {}
+
+void TRetryBudget::requestStarted() {
+  Guard g(mutex_);
+  ++numRequests_;
+  balance_ += ratio_;
+  if (balance_ > reserve_) {
+    balance_ = reserve_;
+  }
+}
+
+bool TRetryBudget::tryRetry() {
+  Guard g(mutex_);
+  if (balance_ < 1.0) {
+    ++numRetriesDenied_;
+    return false;
+  }
+  balance_ -= 1.0;
+  ++numRetries_;
+  return true;
+}
+
+uint64_t TRetryBudget::getNumRequests() const {
+  Guard g(mutex_);
+  return numRequests_;
+}
+
+uint64_t TRetryBudget::getNumRetries() const {
+  Guard g(mutex_);
+  return numRetries_;
+}
+
+uint64_t TRetryBudget::getNumRetriesDenied() const {
+  Guard g(mutex_);
+  return numRetriesDenied_;
+}
+
+/**
+ * Selection policies
+ *
+ */
+
+void TRandomPolicy::order(vector< shared_ptr<TSocketPoolServer> >& servers) {
+  random_shuffle(servers.begin(), servers.end());
+}
+
+void TRoundRobinPolicy::order(vector< shared_ptr<TSocketPoolServer> >& servers) {
+  if (servers.empty()) {
+    return;
+  }
+  unsigned int first;
+  {
+    Guard g(mutex_);
+    first = next_++ % servers.size();
+  }
+  rotate(servers.begin(), servers.begin() + first, servers.end());
+}
+
+namespace {
+
+struct LessLoaded {
+  bool operator()(const shared_ptr<TSocketPoolServer>& a,
+                  const shared_ptr<TSocketPoolServer>& b) const {
+    int aOut = a->getOutstanding();
+    int bOut = b->getOutstanding();
+    if (aOut != bOut) {
+      return aOut < bOut;
+    }
+    return a->getLatencyEwma() < b->getLatencyEwma();
+  }
+};
+
+}
+
+void TLeastLoadedPolicy::order(vector< shared_ptr<TSocketPoolServer> >& servers) {
+  // Shuffle first so that ties are broken randomly.
+  random_shuffle(servers.begin(), servers.end());
+  stable_sort(servers.begin(), servers.end(), LessLoaded());
+}
+
+double TPowerOfTwoChoicesPolicy::cost(const TSocketPoolServer& server) {
+  return server.getLatencyEwma() * (server.getOutstanding() + 1);
+}
+
+bool TPowerOfTwoChoicesPolicy::cheaper(const TSocketPoolServer& a,
+                                       const TSocketPoolServer& b) {
+  // Without latency samples on both sides, go by outstanding calls alone:
+  // an idle new server gets probed, but a busy one is not piled onto.
+  if (a.getLatencyEwma() == 0 || b.getLatencyEwma() == 0) {
+    return a.getOutstanding() < b.getOutstanding() ||
+      (a.getOutstanding() == b.getOutstanding() && a.getLatencyEwma() < b.getLatencyEwma());
+  }
+  return cost(a) < cost(b);
+}
+
+void TPowerOfTwoChoicesPolicy::order(vector< shared_ptr<TSocketPoolServer> >& servers) {
+  random_shuffle(servers.begin(), servers.end());
+  if (servers.size() >= 2 && cheaper(*servers[1], *servers[0])) {
+    swap(servers[0], servers[1]);
+  }
+}
 
 /**
  * TSocketPool implementation.
@@ -59,7 +338,13 @@ TSocketPool::TSocketPool() : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true) {
+  alwaysTryLast_(true),
+  latencyAlpha_(0.3),
+  inCall_(false),
+  callStartUs_(0),
+  callSent_(false),
+  breakerEnabled_(false),
+  numResolved_(0) {
 }
 
 TSocketPool::TSocketPool(const vector<string> &hosts,
@@ -68,7 +353,13 @@ TSocketPool::TSocketPool(const vector<string> &hosts,
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAlpha_(0.3),
+  inCall_(false),
+  callStartUs_(0),
+  callSent_(false),
+  breakerEnabled_(false),
+  numResolved_(0)
 {
   if (hosts.size() != ports.size()) {
     GlobalOutput("TSocketPool::TSocketPool: hosts.size != ports.size");
@@ -85,7 +376,13 @@ TSocketPool::TSocketPool(const vector<pair<string, int> >& servers) : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAlpha_(0.3),
+  inCall_(false),
+  callStartUs_(0),
+  callSent_(false),
+  breakerEnabled_(false),
+  numResolved_(0)
 {
   for (unsigned i = 0; i < servers.size(); ++i) {
     addServer(servers[i].first, servers[i].second);
@@ -98,7 +395,13 @@ TSocketPool::TSocketPool(const vector< shared_ptr<TSocketPoolServer> >& servers)
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAlpha_(0.3),
+  inCall_(false),
+  callStartUs_(0),
+  callSent_(false),
+  breakerEnabled_(false),
+  numResolved_(0)
 {
 }
 
@@ -107,7 +410,13 @@ TSocketPool::TSocketPool(const string& host, int port) : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAlpha_(0.3),
+  inCall_(false),
+  callStartUs_(0),
+  callSent_(false),
+  breakerEnabled_(false),
+  numResolved_(0)
 {
   addServer(host, port);
 }
@@ -154,6 +463,39 @@ void TSocketPool::setAlwaysTryLast(bool alwaysTryLast) {
   alwaysTryLast_ = alwaysTryLast;
 }
 
+void TSocketPool::setPolicy(shared_ptr<TSocketPoolPolicy> policy) {
+  policy_ = policy;
+}
+
+void TSocketPool::setLatencyAlpha(double alpha) {
+  latencyAlpha_ = alpha;
+}
+
+void TSocketPool::setCircuitBreaker(const TCircuitBreakerConfig& config) {
+  breakerEnabled_ = true;
+  breakerConfig_ = config;
+}
+
+void TSocketPool::setRetryBudget(shared_ptr<TRetryBudget> budget) {
+  retryBudget_ = budget;
+}
+
+void TSocketPool::getCounters(map<string, int64_t>& counters, const string& prefix) {
+  for (size_t i = 0; i < servers_.size(); ++i) {
+    ostringstream key;
+    key << prefix << "." << servers_[i]->host_ << ":" << servers_[i]->port_ << ".";
+    counters[key.str() + "breaker_state"] = servers_[i]->getBreakerState();
+    counters[key.str() + "breaker_trips"] = servers_[i]->getNumTrips();
+    counters[key.str() + "breaker_rejected"] = servers_[i]->getNumRejected();
+    counters[key.str() + "outstanding"] = servers_[i]->getOutstanding();
+  }
+  if (retryBudget_ != NULL) {
+    counters[prefix + ".requests"] = retryBudget_->getNumRequests();
+    counters[prefix + ".retries"] = retryBudget_->getNumRetries();
+    counters[prefix + ".retries_denied"] = retryBudget_->getNumRetriesDenied();
+  }
+}
+
 void TSocketPool::setCurrentServer(const shared_ptr<TSocketPoolServer> &server) {
   currentServer_ = server;
   host_ = server->host_;
@@ -163,17 +505,32 @@ void TSocketPool::setCurrentServer(const shared_ptr<TSocketPoolServer> &server)
 
 /* TODO: without apc we ignore a lot of functionality from the php version */
 void TSocketPool::open() {
-  if (randomize_) {
-    random_shuffle(servers_.begin(), servers_.end());
+  // Order a copy, so that each policy starts from the configured order.
+  vector< shared_ptr<TSocketPoolServer> > servers(servers_);
+  if (policy_ != NULL) {
+    policy_->order(servers);
+  } else if (randomize_) {
+    random_shuffle(servers.begin(), servers.end());
+  }
+
+  if (connectStagger_ > 0) {
+    openRacing(servers);
+    return;
   }
 
-  unsigned int numServers = servers_.size();
+  int64_t nowMs = nowUsec() / 1000;
+  bool attempted = false;
+  unsigned int numServers = servers.size();
   for (unsigned int i = 0; i < numServers; ++i) {
 
-    shared_ptr<TSocketPoolServer> &server = servers_[i];
+    shared_ptr<TSocketPoolServer> &server = servers[i];
     bool retryIntervalPassed = (server->lastFailTime_ == 0);
     bool isLastServer = alwaysTryLast_ ? (i == (numServers - 1)) : false;
 
+    if (breakerEnabled_ && !server->isAvailable(breakerConfig_, nowMs)) {
+      continue;
+    }
+
     // Impersonate the server socket
     setCurrentServer(server);
 
@@ -192,6 +549,13 @@ void TSocketPool::open() {
 
     if (retryIntervalPassed || isLastServer) {
       for (int j = 0; j < numRetries_; ++j) {
+        if (attempted && retryBudget_ != NULL && !retryBudget_->tryRetry()) {
+          GlobalOutput("TSocketPool::open: retry budget exhausted");
+          throw TTransportException(TTransportException::NOT_OPEN,
+                                    "TSocketPool: retry budget exhausted");
+        }
+        attempted = true;
+
         try {
           TSocket::open();
 
@@ -209,15 +573,13 @@ void TSocketPool::open() {
           string errStr = "TSocketPool::open failed "+getSocketInfo()+": "+e.what();
           GlobalOutput(errStr.c_str());
           // connection failed
+          if (breakerEnabled_) {
+            server->recordOutcome(TSocketPoolServer::CALL_ERROR, breakerConfig_, nowUsec() / 1000);
+          }
         }
       }
 
-      ++server->consecutiveFailures_;
-      if (server->consecutiveFailures_ > maxConsecutiveFailures_) {
-        // Mark server as down
-        server->consecutiveFailures_ = 0;
-        server->lastFailTime_ = time(NULL);
-      }
+      connectFailed(server);
     }
   }
 
@@ -225,11 +587,195 @@ void TSocketPool::open() {
   throw TTransportException(TTransportException::NOT_OPEN);
 }
 
+void TSocketPool::openRacing(const vector< shared_ptr<TSocketPoolServer> >& servers) {
+  int64_t nowMs = nowUsec() / 1000;
+  racing_.clear();
+  numResolved_ = 0;
+  unsigned int numServers = servers.size();
+  for (unsigned int i = 0; i < numServers; ++i) {
+    const shared_ptr<TSocketPoolServer> &server = servers[i];
+    if (breakerEnabled_ && !server->isAvailable(breakerConfig_, nowMs)) {
+      continue;
+    }
+    if (server->socket_ >= 0) {
+      // already open means we're done
+      setCurrentServer(server);
+      return;
+    }
+
+    bool retryIntervalPassed = (server->lastFailTime_ == 0) ||
+      (time(NULL) - server->lastFailTime_ > retryInterval_);
+    bool isLastServer = alwaysTryLast_ ? (i == (numServers - 1)) : false;
+    if (!retryIntervalPassed && !isLastServer) {
+      continue;
+    }
+    racing_.push_back(server);
+  }
+
+  if (racing_.empty()) {
+    GlobalOutput("TSocketPool::open: all connections failed");
+    throw TTransportException(TTransportException::NOT_OPEN);
+  }
+
+  // The sockets in the race belong to no server until one wins
+  currentServer_.reset();
+  socket_ = -1;
+
+  // Servers are resolved by moreCandidates() as their turn comes.
+  vector<ConnectCandidate> candidates;
+  vector<bool> failed;
+  vector<bool> started;
+  size_t winner = 0;
+  bool won = true;
+  try {
+    winner = raceConnect(candidates, failed, started);
+  } catch (TTransportException&) {
+    won = false;
+  }
+
+  // Only servers that were actually tried can have failed.  Those whose
+  // every connect was refused did; the rest only lost, unless nobody won.
+  vector<bool> tried(racing_.size(), false);
+  vector<bool> refused(racing_.size(), true);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (started[i]) {
+      tried[candidates[i].tag] = true;
+    }
+    if (!failed[i]) {
+      refused[candidates[i].tag] = false;
+    }
+  }
+  for (size_t i = 0; i < racing_.size(); ++i) {
+    if (tried[i] && (refused[i] || !won)) {
+      raceFailed(racing_[i]);
+    }
+  }
+
+  if (!won) {
+    racing_.clear();
+    GlobalOutput("TSocketPool::open: all connections failed");
+    throw TTransportException(TTransportException::NOT_OPEN);
+  }
+
+  int socket = socket_;
+  shared_ptr<TSocketPoolServer> server = racing_[candidates[winner].tag];
+  racing_.clear();
+  setCurrentServer(server);
+  socket_ = socket;
+  server->socket_ = socket;
+  server->lastFailTime_ = 0;
+}
+
+bool TSocketPool::moreCandidates(vector<ConnectCandidate>& candidates) {
+  if (numResolved_ == racing_.size()) {
+    return false;
+  }
+  size_t i = numResolved_++;
+  try {
+    resolve(racing_[i]->host_, racing_[i]->port_, i, candidates);
+  } catch (TTransportException&) {
+    raceFailed(racing_[i]);
+  }
+  return true;
+}
+
+void TSocketPool::raceFailed(const shared_ptr<TSocketPoolServer>& server) {
+  if (breakerEnabled_) {
+    server->recordOutcome(TSocketPoolServer::CALL_ERROR, breakerConfig_, nowUsec() / 1000);
+  }
+  connectFailed(server);
+}
+
+bool TSocketPool::mayStartConnect() {
+  return retryBudget_ == NULL || retryBudget_->tryRetry();
+}
+
+void TSocketPool::connectFailed(const shared_ptr<TSocketPoolServer>& server) {
+  ++server->consecutiveFailures_;
+  if (server->consecutiveFailures_ > maxConsecutiveFailures_) {
+    // Mark server as down
+    server->consecutiveFailures_ = 0;
+    server->lastFailTime_ = time(NULL);
+  }
+}
+
 void TSocketPool::close() {
+  // An abandoned call took at least this long, which is what lets a
+  // server that stops answering drain.
+  finishCall(TSocketPoolServer::CALL_ABANDONED);
   if (isOpen()) {
     TSocket::close();
     currentServer_->socket_ = -1;
   }
 }
 
+void TSocketPool::write(const uint8_t* buf, uint32_t len) {
+  if (inCall_ && callSent_) {
+    // Nothing came back for the last request, so it was oneway.
+    finishCall(TSocketPoolServer::CALL_OK, false);
+  }
+  if (!inCall_ && currentServer_ != NULL) {
+    startCall();
+  }
+  try {
+    TSocket::write(buf, len);
+  } catch (TTransportException&) {
+    finishCall(TSocketPoolServer::CALL_ERROR);
+    throw;
+  }
+}
+
+void TSocketPool::flush() {
+  TSocket::flush();
+  if (inCall_) {
+    callSent_ = true;
+  }
+}
+
+uint32_t TSocketPool::read(uint8_t* buf, uint32_t len) {
+  uint32_t got;
+  try {
+    got = TSocket::read(buf, len);
+  } catch (TTransportException& ttx) {
+    // A timeout is as slow as the server got; count it.
+    finishCall(ttx.getType() == TTransportException::TIMED_OUT ?
+               TSocketPoolServer::CALL_TIMEOUT : TSocketPoolServer::CALL_ERROR);
+    throw;
+  }
+  // Nothing at all means the server hung up on us
+  finishCall(got > 0 ? TSocketPoolServer::CALL_OK : TSocketPoolServer::CALL_ERROR);
+  return got;
+}
+
+void TSocketPool::startCall() {
+  if (breakerEnabled_ &&
+      !currentServer_->tryAcquire(breakerConfig_, nowUsec() / 1000)) {
+    // None of the call has been written yet, so it can still go to
+    // another server.
+    close();
+    open();
+    if (!currentServer_->tryAcquire(breakerConfig_, nowUsec() / 1000)) {
+      throw TTransportException(TTransportException::NOT_OPEN,
+                                "TSocketPool: circuit open for " + getSocketInfo());
+    }
+  }
+  if (retryBudget_ != NULL) {
+    retryBudget_->requestStarted();
+  }
+  inCall_ = true;
+  callStartUs_ = nowUsec();
+  callSent_ = false;
+  currentServer_->callStarted();
+}
+
+void TSocketPool::finishCall(TSocketPoolServer::CallOutcome outcome, bool sampleLatency) {
+  if (inCall_) {
+    inCall_ = false;
+    currentServer_->callFinished(sampleLatency ? nowUsec() - callStartUs_ : -1, latencyAlpha_);
+    if (breakerEnabled_) {
+      currentServer_->recordOutcome(outcome, breakerConfig_, nowUsec() / 1000);
+    }
+  }
+}
+
 }}} // apache::thrift::transport
@@ -20,11 +20,36 @@
 #ifndef _THRIFT_TRANSPORT_TSOCKETPOOL_H_
 #define _THRIFT_TRANSPORT_TSOCKETPOOL_H_ 1
 
+#include <deque>
+#include <map>
 #include <vector>
+#include <concurrency/Mutex.h>
 #include "TSocket.h"
 
 namespace apache { namespace thrift { namespace transport {
 
+/**
+ * When a TSocketPool's circuit breaker stops sending calls to a server.
+ * The rates are over the last windowSize calls to that server, and only
+ * count once it has seen minCalls of them.
+ *
+ */
+struct TCircuitBreakerConfig {
+  TCircuitBreakerConfig() :
+    windowSize(20),
+    minCalls(10),
+    maxErrorRate(0.5),
+    maxTimeoutRate(0.5),
+    openTimeMs(5000) {}
+
+  int windowSize;
+  int minCalls;
+  double maxErrorRate;
+  double maxTimeoutRate;
+  // How long an open breaker waits before letting a trial call through
+  int openTimeMs;
+};
+
  /**
   * Class to hold server information for TSocketPool
   *
@@ -32,6 +57,25 @@ namespace apache { namespace thrift { namespace transport {
 class TSocketPoolServer {
 
   public:
+  /**
+   * Circuit breaker states.  A closed breaker lets calls through; an open
+   * one refuses them until openTimeMs has passed, then goes half open and
+   * lets a single trial call through, whose result closes or reopens it.
+   */
+  enum BreakerState {
+    BREAKER_CLOSED = 0,
+    BREAKER_OPEN = 1,
+    BREAKER_HALF_OPEN = 2
+  };
+
+  enum CallOutcome {
+    CALL_OK,
+    CALL_ERROR,
+    CALL_TIMEOUT,
+    // Given up on by the client, e.g. a losing hedge; says nothing
+    CALL_ABANDONED
+  };
+
   /**
    * Default constructor for server info
    */
@@ -56,6 +100,169 @@ class TSocketPoolServer {
 
   // Number of consecutive times connecting to this server failed
   int consecutiveFailures_;
+
+  /**
+   * Records the start of a call on this server.
+   */
+  void callStarted();
+
+  /**
+   * Records the end of a call, folding its latency into the average with
+   * weight alpha.
+   */
+  void callFinished(int64_t latencyUs, double alpha);
+
+  /**
+   * Exponentially weighted moving average of call latency in microseconds,
+   * or 0 if no call has finished yet.
+   */
+  double getLatencyEwma() const;
+
+  /**
+   * Number of calls started but not yet finished.
+   */
+  int getOutstanding() const;
+
+  /**
+   * Whether the breaker would let a call through now, without claiming
+   * the trial call of a half open breaker.
+   */
+  bool isAvailable(const TCircuitBreakerConfig& config, int64_t nowMs);
+
+  /**
+   * Asks the breaker to let a call through.  In the half open state the
+   * caller that gets true owns the trial call.
+   */
+  bool tryAcquire(const TCircuitBreakerConfig& config, int64_t nowMs);
+
+  /**
+   * Feeds the outcome of a call, or of a connect attempt, to the breaker.
+   */
+  void recordOutcome(CallOutcome outcome, const TCircuitBreakerConfig& config, int64_t nowMs);
+
+  BreakerState getBreakerState() const;
+
+  /**
+   * Number of times the breaker opened, and calls it refused.
+   */
+  uint64_t getNumTrips() const;
+
+  uint64_t getNumRejected() const;
+
+ private:
+  void trip(int64_t nowMs);
+
+  // Guards the load statistics and breaker, which may be shared by pools
+  // on several threads
+  apache::thrift::concurrency::Mutex statsMutex_;
+  double latencyEwma_;
+  int outstanding_;
+
+  BreakerState breakerState_;
+  // Outcomes of the latest calls, newest at the back
+  std::deque<CallOutcome> window_;
+  int windowErrors_;
+  int windowTimeouts_;
+  int64_t openedAtMs_;
+  bool trialInFlight_;
+  uint64_t numTrips_;
+  uint64_t numRejected_;
+};
+
+/**
+ * Caps retries at a fraction of requests, across every TSocketPool that
+ * shares it.  Each request earns ratio of a retry and each retry spends
+ * one; up to reserve unspent retries are kept, and the budget starts full
+ * so that a new client can still fail over.
+ *
+ */
+class TRetryBudget {
+ public:
+  TRetryBudget(double ratio = 0.1, double reserve = 10);
+
+  void requestStarted();
+
+  /**
+   * Spends a retry, or returns false if there is none left.
+   */
+  bool tryRetry();
+
+  uint64_t getNumRequests() const;
+
+  uint64_t getNumRetries() const;
+
+  uint64_t getNumRetriesDenied() const;
+
+ private:
+  apache::thrift::concurrency::Mutex mutex_;
+  double ratio_;
+  double reserve_;
+  double balance_;
+  uint64_t numRequests_;
+  uint64_t numRetries_;
+  uint64_t numRetriesDenied_;
+};
+
+/**
+ * Decides the order in which TSocketPool::open() tries its servers.
+ * Servers that are marked down are still skipped by the pool itself.
+ *
+ */
+class TSocketPoolPolicy {
+ public:
+  virtual ~TSocketPoolPolicy() {}
+
+  /**
+   * Reorders servers, most preferred first.
+   */
+  virtual void order(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers) = 0;
+};
+
+/**
+ * Shuffles the servers.  This is what setRandomize(true) does.
+ */
+class TRandomPolicy : public TSocketPoolPolicy {
+ public:
+  void order(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+};
+
+/**
+ * Starts each open() one server further along the list.
+ */
+class TRoundRobinPolicy : public TSocketPoolPolicy {
+ public:
+  TRoundRobinPolicy() : next_(0) {}
+
+  void order(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+
+ private:
+  apache::thrift::concurrency::Mutex mutex_;
+  unsigned int next_;
+};
+
+/**
+ * Prefers the servers with the fewest outstanding calls, then the lowest
+ * average latency.
+ */
+class TLeastLoadedPolicy : public TSocketPoolPolicy {
+ public:
+  void order(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+};
+
+/**
+ * Power of two choices: picks two servers at random and prefers the one
+ * with the lower expected wait (average latency scaled by outstanding
+ * calls), or with fewer outstanding calls if either has no latency samples
+ * yet.  Slow servers lose traffic without any single fast server being
+ * swamped.  The rest are shuffled behind them for failover.
+ */
+class TPowerOfTwoChoicesPolicy : public TSocketPoolPolicy {
+ public:
+  void order(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+
+  static double cost(const TSocketPoolServer& server);
+
+  static bool cheaper(const TSocketPoolServer& a, const TSocketPoolServer& b);
 };
 
 /**
@@ -122,6 +329,13 @@ class TSocketPool : public TSocket {
     */
   void getServers(std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
 
+   /**
+    * The server open() last connected to, or NULL.
+    */
+   boost::shared_ptr<TSocketPoolServer> getCurrentServer() {
+     return currentServer_;
+   }
+
    /**
     * Sets how many times to keep retrying a host in the connect function.
     */
@@ -148,7 +362,44 @@ class TSocketPool : public TSocket {
    void setAlwaysTryLast(bool alwaysTryLast);
 
    /**
-    * Creates and opens the UNIX socket.
+    * Sets the policy ordering the servers in open().  Overrides
+    * setRandomize().
+    */
+   void setPolicy(boost::shared_ptr<TSocketPoolPolicy> policy);
+
+   /**
+    * Weight of the newest sample in each server's latency average, in
+    * (0, 1].  Higher values react faster to change.
+    */
+   void setLatencyAlpha(double alpha);
+
+   /**
+    * Turns on a circuit breaker per server, fed by connect failures and
+    * by the errors and timeouts of calls.  open() skips servers whose
+    * breaker is open, and a call about to start on one is moved to
+    * another server first.  Off by default.
+    */
+   void setCircuitBreaker(const TCircuitBreakerConfig& config);
+
+   /**
+    * Limits the connect attempts open() makes after its first one.  NULL,
+    * the default, means no limit beyond setNumRetries().
+    */
+   void setRetryBudget(boost::shared_ptr<TRetryBudget> budget);
+
+   /**
+    * Adds the breaker state and counters of each server, and those of the
+    * retry budget, to counters, named "<prefix>.<host>:<port>.<counter>"
+    * and "<prefix>.<counter>".  Meant for fb303's getCounters().
+    */
+   void getCounters(std::map<std::string, int64_t>& counters,
+                    const std::string& prefix = "socket_pool");
+
+   /**
+    * Creates and opens the UNIX socket.  With a connect stagger set (see
+    * TSocket::setConnectStagger()), races the addresses of all servers it
+    * may try, in policy order, instead of trying them one at a time; the
+    * number of retries does not apply then.
     */
    void open();
 
@@ -157,10 +408,31 @@ class TSocketPool : public TSocket {
     */
    void close();
 
+   /**
+    * Reads and writes are timed to keep the current server's load
+    * statistics: a call runs from the first byte written after a response
+    * to the first byte of the next response, or to close() if that comes
+    * first.  How it ended (a reply, an error or a timeout) goes to the
+    * server's circuit breaker.  A request that was flushed and then
+    * followed by another write got no response (it was oneway); it counts
+    * as a success, but not towards the latency average.
+    */
+   uint32_t read(uint8_t* buf, uint32_t len);
+
+   void write(const uint8_t* buf, uint32_t len);
+
+   void flush();
+
  protected:
 
   void setCurrentServer(const boost::shared_ptr<TSocketPoolServer> &server);
 
+  /** Extra connects in a race count against the retry budget */
+  bool mayStartConnect();
+
+  /** Resolves the next server in the race */
+  bool moreCandidates(std::vector<ConnectCandidate>& candidates);
+
    /** List of servers to connect to */
   std::vector< boost::shared_ptr<TSocketPoolServer> > servers_;
 
@@ -183,6 +455,40 @@ class TSocketPool : public TSocket {
 
    /** Always try last host, even if marked down? */
    bool alwaysTryLast_;
+
+   /** Server ordering, or NULL to go by randomize_ */
+   boost::shared_ptr<TSocketPoolPolicy> policy_;
+
+   /** Weight of new latency samples */
+   double latencyAlpha_;
+
+   /** Whether a call is in flight on the current server, since when, and
+       whether all of its request has been flushed */
+   bool inCall_;
+   int64_t callStartUs_;
+   bool callSent_;
+
+   /** Circuit breaker settings, if turned on */
+   bool breakerEnabled_;
+   TCircuitBreakerConfig breakerConfig_;
+
+   /** Servers in the race under way, and how many have been resolved */
+   std::vector< boost::shared_ptr<TSocketPoolServer> > racing_;
+   size_t numResolved_;
+
+   /** Shared limit on retries, or NULL */
+   boost::shared_ptr<TRetryBudget> retryBudget_;
+
+ private:
+   void startCall();
+
+   void finishCall(TSocketPoolServer::CallOutcome outcome, bool sampleLatency = true);
+
+   void openRacing(const std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+
+   void connectFailed(const boost::shared_ptr<TSocketPoolServer>& server);
+
+   void raceFailed(const boost::shared_ptr<TSocketPoolServer>& server);
 };
 
 }}} // apache::thrift::transport
@@ -0,0 +1,273 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <concurrency/PosixThreadFactory.h>
+#include <concurrency/Util.h>
+#include "TTeeTransport.h"
+#include "TFileTransport.h"
+#include "TTransportException.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::TimedOutException;
+using apache::thrift::concurrency::Util;
+
+const uint32_t TTeeLogger::DEFAULT_MAX_QUEUED;
+const int32_t TTeeLogger::FLUSH_EVERY_BATCH;
+const int32_t TTeeLogger::NEVER_FLUSH;
+const uint32_t TTeeLogger::MAX_SPARE_SIZE;
+
+class TTeeLogger::Writer : public Runnable {
+ public:
+  Writer(TTeeLogger* logger) :
+    logger_(logger) {}
+
+  void run() {
+    logger_->run();
+  }
+
+ private:
+  TTeeLogger* logger_;
+};
+
+TTeeLogger::TTeeLogger(shared_ptr<TTransport> dstTrans,
+                       uint32_t maxQueued,
+                       DropPolicy policy) :
+  dstTrans_(dstTrans),
+  maxQueued_(maxQueued > 0 ? maxQueued : 1),
+  policy_(policy),
+  flushIntervalMs_(dynamic_cast<TFileTransport*>(dstTrans.get()) != NULL ?
+                   NEVER_FLUSH : FLUSH_EVERY_BATCH),
+  stopping_(false),
+  numLogged_(0),
+  numDropped_(0),
+  numFailed_(0) {
+  PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                   PosixThreadFactory::NORMAL,
+                                   1,
+                                   false);
+  thread_ = threadFactory.newThread(shared_ptr<Runnable>(new Writer(this)));
+  thread_->start();
+}
+
+TTeeLogger::~TTeeLogger() {
+  {
+    Synchronized s(monitor_);
+    stopping_ = true;
+    monitor_.notifyAll();
+  }
+  thread_->join();
+}
+
+void TTeeLogger::log(string& message) {
+  if (message.empty()) {
+    return;
+  }
+
+  Synchronized s(monitor_);
+  if (queue_.size() >= maxQueued_) {
+    switch (policy_) {
+    case DROP_NEWEST:
+      numDropped_++;
+      message.clear();
+      return;
+    case DROP_OLDEST:
+      numDropped_++;
+      recycle(queue_.front());
+      queue_.pop_front();
+      break;
+    case BLOCK:
+      while (queue_.size() >= maxQueued_ && !stopping_) {
+        monitor_.wait();
+      }
+      break;
+    }
+  }
+
+  queue_.push_back(string());
+  queue_.back().swap(message);
+  if (!spare_.empty()) {
+    message.swap(spare_.back());
+    spare_.pop_back();
+  }
+  if (queue_.size() == 1) {
+    monitor_.notifyAll();
+  }
+}
+
+void TTeeLogger::setFlushInterval(int32_t ms) {
+  Synchronized s(monitor_);
+  flushIntervalMs_ = ms < 0 ? NEVER_FLUSH : ms;
+  monitor_.notifyAll();
+}
+
+int32_t TTeeLogger::getFlushInterval() {
+  Synchronized s(monitor_);
+  return flushIntervalMs_;
+}
+
+void TTeeLogger::recycle(string& message) {
+  if (spare_.size() < maxQueued_ && message.capacity() <= MAX_SPARE_SIZE) {
+    message.clear();
+    spare_.push_back(string());
+    spare_.back().swap(message);
+  }
+}
+
+void TTeeLogger::run() {
+  deque<string> batch;
+  bool failing = false;
+  // Messages written since the last flush, and when that was
+  uint64_t unflushed = 0;
+  int64_t lastFlush = Util::currentTime();
+
+  while (true) {
+    bool stopping;
+    int32_t flushInterval;
+    {
+      Synchronized s(monitor_);
+      while (queue_.empty() && !stopping_) {
+        if (unflushed == 0 || flushIntervalMs_ <= 0) {
+          monitor_.wait();
+          continue;
+        }
+        // Wake up to flush what was written
+        int64_t left = lastFlush + flushIntervalMs_ - Util::currentTime();
+        if (left <= 0) {
+          break;
+        }
+        try {
+          monitor_.wait(left);
+        } catch (TimedOutException&) {
+          break;
+        }
+      }
+      stopping = stopping_ && queue_.empty();
+      flushInterval = flushIntervalMs_;
+      batch.swap(queue_);
+      // Wake producers waiting for room
+      monitor_.notifyAll();
+    }
+
+    uint64_t failed = 0;
+    for (deque<string>::iterator it = batch.begin(); it != batch.end(); ++it) {
+      try {
+        dstTrans_->write((const uint8_t*)it->data(), it->size());
+        unflushed++;
+      } catch (TTransportException& ttx) {
+        if (!failing) {
+          GlobalOutput.printf("TTeeLogger: write failed: %s", ttx.what());
+          failing = true;
+        }
+        failed++;
+      }
+    }
+
+    uint64_t logged = 0;
+    if (flushInterval == NEVER_FLUSH) {
+      logged = unflushed;
+      unflushed = 0;
+      failing = failed > 0;
+    } else if (unflushed > 0 &&
+               (stopping || flushInterval == FLUSH_EVERY_BATCH ||
+                Util::currentTime() - lastFlush >= flushInterval)) {
+      try {
+        dstTrans_->flush();
+        logged = unflushed;
+        failing = failed > 0;
+      } catch (TTransportException& ttx) {
+        if (!failing) {
+          GlobalOutput.printf("TTeeLogger: flush failed: %s", ttx.what());
+          failing = true;
+        }
+        failed += unflushed;
+      }
+      unflushed = 0;
+      lastFlush = Util::currentTime();
+    }
+
+    Synchronized s(monitor_);
+    numLogged_ += logged;
+    numFailed_ += failed;
+    for (deque<string>::iterator it = batch.begin(); it != batch.end(); ++it) {
+      recycle(*it);
+    }
+    batch.clear();
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+uint64_t TTeeLogger::getNumLogged() {
+  Synchronized s(monitor_);
+  return numLogged_;
+}
+
+uint64_t TTeeLogger::getNumDropped() {
+  Synchronized s(monitor_);
+  return numDropped_;
+}
+
+uint64_t TTeeLogger::getNumFailed() {
+  Synchronized s(monitor_);
+  return numFailed_;
+}
+
+uint32_t TTeeLogger::getNumQueued() {
+  Synchronized s(monitor_);
+  return queue_.size();
+}
+
+uint32_t TTeeTransport::read(uint8_t* buf, uint32_t len) {
+  uint32_t got = srcTrans_->read(buf, len);
+  if (teeReads_) {
+    rBuf_.append((const char*)buf, got);
+  }
+  return got;
+}
+
+void TTeeTransport::readEnd() {
+  if (teeReads_) {
+    logger_->log(rBuf_);
+  }
+  srcTrans_->readEnd();
+}
+
+void TTeeTransport::write(const uint8_t* buf, uint32_t len) {
+  srcTrans_->write(buf, len);
+  if (teeWrites_) {
+    wBuf_.append((const char*)buf, len);
+  }
+}
+
+void TTeeTransport::writeEnd() {
+  if (teeWrites_) {
+    logger_->log(wBuf_);
+  }
+  srcTrans_->writeEnd();
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,258 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_TRANSPORT_TTEETRANSPORT_H_
+#define _THRIFT_TRANSPORT_TTEETRANSPORT_H_ 1
+
+#include <deque>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Monitor.h>
+#include <concurrency/Thread.h>
+#include "TTransport.h"
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Writes messages to a destination transport from a thread of its own, for
+ * request logging that should not add to request latency.
+ *
+ * log() takes the contents of a message buffer by swapping it for an empty
+ * one (which keeps the capacity of an earlier message where it can), so
+ * queueing a message copies nothing.  The logger thread writes whatever is
+ * queued to the destination, one write() per message, and flushes it as
+ * setFlushInterval() says.  With a TFileTransport destination every
+ * message is an event that TFileProcessor can replay.
+ *
+ * At most maxQueued messages wait for the logger.  When it falls behind,
+ * the policy decides what gives:
+ *
+ *   DROP_NEWEST  the message being logged is dropped
+ *   DROP_OLDEST  the oldest queued message is dropped to make room
+ *   BLOCK        the caller waits for room, so nothing is lost
+ *
+ * Dropped messages are counted, as are messages the destination failed to
+ * take.  The destructor writes out what is queued and stops the thread.
+ *
+ */
+class TTeeLogger {
+ public:
+  enum DropPolicy {
+    DROP_NEWEST,
+    DROP_OLDEST,
+    BLOCK
+  };
+
+  static const uint32_t DEFAULT_MAX_QUEUED = 1024;
+
+  static const int32_t FLUSH_EVERY_BATCH = 0;
+  static const int32_t NEVER_FLUSH = -1;
+
+  TTeeLogger(boost::shared_ptr<TTransport> dstTrans,
+             uint32_t maxQueued = DEFAULT_MAX_QUEUED,
+             DropPolicy policy = DROP_NEWEST);
+
+  ~TTeeLogger();
+
+  /**
+   * Queues the contents of message, leaving it empty.  Empty messages are
+   * ignored.
+   */
+  void log(std::string& message);
+
+  DropPolicy getDropPolicy() const {
+    return policy_;
+  }
+
+  uint32_t getMaxQueued() const {
+    return maxQueued_;
+  }
+
+  /**
+   * When the destination is flushed:
+   *
+   *   FLUSH_EVERY_BATCH  after each batch of messages written to it
+   *   NEVER_FLUSH        never; the destination flushes on its own
+   *   ms > 0             once ms have passed since the last flush
+   *
+   * A TFileTransport destination defaults to NEVER_FLUSH.  Its flush waits
+   * for an fsync and ends a compressed chunk, so its own flushMaxUs and
+   * flushMaxBytes should decide when events reach the disk.  Other
+   * destinations default to FLUSH_EVERY_BATCH.  Unless it is NEVER_FLUSH,
+   * the destructor flushes whatever is left.
+   */
+  void setFlushInterval(int32_t ms);
+
+  int32_t getFlushInterval();
+
+  /**
+   * Number of messages written (and flushed, where the logger flushes),
+   * dropped under the policy, lost to errors from the destination, and
+   * waiting to be written.
+   */
+  uint64_t getNumLogged();
+
+  uint64_t getNumDropped();
+
+  uint64_t getNumFailed();
+
+  uint32_t getNumQueued();
+
+ private:
+  class Writer;
+
+  // Largest buffer kept around for reuse
+  static const uint32_t MAX_SPARE_SIZE = 1024 * 1024;
+
+  void run();
+
+  // Called with monitor_ held
+  void recycle(std::string& message);
+
+  boost::shared_ptr<TTransport> dstTrans_;
+  uint32_t maxQueued_;
+  DropPolicy policy_;
+  int32_t flushIntervalMs_;
+
+  apache::thrift::concurrency::Monitor monitor_;
+  std::deque<std::string> queue_;
+  std::deque<std::string> spare_;
+  bool stopping_;
+
+  uint64_t numLogged_;
+  uint64_t numDropped_;
+  uint64_t numFailed_;
+
+  boost::shared_ptr<apache::thrift::concurrency::Thread> thread_;
+};
+
+/**
+ * Hands the requests read and/or the replies written through a transport
+ * to a TTeeLogger, without waiting on the logger's destination.
+ *
+ * Like TPipedTransport, it keeps the bytes of the current message and
+ * passes them on at readEnd() and writeEnd(); unlike it, what the request
+ * waits for is a buffer swap rather than a write and a flush.  It reads
+ * straight from the source transport, so only what the protocol consumed
+ * is logged.
+ *
+ */
+class TTeeTransport : public TTransport {
+ public:
+  TTeeTransport(boost::shared_ptr<TTransport> srcTrans,
+                boost::shared_ptr<TTeeLogger> logger,
+                bool teeReads = true,
+                bool teeWrites = false) :
+    srcTrans_(srcTrans),
+    logger_(logger),
+    teeReads_(teeReads),
+    teeWrites_(teeWrites) {}
+
+  bool isOpen() {
+    return srcTrans_->isOpen();
+  }
+
+  bool peek() {
+    return srcTrans_->peek();
+  }
+
+  void open() {
+    srcTrans_->open();
+  }
+
+  void close() {
+    srcTrans_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  /**
+   * Logs the request read, if reads are teed.
+   */
+  void readEnd();
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  /**
+   * Logs the reply written, if writes are teed.
+   */
+  void writeEnd();
+
+  void flush() {
+    srcTrans_->flush();
+  }
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return srcTrans_;
+  }
+
+  boost::shared_ptr<TTeeLogger> getLogger() {
+    return logger_;
+  }
+
+ private:
+  boost::shared_ptr<TTransport> srcTrans_;
+  boost::shared_ptr<TTeeLogger> logger_;
+  bool teeReads_;
+  bool teeWrites_;
+  std::string rBuf_;
+  std::string wBuf_;
+};
+
+/**
+ * Wraps the transports a factory makes in TTeeTransports sharing one
+ * logger, so a server can log its requests:
+ *
+ *   shared_ptr<TTeeLogger> logger(new TTeeLogger(fileTransport));
+ *   shared_ptr<TTransportFactory> transportFactory(
+ *     new TTeeTransportFactory(logger,
+ *                              shared_ptr<TTransportFactory>(new TFramedTransportFactory())));
+ *
+ * Teeing above the framing logs just the messages.
+ *
+ */
+class TTeeTransportFactory : public TTransportFactory {
+ public:
+  TTeeTransportFactory(boost::shared_ptr<TTeeLogger> logger,
+                       boost::shared_ptr<TTransportFactory> factory =
+                         boost::shared_ptr<TTransportFactory>(new TTransportFactory()),
+                       bool teeReads = true,
+                       bool teeWrites = false) :
+    logger_(logger),
+    factory_(factory),
+    teeReads_(teeReads),
+    teeWrites_(teeWrites) {}
+
+  boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans) {
+    return boost::shared_ptr<TTransport>(
+      new TTeeTransport(factory_->getTransport(trans), logger_, teeReads_, teeWrites_));
+  }
+
+ private:
+  boost::shared_ptr<TTeeLogger> logger_;
+  boost::shared_ptr<TTransportFactory> factory_;
+  bool teeReads_;
+  bool teeWrites_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TTEETRANSPORT_H_
@@ -64,6 +64,9 @@ class TNullTransport : public TTransport {
  * The underlying buffer expands to a keep a copy of the entire
  * request/response.
  *
+ * The copy is written to the destination, and flushed, on the caller's
+ * thread.  TTeeTransport hands it to a background logger instead.
+ *
  */
 class TPipedTransport : virtual public TTransport {
  public:
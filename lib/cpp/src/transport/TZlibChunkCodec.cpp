@@ -0,0 +1,53 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <transport/TZlibChunkCodec.h>
+#include <transport/TZlibTransport.h>
+#include <zlib.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+uint32_t TZlibChunkCodec::compressBound(uint32_t len) {
+  return ::compressBound(len);
+}
+
+uint32_t TZlibChunkCodec::compress(const uint8_t* in, uint32_t len, uint8_t* out) {
+  uLongf outLen = ::compressBound(len);
+  int rv = compress2(out, &outLen, in, len, level_);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, NULL);
+  }
+  return (uint32_t)outLen;
+}
+
+void TZlibChunkCodec::uncompress(const uint8_t* in, uint32_t len,
+                                 uint8_t* out, uint32_t outLen) {
+  uLongf got = outLen;
+  int rv = ::uncompress(out, &got, in, len);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, NULL);
+  }
+  if (got != outLen) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TZlibChunkCodec: chunk uncompressed to the wrong size");
+  }
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,59 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef _THRIFT_TRANSPORT_TZLIBCHUNKCODEC_H_
+#define _THRIFT_TRANSPORT_TZLIBCHUNKCODEC_H_ 1
+
+#include <transport/TFileTransport.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Compresses the chunks of a TFileTransport log with zlib.
+ *
+ */
+class TZlibChunkCodec : public TFileChunkCodec {
+ public:
+  // "zlib"
+  static const uint32_t CODEC_ID = 0x7a6c6962;
+  // zlib's Z_DEFAULT_COMPRESSION
+  static const int DEFAULT_LEVEL = -1;
+
+  /**
+   * @param level  zlib compression level, from 1 (fastest) to 9 (smallest)
+   */
+  explicit TZlibChunkCodec(int level = DEFAULT_LEVEL) :
+    level_(level) {}
+
+  uint32_t getId() {
+    return CODEC_ID;
+  }
+
+  uint32_t compressBound(uint32_t len);
+  uint32_t compress(const uint8_t* in, uint32_t len, uint8_t* out);
+  void uncompress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t outLen);
+
+ private:
+  int level_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TZLIBCHUNKCODEC_H_
@@ -0,0 +1,119 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/PosixThreadFactory.h>
+#include <concurrency/TimerManager.h>
+#include <transport/TBatchingTransport.h>
+
+BOOST_AUTO_TEST_SUITE( BatchingTransportTest )
+
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+
+// Remembers what reached it, and in how many flushes.
+class RecordingTransport : public TMemoryBuffer {
+ public:
+  RecordingTransport() :
+    numFlushes(0) {}
+
+  void flush() {
+    ++numFlushes;
+  }
+
+  int numFlushes;
+};
+
+static void call(TTransport& transport, const std::string& data) {
+  transport.write((const uint8_t*)data.data(), data.size());
+  transport.flush();
+}
+
+BOOST_AUTO_TEST_CASE( test_flushes_on_count ) {
+  shared_ptr<RecordingTransport> under(new RecordingTransport());
+  TBatchingTransport batching(under, 1024, 3);
+
+  call(batching, "one");
+  call(batching, "two");
+  BOOST_CHECK_EQUAL(under->numFlushes, 0);
+  BOOST_CHECK_EQUAL(under->getBufferAsString(), "");
+
+  call(batching, "six");
+  BOOST_CHECK_EQUAL(under->numFlushes, 1);
+  BOOST_CHECK_EQUAL(under->getBufferAsString(), "onetwosix");
+  BOOST_CHECK_EQUAL(batching.getNumCalls(), 3U);
+  BOOST_CHECK_EQUAL(batching.getNumBatches(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE( test_flushes_on_size ) {
+  shared_ptr<RecordingTransport> under(new RecordingTransport());
+  TBatchingTransport batching(under, 8, 100);
+
+  call(batching, "abcd");
+  BOOST_CHECK_EQUAL(under->numFlushes, 0);
+  call(batching, "efgh");
+  BOOST_CHECK_EQUAL(under->numFlushes, 1);
+  BOOST_CHECK_EQUAL(under->getBufferAsString(), "abcdefgh");
+}
+
+BOOST_AUTO_TEST_CASE( test_read_and_close_flush ) {
+  shared_ptr<RecordingTransport> under(new RecordingTransport());
+  TBatchingTransport batching(under);
+
+  call(batching, "request");
+  uint8_t buf[16];
+  BOOST_CHECK_EQUAL(batching.read(buf, sizeof(buf)), 7U);
+  BOOST_CHECK_EQUAL(under->numFlushes, 1);
+
+  call(batching, "last");
+  batching.close();
+  BOOST_CHECK_EQUAL(under->numFlushes, 2);
+  BOOST_CHECK_EQUAL(under->getBufferAsString(), "last");
+}
+
+BOOST_AUTO_TEST_CASE( test_timer_flushes ) {
+  shared_ptr<TimerManager> timerManager(new TimerManager());
+  timerManager->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+  timerManager->start();
+
+  shared_ptr<RecordingTransport> under(new RecordingTransport());
+  {
+    TBatchingTransport batching(under);
+    batching.setFlushInterval(timerManager, 20);
+
+    call(batching, "a");
+    call(batching, "b");
+    usleep(200 * 1000);
+    BOOST_CHECK_EQUAL(batching.getNumBatches(), 1U);
+    BOOST_CHECK_EQUAL(under->getBufferAsString(), "ab");
+
+    // A timer left behind must not touch a transport that is gone
+    call(batching, "c");
+  }
+  BOOST_CHECK_EQUAL(under->getBufferAsString(), "abc");
+  usleep(100 * 1000);
+  BOOST_CHECK_EQUAL(under->numFlushes, 2);
+
+  timerManager->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
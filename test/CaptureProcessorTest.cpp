@@ -0,0 +1,200 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <processor/TCaptureProcessor.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include <transport/TFileTransport.h>
+
+BOOST_AUTO_TEST_SUITE( CaptureProcessorTest )
+
+using namespace apache::thrift::transport;
+using apache::thrift::TProcessor;
+using apache::thrift::processor::TCaptureProcessor;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::T_CALL;
+
+// A request for method with the string argument
+static std::string makeRequest(const std::string& method, const std::string& arg) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+  protocol.writeMessageBegin(method, T_CALL, 0);
+  protocol.writeString(arg);
+  protocol.writeMessageEnd();
+  return buffer->getBufferAsString();
+}
+
+// Keeps the method and argument of each request
+class RecordingProcessor : public TProcessor {
+ public:
+  bool process(boost::shared_ptr<TProtocol> in, boost::shared_ptr<TProtocol>) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    std::string arg;
+    in->readMessageBegin(name, type, seqid);
+    in->readString(arg);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+    requests.push_back(name + " " + arg);
+    return true;
+  }
+
+  std::vector<std::string> requests;
+};
+
+// Keeps each write
+class RecordingTransport : public TTransport {
+ public:
+  void write(const uint8_t* buf, uint32_t len) {
+    writes.push_back(std::string((const char*)buf, len));
+  }
+
+  std::vector<std::string> writes;
+};
+
+struct Fixture {
+  Fixture() :
+    processor(new RecordingProcessor()),
+    capture(new RecordingTransport()) {}
+
+  boost::shared_ptr<RecordingProcessor> processor;
+  boost::shared_ptr<RecordingTransport> capture;
+};
+
+static char* arg(int i) {
+  static char buf[16];
+  sprintf(buf, "%d", i);
+  return buf;
+}
+
+BOOST_AUTO_TEST_CASE( test_sample_memory_buffer ) {
+  Fixture f;
+  TCaptureProcessor processor(f.processor, f.capture, 3);
+
+  // As the nonblocking server does, over its read buffer
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(buffer));
+  for (int i = 1; i <= 9; ++i) {
+    std::string request = makeRequest("get", arg(i));
+    buffer->resetBuffer((uint8_t*)request.data(), request.size());
+    BOOST_CHECK(processor.process(protocol, protocol));
+  }
+
+  BOOST_CHECK_EQUAL(f.processor->requests.size(), 9U);
+  BOOST_REQUIRE_EQUAL(f.capture->writes.size(), 3U);
+  for (int i = 0; i < 3; ++i) {
+    BOOST_CHECK(f.capture->writes[i] == makeRequest("get", arg(3 * (i + 1))));
+  }
+  BOOST_CHECK_EQUAL(processor.getNumRequests(), 9U);
+  BOOST_CHECK_EQUAL(processor.getNumCaptured(), 3U);
+  BOOST_CHECK_EQUAL(processor.getNumSkipped(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_methods_framed ) {
+  Fixture f;
+  TCaptureProcessor processor(f.processor, f.capture);
+  processor.captureMethod("put");
+
+  boost::shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  TFramedTransport writer(wire);
+  const char* methods[] = { "get", "put", "get", "delete", "put" };
+  for (int i = 0; i < 5; ++i) {
+    std::string request = makeRequest(methods[i], arg(i));
+    writer.write((const uint8_t*)request.data(), request.size());
+    writer.flush();
+  }
+
+  boost::shared_ptr<TTransport> framed(new TFramedTransport(wire));
+  boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(framed));
+
+  // Plain borrows still stop at the end of a frame
+  uint32_t want = 1;
+  BOOST_CHECK(framed->borrow(NULL, &want) == NULL);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK(processor.process(protocol, protocol));
+  }
+  BOOST_CHECK_EQUAL(wire->available_read(), 0U);
+
+  BOOST_REQUIRE_EQUAL(f.processor->requests.size(), 5U);
+  BOOST_CHECK_EQUAL(f.processor->requests[3], "delete 3");
+  BOOST_REQUIRE_EQUAL(f.capture->writes.size(), 2U);
+  BOOST_CHECK(f.capture->writes[0] == makeRequest("put", "1"));
+  BOOST_CHECK(f.capture->writes[1] == makeRequest("put", "4"));
+}
+
+BOOST_AUTO_TEST_CASE( test_unframed_skipped ) {
+  Fixture f;
+  TCaptureProcessor processor(f.processor, f.capture, 1);
+
+  boost::shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  std::string request = makeRequest("get", "1");
+  wire->write((const uint8_t*)request.data(), request.size());
+  boost::shared_ptr<TTransport> buffered(new TBufferedTransport(wire));
+  boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(buffered));
+  BOOST_CHECK(processor.process(protocol, protocol));
+
+  BOOST_CHECK_EQUAL(f.processor->requests.size(), 1U);
+  BOOST_CHECK(f.capture->writes.empty());
+  BOOST_CHECK_EQUAL(processor.getNumSkipped(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE( test_replay_capture ) {
+  char name[] = "/tmp/CaptureProcessorTest.XXXXXX";
+  int fd = mkstemp(name);
+  close(fd);
+
+  {
+    boost::shared_ptr<TFileTransport> log(new TFileTransport(name));
+    log->setFlushMaxUs(10 * 1000);
+    Fixture f;
+    TCaptureProcessor processor(f.processor, log, 2);
+    boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+    boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(buffer));
+    for (int i = 1; i <= 10; ++i) {
+      std::string request = makeRequest("get", arg(i));
+      buffer->resetBuffer((uint8_t*)request.data(), request.size());
+      processor.process(protocol, protocol);
+    }
+    log->flush();
+  }
+
+  boost::shared_ptr<TFileTransport> reader(new TFileTransport(name, true));
+  boost::shared_ptr<RecordingProcessor> replayed(new RecordingProcessor());
+  TFileProcessor fileProcessor(replayed,
+                               boost::shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory()),
+                               reader);
+  fileProcessor.process(0, false);
+  unlink(name);
+
+  BOOST_REQUIRE_EQUAL(replayed->requests.size(), 5U);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK_EQUAL(replayed->requests[i], std::string("get ") + arg(2 * (i + 1)));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <transport/TServerSocket.h>
+#include <transport/TSocketPool.h>
+
+BOOST_AUTO_TEST_SUITE( CircuitBreakerTest )
+
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+
+static TCircuitBreakerConfig makeConfig() {
+  TCircuitBreakerConfig config;
+  config.windowSize = 10;
+  config.minCalls = 4;
+  config.maxErrorRate = 0.5;
+  config.maxTimeoutRate = 0.3;
+  config.openTimeMs = 1000;
+  return config;
+}
+
+BOOST_AUTO_TEST_CASE( test_trips_on_error_rate ) {
+  TCircuitBreakerConfig config = makeConfig();
+  TSocketPoolServer server("host", 9090);
+
+  // Too few calls to judge
+  server.recordOutcome(TSocketPoolServer::CALL_ERROR, config, 0);
+  server.recordOutcome(TSocketPoolServer::CALL_ERROR, config, 0);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_CLOSED);
+  server.recordOutcome(TSocketPoolServer::CALL_OK, config, 0);
+  server.recordOutcome(TSocketPoolServer::CALL_OK, config, 0);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_OPEN);
+  BOOST_CHECK_EQUAL(server.getNumTrips(), 1U);
+
+  BOOST_CHECK(!server.isAvailable(config, 999));
+  BOOST_CHECK(!server.tryAcquire(config, 999));
+  BOOST_CHECK_EQUAL(server.getNumRejected(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE( test_trips_on_timeout_rate ) {
+  TCircuitBreakerConfig config = makeConfig();
+  TSocketPoolServer server("host", 9090);
+  for (int i = 0; i < 7; ++i) {
+    server.recordOutcome(TSocketPoolServer::CALL_OK, config, 0);
+  }
+  server.recordOutcome(TSocketPoolServer::CALL_TIMEOUT, config, 0);
+  server.recordOutcome(TSocketPoolServer::CALL_TIMEOUT, config, 0);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_CLOSED);
+  server.recordOutcome(TSocketPoolServer::CALL_TIMEOUT, config, 0);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_OPEN);
+}
+
+BOOST_AUTO_TEST_CASE( test_half_open_trial ) {
+  TCircuitBreakerConfig config = makeConfig();
+  TSocketPoolServer server("host", 9090);
+  for (int i = 0; i < 4; ++i) {
+    server.recordOutcome(TSocketPoolServer::CALL_ERROR, config, 0);
+  }
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_OPEN);
+
+  // One trial call at a time once the wait is over
+  BOOST_CHECK(server.isAvailable(config, 1000));
+  BOOST_CHECK(server.tryAcquire(config, 1000));
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_HALF_OPEN);
+  BOOST_CHECK(!server.tryAcquire(config, 1000));
+
+  // A failed trial reopens it, and the wait starts over.
+  server.recordOutcome(TSocketPoolServer::CALL_TIMEOUT, config, 1500);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_OPEN);
+  BOOST_CHECK_EQUAL(server.getNumTrips(), 2U);
+  BOOST_CHECK(!server.tryAcquire(config, 2000));
+
+  // An abandoned trial lets another one through.
+  BOOST_CHECK(server.tryAcquire(config, 2500));
+  server.recordOutcome(TSocketPoolServer::CALL_ABANDONED, config, 2500);
+  BOOST_CHECK(server.tryAcquire(config, 2500));
+  server.recordOutcome(TSocketPoolServer::CALL_OK, config, 2600);
+  BOOST_CHECK_EQUAL(server.getBreakerState(), TSocketPoolServer::BREAKER_CLOSED);
+  BOOST_CHECK(server.tryAcquire(config, 2600));
+}
+
+BOOST_AUTO_TEST_CASE( test_retry_budget ) {
+  TRetryBudget budget(0.5, 2);
+  BOOST_CHECK(budget.tryRetry());
+  BOOST_CHECK(budget.tryRetry());
+  BOOST_CHECK(!budget.tryRetry());
+
+  budget.requestStarted();
+  BOOST_CHECK(!budget.tryRetry());
+  budget.requestStarted();
+  BOOST_CHECK(budget.tryRetry());
+
+  BOOST_CHECK_EQUAL(budget.getNumRequests(), 2U);
+  BOOST_CHECK_EQUAL(budget.getNumRetries(), 3U);
+  BOOST_CHECK_EQUAL(budget.getNumRetriesDenied(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE( test_pool_skips_open_breaker ) {
+  // Nothing listens on the first port, so connecting there fails at once.
+  TServerSocket serverSocket(19299);
+  serverSocket.listen();
+  TSocketPool pool;
+  pool.addServer("localhost", 19298);
+  pool.addServer("localhost", 19299);
+  pool.setRandomize(false);
+  pool.setAlwaysTryLast(false);
+  pool.setRetryInterval(0);
+  TCircuitBreakerConfig config = makeConfig();
+  config.minCalls = 2;
+  pool.setCircuitBreaker(config);
+  shared_ptr<TRetryBudget> budget(new TRetryBudget(0.1, 3));
+  pool.setRetryBudget(budget);
+
+  // Each open() falls through to the second server, spending a retry.
+  for (int i = 0; i < 2; ++i) {
+    pool.open();
+    BOOST_CHECK_EQUAL(pool.getPort(), 19299);
+    pool.close();
+  }
+  BOOST_CHECK_EQUAL(budget->getNumRetries(), 2U);
+
+  // Now the first server's breaker is open, so it is not even tried.
+  pool.open();
+  BOOST_CHECK_EQUAL(pool.getPort(), 19299);
+  BOOST_CHECK_EQUAL(budget->getNumRetries(), 2U);
+
+  std::map<std::string, int64_t> counters;
+  pool.getCounters(counters);
+  BOOST_CHECK_EQUAL(counters["socket_pool.localhost:19298.breaker_state"],
+                    (int64_t)TSocketPoolServer::BREAKER_OPEN);
+  BOOST_CHECK_EQUAL(counters["socket_pool.localhost:19299.breaker_state"],
+                    (int64_t)TSocketPoolServer::BREAKER_CLOSED);
+  BOOST_CHECK_EQUAL(counters["socket_pool.retries"], 2);
+  pool.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
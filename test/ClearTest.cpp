@@ -0,0 +1,87 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "gen-cpp/DebugProtoTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( ClearTest )
+
+using thrift::test::debug::HolyMoley;
+using thrift::test::debug::Nesting;
+using thrift::test::debug::OneOfEach;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_CASE( test_clear_restores_defaults ) {
+  Nesting n;
+  n.my_ooe.integer16 = 1;
+  n.my_ooe.some_characters = "Debug THIS!";
+  n.my_ooe.byte_list.clear();
+  n.my_ooe.__isset.some_characters = true;
+  n.my_bonk.message = "bonk";
+  n.__isset.my_bonk = true;
+
+  n.__clear();
+  BOOST_CHECK(n == Nesting());
+  BOOST_CHECK(!n.__isset.my_bonk);
+  BOOST_CHECK(!n.my_ooe.__isset.some_characters);
+  BOOST_CHECK_EQUAL(n.my_ooe.byte_list.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE( test_clear_keeps_capacity ) {
+  HolyMoley hm;
+  hm.big.resize(100);
+  std::vector<OneOfEach>::size_type capacity = hm.big.capacity();
+
+  hm.__clear();
+  BOOST_CHECK(hm.big.empty());
+  BOOST_CHECK_EQUAL(hm.big.capacity(), capacity);
+}
+
+BOOST_AUTO_TEST_CASE( test_read_reuses_list_elements ) {
+  HolyMoley small;
+  small.big.resize(2);
+  small.big[1].some_characters = "second";
+  HolyMoley large;
+  large.big.resize(4);
+
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+
+  // Elements already in the list are cleared and read into
+  HolyMoley hm;
+  hm.big.resize(3);
+  hm.big[0].byte_list.resize(1000);
+  hm.big[2].some_characters = "stale";
+  small.write(&protocol);
+  hm.read(&protocol);
+  BOOST_CHECK(hm == small);
+  BOOST_CHECK(hm.big[0].byte_list.capacity() >= 1000U);
+
+  // And the list grows when more are sent
+  large.write(&protocol);
+  hm.read(&protocol);
+  BOOST_CHECK(hm == large);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
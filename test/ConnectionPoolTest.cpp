@@ -0,0 +1,199 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Mutex.h>
+#include <concurrency/PosixThreadFactory.h>
+#include <transport/TConnectionPool.h>
+#include <transport/TServerSocket.h>
+
+BOOST_AUTO_TEST_SUITE( ConnectionPoolTest )
+
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+
+static const int kPort = 19295;
+
+// Accepts connections and holds them open until told to drop them.
+class AcceptingServer : public Runnable {
+ public:
+  AcceptingServer() : serverSocket_(kPort) {
+    serverSocket_.listen();
+  }
+
+  void run() {
+    try {
+      for (;;) {
+        shared_ptr<TTransport> client = serverSocket_.accept();
+        Guard g(mutex_);
+        clients_.push_back(client);
+      }
+    } catch (TTransportException&) {
+      // Interrupted by stop()
+    }
+  }
+
+  void stop() {
+    serverSocket_.interrupt();
+  }
+
+  size_t numAccepted() {
+    Guard g(mutex_);
+    return clients_.size();
+  }
+
+  void dropAll() {
+    Guard g(mutex_);
+    for (size_t i = 0; i < clients_.size(); ++i) {
+      clients_[i]->close();
+    }
+  }
+
+ private:
+  TServerSocket serverSocket_;
+  Mutex mutex_;
+  std::vector<shared_ptr<TTransport> > clients_;
+};
+
+struct ServerFixture {
+  ServerFixture() : server(new AcceptingServer()) {
+    PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                     PosixThreadFactory::NORMAL,
+                                     1,
+                                     false);
+    thread = threadFactory.newThread(server);
+    thread->start();
+  }
+
+  ~ServerFixture() {
+    server->stop();
+    thread->join();
+  }
+
+  void waitForAccepts(size_t n) {
+    while (server->numAccepted() < n) {
+      usleep(1000);
+    }
+  }
+
+  shared_ptr<AcceptingServer> server;
+  shared_ptr<Thread> thread;
+};
+
+BOOST_FIXTURE_TEST_CASE( test_released_connection_is_reused, ServerFixture ) {
+  TConnectionPool pool;
+  shared_ptr<TSocket> first = pool.lease("localhost", kPort);
+  BOOST_CHECK(first->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumLeased(), 1U);
+  pool.release(first);
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 1U);
+
+  shared_ptr<TSocket> second = pool.lease("localhost", kPort);
+  BOOST_CHECK(second == first);
+  BOOST_CHECK_EQUAL(pool.getNumOpened(), 1U);
+  BOOST_CHECK_EQUAL(pool.getNumReused(), 1U);
+
+  // A failed call's connection is closed, not pooled.
+  pool.release(second, false);
+  BOOST_CHECK(!second->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 0U);
+  BOOST_CHECK_EQUAL(pool.getNumLeased(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_closed_connection_is_not_reused, ServerFixture ) {
+  TConnectionPool pool;
+  shared_ptr<TSocket> first = pool.lease("localhost", kPort);
+  pool.release(first);
+  waitForAccepts(1);
+  server->dropAll();
+  usleep(10000);
+
+  shared_ptr<TSocket> second = pool.lease("localhost", kPort);
+  BOOST_CHECK(second != first);
+  BOOST_CHECK(second->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumDiscarded(), 1U);
+  BOOST_CHECK_EQUAL(pool.getNumOpened(), 2U);
+  pool.release(second);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_limits_and_eviction, ServerFixture ) {
+  TConnectionPool pool;
+  pool.setMaxTotalPerHost(2);
+  pool.setMaxIdlePerHost(1);
+
+  shared_ptr<TSocket> a = pool.lease("localhost", kPort);
+  shared_ptr<TSocket> b = pool.lease("localhost", kPort);
+  BOOST_CHECK_THROW(pool.lease("localhost", kPort), TTransportException);
+
+  pool.setLeaseTimeout(10);
+  BOOST_CHECK_THROW(pool.lease("localhost", kPort), TTransportException);
+
+  // Only one of them fits in the idle list.
+  pool.release(a);
+  pool.release(b);
+  BOOST_CHECK(!b->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 1U);
+
+  pool.evictIdle();
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 1U);
+  pool.setIdleTimeout(0);
+  pool.evictIdle();
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 0U);
+  BOOST_CHECK(!a->isOpen());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_lease_scope, ServerFixture ) {
+  TConnectionPool pool;
+  shared_ptr<TSocket> socket;
+  {
+    TConnectionLease lease(pool, "localhost", kPort);
+    socket = lease.socket();
+    lease.release();
+  }
+  BOOST_CHECK(socket->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 1U);
+
+  {
+    TConnectionLease lease(pool, "localhost", kPort);
+    BOOST_CHECK(lease.socket() == socket);
+    // Leaving the scope without release() discards the connection.
+  }
+  BOOST_CHECK(!socket->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_lease_outlives_pool, ServerFixture ) {
+  std::auto_ptr<TConnectionPool> pool(new TConnectionPool());
+  TConnectionLease lease(*pool, "localhost", kPort);
+  shared_ptr<TSocket> socket = lease.socket();
+  pool.reset();
+
+  // Nothing is left to pool it into, so the connection is closed.
+  BOOST_CHECK(socket->isOpen());
+  lease.release();
+  BOOST_CHECK(!socket->isOpen());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,156 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Util.h>
+#include <processor/TDeadline.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "gen-cpp/ThriftTest.h"
+
+BOOST_AUTO_TEST_SUITE( DeadlineTest )
+
+using apache::thrift::TApplicationException;
+using apache::thrift::concurrency::Util;
+using apache::thrift::processor::TDeadline;
+using apache::thrift::processor::TDeadlineScope;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using thrift::test::ThriftTestClient;
+using thrift::test::ThriftTestIf;
+using thrift::test::ThriftTestNull;
+using thrift::test::ThriftTestProcessor;
+
+class CountingHandler : public ThriftTestNull {
+ public:
+  CountingHandler() : numCalls(0) {}
+
+  void testString(std::string& _return, const std::string& thing) {
+    ++numCalls;
+    _return = thing;
+  }
+
+  int numCalls;
+};
+
+// A ThriftTest client and processor with the wire in between exposed
+struct CallFixture {
+  CallFixture() :
+    requests(new TMemoryBuffer()),
+    replies(new TMemoryBuffer()),
+    in(new TBinaryProtocol(requests)),
+    out(new TBinaryProtocol(replies)),
+    handler(new CountingHandler()),
+    processor(boost::shared_ptr<ThriftTestIf>(handler)),
+    client(out, in) {}
+
+  boost::shared_ptr<TMemoryBuffer> requests;
+  boost::shared_ptr<TMemoryBuffer> replies;
+  boost::shared_ptr<TProtocol> in;
+  boost::shared_ptr<TProtocol> out;
+  CountingHandler* handler;
+  ThriftTestProcessor processor;
+  ThriftTestClient client;
+};
+
+BOOST_AUTO_TEST_CASE( test_no_deadline ) {
+  TDeadlineScope scope(0);
+  BOOST_CHECK(!scope.expired());
+  BOOST_CHECK_EQUAL(TDeadline::getCurrent(), 0);
+  BOOST_CHECK_EQUAL(TDeadline::budgetFor(0), 0);
+  BOOST_CHECK_EQUAL(TDeadline::budgetFor(250), 250);
+}
+
+BOOST_AUTO_TEST_CASE( test_queue_time_counts ) {
+  // Arrived 100 ms ago with 50 ms to spare
+  TDeadline::setReceived(Util::currentTime() - 100);
+  {
+    TDeadlineScope scope(50);
+    BOOST_CHECK(scope.expired());
+  }
+
+  // The arrival time is used up by the call it was recorded for.
+  TDeadlineScope scope(50);
+  BOOST_CHECK(!scope.expired());
+}
+
+BOOST_AUTO_TEST_CASE( test_nested_calls_inherit_deadline ) {
+  {
+    TDeadlineScope scope(10000);
+    int64_t current = TDeadline::getCurrent();
+    BOOST_CHECK(current > Util::currentTime());
+
+    // Downstream calls get whatever is tighter.
+    int32_t budget = TDeadline::budgetFor(0);
+    BOOST_CHECK(budget > 9000 && budget <= 10000);
+    BOOST_CHECK_EQUAL(TDeadline::budgetFor(100), 100);
+
+    {
+      TDeadlineScope inner(0);
+      BOOST_CHECK_EQUAL(TDeadline::getCurrent(), 0);
+    }
+    BOOST_CHECK_EQUAL(TDeadline::getCurrent(), current);
+  }
+  BOOST_CHECK_EQUAL(TDeadline::getCurrent(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_expired_counter ) {
+  uint64_t before = TDeadline::getNumExpired();
+  TDeadline::expired();
+  BOOST_CHECK_EQUAL(TDeadline::getNumExpired(), before + 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_expired_call_skips_handler ) {
+  CallFixture f;
+  f.client.setCallTimeout(50);
+  f.client.send_testString("late");
+
+  // The request waited 100 ms in a queue before the processor saw it.
+  uint64_t before = TDeadline::getNumExpired();
+  TDeadline::setReceived(Util::currentTime() - 100);
+  BOOST_CHECK(f.processor.process(f.in, f.out));
+  BOOST_CHECK_EQUAL(f.handler->numCalls, 0);
+  BOOST_CHECK_EQUAL(TDeadline::getNumExpired(), before + 1);
+
+  std::string result;
+  try {
+    f.client.recv_testString(result);
+    BOOST_ERROR("recv_testString returned");
+  } catch (TApplicationException& x) {
+    BOOST_CHECK_EQUAL(x.getType(), TApplicationException::TIMED_OUT);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_call_in_time_runs_handler ) {
+  CallFixture f;
+  f.client.setCallTimeout(10000);
+  f.client.send_testString("early");
+
+  TDeadline::setReceived(Util::currentTime() - 100);
+  BOOST_CHECK(f.processor.process(f.in, f.out));
+  BOOST_CHECK_EQUAL(f.handler->numCalls, 1);
+
+  std::string result;
+  f.client.recv_testString(result);
+  BOOST_CHECK_EQUAL(result, "early");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -214,19 +214,23 @@ const CompactProtoTestStruct COMPACT_TEST = {
 }
 
 
+exception JankyException {
+  1: i32 arg;
+}
 
 service Srv {
-  i32 Janky(1: i32 arg);
+  i32 Janky(1: i32 arg) (cpp.cache_ttl_ms = "1000");
   
   // return type only methods
   
   void voidMethod();
-  i32 primitiveMethod();
-  CompactProtoTestStruct structMethod();
+  i32 primitiveMethod() (idempotent = "true");
+  CompactProtoTestStruct structMethod() (cpp.cache_ttl_ms = "1000");
+  i32 jankyOrThrow(1: i32 arg) throws (1: JankyException ex) (cpp.cache_ttl_ms = "1000");
 }
 
 service Inherited extends Srv {
-  i32 identity(1: i32 arg)
+  i32 identity(1: i32 arg) (idempotent = "true")
 }
 
 service EmptyService {}
@@ -271,4 +275,9 @@ struct PrimitiveThenStruct {
   1: i32 blah;
   2: i32 blah2;
   3: Backwards bw;
-}
\ No newline at end of file
+}
+struct LazyNesting {
+  1: i32 before;
+  2: HolyMoley payload (cpp.lazy = "true");
+  3: string after;
+}
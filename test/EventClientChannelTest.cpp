@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <async/TEventClientChannel.h>
+#include <protocol/TBinaryProtocol.h>
+#include <server/TNonblockingServer.h>
+#include <transport/TTransportException.h>
+#include "gen-cpp/Srv.h"
+
+BOOST_AUTO_TEST_SUITE( EventClientChannelTest )
+
+using apache::thrift::TProcessor;
+using apache::thrift::async::TEventClientChannel;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::server::TNonblockingServer;
+using apache::thrift::transport::TTransportException;
+using namespace thrift::test::debug;
+
+class DoublingHandler : public SrvNull {
+ public:
+  int32_t Janky(const int32_t arg) {
+    return arg * 2;
+  }
+
+  int32_t jankyOrThrow(const int32_t arg) {
+    JankyException ex;
+    ex.arg = arg;
+    throw ex;
+  }
+};
+
+// Keeps the result of each call, -1 for a failed one and -2 for a
+// JankyException
+struct RecordResult {
+  RecordResult(std::vector<int32_t>* results, bool orThrow = false) :
+    results_(results),
+    orThrow_(orThrow) {}
+
+  void operator()(SrvAsyncClient* client) {
+    try {
+      results_->push_back(orThrow_ ? client->recv_jankyOrThrow() : client->recv_Janky());
+    } catch (JankyException&) {
+      results_->push_back(-2);
+    } catch (TTransportException&) {
+      results_->push_back(-1);
+    }
+  }
+
+  std::vector<int32_t>* results_;
+  bool orThrow_;
+};
+
+// The server and the client channel share one event_base, so the test
+// thread runs both.
+struct Fixture {
+  Fixture(int port) :
+    base(static_cast<event_base*>(event_init())),
+    server(new TNonblockingServer(boost::shared_ptr<TProcessor>(
+      new SrvProcessor(boost::shared_ptr<SrvIf>(new DoublingHandler()))), port)),
+    channel(new TEventClientChannel("localhost", port, base)),
+    client(channel, &protocolFactory) {
+    server->listenSocket();
+    server->registerEvents(base);
+    channel->open();
+  }
+
+  ~Fixture() {
+    // The channel unregisters its event; the server leaks its own.
+    channel.reset();
+    event_base_free(base);
+  }
+
+  // Runs the loop until there are n results, for at most about 5s
+  void runUntil(size_t n) {
+    for (int i = 0; i < 50 && results.size() < n; ++i) {
+      struct timeval tv = {0, 100 * 1000};
+      event_base_loopexit(base, &tv);
+      event_base_loop(base, EVLOOP_ONCE);
+    }
+  }
+
+  event_base* base;
+  boost::shared_ptr<TNonblockingServer> server;
+  TBinaryProtocolFactory protocolFactory;
+  boost::shared_ptr<TEventClientChannel> channel;
+  SrvAsyncClient client;
+  std::vector<int32_t> results;
+};
+
+BOOST_AUTO_TEST_CASE( test_pipelined_calls ) {
+  Fixture f(19303);
+  for (int i = 0; i < 10; ++i) {
+    f.client.Janky(RecordResult(&f.results), i);
+  }
+  f.client.jankyOrThrow(RecordResult(&f.results, true), 7);
+  f.client.Janky(RecordResult(&f.results), 100);
+  BOOST_CHECK_EQUAL(f.channel->getNumPending(), 12U);
+
+  f.runUntil(12);
+  BOOST_REQUIRE_EQUAL(f.results.size(), 12U);
+  for (int i = 0; i < 10; ++i) {
+    BOOST_CHECK_EQUAL(f.results[i], i * 2);
+  }
+  BOOST_CHECK_EQUAL(f.results[10], -2);
+  BOOST_CHECK_EQUAL(f.results[11], 200);
+  BOOST_CHECK_EQUAL(f.channel->getNumPending(), 0U);
+  BOOST_CHECK(f.channel->good());
+}
+
+BOOST_AUTO_TEST_CASE( test_failure_completes_outstanding_calls ) {
+  Fixture f(19304);
+  // Every reply is bigger than this
+  f.channel->setMaxFrameSize(8);
+  for (int i = 0; i < 5; ++i) {
+    f.client.Janky(RecordResult(&f.results), i);
+  }
+
+  f.runUntil(5);
+  BOOST_REQUIRE_EQUAL(f.results.size(), 5U);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK_EQUAL(f.results[i], -1);
+  }
+  BOOST_CHECK(f.channel->error());
+  BOOST_CHECK_EQUAL(f.channel->getNumPending(), 0U);
+
+  // Later calls fail straight away
+  f.client.Janky(RecordResult(&f.results), 1);
+  BOOST_CHECK_EQUAL(f.results.size(), 6U);
+  BOOST_CHECK_EQUAL(f.results.back(), -1);
+}
+
+BOOST_AUTO_TEST_CASE( test_close_completes_outstanding_calls ) {
+  Fixture f(19305);
+  for (int i = 0; i < 5; ++i) {
+    f.client.Janky(RecordResult(&f.results), i);
+  }
+  f.channel->close();
+  BOOST_REQUIRE_EQUAL(f.results.size(), 5U);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK_EQUAL(f.results[i], -1);
+  }
+  BOOST_CHECK(!f.channel->isOpen());
+  BOOST_CHECK_EQUAL(f.channel->getNumPending(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,106 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <transport/TBufferTransports.h>
+#include <protocol/TBinaryProtocol.h>
+#include <protocol/TCompactProtocol.h>
+#include <protocol/TFieldMask.h>
+#include "gen-cpp/DebugProtoTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( FieldMaskTest )
+
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TFieldMask;
+using boost::shared_ptr;
+using thrift::test::debug::Nesting;
+using thrift::test::debug::OneOfEach;
+
+static Nesting make_nesting() {
+  Nesting n;
+  n.my_bonk.type = 31337;
+  n.my_bonk.message = "I am a bonk... xor!";
+  n.my_ooe.im_true = true;
+  n.my_ooe.integer16 = 27000;
+  n.my_ooe.integer32 = 1<<24;
+  n.my_ooe.integer64 = 6000 * 1000 * 1000LL;
+  n.my_ooe.some_characters = "Debug THIS!";
+  n.my_ooe.zomg_unicode = std::string(10000, 'z');
+  n.my_ooe.base64 = "\1\2\3\255";
+  return n;
+}
+
+template <typename Protocol>
+static void check_projection(shared_ptr<TTransport> trans) {
+  Protocol prot(trans);
+  Nesting n = make_nesting();
+  n.write(&prot);
+  n.write(&prot);
+  trans->flush();
+
+  TFieldMask ooe_mask;
+  ooe_mask.add(5).add(8);
+  TFieldMask mask;
+  mask.add(1).add(2, ooe_mask);
+
+  Nesting n2;
+  n2.readFields(&prot, mask);
+  BOOST_CHECK(n2.my_bonk == n.my_bonk);
+  BOOST_CHECK_EQUAL(n2.my_ooe.integer32, n.my_ooe.integer32);
+  BOOST_CHECK_EQUAL(n2.my_ooe.some_characters, n.my_ooe.some_characters);
+  BOOST_CHECK(!n2.my_ooe.__isset.im_true);
+  BOOST_CHECK(!n2.my_ooe.im_true);
+  BOOST_CHECK_EQUAL(n2.my_ooe.integer16, 33000 - 65536);
+  BOOST_CHECK(n2.my_ooe.zomg_unicode.empty());
+  BOOST_CHECK(n2.my_ooe.base64.empty());
+
+  // Skipping left the stream positioned at the next struct.
+  TFieldMask only_ooe;
+  only_ooe.add(2);
+  Nesting n3;
+  n3.readFields(&prot, only_ooe);
+  BOOST_CHECK(!n3.__isset.my_bonk);
+  BOOST_CHECK(n3.my_bonk.message.empty());
+  BOOST_CHECK(n3.my_ooe == n.my_ooe);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_memory ) {
+  check_projection<TBinaryProtocol>(
+      shared_ptr<TTransport>(new TMemoryBuffer()));
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_memory ) {
+  check_projection<TCompactProtocol>(
+      shared_ptr<TTransport>(new TMemoryBuffer()));
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_buffered ) {
+  // Strings longer than the read buffer can't be borrowed and are drained.
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  check_projection<TBinaryProtocol>(
+      shared_ptr<TTransport>(new TBufferedTransport(buf, 512)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
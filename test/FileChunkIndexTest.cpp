@@ -0,0 +1,257 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Util.h>
+#include <transport/TFileChunkIndex.h>
+#include <transport/TFileTransport.h>
+
+BOOST_AUTO_TEST_SUITE( FileChunkIndexTest )
+
+using namespace apache::thrift::transport;
+using apache::thrift::concurrency::Util;
+
+typedef TFileChunkIndex::Entry Entry;
+
+// A log file, and its index, that are removed when the test is done
+struct TempLog {
+  TempLog() {
+    char name[] = "/tmp/FileChunkIndexTest.XXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+    path = name;
+  }
+
+  ~TempLog() {
+    unlink(path.c_str());
+    unlink(TFileChunkIndex::pathFor(path).c_str());
+  }
+
+  std::string path;
+};
+
+// Events are 26 bytes, so three of them fill a 100 byte chunk
+static const uint32_t kChunkSize = 100;
+
+static std::string makeEvent(int i) {
+  std::string event(26, 'a' + i % 26);
+  event[0] = (char)i;
+  return event;
+}
+
+static void writeEvents(const std::string& path, int from, int to, bool chunkIndex) {
+  TFileTransport writer(path);
+  writer.setChunkSize(kChunkSize);
+  writer.setFlushMaxUs(10 * 1000);
+  writer.setChunkIndex(chunkIndex);
+  for (int i = from; i < to; ++i) {
+    std::string event = makeEvent(i);
+    writer.write((const uint8_t*)event.data(), event.size());
+  }
+  writer.flush();
+}
+
+// Number of the next event read, or -1 at the end
+static int nextEvent(TFileTransport& reader) {
+  uint8_t buf[64];
+  if (reader.read(buf, sizeof(buf)) == 0) {
+    return -1;
+  }
+  return buf[0];
+}
+
+static Entry makeEntry(uint32_t chunk, uint64_t firstEvent, uint32_t numEvents,
+                       int64_t minTime, int64_t maxTime) {
+  Entry entry;
+  entry.chunk = chunk;
+  entry.firstEvent = firstEvent;
+  entry.numEvents = numEvents;
+  entry.minTime = minTime;
+  entry.maxTime = maxTime;
+  return entry;
+}
+
+BOOST_AUTO_TEST_CASE( test_lookups ) {
+  TempLog log;
+  {
+    TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+    index.append(makeEntry(0, 0, 3, 100, 200));
+    index.append(makeEntry(1, 3, 3, 0, 0));
+    index.append(makeEntry(2, 6, 3, 300, 400));
+    // chunk 3 was lost to corruption
+    index.append(makeEntry(4, 9, 2, 500, 600));
+    index.write();
+  }
+
+  TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+  index.load();
+  BOOST_REQUIRE_EQUAL(index.getEntries().size(), 4U);
+  BOOST_CHECK_EQUAL(index.getNumEvents(), 11U);
+  BOOST_CHECK_EQUAL(index.getNextChunk(), 5U);
+
+  BOOST_CHECK_EQUAL(index.findEvent(0)->chunk, 0U);
+  BOOST_CHECK_EQUAL(index.findEvent(5)->chunk, 1U);
+  BOOST_CHECK_EQUAL(index.findEvent(10)->chunk, 4U);
+  BOOST_CHECK(index.findEvent(11) == NULL);
+
+  BOOST_CHECK_EQUAL(index.findTime(50)->chunk, 0U);
+  BOOST_CHECK_EQUAL(index.findTime(200)->chunk, 0U);
+  // chunk 1 may hold anything written between 200 and 300
+  BOOST_CHECK_EQUAL(index.findTime(250)->chunk, 1U);
+  BOOST_CHECK_EQUAL(index.findTime(450)->chunk, 4U);
+  BOOST_CHECK(index.findTime(700) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_writer_keeps_index ) {
+  TempLog log;
+  writeEvents(log.path, 0, 30, true);
+
+  // the last chunk is still open, so it is not indexed
+  TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+  index.load();
+  BOOST_REQUIRE_EQUAL(index.getEntries().size(), 9U);
+  for (uint32_t i = 0; i < 9; ++i) {
+    const Entry& entry = index.getEntries()[i];
+    BOOST_CHECK_EQUAL(entry.chunk, i);
+    BOOST_CHECK_EQUAL(entry.firstEventOffset, 0U);
+    BOOST_CHECK_EQUAL(entry.firstEvent, 3 * i);
+    BOOST_CHECK_EQUAL(entry.numEvents, 3U);
+    BOOST_CHECK(entry.minTime > 0 && entry.minTime <= entry.maxTime);
+  }
+
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(kChunkSize);
+  reader.seekToEvent(17);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 17);
+  // in the chunk that is not indexed
+  reader.seekToEvent(28);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 28);
+  reader.seekToEvent(30);
+  BOOST_CHECK_EQUAL(nextEvent(reader), -1);
+  reader.seekToEvent(0);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_seek_to_time ) {
+  TempLog log;
+  writeEvents(log.path, 0, 3, true);
+  // times of chunks indexed by a later writer come from the log's
+  // modification time, which may only count whole seconds
+  usleep((1000 - Util::currentTime() % 1000 + 20) * 1000);
+  int64_t start = Util::currentTime();
+  writeEvents(log.path, 3, 9, true);
+
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(kChunkSize);
+  reader.seekToTime(start);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 3);
+  reader.seekToTime(0);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 0);
+  // nothing indexed is that new, so the newest chunk is next
+  reader.seekToTime(start + 1000 * 1000);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 6);
+}
+
+BOOST_AUTO_TEST_CASE( test_seek_catches_up ) {
+  TempLog log;
+  writeEvents(log.path, 0, 10, false);
+  // the writer does not stop to index the log it was given
+  writeEvents(log.path, 10, 20, true);
+  {
+    TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+    index.load();
+    BOOST_CHECK_EQUAL(index.getEntries().size(), 0U);
+  }
+
+  // the first seek does
+  {
+    TFileTransport reader(log.path, true);
+    reader.setChunkSize(kChunkSize);
+    reader.seekToEvent(10);
+    BOOST_CHECK_EQUAL(nextEvent(reader), 10);
+  }
+  {
+    TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+    index.load();
+    BOOST_REQUIRE_EQUAL(index.getEntries().size(), 6U);
+    BOOST_CHECK_EQUAL(index.getNumEvents(), 18U);
+    // chunks indexed after the fact only have an upper bound
+    BOOST_CHECK_EQUAL(index.getEntries()[0].minTime, 0);
+    BOOST_CHECK(index.getEntries()[0].maxTime > 0);
+  }
+
+  // and from then on the writer keeps it
+  writeEvents(log.path, 20, 30, true);
+  TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+  index.load();
+  BOOST_REQUIRE_EQUAL(index.getEntries().size(), 9U);
+  BOOST_CHECK_EQUAL(index.getNumEvents(), 27U);
+  BOOST_CHECK(index.getEntries()[8].minTime > 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_torn_record ) {
+  TempLog log;
+  writeEvents(log.path, 0, 12, true);
+
+  // as if the writer crashed half way through writing the third entry
+  BOOST_REQUIRE_EQUAL(truncate(TFileChunkIndex::pathFor(log.path).c_str(),
+                               2 * sizeof(Entry) + sizeof(Entry) / 2), 0);
+  writeEvents(log.path, 12, 30, true);
+
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(kChunkSize);
+  reader.seekToEvent(20);
+  BOOST_CHECK_EQUAL(nextEvent(reader), 20);
+
+  TFileChunkIndex index(TFileChunkIndex::pathFor(log.path));
+  index.load();
+  BOOST_REQUIRE_EQUAL(index.getEntries().size(), 9U);
+  for (uint32_t i = 0; i < 9; ++i) {
+    BOOST_CHECK_EQUAL(index.getEntries()[i].chunk, i);
+    BOOST_CHECK_EQUAL(index.getEntries()[i].firstEvent, 3 * i);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_rebuild ) {
+  TempLog log;
+  writeEvents(log.path, 0, 12, true);
+  TFileChunkIndex before(TFileChunkIndex::pathFor(log.path));
+  before.load();
+
+  // a lost tail of the index is rebuilt, and the times that are left kept
+  BOOST_REQUIRE_EQUAL(truncate(TFileChunkIndex::pathFor(log.path).c_str(), 2 * sizeof(Entry)), 0);
+  {
+    TFileTransport reader(log.path, true);
+    reader.setChunkSize(kChunkSize);
+    reader.rebuildChunkIndex();
+    BOOST_CHECK_EQUAL(nextEvent(reader), 0);
+  }
+
+  TFileChunkIndex after(TFileChunkIndex::pathFor(log.path));
+  after.load();
+  BOOST_REQUIRE_EQUAL(after.getEntries().size(), 3U);
+  BOOST_CHECK_EQUAL(after.getEntries()[1].minTime, before.getEntries()[1].minTime);
+  BOOST_CHECK_EQUAL(after.getEntries()[2].firstEvent, 6U);
+  BOOST_CHECK_EQUAL(after.getEntries()[2].minTime, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,364 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Mutex.h>
+#include <concurrency/PosixThreadFactory.h>
+#include <concurrency/ThreadManager.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include <transport/TFileTransport.h>
+
+BOOST_AUTO_TEST_SUITE( FileReplayTest )
+
+using namespace apache::thrift::transport;
+using apache::thrift::TProcessor;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TProtocol;
+
+// A log file that is removed when the test is done
+struct TempLog {
+  TempLog() {
+    char name[] = "/tmp/FileReplayTest.XXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+    path = name;
+  }
+
+  ~TempLog() {
+    unlink(path.c_str());
+  }
+
+  std::string path;
+};
+
+static const uint32_t kChunkSize = 256;
+static const int kNumEvents = 2000;
+static const int kNumKeys = 7;
+
+// Stores each byte inverted, so a log is unreadable without it
+class InvertingCodec : public TFileChunkCodec {
+ public:
+  uint32_t getId() {
+    return 0x696e7600;
+  }
+
+  uint32_t compressBound(uint32_t len) {
+    return len;
+  }
+
+  uint32_t compress(const uint8_t* in, uint32_t len, uint8_t* out) {
+    for (uint32_t i = 0; i < len; ++i) {
+      out[i] = ~in[i];
+    }
+    return len;
+  }
+
+  void uncompress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t outLen) {
+    if (len != outLen) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA, "bad length");
+    }
+    compress(in, len, out);
+  }
+};
+
+// How a log is written, and so has to be read
+struct LogFormat {
+  LogFormat() : checksums(false) {}
+
+  boost::shared_ptr<TFileChunkCodec> codec;
+  bool checksums;
+};
+
+static void setFormat(TFileTransport& transport, const LogFormat& format) {
+  transport.setChunkSize(kChunkSize);
+  transport.setChunkCodec(format.codec);
+  transport.setEventChecksums(format.checksums);
+}
+
+// Event i is the string "<key> <i>", in the binary protocol
+static void writeLog(const std::string& path, const LogFormat& format = LogFormat()) {
+  TFileTransport writer(path);
+  setFormat(writer, format);
+  writer.setFlushMaxUs(10 * 1000);
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBinaryProtocol protocol(buffer);
+  for (int i = 0; i < kNumEvents; ++i) {
+    char event[32];
+    sprintf(event, "%d %d", i % kNumKeys, i);
+    protocol.writeString(event);
+    std::string bytes = buffer->getBufferAsString();
+    writer.write((const uint8_t*)bytes.data(), bytes.size());
+    buffer->resetBuffer();
+  }
+  writer.flush();
+}
+
+// What all the processors of a replay saw
+struct Replayed {
+  Replayed() : throwAt(-1) {}
+
+  Mutex mutex;
+  // The processors throw a std::exception on this event
+  int throwAt;
+  std::vector<std::pair<int, int> > events;
+  std::vector<std::vector<std::pair<int, int> > > byProcessor;
+};
+
+class RecordingProcessor : public TProcessor {
+ public:
+  RecordingProcessor(Replayed* replayed, size_t id) :
+    replayed_(replayed),
+    id_(id) {}
+
+  bool process(boost::shared_ptr<TProtocol> in, boost::shared_ptr<TProtocol>) {
+    std::string str;
+    in->readString(str);
+    int key;
+    int seq;
+    if (sscanf(str.c_str(), "%d %d", &key, &seq) != 2) {
+      return false;
+    }
+    if (seq == replayed_->throwAt) {
+      throw std::runtime_error("not a TException");
+    }
+    Guard g(replayed_->mutex);
+    replayed_->events.push_back(std::make_pair(key, seq));
+    replayed_->byProcessor[id_].push_back(std::make_pair(key, seq));
+    return true;
+  }
+
+ private:
+  Replayed* replayed_;
+  size_t id_;
+};
+
+class RecordingProcessorFactory : public TFileProcessorFactory {
+ public:
+  explicit RecordingProcessorFactory(Replayed* replayed) :
+    replayed_(replayed) {}
+
+  boost::shared_ptr<TProcessor> getProcessor() {
+    Guard g(replayed_->mutex);
+    replayed_->byProcessor.resize(replayed_->byProcessor.size() + 1);
+    return boost::shared_ptr<TProcessor>(
+      new RecordingProcessor(replayed_, replayed_->byProcessor.size() - 1));
+  }
+
+ private:
+  Replayed* replayed_;
+};
+
+// Keys events by the number before the space
+class LeadingKey : public TFileEventKey {
+ public:
+  uint64_t getKey(const uint8_t* event, uint32_t len) {
+    // skip the string's length
+    return len > 4 ? event[4] - '0' : 0;
+  }
+};
+
+static boost::shared_ptr<ThreadManager> startThreads(size_t count) {
+  boost::shared_ptr<ThreadManager> threadManager =
+    ThreadManager::newSimpleThreadManager(count);
+  threadManager->threadFactory(
+    boost::shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+  threadManager->start();
+  return threadManager;
+}
+
+static void replay(const std::string& path, Replayed* replayed,
+                   boost::shared_ptr<TFileEventKey> key,
+                   std::map<std::string, int64_t>* counters,
+                   const LogFormat& format = LogFormat()) {
+  boost::shared_ptr<TFileTransport> reader(new TFileTransport(path, true));
+  setFormat(*reader, format);
+  TFileProcessor fileProcessor(boost::shared_ptr<TProcessor>(),
+                               boost::shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory()),
+                               reader);
+  fileProcessor.setParallelChunks(3);
+  boost::shared_ptr<ThreadManager> threadManager = startThreads(4);
+  fileProcessor.processParallel(threadManager,
+                                boost::shared_ptr<TFileProcessorFactory>(
+                                  new RecordingProcessorFactory(replayed)),
+                                key);
+  threadManager->stop();
+  fileProcessor.getCounters(*counters);
+}
+
+static void checkAllReplayed(Replayed* replayed,
+                             std::map<std::string, int64_t>& counters) {
+  BOOST_REQUIRE_EQUAL(replayed->events.size(), (size_t)kNumEvents);
+  std::vector<bool> seen(kNumEvents);
+  for (size_t i = 0; i < replayed->events.size(); ++i) {
+    int seq = replayed->events[i].second;
+    BOOST_REQUIRE(seq >= 0 && seq < kNumEvents);
+    BOOST_CHECK(!seen[seq]);
+    seen[seq] = true;
+  }
+
+  BOOST_CHECK_EQUAL(counters["file_replay.events"], kNumEvents);
+  BOOST_CHECK_EQUAL(counters["file_replay.failed"], 0);
+  BOOST_CHECK(counters["file_replay.chunks"] > 1);
+  BOOST_CHECK_EQUAL(counters["file_replay.chunks_done"], counters["file_replay.chunks"]);
+  int64_t events = 0;
+  for (int i = 0; i < 4; ++i) {
+    char name[64];
+    sprintf(name, "file_replay.worker%d.events", i);
+    BOOST_REQUIRE(counters.count(name));
+    events += counters[name];
+  }
+  BOOST_CHECK_EQUAL(events, kNumEvents);
+}
+
+// Replays the log with and without a key
+static void checkReplays(const std::string& path, const LogFormat& format) {
+  for (int keyed = 0; keyed < 2; ++keyed) {
+    boost::shared_ptr<TFileEventKey> key;
+    if (keyed) {
+      key.reset(new LeadingKey());
+    }
+    Replayed replayed;
+    std::map<std::string, int64_t> counters;
+    replay(path, &replayed, key, &counters, format);
+    checkAllReplayed(&replayed, counters);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_chunk_ranges ) {
+  TempLog log;
+  writeLog(log.path);
+
+  Replayed replayed;
+  std::map<std::string, int64_t> counters;
+  replay(log.path, &replayed, boost::shared_ptr<TFileEventKey>(), &counters);
+  checkAllReplayed(&replayed, counters);
+  BOOST_CHECK_EQUAL(replayed.byProcessor.size(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE( test_keys_keep_order ) {
+  TempLog log;
+  writeLog(log.path);
+
+  Replayed replayed;
+  std::map<std::string, int64_t> counters;
+  replay(log.path, &replayed, boost::shared_ptr<TFileEventKey>(new LeadingKey()), &counters);
+  checkAllReplayed(&replayed, counters);
+
+  // each key went to one processor, in the order it was written
+  std::vector<int> processorOf(kNumKeys, -1);
+  for (size_t p = 0; p < replayed.byProcessor.size(); ++p) {
+    std::vector<int> last(kNumKeys, -1);
+    for (size_t i = 0; i < replayed.byProcessor[p].size(); ++i) {
+      int key = replayed.byProcessor[p][i].first;
+      int seq = replayed.byProcessor[p][i].second;
+      BOOST_CHECK(processorOf[key] == -1 || processorOf[key] == (int)p);
+      processorOf[key] = p;
+      BOOST_CHECK(seq > last[key]);
+      last[key] = seq;
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_compressed_log ) {
+  TempLog log;
+  LogFormat format;
+  format.codec.reset(new InvertingCodec());
+  writeLog(log.path, format);
+
+  checkReplays(log.path, format);
+}
+
+BOOST_AUTO_TEST_CASE( test_checksummed_log ) {
+  TempLog log;
+  LogFormat format;
+  format.checksums = true;
+  writeLog(log.path, format);
+
+  checkReplays(log.path, format);
+}
+
+BOOST_AUTO_TEST_CASE( test_unreadable_log_throws ) {
+  TempLog log;
+  LogFormat format;
+  format.codec.reset(new InvertingCodec());
+  writeLog(log.path, format);
+
+  // read without its codec
+  for (int keyed = 0; keyed < 2; ++keyed) {
+    boost::shared_ptr<TFileEventKey> key;
+    if (keyed) {
+      key.reset(new LeadingKey());
+    }
+    Replayed replayed;
+    std::map<std::string, int64_t> counters;
+    BOOST_CHECK_THROW(replay(log.path, &replayed, key, &counters), TTransportException);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_failed_events_are_skipped ) {
+  TempLog log;
+  writeLog(log.path);
+  {
+    TFileTransport writer(log.path);
+    writer.setChunkSize(kChunkSize);
+    writer.setFlushMaxUs(10 * 1000);
+    boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+    TBinaryProtocol protocol(buffer);
+    protocol.writeString("not an event");
+    std::string bytes = buffer->getBufferAsString();
+    writer.write((const uint8_t*)bytes.data(), bytes.size());
+    writer.flush();
+  }
+
+  Replayed replayed;
+  std::map<std::string, int64_t> counters;
+  replay(log.path, &replayed, boost::shared_ptr<TFileEventKey>(), &counters);
+  BOOST_CHECK_EQUAL(replayed.events.size(), (size_t)kNumEvents);
+  BOOST_CHECK_EQUAL(counters["file_replay.events"], kNumEvents);
+  BOOST_CHECK_EQUAL(counters["file_replay.failed"], 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_worker_exception_ends_replay ) {
+  TempLog log;
+  writeLog(log.path);
+
+  for (int keyed = 0; keyed < 2; ++keyed) {
+    boost::shared_ptr<TFileEventKey> key;
+    if (keyed) {
+      key.reset(new LeadingKey());
+    }
+    Replayed replayed;
+    replayed.throwAt = kNumEvents / 2;
+    std::map<std::string, int64_t> counters;
+    BOOST_CHECK_THROW(replay(log.path, &replayed, key, &counters), TTransportException);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
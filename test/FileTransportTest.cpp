@@ -0,0 +1,540 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/test/unit_test.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include <transport/TCrc32c.h>
+#include <transport/TFileTransport.h>
+
+BOOST_AUTO_TEST_SUITE( FileTransportTest )
+
+using namespace apache::thrift::transport;
+using apache::thrift::TProcessor;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TProtocol;
+
+// A log file that is removed when the test is done
+struct TempLog {
+  TempLog() {
+    char name[] = "/tmp/FileTransportTest.XXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+    path = name;
+  }
+
+  ~TempLog() {
+    unlink(path.c_str());
+  }
+
+  off_t size() {
+    struct stat st;
+    stat(path.c_str(), &st);
+    return st.st_size;
+  }
+
+  std::string path;
+};
+
+static std::string makeEvent(int i, size_t len) {
+  std::string event(len, 'a' + i % 26);
+  event[0] = (char)i;
+  return event;
+}
+
+static void writeEvents(const std::string& path, uint32_t chunkSize,
+                        int count, size_t len) {
+  TFileTransport writer(path);
+  writer.setChunkSize(chunkSize);
+  writer.setFlushMaxUs(10 * 1000);
+  writer.setPreallocateChunks(true);
+  for (int i = 0; i < count; ++i) {
+    std::string event = makeEvent(i, len);
+    writer.write((const uint8_t*)event.data(), event.size());
+  }
+  writer.flush();
+}
+
+static void checkEvents(const std::string& path, uint32_t chunkSize,
+                        int count, size_t len, bool mapReads = false) {
+  TFileTransport reader(path, true);
+  reader.setChunkSize(chunkSize);
+  reader.setMapReads(mapReads);
+  std::vector<uint8_t> buf(len + 1);
+  for (int i = 0; i < count; ++i) {
+    uint32_t got = reader.read(&buf[0], buf.size());
+    BOOST_REQUIRE_EQUAL(got, len);
+    BOOST_REQUIRE(std::string((char*)&buf[0], got) == makeEvent(i, len));
+  }
+  BOOST_CHECK_EQUAL(reader.read(&buf[0], buf.size()), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  TempLog log;
+  // More events than one writev() takes
+  writeEvents(log.path, 1024 * 1024, 5000, 20);
+  BOOST_CHECK_EQUAL(log.size(), 5000 * 24);
+  checkEvents(log.path, 1024 * 1024, 5000, 20);
+}
+
+BOOST_AUTO_TEST_CASE( test_events_do_not_cross_chunks ) {
+  TempLog log;
+  // Three 30 byte events fit in a 100 byte chunk, then 10 bytes of padding
+  writeEvents(log.path, 100, 10, 26);
+  BOOST_CHECK_EQUAL(log.size(), 3 * 100 + 30);
+  checkEvents(log.path, 100, 10, 26);
+}
+
+BOOST_AUTO_TEST_CASE( test_map_reads ) {
+  TempLog log;
+  // chunks that are not page aligned, with padding between them
+  writeEvents(log.path, 100, 10, 26);
+  checkEvents(log.path, 100, 10, 26, true);
+
+  TempLog big;
+  writeEvents(big.path, 1024 * 1024, 5000, 20);
+  checkEvents(big.path, 1024 * 1024, 5000, 20, true);
+}
+
+BOOST_AUTO_TEST_CASE( test_event_views ) {
+  TempLog log;
+  writeEvents(log.path, 100, 10, 26);
+
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(100);
+  reader.setMapReads(true);
+  TMemoryBuffer view;
+  for (int i = 0; i < 10; ++i) {
+    BOOST_REQUIRE(reader.readEvent(&view));
+    BOOST_CHECK(view.getBufferAsString() == makeEvent(i, 26));
+  }
+  BOOST_CHECK(!reader.readEvent(&view));
+}
+
+// Reads one string per call, and remembers them
+class StringProcessor : public TProcessor {
+ public:
+  bool process(boost::shared_ptr<TProtocol> in, boost::shared_ptr<TProtocol>) {
+    std::string str;
+    in->readString(str);
+    strings.push_back(str);
+    return true;
+  }
+
+  std::vector<std::string> strings;
+};
+
+BOOST_AUTO_TEST_CASE( test_process_in_place ) {
+  TempLog log;
+  {
+    TFileTransport writer(log.path);
+    writer.setChunkSize(100);
+    writer.setFlushMaxUs(10 * 1000);
+    boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+    TBinaryProtocol protocol(buffer);
+    for (int i = 0; i < 10; ++i) {
+      protocol.writeString(makeEvent(i, 26));
+      std::string event = buffer->getBufferAsString();
+      writer.write((const uint8_t*)event.data(), event.size());
+      buffer->resetBuffer();
+    }
+    writer.flush();
+  }
+
+  for (int inPlace = 0; inPlace < 2; ++inPlace) {
+    boost::shared_ptr<TFileTransport> reader(new TFileTransport(log.path, true));
+    reader->setChunkSize(100);
+    reader->setMapReads(inPlace);
+    boost::shared_ptr<StringProcessor> processor(new StringProcessor());
+    TFileProcessor fileProcessor(processor,
+                                 boost::shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory()),
+                                 reader);
+    fileProcessor.setProcessInPlace(inPlace);
+    fileProcessor.process(0, false);
+    BOOST_REQUIRE_EQUAL(processor->strings.size(), 10U);
+    for (int i = 0; i < 10; ++i) {
+      BOOST_CHECK(processor->strings[i] == makeEvent(i, 26));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_recovery ) {
+  for (int mapReads = 0; mapReads < 2; ++mapReads) {
+    TempLog log;
+    writeEvents(log.path, 100, 10, 26);
+
+    // make the first event of the second chunk claim to cross into the third
+    {
+      FILE* f = fopen(log.path.c_str(), "r+b");
+      uint32_t bogus = 97;
+      fseek(f, 100, SEEK_SET);
+      fwrite(&bogus, sizeof(bogus), 1, f);
+      fclose(f);
+    }
+
+    // the rest of the second chunk is given up on
+    TFileTransport reader(log.path, true);
+    reader.setChunkSize(100);
+    reader.setMapReads(mapReads);
+    uint8_t buf[64];
+    int expected[] = { 0, 1, 2, 6, 7, 8, 9 };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+      uint32_t got = reader.read(buf, sizeof(buf));
+      BOOST_REQUIRE_EQUAL(got, 26U);
+      BOOST_CHECK(std::string((char*)buf, got) == makeEvent(expected[i], 26));
+    }
+    BOOST_CHECK_EQUAL(reader.read(buf, sizeof(buf)), 0U);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_append ) {
+  TempLog log;
+  writeEvents(log.path, 100, 4, 26);
+  {
+    TFileTransport writer(log.path);
+    writer.setChunkSize(100);
+    writer.setFlushMaxUs(10 * 1000);
+    for (int i = 4; i < 8; ++i) {
+      std::string event = makeEvent(i, 26);
+      writer.write((const uint8_t*)event.data(), event.size());
+    }
+    writer.flush();
+  }
+  BOOST_CHECK_EQUAL(log.size(), 2 * 100 + 60);
+  checkEvents(log.path, 100, 8, 26);
+}
+
+BOOST_AUTO_TEST_CASE( test_mixed_event_sizes ) {
+  TempLog log;
+  // Sizes on both sides of the buffer's initial arena, read back with the
+  // reader reusing its event buffers
+  size_t sizes[] = { 10, 200 * 1024, 3, 70 * 1024, 1000 };
+  int count = sizeof(sizes) / sizeof(sizes[0]);
+  {
+    TFileTransport writer(log.path);
+    writer.setChunkSize(1024 * 1024);
+    writer.setFlushMaxUs(10 * 1000);
+    for (int i = 0; i < count; ++i) {
+      std::string event = makeEvent(i, sizes[i]);
+      writer.write((const uint8_t*)event.data(), event.size());
+    }
+    writer.flush();
+  }
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(1024 * 1024);
+  std::vector<uint8_t> buf(256 * 1024);
+  for (int i = 0; i < count; ++i) {
+    uint32_t got = reader.read(&buf[0], buf.size());
+    BOOST_REQUIRE_EQUAL(got, sizes[i]);
+    BOOST_REQUIRE(std::string((char*)&buf[0], got) == makeEvent(i, sizes[i]));
+  }
+}
+
+struct Producer {
+  TFileTransport* transport;
+  uint32_t id;
+  uint32_t count;
+};
+
+static void* produce(void* arg) {
+  Producer* p = (Producer*)arg;
+  for (uint32_t i = 0; i < p->count; ++i) {
+    uint32_t event[2] = { p->id, i };
+    p->transport->write((const uint8_t*)event, sizeof(event));
+  }
+  return NULL;
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_writers ) {
+  TempLog log;
+  const uint32_t numThreads = 16;
+  const uint32_t count = 5000;
+  {
+    TFileTransport writer(log.path);
+    writer.setFlushMaxUs(10 * 1000);
+    // sharding is opt-in
+    BOOST_CHECK_EQUAL(writer.getEnqueueShards(), 1U);
+    // more threads than shards, and small shards so writers fill them up
+    writer.setEnqueueShards(4);
+    writer.setEventBufferSize(100);
+
+    Producer producers[numThreads];
+    pthread_t threads[numThreads];
+    for (uint32_t t = 0; t < numThreads; ++t) {
+      producers[t].transport = &writer;
+      producers[t].id = t;
+      producers[t].count = count;
+      BOOST_REQUIRE_EQUAL(pthread_create(&threads[t], NULL, produce, &producers[t]), 0);
+    }
+    for (uint32_t t = 0; t < numThreads; ++t) {
+      pthread_join(threads[t], NULL);
+    }
+
+    // flush() is a barrier for everything written before it
+    writer.flush();
+    BOOST_CHECK_EQUAL(log.size(), numThreads * count * 12);
+  }
+
+  // every thread's events are there, in the order it wrote them
+  TFileTransport reader(log.path, true);
+  std::vector<uint32_t> next(numThreads, 0);
+  uint32_t event[2];
+  for (uint32_t i = 0; i < numThreads * count; ++i) {
+    BOOST_REQUIRE_EQUAL(reader.read((uint8_t*)event, sizeof(event)), sizeof(event));
+    BOOST_REQUIRE(event[0] < numThreads);
+    BOOST_REQUIRE_EQUAL(event[1], next[event[0]]);
+    next[event[0]]++;
+  }
+}
+
+// Run-length encoding, enough to shrink padding and repetitive events
+class RunLengthCodec : public TFileChunkCodec {
+ public:
+  uint32_t getId() {
+    return 0x726c6500;
+  }
+
+  uint32_t compressBound(uint32_t len) {
+    return 2 * len;
+  }
+
+  uint32_t compress(const uint8_t* in, uint32_t len, uint8_t* out) {
+    uint32_t outLen = 0;
+    for (uint32_t i = 0; i < len; ) {
+      uint32_t run = 1;
+      while (i + run < len && run < 255 && in[i + run] == in[i]) {
+        ++run;
+      }
+      out[outLen++] = (uint8_t)run;
+      out[outLen++] = in[i];
+      i += run;
+    }
+    return outLen;
+  }
+
+  void uncompress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t outLen) {
+    uint32_t got = 0;
+    for (uint32_t i = 0; i + 1 < len; i += 2) {
+      if (got + in[i] > outLen) {
+        throw TTransportException(TTransportException::CORRUPTED_DATA, "run too long");
+      }
+      memset(out + got, in[i + 1], in[i]);
+      got += in[i];
+    }
+    if (got != outLen) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA, "chunk too short");
+    }
+  }
+};
+
+static void writeCompressed(const std::string& path, int from, int to, bool flushEach) {
+  TFileTransport writer(path);
+  writer.setChunkSize(100);
+  writer.setFlushMaxUs(10 * 1000);
+  writer.setChunkCodec(boost::shared_ptr<TFileChunkCodec>(new RunLengthCodec()));
+  for (int i = from; i < to; ++i) {
+    std::string event = makeEvent(i, 26);
+    writer.write((const uint8_t*)event.data(), event.size());
+    if (flushEach) {
+      writer.flush();
+    }
+  }
+  writer.flush();
+}
+
+static void checkCompressed(const std::string& path, int32_t chunk,
+                            const std::vector<int>& expected) {
+  TFileTransport reader(path, true);
+  reader.setChunkSize(100);
+  reader.setChunkCodec(boost::shared_ptr<TFileChunkCodec>(new RunLengthCodec()));
+  if (chunk > 0) {
+    reader.seekToChunk(chunk);
+  }
+  TMemoryBuffer view;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    BOOST_REQUIRE(reader.readEvent(&view));
+    BOOST_CHECK(view.getBufferAsString() == makeEvent(expected[i], 26));
+  }
+  BOOST_CHECK(!reader.readEvent(&view));
+}
+
+static std::vector<int> range(int from, int to) {
+  std::vector<int> events;
+  for (int i = from; i < to; ++i) {
+    events.push_back(i);
+  }
+  return events;
+}
+
+BOOST_AUTO_TEST_CASE( test_compressed_chunks ) {
+  TempLog log;
+  writeCompressed(log.path, 0, 100, false);
+
+  // three events to a chunk, each well under 100 bytes on disk
+  BOOST_CHECK(log.size() < 34 * 50);
+  checkCompressed(log.path, 0, range(0, 100));
+  checkCompressed(log.path, 5, range(15, 100));
+
+  TFileTransport reader(log.path, true);
+  reader.setChunkSize(100);
+  reader.setChunkCodec(boost::shared_ptr<TFileChunkCodec>(new RunLengthCodec()));
+  BOOST_CHECK_EQUAL(reader.getNumChunks(), 34U);
+  uint8_t buf[64];
+  reader.seekToChunk(33);
+  BOOST_CHECK_EQUAL(reader.getCurChunk(), 33U);
+  BOOST_REQUIRE_EQUAL(reader.read(buf, sizeof(buf)), 26U);
+  BOOST_CHECK(std::string((char*)buf, 26) == makeEvent(99, 26));
+}
+
+BOOST_AUTO_TEST_CASE( test_compressed_flushes_and_reopening ) {
+  TempLog log;
+  // each flush writes out the chunk so far, and the second writer carries
+  // on in the middle of a chunk
+  writeCompressed(log.path, 0, 5, true);
+  writeCompressed(log.path, 5, 10, true);
+  checkCompressed(log.path, 0, range(0, 10));
+  checkCompressed(log.path, 1, range(3, 10));
+  checkCompressed(log.path, 3, range(9, 10));
+}
+
+BOOST_AUTO_TEST_CASE( test_compressed_recovery ) {
+  TempLog log;
+  writeCompressed(log.path, 0, 9, false);
+
+  // the first chunk's record is lost, and the reader finds the next one
+  {
+    FILE* f = fopen(log.path.c_str(), "r+b");
+    fputc('X', f);
+    fclose(f);
+  }
+  checkCompressed(log.path, 0, range(3, 9));
+
+  // so is one cut short at the end, which the next writer replaces
+  truncate(log.path.c_str(), log.size() - 1);
+  checkCompressed(log.path, 0, range(3, 6));
+  writeCompressed(log.path, 9, 12, false);
+  std::vector<int> expected = range(3, 6);
+  expected.push_back(9);
+  expected.push_back(10);
+  expected.push_back(11);
+  checkCompressed(log.path, 0, expected);
+}
+
+BOOST_AUTO_TEST_CASE( test_crc32c ) {
+  const uint8_t* digits = (const uint8_t*)"123456789";
+  BOOST_CHECK_EQUAL(TCrc32c::value(digits, 9), 0xe3069283U);
+  BOOST_CHECK_EQUAL(TCrc32c::extend(TCrc32c::value(digits, 4), digits + 4, 5), 0xe3069283U);
+  BOOST_CHECK_EQUAL(TCrc32c::value(digits, 0), 0U);
+}
+
+static void writeChecksummed(const std::string& path, int count) {
+  TFileTransport writer(path);
+  writer.setChunkSize(100);
+  writer.setFlushMaxUs(10 * 1000);
+  writer.setEventChecksums(true);
+  for (int i = 0; i < count; ++i) {
+    std::string event = makeEvent(i, 26);
+    writer.write((const uint8_t*)event.data(), event.size());
+  }
+  writer.flush();
+}
+
+// Reads with each way of reading: mapped, and read() with a buffer big
+// enough for a chunk and one smaller than an event
+static void checkChecksummed(const std::string& path, const std::vector<int>& expected) {
+  for (int mode = 0; mode < 3; ++mode) {
+    TFileTransport reader(path, true);
+    reader.setChunkSize(100);
+    reader.setEventChecksums(true);
+    reader.setMapReads(mode == 0);
+    reader.setReadBuffSize(mode == 2 ? 20 : 1024);
+    uint8_t buf[64];
+    for (size_t i = 0; i < expected.size(); ++i) {
+      uint32_t got = reader.read(buf, sizeof(buf));
+      BOOST_REQUIRE_EQUAL(got, 26U);
+      BOOST_CHECK(std::string((char*)buf, got) == makeEvent(expected[i], 26));
+    }
+    BOOST_CHECK_EQUAL(reader.read(buf, sizeof(buf)), 0U);
+  }
+}
+
+static void damage(const std::string& path, long offset, uint8_t value) {
+  FILE* f = fopen(path.c_str(), "r+b");
+  fseek(f, offset, SEEK_SET);
+  fputc(value, f);
+  fclose(f);
+}
+
+BOOST_AUTO_TEST_CASE( test_checksummed_events ) {
+  TempLog log;
+  // 38 bytes framed, so two events to a chunk
+  writeChecksummed(log.path, 10);
+  BOOST_CHECK_EQUAL(log.size(), 4 * 100 + 2 * 38);
+  checkChecksummed(log.path, range(0, 10));
+}
+
+BOOST_AUTO_TEST_CASE( test_checksum_resync ) {
+  int expected[] = { 0, 2, 3, 4, 5, 6, 7, 8, 9 };
+  std::vector<int> all_but_one(expected, expected + 9);
+
+  // a damaged event is dropped, and the next one in the chunk still read
+  {
+    TempLog log;
+    writeChecksummed(log.path, 10);
+    damage(log.path, 38 + 12 + 5, 'X');
+    checkChecksummed(log.path, all_but_one);
+  }
+
+  // as is one whose length is wrong, whichever way
+  for (int length = 1; length < 100; length += 30) {
+    TempLog log;
+    writeChecksummed(log.path, 10);
+    damage(log.path, 38 + 4, (uint8_t)length);
+    checkChecksummed(log.path, all_but_one);
+  }
+
+  // and one without its marker
+  {
+    TempLog log;
+    writeChecksummed(log.path, 10);
+    damage(log.path, 38 + 1, 0);
+    checkChecksummed(log.path, all_but_one);
+  }
+
+  // garbage at the start of a chunk takes the events it covers
+  {
+    TempLog log;
+    writeChecksummed(log.path, 10);
+    FILE* f = fopen(log.path.c_str(), "r+b");
+    fseek(f, 200, SEEK_SET);
+    fwrite("garbage garbage garbage garbage garbage garbage", 40, 1, f);
+    fclose(f);
+    int expected[] = { 0, 1, 2, 3, 6, 7, 8, 9 };
+    checkChecksummed(log.path, std::vector<int>(expected, expected + 8));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,56 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include "gen-cpp/ThriftTest_types.h"
+#include "gen-cpp/DebugProtoTest_constants.h"
+
+BOOST_AUTO_TEST_SUITE( GeneratedConstantsTest )
+
+using thrift::test::Numberz_name;
+using thrift::test::debug::DebugProtoTestConstants;
+
+namespace other {
+// Must not clash with the generated name
+static const int g_DebugProtoTest_constants = 0;
+}
+
+BOOST_AUTO_TEST_CASE( test_enum_names ) {
+  BOOST_CHECK(std::strcmp(Numberz_name(thrift::test::ONE), "ONE") == 0);
+  BOOST_CHECK(std::strcmp(Numberz_name(thrift::test::EIGHT), "EIGHT") == 0);
+  // Gaps and out-of-range values have no name.
+  BOOST_CHECK(Numberz_name(4) == NULL);
+  BOOST_CHECK(Numberz_name(0) == NULL);
+  BOOST_CHECK(Numberz_name(-1) == NULL);
+  BOOST_CHECK(Numberz_name(9) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_lazy_constants ) {
+  const DebugProtoTestConstants& c = DebugProtoTestConstants::instance();
+  BOOST_CHECK(&c == &DebugProtoTestConstants::instance());
+  BOOST_CHECK(&c == &thrift::test::debug::g_DebugProtoTest_constants());
+  BOOST_CHECK_EQUAL(other::g_DebugProtoTest_constants, 0);
+  BOOST_CHECK_EQUAL(c.COMPACT_TEST.a_i16, 32000);
+  BOOST_CHECK_EQUAL(c.COMPACT_TEST.a_string, "my string");
+  BOOST_CHECK_EQUAL(c.COMPACT_TEST.byte_list.size(), 5U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
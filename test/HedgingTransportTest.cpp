@@ -0,0 +1,229 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/PosixThreadFactory.h>
+#include <concurrency/Util.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/THedgingTransport.h>
+#include <transport/TServerSocket.h>
+
+BOOST_AUTO_TEST_SUITE( HedgingTransportTest )
+
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+
+static const int kSlowPort = 19296;
+static const int kFastPort = 19297;
+static const int kHangMs = 600;
+
+// Answers each call with its own name after a fixed delay.  Calls named
+// "quick" are answered at once, and calls named "hang" after kHangMs.
+class DelayedEchoServer : public Runnable {
+ public:
+  DelayedEchoServer(int port, int delayMs) :
+    serverSocket_(port),
+    delayMs_(delayMs) {
+    serverSocket_.listen();
+  }
+
+  void run() {
+    try {
+      for (;;) {
+        shared_ptr<TTransport> client = serverSocket_.accept();
+        shared_ptr<TTransport> trans(new TFramedTransport(client));
+        TBinaryProtocol prot(trans);
+        try {
+          for (;;) {
+            std::string name;
+            TMessageType type;
+            int32_t seqid;
+            prot.readMessageBegin(name, type, seqid);
+            prot.readMessageEnd();
+            if (name == "hang") {
+              usleep(kHangMs * 1000);
+            } else if (name != "quick") {
+              usleep(delayMs_ * 1000);
+            }
+            prot.writeMessageBegin(name, T_REPLY, seqid);
+            prot.writeMessageEnd();
+            trans->flush();
+          }
+        } catch (TTransportException&) {
+          // Client went away
+        }
+        client->close();
+      }
+    } catch (TTransportException&) {
+      // Interrupted by stop()
+    }
+  }
+
+  void stop() {
+    serverSocket_.interrupt();
+  }
+
+ private:
+  TServerSocket serverSocket_;
+  int delayMs_;
+};
+
+static bool hedgeIdem(const std::string& fname) {
+  return fname == "idem";
+}
+
+static bool hedgeAll(const std::string&) {
+  return true;
+}
+
+struct ServerFixture {
+  ServerFixture() :
+    slow(new DelayedEchoServer(kSlowPort, 300)),
+    fast(new DelayedEchoServer(kFastPort, 0)) {
+    PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                     PosixThreadFactory::NORMAL,
+                                     1,
+                                     false);
+    slowThread = threadFactory.newThread(slow);
+    slowThread->start();
+    fastThread = threadFactory.newThread(fast);
+    fastThread->start();
+
+    std::vector<shared_ptr<TSocketPoolServer> > servers;
+    servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("localhost", kSlowPort)));
+    servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("localhost", kFastPort)));
+    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+    transport.reset(new THedgingTransport(servers, protocolFactory));
+    // Tried in order, so the slow one is the primary
+    transport->getPrimary()->setRandomize(false);
+    transport->setHedgeDelay(20);
+    transport->setHedgeBudget(100);
+    transport->open();
+    prot = protocolFactory->getProtocol(transport);
+  }
+
+  ~ServerFixture() {
+    transport->close();
+    slow->stop();
+    fast->stop();
+    slowThread->join();
+    fastThread->join();
+  }
+
+  // Makes a call and returns the name in the reply
+  std::string call(const std::string& fname, int32_t seqid) {
+    prot->writeMessageBegin(fname, T_CALL, seqid);
+    prot->writeMessageEnd();
+    transport->flush();
+
+    std::string name;
+    TMessageType type;
+    int32_t rseqid;
+    prot->readMessageBegin(name, type, rseqid);
+    prot->readMessageEnd();
+    BOOST_CHECK_EQUAL(type, T_REPLY);
+    BOOST_CHECK_EQUAL(rseqid, seqid);
+    return name;
+  }
+
+  shared_ptr<DelayedEchoServer> slow;
+  shared_ptr<DelayedEchoServer> fast;
+  shared_ptr<Thread> slowThread;
+  shared_ptr<Thread> fastThread;
+  shared_ptr<THedgingTransport> transport;
+  shared_ptr<TProtocol> prot;
+};
+
+BOOST_FIXTURE_TEST_CASE( test_only_filtered_calls_are_hedged, ServerFixture ) {
+  BOOST_CHECK_EQUAL(call("idem", 1), "idem");
+  BOOST_CHECK_EQUAL(transport->getNumHedgeable(), 0U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 0U);
+
+  transport->setHedgeFilter(&hedgeIdem);
+  BOOST_CHECK_EQUAL(call("other", 2), "other");
+  BOOST_CHECK_EQUAL(transport->getNumHedgeable(), 0U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_fast_backup_wins, ServerFixture ) {
+  transport->setHedgeFilter(&hedgeIdem);
+  BOOST_CHECK_EQUAL(call("idem", 1), "idem");
+  BOOST_CHECK_EQUAL(transport->getNumHedgeable(), 1U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 1U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesWon(), 1U);
+  BOOST_CHECK(transport->getBackup()->isOpen());
+  BOOST_CHECK(!transport->getPrimary()->isOpen());
+
+  // The abandoned reply must not be mistaken for the next one.
+  BOOST_CHECK_EQUAL(call("idem", 2), "idem");
+  BOOST_CHECK_EQUAL(transport->getNumHedgesWon(), 2U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_budget_limits_hedges, ServerFixture ) {
+  transport->setHedgeFilter(&hedgeIdem);
+  transport->setHedgeBudget(50);
+  for (int i = 0; i < 4; ++i) {
+    call("idem", i);
+  }
+  BOOST_CHECK_EQUAL(transport->getNumHedgeable(), 4U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 2U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_fast_calls_earn_budget, ServerFixture ) {
+  transport->setHedgeFilter(&hedgeAll);
+  transport->setHedgeBudget(50);
+  for (int i = 0; i < 4; ++i) {
+    call("quick", i);
+  }
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 0U);
+
+  // The quick calls paid for hedging both slow ones.
+  call("idem", 4);
+  call("idem", 5);
+  BOOST_CHECK_EQUAL(transport->getNumHedgeable(), 6U);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 2U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_hedged_call_times_out, ServerFixture ) {
+  transport->setHedgeFilter(&hedgeAll);
+  transport->getPrimary()->setRecvTimeout(150);
+  transport->getBackup()->setRecvTimeout(150);
+
+  prot->writeMessageBegin("hang", T_CALL, 1);
+  prot->writeMessageEnd();
+  int64_t start = Util::currentTime();
+  try {
+    transport->flush();
+    BOOST_ERROR("expected a timeout");
+  } catch (TTransportException& ttx) {
+    BOOST_CHECK_EQUAL(ttx.getType(), TTransportException::TIMED_OUT);
+  }
+  int64_t elapsed = Util::currentTime() - start;
+  BOOST_CHECK(elapsed >= 150 && elapsed < kHangMs);
+  BOOST_CHECK_EQUAL(transport->getNumHedgesSent(), 1U);
+  BOOST_CHECK(!transport->getPrimary()->isOpen());
+  BOOST_CHECK(!transport->getBackup()->isOpen());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <transport/TBufferTransports.h>
+#include <protocol/TBinaryProtocol.h>
+#include <protocol/TCompactProtocol.h>
+#include "gen-cpp/DebugProtoTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( LazyFieldTest )
+
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using boost::shared_ptr;
+using thrift::test::debug::LazyNesting;
+using thrift::test::debug::HolyMoley;
+using thrift::test::debug::OneOfEach;
+
+static LazyNesting make_lazy_nesting() {
+  LazyNesting ln;
+  ln.before = 1;
+  ln.after = "after";
+  OneOfEach ooe;
+  ooe.some_characters = "Debug THIS!";
+  ooe.integer64 = 64;
+  HolyMoley& hm = ln.mutable_payload();
+  hm.big.push_back(ooe);
+  hm.big.push_back(ooe);
+  hm.big[1].integer32 = 32;
+  std::vector<std::string> stage;
+  stage.push_back("and a one");
+  hm.contain.insert(stage);
+  return ln;
+}
+
+template <typename Protocol>
+static void check_roundtrip() {
+  LazyNesting ln = make_lazy_nesting();
+
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<TProtocol> prot(new Protocol(buf));
+  ln.write(prot.get());
+  std::string serialized = buf->getBufferAsString();
+
+  LazyNesting ln2;
+  ln2.read(prot.get());
+  BOOST_CHECK(ln2.__isset.payload);
+  BOOST_CHECK(ln2.__lazy_payload.pending());
+  BOOST_CHECK_EQUAL(ln2.after, "after");
+
+  // Forwarding an untouched struct reproduces the input exactly.
+  ln2.write(prot.get());
+  BOOST_CHECK(buf->getBufferAsString() == serialized);
+  buf->resetBuffer();
+
+  // Reading decodes on demand and keeps the raw bytes.
+  BOOST_CHECK_EQUAL(ln2.get_payload().big.size(), 2U);
+  BOOST_CHECK_EQUAL(ln2.get_payload().big[1].integer32, 32);
+  BOOST_CHECK(!ln2.__lazy_payload.pending());
+  BOOST_CHECK(ln2 == ln);
+
+  // Modifying the field forces it to be re-encoded.
+  ln2.mutable_payload().big.pop_back();
+  BOOST_CHECK_EQUAL(ln2.__lazy_payload.size(), 0U);
+  ln2.write(prot.get());
+  LazyNesting ln3;
+  ln3.read(prot.get());
+  BOOST_CHECK_EQUAL(ln3.get_payload().big.size(), 1U);
+  BOOST_CHECK(ln3 == ln2);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_roundtrip ) {
+  check_roundtrip<TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_roundtrip ) {
+  check_roundtrip<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_eager_fallback ) {
+  LazyNesting ln = make_lazy_nesting();
+
+  // A buffered transport may refill under us, so the field is read eagerly.
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<TTransport> trans(new TBufferedTransport(buf));
+  TBinaryProtocol prot(trans);
+  ln.write(&prot);
+  trans->flush();
+
+  LazyNesting ln2;
+  ln2.read(&prot);
+  BOOST_CHECK(!ln2.__lazy_payload.pending());
+  BOOST_CHECK_EQUAL(ln2.get_payload().big.size(), 2U);
+  BOOST_CHECK(ln2 == ln);
+}
+
+BOOST_AUTO_TEST_CASE( test_const_access_decodes_once ) {
+  LazyNesting ln = make_lazy_nesting();
+
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  ln.write(&prot);
+  std::string serialized = buf->getBufferAsString();
+
+  LazyNesting ln2;
+  ln2.read(&prot);
+
+  // Const readers decode into the struct, once.
+  const LazyNesting& cln2 = ln2;
+  const HolyMoley& payload = cln2.get_payload();
+  BOOST_CHECK_EQUAL(payload.big.size(), 2U);
+  BOOST_CHECK(!ln2.__lazy_payload.pending());
+  BOOST_CHECK(&cln2.get_payload() == &payload);
+  BOOST_CHECK(cln2 == ln);
+
+  // The bytes are still there to forward.
+  ln2.write(&prot);
+  BOOST_CHECK(buf->getBufferAsString() == serialized);
+}
+
+BOOST_AUTO_TEST_CASE( test_reread_without_field ) {
+  LazyNesting ln = make_lazy_nesting();
+
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  ln.write(&prot);
+  LazyNesting ln2;
+  ln2.read(&prot);
+  BOOST_CHECK(ln2.__lazy_payload.pending());
+
+  // The next message has no payload at all.
+  prot.writeStructBegin("LazyNesting");
+  prot.writeFieldBegin("before", apache::thrift::protocol::T_I32, 1);
+  prot.writeI32(2);
+  prot.writeFieldEnd();
+  prot.writeFieldStop();
+  prot.writeStructEnd();
+  ln2.read(&prot);
+
+  BOOST_CHECK_EQUAL(ln2.before, 2);
+  BOOST_CHECK(!ln2.__isset.payload);
+  BOOST_CHECK(!ln2.__lazy_payload.pending());
+  BOOST_CHECK(ln2.get_payload().big.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
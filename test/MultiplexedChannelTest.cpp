@@ -0,0 +1,230 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <set>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <async/TMultiplexedChannel.h>
+#include <concurrency/PosixThreadFactory.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TServerSocket.h>
+#include <transport/TSocket.h>
+#include "gen-cpp/ThriftTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( MultiplexedChannelTest )
+
+using namespace apache::thrift;
+using namespace apache::thrift::async;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+using thrift::test::Xtruct;
+
+static const int kCalls = 8;
+
+// Reads kCalls requests, then answers them in reverse order.
+class ReversingServer : public Runnable {
+ public:
+  ReversingServer(int port) : serverSocket_(port) {
+    serverSocket_.listen();
+  }
+
+  void run() {
+    shared_ptr<TTransport> client = serverSocket_.accept();
+    shared_ptr<TTransport> trans(new TFramedTransport(client));
+    TBinaryProtocol prot(trans);
+
+    std::vector<std::pair<int32_t, Xtruct> > requests;
+    for (int i = 0; i < kCalls; ++i) {
+      std::string name;
+      TMessageType type;
+      int32_t seqid;
+      Xtruct x;
+      prot.readMessageBegin(name, type, seqid);
+      x.read(&prot);
+      prot.readMessageEnd();
+      requests.push_back(std::make_pair(seqid, x));
+      wireSeqIds.insert(seqid);
+    }
+    for (int i = kCalls - 1; i >= 0; --i) {
+      prot.writeMessageBegin("echo", T_REPLY, requests[i].first);
+      requests[i].second.write(&prot);
+      prot.writeMessageEnd();
+      trans->flush();
+    }
+    client->close();
+  }
+
+  std::set<int32_t> wireSeqIds;
+
+ private:
+  TServerSocket serverSocket_;
+};
+
+// Lets a protocol borrow a buffer it does not own
+struct NoDelete {
+  void operator()(TTransport*) {}
+};
+
+static void writeRequest(TMemoryBuffer* buf, int32_t seqid, int32_t value) {
+  TBinaryProtocol prot(shared_ptr<TTransport>(buf, NoDelete()));
+  Xtruct x;
+  x.i32_thing = value;
+  prot.writeMessageBegin("echo", T_CALL, seqid);
+  x.write(&prot);
+  prot.writeMessageEnd();
+}
+
+static int32_t readResponse(TMemoryBuffer* buf, int32_t* seqid) {
+  TBinaryProtocol prot(shared_ptr<TTransport>(buf, NoDelete()));
+  std::string name;
+  TMessageType type;
+  Xtruct x;
+  prot.readMessageBegin(name, type, *seqid);
+  x.read(&prot);
+  prot.readMessageEnd();
+  return x.i32_thing;
+}
+
+static shared_ptr<Thread> startThread(shared_ptr<Runnable> runnable) {
+  PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                   PosixThreadFactory::NORMAL,
+                                   1,
+                                   false);
+  shared_ptr<Thread> thread = threadFactory.newThread(runnable);
+  thread->start();
+  return thread;
+}
+
+static shared_ptr<TMultiplexedChannel> openChannel(int port) {
+  shared_ptr<TMultiplexedChannel> channel(
+      new TMultiplexedChannel(shared_ptr<TTransport>(new TSocket("localhost", port)),
+                              shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory())));
+  channel->open();
+  return channel;
+}
+
+struct AsyncResults {
+  Monitor monitor;
+  std::vector<int32_t> order;
+  bool ok;
+
+  AsyncResults() : ok(true) {}
+
+  void complete(TMemoryBuffer* buf, int32_t expected) {
+    int32_t seqid;
+    int32_t value = readResponse(buf, &seqid);
+    Synchronized s(monitor);
+    ok = ok && value == expected && seqid == 1000 + expected;
+    order.push_back(value);
+    monitor.notify();
+  }
+};
+
+BOOST_AUTO_TEST_CASE( test_async_out_of_order ) {
+  shared_ptr<ReversingServer> server(new ReversingServer(19293));
+  shared_ptr<Thread> serverThread = startThread(server);
+  shared_ptr<TMultiplexedChannel> channel = openChannel(19293);
+
+  AsyncResults results;
+  TMemoryBuffer sendBufs[kCalls];
+  TMemoryBuffer recvBufs[kCalls];
+  for (int i = 0; i < kCalls; ++i) {
+    writeRequest(&sendBufs[i], 1000 + i, i);
+    channel->sendAndRecvMessage(
+        std::tr1::bind(&AsyncResults::complete, &results, &recvBufs[i], i),
+        &sendBufs[i], &recvBufs[i]);
+    BOOST_CHECK_EQUAL(sendBufs[i].available_read(), 0U);
+  }
+
+  {
+    Synchronized s(results.monitor);
+    while (results.order.size() < (size_t)kCalls) {
+      results.monitor.wait();
+    }
+  }
+  serverThread->join();
+
+  BOOST_CHECK(results.ok);
+  for (int i = 0; i < kCalls; ++i) {
+    BOOST_CHECK_EQUAL(results.order[i], kCalls - 1 - i);
+  }
+  BOOST_CHECK_EQUAL(server->wireSeqIds.size(), (size_t)kCalls);
+  BOOST_CHECK_EQUAL(channel->getNumPending(), 0U);
+}
+
+class BlockingCaller : public Runnable {
+ public:
+  BlockingCaller(shared_ptr<TMultiplexedChannel> channel, int32_t value) :
+    transport_(new TMultiplexedTransport(channel)),
+    value_(value),
+    result_(-1),
+    seqid_(-1) {}
+
+  void run() {
+    TMemoryBuffer buf;
+    writeRequest(&buf, 0, value_);
+    uint8_t* data;
+    uint32_t sz;
+    buf.getBuffer(&data, &sz);
+    transport_->write(data, sz);
+    transport_->flush();
+
+    TBinaryProtocol prot(transport_);
+    std::string name;
+    TMessageType type;
+    Xtruct x;
+    prot.readMessageBegin(name, type, seqid_);
+    x.read(&prot);
+    prot.readMessageEnd();
+    result_ = x.i32_thing;
+  }
+
+  shared_ptr<TMultiplexedTransport> transport_;
+  int32_t value_;
+  int32_t result_;
+  int32_t seqid_;
+};
+
+BOOST_AUTO_TEST_CASE( test_blocking_callers_share_connection ) {
+  shared_ptr<ReversingServer> server(new ReversingServer(19294));
+  shared_ptr<Thread> serverThread = startThread(server);
+  shared_ptr<TMultiplexedChannel> channel = openChannel(19294);
+
+  // Every caller uses seqid 0; the channel must keep them apart.
+  std::vector<shared_ptr<BlockingCaller> > callers;
+  std::vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < kCalls; ++i) {
+    callers.push_back(shared_ptr<BlockingCaller>(new BlockingCaller(channel, i)));
+    threads.push_back(startThread(callers.back()));
+  }
+  for (int i = 0; i < kCalls; ++i) {
+    threads[i]->join();
+    BOOST_CHECK_EQUAL(callers[i]->result_, i);
+    BOOST_CHECK_EQUAL(callers[i]->seqid_, 0);
+  }
+  serverThread->join();
+
+  BOOST_CHECK_EQUAL(server->wireSeqIds.size(), (size_t)kCalls);
+  BOOST_CHECK_EQUAL(channel->getNumPending(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
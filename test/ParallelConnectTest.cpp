@@ -0,0 +1,181 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Util.h>
+#include <transport/TServerSocket.h>
+#include <transport/TSocketPool.h>
+
+BOOST_AUTO_TEST_SUITE( ParallelConnectTest )
+
+using namespace apache::thrift::transport;
+using apache::thrift::concurrency::Util;
+using boost::shared_ptr;
+
+static const int kStalledPort = 19300;
+static const int kLivePort = 19301;
+static const int kDeadPort = 19302;
+
+// A listener whose accept queue is full, so further connects hang the way
+// they do to an unreachable host.
+class StalledListener {
+ public:
+  StalledListener(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    bind(listener_, (struct sockaddr*)&addr, sizeof(addr));
+    listen(listener_, 0);
+
+    // Never accepted, these fill the queue
+    for (int i = 0; i < 4; ++i) {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+      fillers_.push_back(fd);
+    }
+    usleep(50 * 1000);
+  }
+
+  ~StalledListener() {
+    for (size_t i = 0; i < fillers_.size(); ++i) {
+      close(fillers_[i]);
+    }
+    close(listener_);
+  }
+
+ private:
+  int listener_;
+  std::vector<int> fillers_;
+};
+
+static shared_ptr<TSocketPool> makePool(int firstPort, int secondPort) {
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("127.0.0.1", firstPort)));
+  servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("127.0.0.1", secondPort)));
+  shared_ptr<TSocketPool> pool(new TSocketPool(servers));
+  pool->setRandomize(false);
+  pool->setConnTimeout(2000);
+  pool->setConnectStagger(50);
+  return pool;
+}
+
+BOOST_AUTO_TEST_CASE( test_single_socket ) {
+  TServerSocket live(kLivePort);
+  live.listen();
+
+  TSocket socket("localhost", kLivePort);
+  socket.setConnectStagger(50);
+  socket.open();
+  BOOST_CHECK(socket.isOpen());
+  socket.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_stalled_server_costs_one_stagger ) {
+  StalledListener stalled(kStalledPort);
+  TServerSocket live(kLivePort);
+  live.listen();
+
+  shared_ptr<TSocketPool> pool = makePool(kStalledPort, kLivePort);
+  int64_t start = Util::currentTime();
+  pool->open();
+  int64_t elapsed = Util::currentTime() - start;
+
+  BOOST_CHECK(pool->isOpen());
+  BOOST_CHECK_EQUAL(pool->getCurrentServer()->port_, kLivePort);
+  BOOST_CHECK(elapsed < 1000);
+  // Losing the race is not a failure
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  pool->getServers(servers);
+  BOOST_CHECK_EQUAL(servers[0]->consecutiveFailures_, 0);
+  pool->close();
+}
+
+BOOST_AUTO_TEST_CASE( test_refused_server_does_not_wait ) {
+  TServerSocket live(kLivePort);
+  live.listen();
+
+  shared_ptr<TSocketPool> pool = makePool(kDeadPort, kLivePort);
+  pool->setConnectStagger(1000);
+  int64_t start = Util::currentTime();
+  pool->open();
+  int64_t elapsed = Util::currentTime() - start;
+
+  BOOST_CHECK_EQUAL(pool->getCurrentServer()->port_, kLivePort);
+  BOOST_CHECK(elapsed < 500);
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  pool->getServers(servers);
+  BOOST_CHECK_EQUAL(servers[0]->consecutiveFailures_, 1);
+  pool->close();
+}
+
+BOOST_AUTO_TEST_CASE( test_all_refused ) {
+  shared_ptr<TSocketPool> pool = makePool(kDeadPort, kDeadPort);
+  BOOST_CHECK_THROW(pool->open(), TTransportException);
+  BOOST_CHECK(!pool->isOpen());
+}
+
+BOOST_AUTO_TEST_CASE( test_retry_budget_limits_race ) {
+  StalledListener stalled(kStalledPort);
+  TServerSocket live(kLivePort);
+  live.listen();
+
+  shared_ptr<TSocketPool> pool = makePool(kStalledPort, kLivePort);
+  pool->setConnTimeout(200);
+  pool->setRetryBudget(shared_ptr<TRetryBudget>(new TRetryBudget(0, 0)));
+  BOOST_CHECK_THROW(pool->open(), TTransportException);
+
+  // The live server was never tried, so it did not fail.
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  pool->getServers(servers);
+  BOOST_CHECK_EQUAL(servers[0]->consecutiveFailures_, 1);
+  BOOST_CHECK_EQUAL(servers[1]->consecutiveFailures_, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_later_servers_resolved_lazily ) {
+  TServerSocket live(kLivePort);
+  live.listen();
+
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("127.0.0.1", kLivePort)));
+  servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("no.such.host.invalid", kLivePort)));
+  TSocketPool pool(servers);
+  pool.setRandomize(false);
+  pool.setConnectStagger(1000);
+  pool.open();
+
+  // Resolving the second server would have failed it.
+  BOOST_CHECK_EQUAL(pool.getCurrentServer()->port_, kLivePort);
+  BOOST_CHECK_EQUAL(servers[1]->consecutiveFailures_, 0);
+  pool.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Monitor.h>
+#include <concurrency/PosixThreadFactory.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "gen-cpp/Service.h"
+
+BOOST_AUTO_TEST_SUITE( PoolArgsTest )
+
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+using test::stress::ServiceClient;
+using test::stress::ServiceIf;
+using test::stress::ServiceNull;
+using test::stress::ServiceProcessor;
+
+// One echoString call through processor
+static std::string echo(ServiceProcessor* processor, const std::string& arg) {
+  shared_ptr<TMemoryBuffer> requests(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> replies(new TMemoryBuffer());
+  shared_ptr<TProtocol> in(new TBinaryProtocol(requests));
+  shared_ptr<TProtocol> out(new TBinaryProtocol(replies));
+  ServiceClient client(out, in);
+  client.send_echoString(arg);
+  processor->process(in, out);
+  std::string result;
+  client.recv_echoString(result);
+  return result;
+}
+
+// Calls back into the processor from echoString("outer"), as a handler
+// forwarding to its own service would
+class ReentrantHandler : public ServiceNull {
+ public:
+  ReentrantHandler() : processor(NULL) {}
+
+  void echoString(std::string& _return, const std::string& arg) {
+    if (arg == "outer") {
+      innerResult = echo(processor, "inner");
+    }
+    _return = arg;
+  }
+
+  ServiceProcessor* processor;
+  std::string innerResult;
+};
+
+struct Fixture {
+  Fixture() :
+    handler(new ReentrantHandler()),
+    processor(new ServiceProcessor(shared_ptr<ServiceIf>(handler))) {
+    handler->processor = processor.get();
+  }
+
+  ReentrantHandler* handler;
+  shared_ptr<ServiceProcessor> processor;
+};
+
+BOOST_AUTO_TEST_CASE( test_reused_args_are_cleared ) {
+  Fixture f;
+  BOOST_CHECK_EQUAL(echo(f.processor.get(), "a rather longer argument"), "a rather longer argument");
+  BOOST_CHECK_EQUAL(echo(f.processor.get(), "x"), "x");
+  BOOST_CHECK_EQUAL(echo(f.processor.get(), ""), "");
+}
+
+BOOST_AUTO_TEST_CASE( test_reentrant_call ) {
+  Fixture f;
+  BOOST_CHECK_EQUAL(echo(f.processor.get(), "outer"), "outer");
+  BOOST_CHECK_EQUAL(f.handler->innerResult, "inner");
+
+  // And the pooled objects are still usable afterwards
+  BOOST_CHECK_EQUAL(echo(f.processor.get(), "again"), "again");
+}
+
+// Makes a call, then waits to be released before exiting
+class Caller : public Runnable {
+ public:
+  Caller(ServiceProcessor* processor) :
+    processor_(processor),
+    called_(false),
+    released_(false) {}
+
+  void run() {
+    result = echo(processor_, "thread");
+    Synchronized s(monitor_);
+    called_ = true;
+    monitor_.notifyAll();
+    while (!released_) {
+      monitor_.wait();
+    }
+  }
+
+  void waitForCall() {
+    Synchronized s(monitor_);
+    while (!called_) {
+      monitor_.wait();
+    }
+  }
+
+  void release() {
+    Synchronized s(monitor_);
+    released_ = true;
+    monitor_.notifyAll();
+  }
+
+  std::string result;
+
+ private:
+  ServiceProcessor* processor_;
+  Monitor monitor_;
+  bool called_;
+  bool released_;
+};
+
+BOOST_AUTO_TEST_CASE( test_processor_destroyed_before_thread_exits ) {
+  Fixture f;
+  PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                   PosixThreadFactory::NORMAL,
+                                   1,
+                                   false);
+  shared_ptr<Caller> caller(new Caller(f.processor.get()));
+  shared_ptr<Thread> thread = threadFactory.newThread(caller);
+  thread->start();
+  caller->waitForCall();
+  BOOST_CHECK_EQUAL(caller->result, "thread");
+
+  // The thread's pool goes with the processor; its exit must not touch it.
+  f.processor.reset();
+  caller->release();
+  thread->join();
+}
+
+BOOST_AUTO_TEST_CASE( test_many_processors ) {
+  // More processors than a process has pthread keys
+  std::vector<shared_ptr<ServiceProcessor> > processors;
+  for (int i = 0; i < 1100; ++i) {
+    processors.push_back(shared_ptr<ServiceProcessor>(
+      new ServiceProcessor(shared_ptr<ServiceIf>(new ServiceNull()))));
+  }
+  BOOST_CHECK_EQUAL(echo(processors.front().get(), "first"), "");
+  BOOST_CHECK_EQUAL(echo(processors.back().get(), "last"), "");
+
+  // Processors come and go while the thread keeps its pools
+  processors.erase(processors.begin(), processors.begin() + 1000);
+  shared_ptr<ServiceProcessor> replacement(
+    new ServiceProcessor(shared_ptr<ServiceIf>(new ServiceNull())));
+  BOOST_CHECK_EQUAL(echo(replacement.get(), "new"), "");
+  BOOST_CHECK_EQUAL(echo(processors.back().get(), "last"), "");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
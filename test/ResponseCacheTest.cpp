@@ -0,0 +1,209 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <processor/TResponseCache.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "gen-cpp/Srv.h"
+
+BOOST_AUTO_TEST_SUITE( ResponseCacheTest )
+
+using apache::thrift::TProcessor;
+using apache::thrift::processor::TResponseCache;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using namespace thrift::test::debug;
+
+// Hands each request a client flushes to the processor and serves the
+// reply to the client's next reads.
+class LoopbackTransport : public TTransport {
+ public:
+  LoopbackTransport(boost::shared_ptr<TProcessor> processor) :
+    processor_(processor),
+    requests_(new TMemoryBuffer()),
+    replies_(new TMemoryBuffer()),
+    numRequests(0) {}
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    return replies_->read(buf, len);
+  }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    requests_->write(buf, len);
+  }
+
+  void flush() {
+    boost::shared_ptr<TProtocol> in(new TBinaryProtocol(requests_));
+    boost::shared_ptr<TProtocol> out(new TBinaryProtocol(replies_));
+    processor_->process(in, out);
+    ++numRequests;
+  }
+
+ private:
+  boost::shared_ptr<TProcessor> processor_;
+  boost::shared_ptr<TMemoryBuffer> requests_;
+  boost::shared_ptr<TMemoryBuffer> replies_;
+
+ public:
+  int numRequests;
+};
+
+class JankyHandler : public SrvNull {
+ public:
+  int32_t Janky(const int32_t arg) {
+    return arg * 2;
+  }
+
+  int32_t jankyOrThrow(const int32_t arg) {
+    JankyException ex;
+    ex.arg = arg;
+    throw ex;
+  }
+};
+
+struct ClientFixture {
+  ClientFixture() :
+    transport(new LoopbackTransport(boost::shared_ptr<TProcessor>(
+      new SrvProcessor(boost::shared_ptr<SrvIf>(new JankyHandler()))))),
+    cache(new TResponseCache()),
+    client(boost::shared_ptr<TProtocol>(new TBinaryProtocol(transport))) {
+    client.setResponseCache(cache);
+  }
+
+  boost::shared_ptr<LoopbackTransport> transport;
+  boost::shared_ptr<TResponseCache> cache;
+  SrvClient client;
+};
+
+BOOST_AUTO_TEST_CASE( test_hit_and_miss ) {
+  TResponseCache cache;
+  std::string value;
+  BOOST_CHECK(!cache.get("key", value));
+  cache.put("key", "value", 10000);
+  BOOST_CHECK(cache.get("key", value));
+  BOOST_CHECK_EQUAL(value, "value");
+  BOOST_CHECK_EQUAL(cache.getNumHits(), 1U);
+  BOOST_CHECK_EQUAL(cache.getNumMisses(), 1U);
+  BOOST_CHECK_EQUAL(cache.getNumEntries(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE( test_expiry ) {
+  TResponseCache cache;
+  std::string value;
+  cache.put("key", "value", 20);
+  usleep(50 * 1000);
+  BOOST_CHECK(!cache.get("key", value));
+  BOOST_CHECK_EQUAL(cache.getNumExpirations(), 1U);
+  BOOST_CHECK_EQUAL(cache.getNumEntries(), 0U);
+  BOOST_CHECK_EQUAL(cache.getSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_size_bound_evicts_lru ) {
+  // One shard with room for about three entries of this size
+  std::string big(200, 'x');
+  TResponseCache cache(1000, 1);
+  cache.put("a", big, 10000);
+  cache.put("b", big, 10000);
+  cache.put("c", big, 10000);
+
+  std::string value;
+  BOOST_CHECK(cache.get("a", value));
+  cache.put("d", big, 10000);
+  BOOST_CHECK_EQUAL(cache.getNumEvictions(), 1U);
+  BOOST_CHECK(cache.getSize() <= 1000U);
+  BOOST_CHECK(cache.get("a", value));
+  BOOST_CHECK(!cache.get("b", value));
+
+  // Too big to ever fit
+  cache.put("huge", std::string(2000, 'x'), 10000);
+  BOOST_CHECK(!cache.get("huge", value));
+}
+
+BOOST_AUTO_TEST_CASE( test_invalidation ) {
+  TResponseCache cache;
+  std::string value;
+  std::string key1 = std::string("Srv.Janky") + '\0' + "1";
+  std::string key2 = std::string("Srv.Janky") + '\0' + "2";
+  std::string other = std::string("Srv.JankyToo") + '\0' + "1";
+  cache.put(key1, "one", 10000);
+  cache.put(key2, "two", 10000);
+  cache.put(other, "three", 10000);
+
+  cache.invalidate(key1);
+  BOOST_CHECK(!cache.get(key1, value));
+  BOOST_CHECK(cache.get(key2, value));
+
+  cache.invalidateFunction("Srv.Janky");
+  BOOST_CHECK(!cache.get(key2, value));
+  BOOST_CHECK(cache.get(other, value));
+
+  cache.clear();
+  BOOST_CHECK_EQUAL(cache.getNumEntries(), 0U);
+  BOOST_CHECK_EQUAL(cache.getSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_counters ) {
+  TResponseCache cache;
+  std::string value;
+  cache.put("key", "value", 10000);
+  cache.get("key", value);
+  std::map<std::string, int64_t> counters;
+  cache.getCounters(counters);
+  BOOST_CHECK_EQUAL(counters["response_cache.hits"], 1);
+  BOOST_CHECK_EQUAL(counters["response_cache.entries"], 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_client_hit_skips_send ) {
+  ClientFixture f;
+  BOOST_CHECK_EQUAL(f.client.Janky(21), 42);
+  BOOST_CHECK_EQUAL(f.transport->numRequests, 1);
+  BOOST_CHECK_EQUAL(f.client.Janky(21), 42);
+  BOOST_CHECK_EQUAL(f.transport->numRequests, 1);
+  BOOST_CHECK_EQUAL(f.cache->getNumHits(), 1U);
+
+  // Other arguments are other keys
+  BOOST_CHECK_EQUAL(f.client.Janky(5), 10);
+  BOOST_CHECK_EQUAL(f.transport->numRequests, 2);
+
+  // Without a cache every call goes out
+  f.client.setResponseCache(boost::shared_ptr<TResponseCache>());
+  BOOST_CHECK_EQUAL(f.client.Janky(21), 42);
+  BOOST_CHECK_EQUAL(f.transport->numRequests, 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_client_exception_not_cached ) {
+  ClientFixture f;
+  for (int i = 1; i <= 2; ++i) {
+    try {
+      f.client.jankyOrThrow(7);
+      BOOST_ERROR("jankyOrThrow returned");
+    } catch (JankyException& ex) {
+      BOOST_CHECK_EQUAL(ex.arg, 7);
+    }
+    BOOST_CHECK_EQUAL(f.transport->numRequests, i);
+  }
+  BOOST_CHECK_EQUAL(f.cache->getNumEntries(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,189 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <transport/TServerSocket.h>
+#include <transport/TSocketPool.h>
+
+BOOST_AUTO_TEST_SUITE( SocketPoolPolicyTest )
+
+using namespace apache::thrift::transport;
+using boost::shared_ptr;
+
+typedef std::vector< shared_ptr<TSocketPoolServer> > ServerList;
+
+static ServerList makeServers(int n) {
+  ServerList servers;
+  for (int i = 0; i < n; ++i) {
+    servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("host", 9090 + i)));
+  }
+  return servers;
+}
+
+BOOST_AUTO_TEST_CASE( test_latency_ewma ) {
+  TSocketPoolServer server("host", 9090);
+  BOOST_CHECK_EQUAL(server.getLatencyEwma(), 0.0);
+
+  server.callStarted();
+  server.callStarted();
+  BOOST_CHECK_EQUAL(server.getOutstanding(), 2);
+  server.callFinished(1000, 0.5);
+  BOOST_CHECK_EQUAL(server.getLatencyEwma(), 1000.0);
+  server.callFinished(3000, 0.5);
+  BOOST_CHECK_EQUAL(server.getLatencyEwma(), 2000.0);
+  BOOST_CHECK_EQUAL(server.getOutstanding(), 0);
+
+  // An abandoned call only releases its slot.
+  server.callStarted();
+  server.callFinished(-1, 0.5);
+  BOOST_CHECK_EQUAL(server.getLatencyEwma(), 2000.0);
+  BOOST_CHECK_EQUAL(server.getOutstanding(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_round_robin ) {
+  TServerSocket serverSocket(19307);
+  serverSocket.listen();
+  // Three entries for the same listener, told apart by identity
+  ServerList servers;
+  for (int i = 0; i < 3; ++i) {
+    servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("localhost", 19307)));
+  }
+  TSocketPool pool(servers);
+  pool.setPolicy(shared_ptr<TSocketPoolPolicy>(new TRoundRobinPolicy()));
+
+  // Every server comes first equally often, in the configured order.
+  int first[3] = {0, 0, 0};
+  for (int i = 0; i < 9; ++i) {
+    pool.open();
+    shared_ptr<TSocketPoolServer> current = pool.getCurrentServer();
+    BOOST_CHECK(current == servers[i % 3]);
+    for (int j = 0; j < 3; ++j) {
+      if (current == servers[j]) {
+        first[j]++;
+      }
+    }
+    pool.close();
+  }
+  BOOST_CHECK_EQUAL(first[0], 3);
+  BOOST_CHECK_EQUAL(first[1], 3);
+  BOOST_CHECK_EQUAL(first[2], 3);
+  serverSocket.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_least_loaded ) {
+  ServerList servers = makeServers(3);
+  servers[0]->callStarted();
+  servers[0]->callStarted();
+  servers[1]->callStarted();
+  servers[1]->callFinished(5000, 1.0);
+  servers[1]->callStarted();
+  servers[2]->callStarted();
+  servers[2]->callFinished(1000, 1.0);
+  servers[2]->callStarted();
+
+  TLeastLoadedPolicy policy;
+  for (int i = 0; i < 10; ++i) {
+    policy.order(servers);
+    BOOST_CHECK_EQUAL(servers[0]->port_, 9092);
+    BOOST_CHECK_EQUAL(servers[1]->port_, 9091);
+    BOOST_CHECK_EQUAL(servers[2]->port_, 9090);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_power_of_two_choices_prefers_fast ) {
+  ServerList servers = makeServers(2);
+  servers[0]->callStarted();
+  servers[0]->callFinished(50000, 1.0);
+  servers[1]->callStarted();
+  servers[1]->callFinished(1000, 1.0);
+
+  // With two servers both are always sampled, so the fast one wins.
+  TPowerOfTwoChoicesPolicy policy;
+  for (int i = 0; i < 20; ++i) {
+    policy.order(servers);
+    BOOST_CHECK_EQUAL(servers[0]->port_, 9091);
+  }
+
+  // Enough outstanding calls make the fast server the costlier one.
+  shared_ptr<TSocketPoolServer> fast = servers[0];
+  for (int i = 0; i < 60; ++i) {
+    fast->callStarted();
+  }
+  policy.order(servers);
+  BOOST_CHECK_EQUAL(servers[0]->port_, 9090);
+}
+
+BOOST_AUTO_TEST_CASE( test_power_of_two_choices_unsampled ) {
+  ServerList servers = makeServers(2);
+  servers[0]->callStarted();
+  servers[0]->callFinished(1000, 1.0);
+  TPowerOfTwoChoicesPolicy policy;
+
+  // An idle server without samples is tried...
+  for (int i = 0; i < 20; ++i) {
+    policy.order(servers);
+    BOOST_CHECK_EQUAL(servers[0]->port_, 9091);
+  }
+
+  // ...but not while its first calls are still outstanding.
+  shared_ptr<TSocketPoolServer> fresh = servers[0];
+  for (int i = 0; i < 3; ++i) {
+    fresh->callStarted();
+  }
+  for (int i = 0; i < 20; ++i) {
+    policy.order(servers);
+    BOOST_CHECK_EQUAL(servers[0]->port_, 9090);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_oneway_call_is_not_timed ) {
+  TServerSocket serverSocket(19306);
+  serverSocket.listen();
+  TSocketPool pool;
+  pool.addServer("localhost", 19306);
+  pool.open();
+  shared_ptr<TTransport> server = serverSocket.accept();
+  shared_ptr<TSocketPoolServer> current = pool.getCurrentServer();
+
+  // A oneway call, left unanswered
+  uint8_t byte = 0;
+  pool.write(&byte, 1);
+  pool.flush();
+  BOOST_CHECK_EQUAL(current->getOutstanding(), 1);
+  usleep(100 * 1000);
+
+  // The next call starts the clock again and is answered at once.
+  pool.write(&byte, 1);
+  pool.flush();
+  BOOST_CHECK_EQUAL(current->getOutstanding(), 1);
+  server->write(&byte, 1);
+  server->flush();
+  pool.read(&byte, 1);
+  BOOST_CHECK_EQUAL(current->getOutstanding(), 0);
+  BOOST_CHECK(current->getLatencyEwma() > 0);
+  BOOST_CHECK(current->getLatencyEwma() < 50 * 1000);
+
+  pool.close();
+  server->close();
+  serverSocket.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
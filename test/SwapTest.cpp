@@ -0,0 +1,65 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+#include "gen-cpp/DebugProtoTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( SwapTest )
+
+using thrift::test::debug::HolyMoley;
+using thrift::test::debug::LazyNesting;
+using thrift::test::debug::OneOfEach;
+
+BOOST_AUTO_TEST_CASE( test_swap_keeps_storage ) {
+  OneOfEach ooe;
+  ooe.some_characters = std::string(1000, 'x');
+  ooe.__isset.some_characters = true;
+  HolyMoley a;
+  a.big.push_back(ooe);
+  a.big.push_back(ooe);
+  a.__isset.big = true;
+  const OneOfEach* storage = &a.big[0];
+  HolyMoley b;
+  HolyMoley a_copy = a;
+
+  swap(a, b);
+  BOOST_CHECK(a.big.empty());
+  BOOST_CHECK(!a.__isset.big);
+  BOOST_CHECK(b.__isset.big);
+  BOOST_CHECK(b == a_copy);
+  // The list moved over without its elements being copied.
+  BOOST_CHECK(&b.big[0] == storage);
+}
+
+BOOST_AUTO_TEST_CASE( test_swap_lazy_field ) {
+  LazyNesting a;
+  a.before = 1;
+  a.mutable_payload().big.resize(3);
+  LazyNesting b;
+  b.before = 2;
+
+  swap(a, b);
+  BOOST_CHECK_EQUAL(a.before, 2);
+  BOOST_CHECK_EQUAL(b.before, 1);
+  BOOST_CHECK_EQUAL(b.get_payload().big.size(), 3U);
+  BOOST_CHECK(a.get_payload().big.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
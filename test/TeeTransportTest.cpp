@@ -0,0 +1,343 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <concurrency/Monitor.h>
+#include <concurrency/PosixThreadFactory.h>
+#include <concurrency/Util.h>
+#include <transport/TBufferTransports.h>
+#include <transport/TFileTransport.h>
+#include <transport/TTeeTransport.h>
+
+BOOST_AUTO_TEST_SUITE( TeeTransportTest )
+
+using namespace std;
+using boost::shared_ptr;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TFileTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTeeLogger;
+using apache::thrift::transport::TTeeTransport;
+using apache::thrift::transport::TTeeTransportFactory;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using apache::thrift::transport::TTransportFactory;
+
+/**
+ * Destination that keeps each write, and can be held up or made to fail.
+ */
+class RecordingTransport : public TTransport {
+ public:
+  RecordingTransport() :
+    held_(false),
+    failing_(false),
+    numFlushes_(0) {}
+
+  void write(const uint8_t* buf, uint32_t len) {
+    Synchronized s(monitor_);
+    while (held_) {
+      monitor_.wait();
+    }
+    if (failing_) {
+      throw TTransportException("failing");
+    }
+    messages_.push_back(string((const char*)buf, len));
+  }
+
+  void flush() {
+    Synchronized s(monitor_);
+    numFlushes_++;
+  }
+
+  void hold(bool held) {
+    Synchronized s(monitor_);
+    held_ = held;
+    monitor_.notifyAll();
+  }
+
+  void fail(bool failing) {
+    Synchronized s(monitor_);
+    failing_ = failing;
+  }
+
+  vector<string> getMessages() {
+    Synchronized s(monitor_);
+    return messages_;
+  }
+
+  int getNumFlushes() {
+    Synchronized s(monitor_);
+    return numFlushes_;
+  }
+
+ private:
+  Monitor monitor_;
+  bool held_;
+  bool failing_;
+  vector<string> messages_;
+  int numFlushes_;
+};
+
+class LogTask : public Runnable {
+ public:
+  LogTask(shared_ptr<TTeeLogger> logger, const string& message) :
+    logger_(logger),
+    message_(message) {}
+
+  void run() {
+    logger_->log(message_);
+  }
+
+ private:
+  shared_ptr<TTeeLogger> logger_;
+  string message_;
+};
+
+// Logs a message and waits until the logger thread is stuck writing it.
+static void logAndWait(shared_ptr<TTeeLogger> logger, const string& message) {
+  string buf(message);
+  logger->log(buf);
+  while (logger->getNumQueued() > 0) {
+    usleep(1000);
+  }
+}
+
+static vector<string> strings(const char* a, const char* b, const char* c = NULL) {
+  vector<string> result;
+  result.push_back(a);
+  result.push_back(b);
+  if (c != NULL) {
+    result.push_back(c);
+  }
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE( test_requests_and_replies ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TMemoryBuffer> src(new TMemoryBuffer());
+  src->write((const uint8_t*)"request1request2", 16);
+
+  {
+    shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+    TTeeTransport tee(src, logger, true, true);
+    uint8_t buf[8];
+    tee.readAll(buf, 8);
+    tee.readEnd();
+    tee.write((const uint8_t*)"reply1", 6);
+    tee.writeEnd();
+    tee.readAll(buf, 8);
+    tee.readEnd();
+
+    // Nothing in between messages
+    tee.readEnd();
+    tee.writeEnd();
+  }
+
+  vector<string> expected = strings("request1", "reply1", "request2");
+  vector<string> messages = dst->getMessages();
+  BOOST_CHECK_EQUAL_COLLECTIONS(messages.begin(), messages.end(),
+                                expected.begin(), expected.end());
+  BOOST_CHECK_EQUAL(src->getBufferAsString(), "reply1");
+}
+
+BOOST_AUTO_TEST_CASE( test_log_swaps_buffers ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+
+  string message(4096, 'x');
+  logAndWait(logger, "warm up the spares");
+  while (logger->getNumLogged() < 1) {
+    usleep(1000);
+  }
+  logger->log(message);
+  // Left with the buffer of the message already written
+  BOOST_CHECK(message.empty());
+  BOOST_CHECK(message.capacity() >= strlen("warm up the spares"));
+
+  logger.reset();
+  BOOST_CHECK_EQUAL(dst->getMessages().back().size(), 4096);
+}
+
+BOOST_AUTO_TEST_CASE( test_drop_newest ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst, 2, TTeeLogger::DROP_NEWEST));
+
+  dst->hold(true);
+  logAndWait(logger, "m0");
+  const char* later[] = { "m1", "m2", "m3" };
+  for (int i = 0; i < 3; i++) {
+    string message(later[i]);
+    logger->log(message);
+    BOOST_CHECK(message.empty());
+  }
+  BOOST_CHECK_EQUAL(logger->getNumQueued(), 2);
+  BOOST_CHECK_EQUAL(logger->getNumDropped(), 1);
+  dst->hold(false);
+  logger.reset();
+
+  vector<string> expected = strings("m0", "m1", "m2");
+  vector<string> messages = dst->getMessages();
+  BOOST_CHECK_EQUAL_COLLECTIONS(messages.begin(), messages.end(),
+                                expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE( test_drop_oldest ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst, 2, TTeeLogger::DROP_OLDEST));
+
+  dst->hold(true);
+  logAndWait(logger, "m0");
+  const char* later[] = { "m1", "m2", "m3" };
+  for (int i = 0; i < 3; i++) {
+    string message(later[i]);
+    logger->log(message);
+  }
+  BOOST_CHECK_EQUAL(logger->getNumDropped(), 1);
+  dst->hold(false);
+  logger.reset();
+
+  vector<string> expected = strings("m0", "m2", "m3");
+  vector<string> messages = dst->getMessages();
+  BOOST_CHECK_EQUAL_COLLECTIONS(messages.begin(), messages.end(),
+                                expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE( test_block ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst, 1, TTeeLogger::BLOCK));
+
+  dst->hold(true);
+  logAndWait(logger, "m0");
+  string message("m1");
+  logger->log(message);
+
+  PosixThreadFactory threadFactory(PosixThreadFactory::ROUND_ROBIN,
+                                   PosixThreadFactory::NORMAL,
+                                   1,
+                                   false);
+  shared_ptr<Thread> thread =
+    threadFactory.newThread(shared_ptr<Runnable>(new LogTask(logger, "m2")));
+  thread->start();
+  usleep(20 * 1000);
+  BOOST_CHECK_EQUAL(logger->getNumQueued(), 1);
+
+  dst->hold(false);
+  thread->join();
+  thread.reset();
+  logger.reset();
+
+  vector<string> expected = strings("m0", "m1", "m2");
+  vector<string> messages = dst->getMessages();
+  BOOST_CHECK_EQUAL_COLLECTIONS(messages.begin(), messages.end(),
+                                expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE( test_failed_writes_are_counted ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+
+  dst->fail(true);
+  logAndWait(logger, "m0");
+  while (logger->getNumFailed() < 1) {
+    usleep(1000);
+  }
+  dst->fail(false);
+  logAndWait(logger, "m1");
+  logger.reset();
+
+  BOOST_CHECK_EQUAL(dst->getMessages().size(), 1);
+  BOOST_CHECK_EQUAL(dst->getMessages()[0], "m1");
+}
+
+BOOST_AUTO_TEST_CASE( test_flush_every_batch ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+  BOOST_CHECK_EQUAL(logger->getFlushInterval(), TTeeLogger::FLUSH_EVERY_BATCH);
+
+  logAndWait(logger, "m0");
+  while (logger->getNumLogged() < 1) {
+    usleep(1000);
+  }
+  BOOST_CHECK_EQUAL(dst->getNumFlushes(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_never_flush ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+  logger->setFlushInterval(TTeeLogger::NEVER_FLUSH);
+
+  logAndWait(logger, "m0");
+  logAndWait(logger, "m1");
+  logger.reset();
+  BOOST_CHECK_EQUAL(dst->getMessages().size(), 2);
+  BOOST_CHECK_EQUAL(dst->getNumFlushes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_flush_interval ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+  logger->setFlushInterval(100);
+
+  int64_t start = Util::currentTime();
+  logAndWait(logger, "m0");
+  logAndWait(logger, "m1");
+  // Written, but not flushed until the interval is up, with nothing
+  // more to log
+  while (logger->getNumLogged() < 2 && Util::currentTime() - start < 5000) {
+    usleep(1000);
+  }
+  BOOST_CHECK_EQUAL(logger->getNumLogged(), 2U);
+  BOOST_CHECK(Util::currentTime() - start >= 90);
+  BOOST_CHECK_EQUAL(dst->getNumFlushes(), 1);
+  BOOST_CHECK_EQUAL(dst->getMessages().size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_file_destination_is_not_flushed ) {
+  char name[] = "/tmp/TeeTransportTest.XXXXXX";
+  int fd = mkstemp(name);
+  close(fd);
+  {
+    shared_ptr<TFileTransport> dst(new TFileTransport(name));
+    TTeeLogger logger(dst);
+    BOOST_CHECK_EQUAL(logger.getFlushInterval(), TTeeLogger::NEVER_FLUSH);
+  }
+  unlink(name);
+}
+
+BOOST_AUTO_TEST_CASE( test_factory ) {
+  shared_ptr<RecordingTransport> dst(new RecordingTransport());
+  shared_ptr<TTeeLogger> logger(new TTeeLogger(dst));
+  TTeeTransportFactory factory(logger);
+
+  shared_ptr<TMemoryBuffer> src(new TMemoryBuffer());
+  shared_ptr<TTransport> trans = factory.getTransport(src);
+  shared_ptr<TTeeTransport> tee = boost::dynamic_pointer_cast<TTeeTransport>(trans);
+  BOOST_REQUIRE(tee);
+  BOOST_CHECK(tee->getUnderlyingTransport() == src);
+  BOOST_CHECK(tee->getLogger() == logger);
+}
+
+BOOST_AUTO_TEST_SUITE_END()